@@ -0,0 +1,454 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_alloc.c
+//  Description    : This is the free block allocator for the LionCloud
+//                   filesystem.  Each device has a bitmap (1 bit per block,
+//                   1 = allocated) plus a cursor to the first word that may
+//                   still have a free bit, so finding the next free block
+//                   does not rescan the device from sector 0.  Every device
+//                   has its own lock, so allocations on different devices
+//                   do not wait for each other.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 10:12:40 AM EDT
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <cmpsc311_log.h>
+#include <lcloud_alloc.h>
+
+// Defines
+#define LC_ALLOC_WORDBITS 64
+
+// allocator state of one device
+typedef struct{
+    uint64_t *bitmap;       // block bitmap, bit (sec*maxblk + blk)
+    int nwords;             // number of words in the bitmap
+    int cursor;             // every word before this one is full
+    int nfree;              // free blocks left on the device
+    uint16_t maxsec;
+    uint16_t maxblk;
+    LcAllocStats stats;     // counters
+    pthread_mutex_t lock;   // protects the bitmap, cursor, count and counters
+}devalloc;
+devalloc *allocinfo;
+
+int allocdevs; // number of devices
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_initalloc
+// Description  : Set up the allocator for numdevs devices
+//
+// Inputs       : numdevs - number of devices
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_initalloc( int numdevs ) {
+
+    allocinfo = (devalloc *)calloc(numdevs, sizeof(devalloc));
+    if(allocinfo == NULL){
+        logMessage(LOG_ERROR_LEVEL, "Failed to allocate allocator for %d devices", numdevs);
+        return -1;
+    }
+    allocdevs = numdevs;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_adddevice
+// Description  : Add a device with maxsec sectors of maxblk blocks, all free
+//
+// Inputs       : dev - device index, maxsec/maxblk - device geometry
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_adddevice( int dev, uint16_t maxsec, uint16_t maxblk ) {
+    int nblks;
+    devalloc *d;
+
+    if(dev < 0 || dev >= allocdevs){
+        logMessage(LOG_ERROR_LEVEL, "Allocator: bad device index %d", dev);
+        return -1;
+    }
+    d = &allocinfo[dev];
+    nblks = maxsec * maxblk;
+    d->nwords = (nblks + LC_ALLOC_WORDBITS - 1) / LC_ALLOC_WORDBITS;
+    d->bitmap = (uint64_t *)calloc(d->nwords, sizeof(uint64_t));
+    if(d->bitmap == NULL){
+        logMessage(LOG_ERROR_LEVEL, "Allocator: failed to allocate bitmap for device %d", dev);
+        return -1;
+    }
+    // bits past the last block are marked allocated so they are never handed out
+    if(nblks % LC_ALLOC_WORDBITS != 0){
+        d->bitmap[d->nwords-1] = ~(uint64_t)0 << (nblks % LC_ALLOC_WORDBITS);
+    }
+    d->cursor = 0;
+    d->nfree = nblks;
+    d->maxsec = maxsec;
+    d->maxblk = maxblk;
+    memset(&d->stats, 0, sizeof(LcAllocStats));
+    d->stats.totalblks = nblks;
+    pthread_mutex_init(&d->lock, NULL);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_allocblk
+// Description  : Allocate the first free block on the device
+//
+// Inputs       : dev - device index
+//                sec, blk - filled with the allocated block
+// Outputs      : 0 if successful, -1 if the device is full
+
+int lcloud_allocblk( int dev, uint16_t *sec, uint16_t *blk ) {
+    devalloc *d = &allocinfo[dev];
+    int w, bit, idx;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->nfree == 0){
+        d->stats.full++;
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+
+    // skip full words from the cursor on, then take the lowest clear bit
+    for(w=d->cursor; w<d->nwords && d->bitmap[w] == ~(uint64_t)0; w++);
+    d->cursor = w;
+    if(w == d->nwords){
+        d->stats.full++;
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+    bit = __builtin_ctzll(~d->bitmap[w]);
+    d->bitmap[w] |= (uint64_t)1 << bit;
+
+    idx = w * LC_ALLOC_WORDBITS + bit;
+    *sec = idx / d->maxblk;
+    *blk = idx % d->maxblk;
+    d->nfree--;
+    d->stats.allocs++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_allocrun
+// Description  : Allocate a run of contiguous free blocks on the device for
+//                an extent: the first run of want blocks from the cursor on,
+//                or the longest one there is when none is that long
+//
+// Inputs       : dev - device index, want - blocks wanted
+//                sec, blk - filled with the first block of the run
+// Outputs      : blocks allocated, -1 if the device is full
+
+int lcloud_allocrun( int dev, int want, uint16_t *sec, uint16_t *blk ) {
+    devalloc *d = &allocinfo[dev];
+    int idx, start, nblks, best = -1, bestlen = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->nfree == 0){
+        d->stats.full++;
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+
+    nblks = d->maxsec * d->maxblk;
+    idx = d->cursor * LC_ALLOC_WORDBITS;
+    while(idx < nblks && bestlen < want){
+        // skip taken blocks, a full word at a time
+        if(idx % LC_ALLOC_WORDBITS == 0 && d->bitmap[idx / LC_ALLOC_WORDBITS] == ~(uint64_t)0){
+            idx += LC_ALLOC_WORDBITS;
+            continue;
+        }
+        if(d->bitmap[idx / LC_ALLOC_WORDBITS] & ((uint64_t)1 << (idx % LC_ALLOC_WORDBITS))){
+            idx++;
+            continue;
+        }
+        // measure the free run starting here, an empty word at a time
+        for(start=idx; idx < nblks && idx - start < want; ){
+            if(idx % LC_ALLOC_WORDBITS == 0 && d->bitmap[idx / LC_ALLOC_WORDBITS] == 0 && idx - start + LC_ALLOC_WORDBITS <= want){
+                idx += LC_ALLOC_WORDBITS;
+            }
+            else if((d->bitmap[idx / LC_ALLOC_WORDBITS] & ((uint64_t)1 << (idx % LC_ALLOC_WORDBITS))) == 0){
+                idx++;
+            }
+            else{
+                break;
+            }
+        }
+        if(idx > nblks){
+            idx = nblks;
+        }
+        if(idx - start > bestlen){
+            best = start;
+            bestlen = idx - start;
+        }
+    }
+    if(bestlen == 0){
+        d->stats.full++;
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+
+    for(idx=best; idx<best+bestlen; idx++){
+        d->bitmap[idx / LC_ALLOC_WORDBITS] |= (uint64_t)1 << (idx % LC_ALLOC_WORDBITS);
+    }
+    while(d->cursor < d->nwords && d->bitmap[d->cursor] == ~(uint64_t)0){
+        d->cursor++;
+    }
+    *sec = best / d->maxblk;
+    *blk = best % d->maxblk;
+    d->nfree -= bestlen;
+    d->stats.runs++;
+    d->stats.runblks += bestlen;
+    pthread_mutex_unlock(&d->lock);
+    return bestlen;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_extendrun
+// Description  : Allocate the free blocks right after sec/blk on the device
+//                (up to want of them), so an extent can keep growing in place
+//
+// Inputs       : dev - device index, sec/blk - last block of the extent
+//                want - blocks wanted
+// Outputs      : blocks allocated (0 if the next block is taken or off the device)
+
+int lcloud_extendrun( int dev, uint16_t sec, uint16_t blk, int want ) {
+    devalloc *d = &allocinfo[dev];
+    int idx, first, n;
+    uint64_t mask;
+
+    first = sec * d->maxblk + blk + 1;
+    pthread_mutex_lock(&d->lock);
+    for(idx=first; idx < d->maxsec * d->maxblk && idx - first < want; idx++){
+        mask = (uint64_t)1 << (idx % LC_ALLOC_WORDBITS);
+        if(d->bitmap[idx / LC_ALLOC_WORDBITS] & mask){
+            break;
+        }
+        d->bitmap[idx / LC_ALLOC_WORDBITS] |= mask;
+    }
+    n = idx - first;
+    if(n == 0){
+        d->stats.extendmisses++;
+    }
+    else{
+        d->nfree -= n;
+        d->stats.runs++;
+        d->stats.runblks += n;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_freeblk
+// Description  : Return a block to the free pool
+//
+// Inputs       : dev - device index, sec/blk - block to free
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_freeblk( int dev, uint16_t sec, uint16_t blk ) {
+    devalloc *d = &allocinfo[dev];
+    int idx, w;
+    uint64_t mask;
+
+    if(sec >= d->maxsec || blk >= d->maxblk){
+        logMessage(LOG_ERROR_LEVEL, "Allocator: freeing bad block [%d/%d] on device %d", sec, blk, dev);
+        return -1;
+    }
+    idx = sec * d->maxblk + blk;
+    w = idx / LC_ALLOC_WORDBITS;
+    mask = (uint64_t)1 << (idx % LC_ALLOC_WORDBITS);
+    pthread_mutex_lock(&d->lock);
+    if((d->bitmap[w] & mask) == 0){
+        pthread_mutex_unlock(&d->lock);
+        logMessage(LOG_ERROR_LEVEL, "Allocator: block [%d/%d] on device %d is already free", sec, blk, dev);
+        return -1;
+    }
+
+    d->bitmap[w] &= ~mask;
+    d->nfree++;
+    d->stats.frees++;
+    if(w < d->cursor){
+        d->cursor = w;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_reserveblk
+// Description  : Allocate a given block (the superblock, say)
+//
+// Inputs       : dev - device index, sec/blk - the block
+// Outputs      : 0 if successful, -1 if it is taken or off the device
+
+int lcloud_reserveblk( int dev, uint16_t sec, uint16_t blk ) {
+    devalloc *d = &allocinfo[dev];
+    int idx, w;
+    uint64_t mask;
+
+    if(sec >= d->maxsec || blk >= d->maxblk){
+        logMessage(LOG_ERROR_LEVEL, "Allocator: reserving bad block [%d/%d] on device %d", sec, blk, dev);
+        return -1;
+    }
+    idx = sec * d->maxblk + blk;
+    w = idx / LC_ALLOC_WORDBITS;
+    mask = (uint64_t)1 << (idx % LC_ALLOC_WORDBITS);
+    pthread_mutex_lock(&d->lock);
+    if(d->bitmap[w] & mask){
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+    d->bitmap[w] |= mask;
+    d->nfree--;
+    d->stats.allocs++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_bitmapsize
+// Description  : Bytes of the device's block bitmap
+//
+// Inputs       : dev - device index
+// Outputs      : the size
+
+int lcloud_bitmapsize( int dev ) {
+    return allocinfo[dev].nwords * (int)sizeof(uint64_t);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_getbitmap
+// Description  : Copy out the device's block bitmap
+//
+// Inputs       : dev - device index, buf - lcloud_bitmapsize bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_getbitmap( int dev, char *buf ) {
+    devalloc *d = &allocinfo[dev];
+
+    pthread_mutex_lock(&d->lock);
+    memcpy(buf, d->bitmap, d->nwords * sizeof(uint64_t));
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_setbitmap
+// Description  : Replace the device's block bitmap with a saved one (of
+//                the same geometry), recounting its free blocks
+//
+// Inputs       : dev - device index, buf - lcloud_bitmapsize bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_setbitmap( int dev, const char *buf ) {
+    devalloc *d = &allocinfo[dev];
+    int w, used = 0;
+
+    pthread_mutex_lock(&d->lock);
+    memcpy(d->bitmap, buf, d->nwords * sizeof(uint64_t));
+    for(w=0; w<d->nwords; w++){
+        used += __builtin_popcountll(d->bitmap[w]);
+    }
+    d->nfree = d->nwords * LC_ALLOC_WORDBITS - used;
+    d->cursor = 0;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_countfree
+// Description  : Number of free blocks left on the device
+//
+// Inputs       : dev - device index
+// Outputs      : number of free blocks
+
+int lcloud_countfree( int dev ) {
+    int nfree;
+
+    pthread_mutex_lock(&allocinfo[dev].lock);
+    nfree = allocinfo[dev].nfree;
+    pthread_mutex_unlock(&allocinfo[dev].lock);
+    return nfree;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_allocstats
+// Description  : Get the allocator counters of the device
+//
+// Inputs       : dev - device index, st - filled with the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_allocstats( int dev, LcAllocStats *st ) {
+
+    if(dev < 0 || dev >= allocdevs || allocinfo[dev].bitmap == NULL){
+        logMessage(LOG_ERROR_LEVEL, "Allocator: bad device index %d", dev);
+        return -1;
+    }
+    pthread_mutex_lock(&allocinfo[dev].lock);
+    *st = allocinfo[dev].stats;
+    st->freeblks = allocinfo[dev].nfree;
+    pthread_mutex_unlock(&allocinfo[dev].lock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_logalloc
+// Description  : Log the allocator counters of every device
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_logalloc( void ) {
+    LcAllocStats st;
+    int i;
+
+    for(i=0; i<allocdevs; i++){
+        if(lcloud_allocstats(i, &st) == -1){
+            continue;
+        }
+        logMessage(LOG_INFO_LEVEL, "Allocator device %d [%d/%d blocks free, %d allocated, %d runs of %d blocks (%d extends missed), %d freed, %d full]",
+            i, st.freeblks, st.totalblks, st.allocs, st.runs, st.runblks, st.extendmisses, st.frees, st.full);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_closealloc
+// Description  : Free the allocator state
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_closealloc( void ) {
+    int i;
+
+    for(i=0; i<allocdevs; i++){
+        if(allocinfo[i].bitmap != NULL){
+            pthread_mutex_destroy(&allocinfo[i].lock);
+        }
+        free(allocinfo[i].bitmap);
+    }
+    free(allocinfo);
+    allocinfo = NULL;
+    allocdevs = 0;
+    return 0;
+}
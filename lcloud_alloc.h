@@ -0,0 +1,76 @@
+#ifndef LCLOUD_ALLOC_INCLUDED
+#define LCLOUD_ALLOC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_alloc.h
+//  Description    : This is the free block allocator API for the LionCloud
+//                   filesystem (one free-space bitmap per device).
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 10:12:40 AM EDT
+//
+
+// Includes
+#include <stdint.h>
+
+// Allocator counters of a device (lcloud_allocstats)
+typedef struct {
+    int totalblks;      // blocks on the device
+    int freeblks;       // blocks free now
+    int allocs;         // blocks handed out by lcloud_allocblk
+    int runs;           // runs handed out by lcloud_allocrun and lcloud_extendrun
+    int runblks;        // blocks in them
+    int extendmisses;   // lcloud_extendrun calls that found the next block taken
+    int frees;          // blocks returned
+    int full;           // lcloud_allocblk calls that found the device full
+} LcAllocStats;
+
+//
+// Functional Prototypes
+
+int lcloud_initalloc( int numdevs );
+    // Set up the allocator for numdevs devices
+
+int lcloud_adddevice( int dev, uint16_t maxsec, uint16_t maxblk );
+    // Add a device (index dev) with maxsec sectors of maxblk blocks, all free
+
+int lcloud_allocblk( int dev, uint16_t *sec, uint16_t *blk );
+    // Allocate the first free block on the device
+
+int lcloud_allocrun( int dev, int want, uint16_t *sec, uint16_t *blk );
+    // Allocate up to want contiguous free blocks on the device (the first run
+    // that long, else the longest), returns how many, -1 if the device is full
+
+int lcloud_extendrun( int dev, uint16_t sec, uint16_t blk, int want );
+    // Allocate up to want free blocks right after sec/blk on the device,
+    // returns how many (0 if the next block is taken)
+
+int lcloud_freeblk( int dev, uint16_t sec, uint16_t blk );
+    // Return a block to the free pool
+
+int lcloud_reserveblk( int dev, uint16_t sec, uint16_t blk );
+    // Allocate a given block (it must be free)
+
+int lcloud_bitmapsize( int dev );
+    // Bytes of the device's block bitmap
+
+int lcloud_getbitmap( int dev, char *buf );
+    // Copy out the device's block bitmap (lcloud_bitmapsize bytes)
+
+int lcloud_setbitmap( int dev, const char *buf );
+    // Replace the device's block bitmap with a saved one
+
+int lcloud_countfree( int dev );
+    // Number of free blocks left on the device
+
+int lcloud_allocstats( int dev, LcAllocStats *st );
+    // Get the allocator counters of the device
+
+int lcloud_logalloc( void );
+    // Log the allocator counters of every device
+
+int lcloud_closealloc( void );
+    // Free the allocator state
+
+#endif
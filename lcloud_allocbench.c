@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_allocbench.c
+//  Description    : This is a microbenchmark for the LionCloud block
+//                   allocator.  It fills every device listed in a hardware
+//                   manifest block by block, once with the old first-fit scan
+//                   of the per-device state grid and once with the bitmap
+//                   allocator, and reports allocations/sec for both.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 10:12:40 AM EDT
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_alloc.h>
+
+// Defines
+#define LCLOUD_ALLOCBENCH_ARGUMENTS "hr:"
+#define LCLOUD_ALLOCBENCH_MAXDEVS 16
+#define USAGE                                                               \
+    "USAGE: lcloud_allocbench [-h] [-r <rounds>] <hardware-manifest>\n"    \
+    "\n"                                                                    \
+    "where:\n"                                                              \
+    "    -h - help mode (display this message)\n"                           \
+    "    -r - number of times to fill the devices (default 10)\n"           \
+    "\n"                                                                    \
+    "    <hardware-manifest> - file containing the device geometries\n"     \
+    "\n"
+
+//
+// Global Data
+int numdevs;
+int maxsec[LCLOUD_ALLOCBENCH_MAXDEVS];
+int maxblk[LCLOUD_ALLOCBENCH_MAXDEVS];
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elapsed
+// Description  : seconds between two timestamps
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readManifest
+// Description  : read the "did sectors blocks" lines of a hardware manifest
+//
+// Inputs       : fname - manifest filename
+// Outputs      : 0 if successful, -1 if failure
+
+int readManifest(const char *fname) {
+    FILE *fp;
+    char line[256];
+    int did, secs, blks;
+
+    if ((fp = fopen(fname, "r")) == NULL) {
+        fprintf(stderr, "Failed to open manifest [%s], aborting.\n", fname);
+        return (-1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL && numdevs < LCLOUD_ALLOCBENCH_MAXDEVS) {
+        if (line[0] == '#' || sscanf(line, "%d %d %d", &did, &secs, &blks) != 3) {
+            continue;
+        }
+        maxsec[numdevs] = secs;
+        maxblk[numdevs] = blks;
+        numdevs++;
+    }
+    fclose(fp);
+    return (numdevs > 0) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fillScan
+// Description  : fill all devices with the old first-fit scan of a state grid
+//
+// Outputs      : number of blocks allocated
+
+long fillScan(void) {
+    char **storage;
+    long count = 0;
+    int n, i, j, found;
+
+    for (n = 0; n < numdevs; n++) {
+        storage = malloc(sizeof(char*) * maxsec[n]);
+        for (i = 0; i < maxsec[n]; i++) {
+            storage[i] = calloc(maxblk[n], sizeof(char));
+        }
+
+        // every allocation rescans from sector 0 block 0
+        do {
+            found = 0;
+            for (i = 0; i < maxsec[n] && !found; i++) {
+                for (j = 0; j < maxblk[n]; j++) {
+                    if (storage[i][j] == 0) {
+                        storage[i][j] = 1;
+                        found = 1;
+                        count++;
+                        break;
+                    }
+                }
+            }
+        } while (found);
+
+        for (i = 0; i < maxsec[n]; i++) {
+            free(storage[i]);
+        }
+        free(storage);
+    }
+    return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fillBitmap
+// Description  : fill all devices with the bitmap allocator
+//
+// Outputs      : number of blocks allocated
+
+long fillBitmap(void) {
+    long count = 0;
+    int n;
+    uint16_t sec, blk;
+
+    lcloud_initalloc(numdevs);
+    for (n = 0; n < numdevs; n++) {
+        lcloud_adddevice(n, maxsec[n], maxblk[n]);
+        while (lcloud_allocblk(n, &sec, &blk) == 0) {
+            count++;
+        }
+    }
+    lcloud_closealloc();
+    return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the allocator benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, -1 if failure
+
+int main(int argc, char* argv[])
+{
+    int ch, r, rounds = 10;
+    long scanned = 0, mapped = 0;
+    struct timespec start, end;
+    double scantime, maptime;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_ALLOCBENCH_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'r': // Number of rounds
+            rounds = atoi(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+    if (argv[optind] == NULL || readManifest(argv[optind]) == -1) {
+        fprintf(stderr, "Missing or empty hardware manifest, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        scanned += fillScan();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    scantime = elapsed(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        mapped += fillBitmap();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    maptime = elapsed(&start, &end);
+
+    printf("devices %d, blocks %ld, rounds %d\n", numdevs, mapped / rounds, rounds);
+    printf("grid scan : %10ld allocs in %8.4f s  (%12.0f allocs/sec)\n", scanned, scantime, scanned / scantime);
+    printf("bitmap    : %10ld allocs in %8.4f s  (%12.0f allocs/sec)\n", mapped, maptime, mapped / maptime);
+
+    freeLogRegistrations();
+    return (0);
+}
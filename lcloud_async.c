@@ -0,0 +1,350 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_async.c
+//  Description    : This is the asynchronous read/write engine for the Lion
+//                   Cloud filesystem.  Submitted requests go in a table and
+//                   a few engine threads run them with lcreadat/lcwriteat,
+//                   so the caller keeps going while the bus works.  Requests
+//                   on the same file run one at a time in submission order;
+//                   requests on different files run side by side, and each
+//                   one batches and pipelines its own block transfers.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 08:41:27 PM EDT
+//
+
+// Includes
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <cmpsc311_log.h>
+#include <lcloud_async.h>
+#include <lcloud_filesys.h>
+
+// request states
+#define LC_ASYNC_FREE 0     // slot unused
+#define LC_ASYNC_QUEUED 1   // waiting for an engine thread
+#define LC_ASYNC_RUNNING 2  // an engine thread is doing it
+#define LC_ASYNC_DONE 3     // finished, waiting to be reaped
+
+// one asynchronous request
+typedef struct{
+    LcRequestId id;     // request id (submission order)
+    int state;          // LC_ASYNC_*
+    int write;          // 1 write, 0 read
+    LcFHandle fh;       // file
+    char *buf;          // data to write / place for the data read
+    size_t len;         // bytes
+    size_t off;         // file position
+    LcCompletionFn fn;  // completion callback, NULL to reap with lcwait/lcpoll
+    void *arg;          // callback argument
+    int result;         // bytes moved or -1, once done
+}asyncreq;
+
+asyncreq asyncreqs[LC_ASYNC_MAXREQ];
+pthread_t engine[LC_ASYNC_MAXTHREADS];
+int nengine = 0;            // engine threads running
+int asyncstop = 0;          // engine threads exit once the queue is empty
+LcRequestId nextreqid = 1;  // id of the next request
+pthread_mutex_t asynclock = PTHREAD_MUTEX_INITIALIZER; // protects everything above
+pthread_cond_t asyncwork = PTHREAD_COND_INITIALIZER;   // a request became runnable
+pthread_cond_t asyncdone = PTHREAD_COND_INITIALIZER;   // a request finished or was reaped
+
+// statistics
+int asyncsubmitted = 0;     // requests submitted
+int asyncmaxpending = 0;    // most requests in the table at once
+int asyncpending = 0;       // requests in the table now
+int asyncactive = 0;        // requests queued or running
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nextrunnable
+// Description  : the oldest queued request whose file has no request
+//                running (lock held)
+//
+// Outputs      : request, NULL if none can run now
+
+asyncreq * nextrunnable(void){
+    asyncreq *best = NULL;
+    int i, j, busy;
+
+    for(i=0; i<LC_ASYNC_MAXREQ; i++){
+        if(asyncreqs[i].state != LC_ASYNC_QUEUED || (best != NULL && asyncreqs[i].id > best->id)){
+            continue;
+        }
+        for(j=0, busy=0; j<LC_ASYNC_MAXREQ && !busy; j++){
+            busy = (asyncreqs[j].state == LC_ASYNC_RUNNING && asyncreqs[j].fh == asyncreqs[i].fh);
+        }
+        if(!busy){
+            best = &asyncreqs[i];
+        }
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : enginethread
+// Description  : I/O engine thread: run queued requests until stopped
+
+void * enginethread(void *arg){
+    asyncreq *r;
+    int result;
+
+    pthread_mutex_lock(&asynclock);
+    while(1){
+        if((r = nextrunnable()) == NULL){
+            if(asyncstop && asyncactive == 0){
+                break;
+            }
+            pthread_cond_wait(&asyncwork, &asynclock);
+            continue;
+        }
+        r->state = LC_ASYNC_RUNNING;
+        pthread_mutex_unlock(&asynclock);
+
+        if(r->write){
+            result = lcwriteat(r->fh, r->buf, r->len, r->off);
+        }
+        else{
+            result = lcreadat(r->fh, r->buf, r->len, r->off);
+        }
+
+        pthread_mutex_lock(&asynclock);
+        r->result = result;
+        r->state = LC_ASYNC_DONE;
+        asyncactive--;
+        if(r->fn != NULL){
+            // callback requests are reaped here
+            pthread_mutex_unlock(&asynclock);
+            r->fn(r->id, result, r->arg);
+            pthread_mutex_lock(&asynclock);
+            r->state = LC_ASYNC_FREE;
+            asyncpending--;
+        }
+        // the file is free for its next request, and someone may be waiting
+        pthread_cond_broadcast(&asyncwork);
+        pthread_cond_broadcast(&asyncdone);
+    }
+    pthread_mutex_unlock(&asynclock);
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startengine
+// Description  : start the I/O engine threads (lock held)
+//
+// Inputs       : nthreads - engine threads
+// Outputs      : 0 if successful, -1 if failure
+
+int startengine( int nthreads ) {
+
+    asyncstop = 0;
+    while(nengine < nthreads){
+        if(pthread_create(&engine[nengine], NULL, enginethread, NULL) != 0){
+            logMessage(LOG_ERROR_LEVEL, "Failed to start async engine thread");
+            return (nengine > 0) ? 0 : -1;
+        }
+        nengine++;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcasync_start
+// Description  : Start the I/O engine threads
+//
+// Inputs       : nthreads - engine threads, 1 to LC_ASYNC_MAXTHREADS
+// Outputs      : 0 if successful, -1 if failure
+
+int lcasync_start( int nthreads ) {
+    int ret;
+
+    if(nthreads < 1 || nthreads > LC_ASYNC_MAXTHREADS){
+        logMessage(LOG_ERROR_LEVEL, "Bad number of async engine threads %d (1-%d)", nthreads, LC_ASYNC_MAXTHREADS);
+        return -1;
+    }
+    pthread_mutex_lock(&asynclock);
+    if(nengine > 0){
+        pthread_mutex_unlock(&asynclock);
+        logMessage(LOG_ERROR_LEVEL, "Async engine is already running");
+        return -1;
+    }
+    ret = startengine(nthreads);
+    pthread_mutex_unlock(&asynclock);
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : submit
+// Description  : put a request in the table for the engine
+//
+// Inputs       : write - 1 write, 0 read, the rest as lcread_async
+// Outputs      : request id if successful, -1 if failure
+
+LcRequestId submit( int write, LcFHandle fh, char *buf, size_t len, size_t off, LcCompletionFn fn, void *arg ) {
+    asyncreq *r = NULL;
+    LcRequestId id;
+    int i;
+
+    pthread_mutex_lock(&asynclock);
+    if(nengine == 0 && startengine(LC_ASYNC_THREADS) == -1){
+        pthread_mutex_unlock(&asynclock);
+        return -1;
+    }
+    for(i=0; i<LC_ASYNC_MAXREQ && r == NULL; i++){
+        if(asyncreqs[i].state == LC_ASYNC_FREE){
+            r = &asyncreqs[i];
+        }
+    }
+    if(r == NULL){
+        pthread_mutex_unlock(&asynclock);
+        logMessage(LOG_ERROR_LEVEL, "Async request table is full (%d requests not reaped)", LC_ASYNC_MAXREQ);
+        return -1;
+    }
+    r->id = id = nextreqid++;
+    r->state = LC_ASYNC_QUEUED;
+    r->write = write;
+    r->fh = fh;
+    r->buf = buf;
+    r->len = len;
+    r->off = off;
+    r->fn = fn;
+    r->arg = arg;
+    r->result = -1;
+    asyncsubmitted++;
+    asyncactive++;
+    if(++asyncpending > asyncmaxpending){
+        asyncmaxpending = asyncpending;
+    }
+    pthread_cond_signal(&asyncwork);
+    pthread_mutex_unlock(&asynclock);
+    return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcread_async
+// Description  : Queue a read from the file
+//
+// Inputs       : fh - file handle, buf - place for the data (valid until
+//                the request is reaped), len - bytes, off - file position,
+//                fn - completion callback or NULL, arg - callback argument
+// Outputs      : request id if successful, -1 if failure
+
+LcRequestId lcread_async( LcFHandle fh, char *buf, size_t len, size_t off, LcCompletionFn fn, void *arg ) {
+    return submit(0, fh, buf, len, off, fn, arg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwrite_async
+// Description  : Queue a write to the file
+//
+// Inputs       : fh - file handle, buf - data (valid until the request is
+//                reaped), len - bytes, off - file position, fn - completion
+//                callback or NULL, arg - callback argument
+// Outputs      : request id if successful, -1 if failure
+
+LcRequestId lcwrite_async( LcFHandle fh, char *buf, size_t len, size_t off, LcCompletionFn fn, void *arg ) {
+    return submit(1, fh, buf, len, off, fn, arg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwait
+// Description  : Wait for a request (without a callback) to finish and reap it
+//
+// Inputs       : id - request id
+// Outputs      : bytes read/written, -1 if failure or unknown request
+
+int lcwait( LcRequestId id ) {
+    asyncreq *r = NULL;
+    int i, result;
+
+    pthread_mutex_lock(&asynclock);
+    for(i=0; i<LC_ASYNC_MAXREQ && r == NULL; i++){
+        if(asyncreqs[i].state != LC_ASYNC_FREE && asyncreqs[i].id == id && asyncreqs[i].fn == NULL){
+            r = &asyncreqs[i];
+        }
+    }
+    if(r == NULL){
+        pthread_mutex_unlock(&asynclock);
+        logMessage(LOG_ERROR_LEVEL, "Waiting on unknown async request %d", id);
+        return -1;
+    }
+    while(r->state != LC_ASYNC_DONE){
+        pthread_cond_wait(&asyncdone, &asynclock);
+    }
+    result = r->result;
+    r->state = LC_ASYNC_FREE;
+    asyncpending--;
+    pthread_mutex_unlock(&asynclock);
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcpoll
+// Description  : Reap the finished requests (without callbacks), oldest
+//                first, without waiting
+//
+// Inputs       : ids, results - filled with the reaped requests
+//                max - room in ids/results
+// Outputs      : number of requests reaped
+
+int lcpoll( LcRequestId *ids, int *results, int max ) {
+    asyncreq *r;
+    int i, n = 0;
+
+    pthread_mutex_lock(&asynclock);
+    while(n < max){
+        for(i=0, r=NULL; i<LC_ASYNC_MAXREQ; i++){
+            if(asyncreqs[i].state == LC_ASYNC_DONE && asyncreqs[i].fn == NULL && (r == NULL || asyncreqs[i].id < r->id)){
+                r = &asyncreqs[i];
+            }
+        }
+        if(r == NULL){
+            break;
+        }
+        ids[n] = r->id;
+        results[n] = r->result;
+        r->state = LC_ASYNC_FREE;
+        asyncpending--;
+        n++;
+    }
+    pthread_mutex_unlock(&asynclock);
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcasync_stop
+// Description  : Let the engine finish the queued requests, then stop it.
+//                Finished requests not reaped yet can still be reaped.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcasync_stop( void ) {
+    int i, n;
+
+    pthread_mutex_lock(&asynclock);
+    n = nengine;
+    asyncstop = 1;
+    pthread_cond_broadcast(&asyncwork);
+    pthread_mutex_unlock(&asynclock);
+
+    for(i=0; i<n; i++){
+        pthread_join(engine[i], NULL);
+    }
+
+    pthread_mutex_lock(&asynclock);
+    nengine = 0;
+    logMessage(LOG_INFO_LEVEL, "Async engine [%d threads, %d requests, at most %d pending]", n, asyncsubmitted, asyncmaxpending);
+    pthread_mutex_unlock(&asynclock);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef LCLOUD_ASYNC_INCLUDED
+#define LCLOUD_ASYNC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_async.h
+//  Description    : This is the asynchronous read/write API for the Lion
+//                   Cloud filesystem.  Requests are queued and run by the
+//                   I/O engine threads; the caller reaps them with lcwait or
+//                   lcpoll, or gets a completion callback.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 08:41:27 PM EDT
+//
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <lcloud_filesys.h>
+
+// Defines
+#define LC_ASYNC_MAXREQ 256      // most requests queued, running or not reaped
+#define LC_ASYNC_MAXTHREADS 32   // most I/O engine threads
+#define LC_ASYNC_THREADS 4       // default I/O engine threads
+
+// Type definitions
+typedef int32_t LcRequestId;
+
+// Called by an engine thread when a request finishes; result is the bytes
+// read/written or -1.  The request is reaped once the callback returns.
+typedef void (*LcCompletionFn)( LcRequestId id, int result, void *arg );
+
+//
+// Functional Prototypes
+
+int lcasync_start( int nthreads );
+    // Start the I/O engine with nthreads threads (done with the default on first use)
+
+LcRequestId lcread_async( LcFHandle fh, char *buf, size_t len, size_t off, LcCompletionFn fn, void *arg );
+    // Queue a read of len bytes at off (fn may be NULL), returns the request id
+
+LcRequestId lcwrite_async( LcFHandle fh, char *buf, size_t len, size_t off, LcCompletionFn fn, void *arg );
+    // Queue a write of len bytes at off (fn may be NULL), returns the request id
+
+int lcwait( LcRequestId id );
+    // Wait for a request and reap it, returns its result
+
+int lcpoll( LcRequestId *ids, int *results, int max );
+    // Reap up to max finished requests without waiting, returns how many
+
+int lcasync_stop( void );
+    // Finish the queued requests and stop the I/O engine
+
+#endif
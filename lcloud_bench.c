@@ -0,0 +1,970 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_bench.c
+//  Description    : This is the benchmark of the LionCloud filesystem.  It
+//                   drives lcopen/lcwrite/lcread/lcseek/lcclose directly with
+//                   synthetic access patterns against lcloud_localserver
+//                   (started by the benchmark with -m, or already running)
+//                   or the in-process devices (-i),
+//                   checks every read against a copy of the data written, and
+//                   reports for each pattern ops/sec, MB/s, bus requests per
+//                   KB moved, how evenly they spread over the devices, the
+//                   cache hit rate and the read/write latency as CSV or
+//                   JSON, so builds can be compared.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 10:21:37 PM EDT
+//
+
+// Include Files
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_alloc.h>
+#include <lcloud_cache.h>
+#include <lcloud_filesys.h>
+#include <lcloud_membus.h>
+#include <lcloud_meta.h>
+#include <lcloud_metrics.h>
+#include <lcloud_network.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LCLOUD_BENCH_ARGUMENTS "hvjP:o:f:F:m:d:s:i:D:x:S:R:K:c:p:w:r:b:q:n:"
+#define LC_BENCH_OPSIZE 1024        // read/write size of the seq, random and zipf patterns
+#define LC_BENCH_LARGEOP 10240      // read/write size of the large pattern
+#define LC_BENCH_SMALLMIN 16        // smallest write of the smallwrite pattern
+#define LC_BENCH_SMALLMAX 64        // largest write of the smallwrite pattern
+#define LC_BENCH_MANYFILES 200      // files open at once in the manyfiles pattern
+#define LC_BENCH_MANYSIZE 8192      // size of each of those files
+#define LC_BENCH_ZIPF 0.99          // Zipf exponent of the zipf pattern
+#define LC_BENCH_NAMES 100000       // distinct file names of the names pattern
+#define LC_BENCH_DIRS 64            // directories of the dirs pattern
+#define LC_BENCH_DIRFILES 64        // files in each of them
+#define LC_BENCH_DIRPAGE 16         // entries listed at a time
+#define LC_BENCH_MAXFILES 256
+#define USAGE                                                               \
+    "USAGE: lcloud_bench [-h] [-v] [-j] [-P <patterns>] [-o <ops>] [-f <files>] [-F <KB>]\n" \
+    "                    [-m <manifest> [-d <usecs>] [-s <usecs>]] [-i <manifest> [-D <dir>]]\n" \
+    "                    [-x <seed>] [-S <width>[,<unit>]] [-R <k>,<m> [-K <dev>]]\n" \
+    "                    [-c <blocks>] [-p <policy>] [-w <dirty>] [-r <blocks>]\n" \
+    "                    [-b <blocks>] [-q <requests>] [-n <connections>]\n" \
+    "\n"                                                                    \
+    "where:\n"                                                              \
+    "    -h - help mode (display this message)\n"                           \
+    "    -v - verbose output\n"                                             \
+    "    -j - JSON output (default CSV)\n"                                  \
+    "    -P - comma separated patterns (default all): seq, random, zipf,\n" \
+    "         smallwrite, large, manyfiles, reopen, names, dirs\n"          \
+    "    -o - operations per pattern (default 20000)\n"                     \
+    "    -f - files per pattern (default 16, up to 256)\n"                  \
+    "    -F - file size in KB (default 64)\n"                               \
+    "    -m - start lcloud_localserver with this hardware manifest\n"       \
+    "    -d - its response delay in microseconds (simulated RTT)\n"         \
+    "    -s - its device service time in microseconds per block\n"         \
+    "    -i - serve the devices of this manifest in process (no server)\n" \
+    "    -D - keep the in-process devices in this directory\n"            \
+    "    -x - random seed (default 1)\n"                                    \
+    "    -S - stripe files over width devices (0 = all) in units of blocks\n" \
+    "    -R - keep m parity blocks for every k data blocks (1,m = m+1 copies)\n" \
+    "    -K - fail device <dev> (index) for the measured phase of each pattern\n" \
+    "         (the files are written before, read and written degraded)\n" \
+    "    -c, -p, -w, -r, -b, -q, -n - cache and bus settings, as lcloud_client\n" \
+    "\n"
+
+// results of one pattern
+typedef struct {
+    const char* pattern;    // pattern name
+    long ops;               // reads and writes done
+    long errors;            // failed calls and data mismatches
+    uint64_t bytes;         // bytes read and written
+    double secs;            // time of the measured phase
+    uint64_t busreqs;       // bus requests that moved blocks
+    uint64_t busblocks;     // blocks moved on the bus
+    int devsused;           // devices that moved some of them
+    double devbalance;      // mean/max of the blocks moved per device (1 = even)
+    int hits;               // cache hits
+    int misses;             // cache misses
+    LcLatencyStats rd;      // lcread latency
+    LcLatencyStats wr;      // lcwrite latency
+} benchresult;
+
+// bus and cache counters at a point in time
+typedef struct {
+    uint64_t busreqs, busblocks;
+    uint64_t devblocks[LC_META_MAXDEVS]; // blocks moved per device
+    int ndevs;
+    int hits, misses;
+} benchsnap;
+
+// a benchmark pattern
+typedef struct {
+    const char* name;
+    int (*run)(benchresult* res);
+} benchpattern;
+
+//
+// Global Data
+int numops = 20000;             // operations per pattern
+int numfiles = 16;              // files per pattern
+int filesize = 64 * 1024;       // bytes per file
+uint64_t rngstate = 1;          // random generator state
+LcFHandle fhs[LC_BENCH_MAXFILES]; // files of the pattern
+char* shadow[LC_BENCH_MAXFILES];  // expected contents of each file
+int shadowsize[LC_BENCH_MAXFILES]; // bytes of each file
+benchsnap before;               // counters at the start of the measured phase
+int faildev = -1;               // device failed during the measured phase (-1 none)
+struct timespec started;        // start of the measured phase
+
+//
+// Functional Prototypes
+
+int runSeq(benchresult* res);
+int runRandom(benchresult* res);
+int runZipf(benchresult* res);
+int runSmallWrite(benchresult* res);
+int runLarge(benchresult* res);
+int runManyFiles(benchresult* res);
+int runReopen(benchresult* res);
+int runNames(benchresult* res);
+int runDirs(benchresult* res);
+
+benchpattern patterns[] = {
+    { "seq", runSeq },
+    { "random", runRandom },
+    { "zipf", runZipf },
+    { "smallwrite", runSmallWrite },
+    { "large", runLarge },
+    { "manyfiles", runManyFiles },
+    { "reopen", runReopen },
+    { "names", runNames },
+    { "dirs", runDirs },
+    { NULL, NULL }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nextRandom
+// Description  : next value of the (xorshift64*) random generator
+//
+// Outputs      : random 64 bit value
+
+uint64_t nextRandom(void)
+{
+    rngstate ^= rngstate >> 12;
+    rngstate ^= rngstate << 25;
+    rngstate ^= rngstate >> 27;
+    return (rngstate * 0x2545F4914F6CDD1DULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : randomBelow
+// Description  : random value from 0 to n-1
+
+int randomBelow(int n)
+{
+    return ((int)(nextRandom() % (uint64_t)n));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeSnapshot
+// Description  : read the bus and cache counters (devices must be on)
+//
+// Inputs       : snap - filled with the counters
+
+void takeSnapshot(benchsnap* snap)
+{
+    LcDeviceStats ds;
+    LcCacheStats cs;
+    int i;
+
+    memset(snap, 0, sizeof(benchsnap));
+    for (i = 0; i < lcdevcount(); i++) {
+        if ((i < LC_META_MAXDEVS) && (lcdevstats(i, &ds) == 0)) {
+            snap->busreqs += ds.busreqs;
+            snap->busblocks += ds.blksread + ds.blkswritten;
+            snap->devblocks[i] = ds.blksread + ds.blkswritten;
+            snap->ndevs = i + 1;
+        }
+    }
+    lcloud_cachestats(&cs);
+    snap->hits = cs.hits;
+    snap->misses = cs.misses;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openFiles
+// Description  : open the files of a pattern (this powers the devices on)
+//
+// Inputs       : pattern - pattern name (part of the file names)
+//                n - number of files, size - bytes of each
+// Outputs      : 0 if successful, -1 if failure
+
+int openFiles(const char* pattern, int n, int size)
+{
+    char name[64];
+    int i;
+
+    for (i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "bench-%s-%d", pattern, i);
+        if ((fhs[i] = lcopen(name)) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Benchmark failed to open [%s]", name);
+            return (-1);
+        }
+        shadow[i] = calloc(size, 1);
+        shadowsize[i] = size;
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : doWrite
+// Description  : write random bytes to a file and to its copy
+//
+// Inputs       : res - results, f - file, off - position, len - bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int doWrite(benchresult* res, int f, int off, int len)
+{
+    char buf[LC_BENCH_LARGEOP];
+    int i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = 'a' + randomBelow(26);
+    }
+    if ((lcseek(fhs[f], off) != off) || (lcwrite(fhs[f], buf, len) != len)) {
+        logMessage(LOG_ERROR_LEVEL, "Benchmark write failed [file %d, pos=%d, size=%d]", f, off, len);
+        res->errors++;
+        return (-1);
+    }
+    memcpy(shadow[f] + off, buf, len);
+    res->ops++;
+    res->bytes += len;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : doRead
+// Description  : read from a file and check the data against its copy
+//
+// Inputs       : res - results, f - file, off - position, len - bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int doRead(benchresult* res, int f, int off, int len)
+{
+    char buf[LC_BENCH_LARGEOP];
+
+    if ((lcseek(fhs[f], off) != off) || (lcread(fhs[f], buf, len) != len)) {
+        logMessage(LOG_ERROR_LEVEL, "Benchmark read failed [file %d, pos=%d, size=%d]", f, off, len);
+        res->errors++;
+        return (-1);
+    }
+    if (memcmp(buf, shadow[f] + off, len) != 0) {
+        logMessage(LOG_ERROR_LEVEL, "Benchmark read data mismatch [file %d, pos=%d, size=%d]", f, off, len);
+        res->errors++;
+        return (-1);
+    }
+    res->ops++;
+    res->bytes += len;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fillFiles
+// Description  : write the files from start to end (not measured)
+//
+// Inputs       : res - results, n - number of files, opsize - write size
+// Outputs      : 0 if successful, -1 if failure
+
+int fillFiles(benchresult* res, int n, int opsize)
+{
+    int f, off;
+
+    for (f = 0; f < n; f++) {
+        for (off = 0; off < shadowsize[f]; off += opsize) {
+            if (doWrite(res, f, off, (shadowsize[f] - off < opsize) ? shadowsize[f] - off : opsize) == -1) {
+                return (-1);
+            }
+        }
+    }
+    res->ops = 0;
+    res->bytes = 0;
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : beginPhase
+// Description  : start measuring a pattern, failing the device given with
+//                -K (when the devices are on already)
+
+void beginPhase(void)
+{
+    if ((faildev != -1) && (lcdevcount() > 0) && (lcfaildevice(faildev, 1) == -1)) {
+        logMessage(LOG_ERROR_LEVEL, "Benchmark failed to fail device %d", faildev);
+    }
+    takeSnapshot(&before);
+    lcmetrics_reset();
+    clock_gettime(CLOCK_MONOTONIC, &started);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : endPhase
+// Description  : close the files (their dirty blocks are written back in
+//                the measured time), stop measuring and shut down
+//
+// Inputs       : res - results, n - number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int endPhase(benchresult* res, int n)
+{
+    struct timespec end;
+    benchsnap after;
+    uint64_t moved, maxmoved = 0;
+    int f, ret = 0;
+
+    for (f = 0; f < n; f++) {
+        if (lcclose(fhs[f]) == -1) {
+            res->errors++;
+            ret = -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    res->secs = (end.tv_sec - started.tv_sec) + (end.tv_nsec - started.tv_nsec) / 1e9;
+    takeSnapshot(&after);
+    res->busreqs = after.busreqs - before.busreqs;
+    res->busblocks = after.busblocks - before.busblocks;
+    for (f = 0; f < after.ndevs; f++) {
+        moved = after.devblocks[f] - before.devblocks[f];
+        res->devsused += (moved > 0) ? 1 : 0;
+        maxmoved = (moved > maxmoved) ? moved : maxmoved;
+    }
+    res->devbalance = (maxmoved > 0) ? (double)res->busblocks / after.ndevs / maxmoved : 0.0;
+    res->hits = after.hits - before.hits;
+    res->misses = after.misses - before.misses;
+    lcmetrics_get(LC_MET_READ, &res->rd);
+    lcmetrics_get(LC_MET_WRITE, &res->wr);
+    if ((faildev != -1) && (lcdevcount() > 0)) {
+        lcfaildevice(faildev, 0); // back for the files of the next pattern (written before it fails)
+    }
+    lcshutdown();
+
+    for (f = 0; f < n; f++) {
+        free(shadow[f]);
+        shadow[f] = NULL;
+    }
+    return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runSeq
+// Description  : sequential pattern: write every file from start to end,
+//                then read them back the same way, over and over
+
+int runSeq(benchresult* res)
+{
+    int k, blocks, f, off, ret = 0;
+
+    if (openFiles("seq", numfiles, filesize) == -1) {
+        return (-1);
+    }
+    beginPhase();
+    blocks = filesize / LC_BENCH_OPSIZE;
+    for (k = 0; k < numops && ret == 0; k++) {
+        f = (k / blocks) % numfiles;
+        off = (k % blocks) * LC_BENCH_OPSIZE;
+        if (k < numfiles * blocks) {
+            ret = doWrite(res, f, off, LC_BENCH_OPSIZE);
+        } else {
+            ret = doRead(res, f, off, LC_BENCH_OPSIZE);
+        }
+    }
+    return (endPhase(res, numfiles) == -1 || ret == -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runRandom
+// Description  : random pattern: 70% reads and 30% writes at uniformly
+//                random positions of full files
+
+int runRandom(benchresult* res)
+{
+    int k, f, off, ret = 0;
+
+    if ((openFiles("random", numfiles, filesize) == -1) || (fillFiles(res, numfiles, LC_BENCH_OPSIZE) == -1)) {
+        return (-1);
+    }
+    beginPhase();
+    for (k = 0; k < numops && ret == 0; k++) {
+        f = randomBelow(numfiles);
+        off = randomBelow(filesize - LC_BENCH_OPSIZE + 1);
+        if (randomBelow(10) < 7) {
+            ret = doRead(res, f, off, LC_BENCH_OPSIZE);
+        } else {
+            ret = doWrite(res, f, off, LC_BENCH_OPSIZE);
+        }
+    }
+    return (endPhase(res, numfiles) == -1 || ret == -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runZipf
+// Description  : Zipfian pattern: 70% reads and 30% writes of chunks
+//                picked with a Zipf distribution over every chunk of every
+//                file, so a few chunks take most of the accesses
+
+int runZipf(benchresult* res)
+{
+    int k, n, chunks, lo, hi, mid, ret = 0;
+    double* cdf, sum = 0.0, u;
+
+    if ((openFiles("zipf", numfiles, filesize) == -1) || (fillFiles(res, numfiles, LC_BENCH_OPSIZE) == -1)) {
+        return (-1);
+    }
+
+    // cumulative distribution of the chunk ranks, the hot chunks scattered
+    chunks = numfiles * (filesize / LC_BENCH_OPSIZE);
+    cdf = malloc(sizeof(double) * chunks);
+    for (n = 0; n < chunks; n++) {
+        sum += 1.0 / pow(n + 1, LC_BENCH_ZIPF);
+        cdf[n] = sum;
+    }
+
+    beginPhase();
+    for (k = 0; k < numops && ret == 0; k++) {
+        u = (nextRandom() >> 11) * (1.0 / 9007199254740992.0) * sum;
+        for (lo = 0, hi = chunks - 1; lo < hi;) {
+            mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        n = (int)(((uint64_t)lo * 2654435761u) % chunks); // rank -> chunk
+        if (randomBelow(10) < 7) {
+            ret = doRead(res, n % numfiles, (n / numfiles) * LC_BENCH_OPSIZE, LC_BENCH_OPSIZE);
+        } else {
+            ret = doWrite(res, n % numfiles, (n / numfiles) * LC_BENCH_OPSIZE, LC_BENCH_OPSIZE);
+        }
+    }
+    free(cdf);
+    return (endPhase(res, numfiles) == -1 || ret == -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runSmallWrite
+// Description  : small write heavy pattern: 90% writes of 16 to 64 bytes
+//                (partial blocks) and 10% reads, at random positions
+
+int runSmallWrite(benchresult* res)
+{
+    int k, f, len, ret = 0;
+
+    if ((openFiles("smallwrite", numfiles, filesize) == -1) || (fillFiles(res, numfiles, LC_BENCH_OPSIZE) == -1)) {
+        return (-1);
+    }
+    beginPhase();
+    for (k = 0; k < numops && ret == 0; k++) {
+        f = randomBelow(numfiles);
+        len = LC_BENCH_SMALLMIN + randomBelow(LC_BENCH_SMALLMAX - LC_BENCH_SMALLMIN + 1);
+        if (randomBelow(10) < 9) {
+            ret = doWrite(res, f, randomBelow(filesize - len + 1), len);
+        } else {
+            ret = doRead(res, f, randomBelow(filesize - len + 1), len);
+        }
+    }
+    return (endPhase(res, numfiles) == -1 || ret == -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runLarge
+// Description  : large operation pattern: 10 KB reads (70%) and writes
+//                (30%) at random positions
+
+int runLarge(benchresult* res)
+{
+    int k, f, off, size, ret = 0;
+
+    size = (filesize < 2 * LC_BENCH_LARGEOP) ? 2 * LC_BENCH_LARGEOP : filesize;
+    if ((openFiles("large", numfiles, size) == -1) || (fillFiles(res, numfiles, LC_BENCH_LARGEOP) == -1)) {
+        return (-1);
+    }
+    beginPhase();
+    for (k = 0; k < numops && ret == 0; k++) {
+        f = randomBelow(numfiles);
+        off = randomBelow(size - LC_BENCH_LARGEOP + 1);
+        if (randomBelow(10) < 7) {
+            ret = doRead(res, f, off, LC_BENCH_LARGEOP);
+        } else {
+            ret = doWrite(res, f, off, LC_BENCH_LARGEOP);
+        }
+    }
+    return (endPhase(res, numfiles) == -1 || ret == -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runManyFiles
+// Description  : many open files pattern: 200 small files open at once,
+//                reads (70%) and writes (30%) spread over all of them
+
+int runManyFiles(benchresult* res)
+{
+    int k, f, off, ret = 0;
+
+    if ((openFiles("manyfiles", LC_BENCH_MANYFILES, LC_BENCH_MANYSIZE) == -1) ||
+        (fillFiles(res, LC_BENCH_MANYFILES, LC_BENCH_OPSIZE) == -1)) {
+        return (-1);
+    }
+    beginPhase();
+    for (k = 0; k < numops && ret == 0; k++) {
+        f = randomBelow(LC_BENCH_MANYFILES);
+        off = randomBelow(LC_BENCH_MANYSIZE - LC_BENCH_OPSIZE + 1);
+        if (randomBelow(10) < 7) {
+            ret = doRead(res, f, off, LC_BENCH_OPSIZE);
+        } else {
+            ret = doWrite(res, f, off, LC_BENCH_OPSIZE);
+        }
+    }
+    return (endPhase(res, LC_BENCH_MANYFILES) == -1 || ret == -1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runReopen
+// Description  : reopen pattern: write the files and shut down, then power
+//                on again loading the filesystem from the devices, reopen
+//                the files and read them back (cold cache)
+
+int runReopen(benchresult* res)
+{
+    char name[64];
+    int k, f, blocks, ret = 0;
+
+    if ((openFiles("reopen", numfiles, filesize) == -1) ||
+        (fillFiles(res, numfiles, LC_BENCH_OPSIZE) == -1)) {
+        return (-1);
+    }
+    for (f = 0; f < numfiles; f++) {
+        lcclose(fhs[f]);
+    }
+    lcshutdown();
+
+    // the measured phase starts at the power on that loads the metadata
+    lcsetmetadata(LC_META_LOAD);
+    beginPhase();
+    for (f = 0; f < numfiles && ret == 0; f++) {
+        snprintf(name, sizeof(name), "bench-reopen-%d", f);
+        if ((fhs[f] = lcopen(name)) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Benchmark failed to reopen [%s]", name);
+            res->errors++;
+            ret = -1;
+        }
+    }
+    blocks = filesize / LC_BENCH_OPSIZE;
+    for (k = 0; k < numops && ret == 0; k++) {
+        ret = doRead(res, (k / blocks) % numfiles, (k % blocks) * LC_BENCH_OPSIZE, LC_BENCH_OPSIZE);
+    }
+    if (ret == -1) {
+        for (; f < numfiles; f++) {
+            fhs[f] = -1;
+        }
+    }
+    ret = (endPhase(res, numfiles) == -1 || ret == -1) ? -1 : 0;
+    lcsetmetadata(LC_META_FORMAT);
+    return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runNames
+// Description  : file table pattern: open and close 100k distinct names
+//                (creating them), then open and close each of them again;
+//                the metadata stays in memory so only the file table is
+//                measured, and the read/write latency columns hold the
+//                lcopen/lcclose latency
+
+int runNames(benchresult* res)
+{
+    struct timespec end;
+    char name[64];
+    int k, pass;
+    LcFHandle fh, base;
+
+    // power on outside the measured phase
+    lcsetmetadata(LC_META_NONE);
+    if (((fh = lcopen("bench-names-first")) == -1) || (lcclose(fh) == -1)) {
+        lcsetmetadata(LC_META_FORMAT);
+        return (-1);
+    }
+    base = fh + 1;
+    beginPhase();
+    for (pass = 0; pass < 2; pass++) {
+        for (k = 0; k < LC_BENCH_NAMES; k++) {
+            snprintf(name, sizeof(name), "bench-names-%d", k);
+            if ((fh = lcopen(name)) == -1) {
+                res->errors++;
+                continue;
+            }
+            if ((fh != base + k) || (lcclose(fh) == -1)) {
+                logMessage(LOG_ERROR_LEVEL, "Benchmark got a bad file handle for [%s] (fh=%d)", name, fh);
+                res->errors++;
+                continue;
+            }
+            res->ops += 2;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    res->secs = (end.tv_sec - started.tv_sec) + (end.tv_nsec - started.tv_nsec) / 1e9;
+    lcmetrics_get(LC_MET_OPEN, &res->rd);
+    lcmetrics_get(LC_MET_CLOSE, &res->wr);
+    lcshutdown();
+    lcsetmetadata(LC_META_FORMAT);
+    return (res->errors > 0) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runDirs
+// Description  : directory pattern: 64 directories of 64 files each, then
+//                opens and closes of random paths (the dentry cache keeps
+//                them off the bus) and a paged listing of every directory;
+//                the read/write latency columns hold the lcopen/lcclose
+//                latency
+
+int runDirs(benchresult* res)
+{
+    LcDirEntry ents[LC_BENCH_DIRPAGE];
+    LcLatencyStats opens, closes;
+    char path[64];
+    uint32_t cookie;
+    int d, k, n, ret = 0;
+    LcFHandle fh;
+
+    for (d = 0; d < LC_BENCH_DIRS && ret == 0; d++) {
+        snprintf(path, sizeof(path), "bench-dirs-%d", d);
+        ret = lcmkdir(path);
+        for (k = 0; k < LC_BENCH_DIRFILES && ret == 0; k++) {
+            snprintf(path, sizeof(path), "bench-dirs-%d/file-%d", d, k);
+            ret = (((fh = lcopen(path)) == -1) || (lcclose(fh) == -1)) ? -1 : 0;
+        }
+    }
+    if (ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Benchmark failed to make [%s]", path);
+        res->errors++;
+        lcshutdown();
+        return (-1);
+    }
+
+    beginPhase();
+    for (k = 0; k < numops; k++) {
+        snprintf(path, sizeof(path), "/bench-dirs-%d/file-%d", randomBelow(LC_BENCH_DIRS), randomBelow(LC_BENCH_DIRFILES));
+        if (((fh = lcopen(path)) == -1) || (lcclose(fh) == -1)) {
+            res->errors++;
+            continue;
+        }
+        res->ops += 2;
+    }
+    for (d = 0; d < LC_BENCH_DIRS; d++) {
+        snprintf(path, sizeof(path), "bench-dirs-%d", d);
+        cookie = 0;
+        for (k = 0; (n = lcreaddir(path, &cookie, ents, LC_BENCH_DIRPAGE)) > 0; k += n) {
+            res->ops += n;
+        }
+        if ((n == -1) || (k != LC_BENCH_DIRFILES)) {
+            logMessage(LOG_ERROR_LEVEL, "Benchmark listed %d entries of [%s]", k, path);
+            res->errors++;
+        }
+    }
+    lcmetrics_get(LC_MET_OPEN, &opens);
+    lcmetrics_get(LC_MET_CLOSE, &closes);
+    ret = endPhase(res, 0);
+    res->rd = opens;
+    res->wr = closes;
+    return (ret == -1 || res->errors > 0) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : printResult
+// Description  : print the results of a pattern as a CSV line or a JSON
+//                object
+//
+// Inputs       : res - results, json - 1 for JSON, first - first result
+
+void printResult(benchresult* res, int json, int first)
+{
+    double secs = (res->secs > 0) ? res->secs : 1e-9;
+    double kb = res->bytes / 1024.0;
+    int lookups = res->hits + res->misses;
+
+    if (json) {
+        printf("%s\n  {\"pattern\": \"%s\", \"ops\": %ld, \"bytes\": %lu, \"secs\": %.6f, \"ops_per_sec\": %.1f, "
+               "\"mb_per_sec\": %.3f, \"bus_requests\": %lu, \"bus_blocks\": %lu, \"bus_requests_per_kb\": %.4f, "
+               "\"devices_used\": %d, \"dev_balance\": %.3f, \"cache_hit_rate\": %.4f, \"read_p50_us\": %.1f, \"read_p99_us\": %.1f, \"write_p50_us\": %.1f, "
+               "\"write_p99_us\": %.1f, \"errors\": %ld}",
+            (first) ? "[" : ",", res->pattern, res->ops, res->bytes, res->secs, res->ops / secs,
+            res->bytes / secs / (1024.0 * 1024.0), res->busreqs, res->busblocks, (kb > 0) ? res->busreqs / kb : 0.0,
+            res->devsused, res->devbalance, (lookups > 0) ? (double)res->hits / lookups : 0.0, res->rd.p50 / 1000.0, res->rd.p99 / 1000.0,
+            res->wr.p50 / 1000.0, res->wr.p99 / 1000.0, res->errors);
+        return;
+    }
+    if (first) {
+        printf("pattern,ops,bytes,secs,ops_per_sec,mb_per_sec,bus_requests,bus_blocks,bus_requests_per_kb,"
+               "devices_used,dev_balance,cache_hit_rate,read_p50_us,read_p99_us,write_p50_us,write_p99_us,errors\n");
+    }
+    printf("%s,%ld,%lu,%.6f,%.1f,%.3f,%lu,%lu,%.4f,%d,%.3f,%.4f,%.1f,%.1f,%.1f,%.1f,%ld\n", res->pattern, res->ops, res->bytes,
+        res->secs, res->ops / secs, res->bytes / secs / (1024.0 * 1024.0), res->busreqs, res->busblocks,
+        (kb > 0) ? res->busreqs / kb : 0.0, res->devsused, res->devbalance, (lookups > 0) ? (double)res->hits / lookups : 0.0,
+        res->rd.p50 / 1000.0, res->rd.p99 / 1000.0, res->wr.p50 / 1000.0, res->wr.p99 / 1000.0, res->errors);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startServer
+// Description  : start lcloud_localserver on a manifest
+//
+// Inputs       : manifest - hardware manifest, delay/service - its -d/-s
+// Outputs      : server process id, -1 if failure
+
+pid_t startServer(char* manifest, char* delay, char* service)
+{
+    pid_t pid;
+
+    if ((pid = fork()) == 0) {
+        execl("./lcloud_localserver", "lcloud_localserver", "-d", delay, "-s", service, manifest, (char*)NULL);
+        fprintf(stderr, "Failed to start ./lcloud_localserver, aborting.\n");
+        _exit(1);
+    }
+    if (pid == -1) {
+        return (-1);
+    }
+    usleep(300000); // let it listen
+    return (pid);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, -1 if failure
+
+int main(int argc, char* argv[])
+{
+    int ch, i, verbose = 0, json = 0, first = 1, failed = 0;
+    int cacheblocks = LC_CACHE_MAXBLOCKS, cachepolicy = LC_CACHE_LRU;
+    int writeback = 0, dirtyhigh = 0, readahead = -1, xferbatch = 1;
+    int buswindow = LCLOUD_DEFAULT_WINDOW, busconns = 1;
+    int stripewidth = 1, stripeunit = LC_STRIPE_UNIT;
+    int redundk = 1, redundm = 0;
+    char *which = NULL, *manifest = NULL, *delay = "0", *service = "0";
+    char *devices = NULL, *store = NULL;
+    LcBusBackend* backend;
+    char list[256], *name;
+    pid_t server = -1;
+    benchresult res;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_BENCH_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'j': // JSON output
+            json = 1;
+            break;
+
+        case 'P': // Patterns to run
+            which = optarg;
+            break;
+
+        case 'o': // Operations per pattern
+            numops = atoi(optarg);
+            break;
+
+        case 'f': // Files per pattern
+            numfiles = atoi(optarg);
+            break;
+
+        case 'F': // File size
+            filesize = atoi(optarg) * 1024;
+            break;
+
+        case 'm': // Start a local server
+            manifest = optarg;
+            break;
+
+        case 'd': // Its response delay
+            delay = optarg;
+            break;
+
+        case 's': // Its service time
+            service = optarg;
+            break;
+
+        case 'i': // In-process devices
+            devices = optarg;
+            break;
+
+        case 'D': // In-process device store directory
+            store = optarg;
+            break;
+
+        case 'x': // Random seed
+            rngstate = strtoull(optarg, NULL, 10) | 1;
+            break;
+
+        case 'S': // Stripe layout
+            stripewidth = atoi(optarg);
+            if (strchr(optarg, ',') != NULL) {
+                stripeunit = atoi(strchr(optarg, ',') + 1);
+            }
+            break;
+
+        case 'R': // Redundancy
+            redundk = atoi(optarg);
+            redundm = (strchr(optarg, ',') != NULL) ? atoi(strchr(optarg, ',') + 1) : 0;
+            break;
+
+        case 'K': // Device failed in the measured phase
+            faildev = atoi(optarg);
+            break;
+
+        case 'c': // Cache size (blocks)
+            cacheblocks = atoi(optarg);
+            break;
+
+        case 'p': // Cache replacement policy
+            if ((cachepolicy = lcloud_cachepolicy(optarg)) == -1) {
+                fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+                return (-1);
+            }
+            break;
+
+        case 'w': // Write-back cache, dirty high watermark
+            writeback = 1;
+            dirtyhigh = atoi(optarg);
+            break;
+
+        case 'r': // Read-ahead window
+            readahead = atoi(optarg);
+            break;
+
+        case 'b': // Vectored transfer size
+            xferbatch = atoi(optarg);
+            break;
+
+        case 'q': // Pipelined transfers in flight
+            buswindow = atoi(optarg);
+            break;
+
+        case 'n': // Connection pool size
+            busconns = atoi(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+    if ((numops < 1) || (numfiles < 1) || (numfiles > LC_BENCH_MAXFILES) || (filesize < 2 * LC_BENCH_OPSIZE)) {
+        fprintf(stderr, "Bad benchmark size, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+
+    // Setup the log and the filesystem
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    LcSimulatorLLevel = registerLogLevel("LCLOUD_SIMULATOR", 0);
+    if (verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+    } else {
+        disableLogLevels(LOG_INFO_LEVEL);
+    }
+    if ((lcloud_configcache(cacheblocks, cachepolicy) == -1) ||
+        (lcloud_configwriteback(writeback, dirtyhigh) == -1) ||
+        ((readahead != -1) && (lcsetreadahead(readahead) == -1)) ||
+        (lcsetxferbatch(xferbatch) == -1) ||
+        (lcsetstripe(stripewidth, stripeunit) == -1) ||
+        (lcsetredundancy(redundk, redundm) == -1) ||
+        (lcsetmetadata(LC_META_FORMAT) == -1) ||
+        (client_lcloud_bus_window(buswindow) == -1) ||
+        (client_lcloud_bus_connections(busconns) == -1)) {
+        fprintf(stderr, "Bad cache configuration, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+    if (devices != NULL) {
+        if ((backend = membus_lcloud_backend(devices, store)) == NULL) {
+            fprintf(stderr, "Failed to set up the in-process devices, aborting.\n");
+            return (-1);
+        }
+        client_lcloud_bus_backend(backend);
+    } else if ((manifest != NULL) && ((server = startServer(manifest, delay, service)) == -1)) {
+        fprintf(stderr, "Failed to start the local server, aborting.\n");
+        return (-1);
+    }
+
+    // Run the patterns, each on a freshly formatted filesystem
+    for (i = 0; patterns[i].name != NULL; i++) {
+        if (which != NULL) {
+            snprintf(list, sizeof(list), ",%s,", which);
+            name = malloc(strlen(patterns[i].name) + 3);
+            sprintf(name, ",%s,", patterns[i].name);
+            if (strstr(list, name) == NULL) {
+                free(name);
+                continue;
+            }
+            free(name);
+        }
+        memset(&res, 0, sizeof(res));
+        res.pattern = patterns[i].name;
+        if (patterns[i].run(&res) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Benchmark pattern [%s] failed", patterns[i].name);
+            failed = 1;
+        }
+        printResult(&res, json, first);
+        first = 0;
+    }
+    if (json) {
+        printf("%s\n", (first) ? "[]" : "\n]");
+    }
+
+    if (server != -1) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    freeLogRegistrations();
+    return (failed) ? -1 : 0;
+}
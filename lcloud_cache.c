@@ -2,134 +2,850 @@
 //
 //  File           : lcloud_cache.c
 //  Description    : This is the cache implementation for the LionCloud
-//                   assignment for CMPSC311.
+//                   assignment for CMPSC311.  The cache is shared by every
+//                   thread using the filesystem; one lock covers the hash
+//                   table, the policy lists and the block data, and blocks
+//                   are copied in and out under it.  Dirty blocks are
+//                   written back in batches without it (one write-back at
+//                   a time, under the flush lock).
 //
 //   Author        : Sung Woo Oh
-//   Last Modified : Thu 19 Mar 2020 09:27:55 AM EDT
+//   Last Modified : Sat 17 Oct 2026 02:40:11 PM EDT
 //
 
-// Includes 
+// Includes
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <pthread.h>
 
 #include <cmpsc311_log.h>
 #include <lcloud_cache.h>
+#include <lcloud_log.h>
 #include <lcloud_controller.h>
 #include <lcloud_filesys.h>
 
-// cache system
+// Defines
+#define LC_CACHE_LISTS 4
+
+// cache system (one entry per cached block, plus "ghost" entries that only
+// remember the key of a recently evicted block for 2Q/ARC)
 typedef struct cachesys{
-    char cacheblock[LC_DEVICE_BLOCK_SIZE];
-    unsigned int cacheline; 
     LcDeviceId did;
     int sec;
     int blk;
-    int howold; // keep track of how old is the cache
+    int slot;   // index of the block data in cacheblocks, -1 for a ghost
+    int list;   // policy list the entry is on
+    int prev;   // more recently used entry on the list (-1 if head)
+    int next;   // less recently used entry on the list (-1 if tail)
+    int ref;    // CLOCK reference bit
+    int dirty;  // block was written in the cache and not yet on the device
+    int dprev;  // dirty list, dirtied earlier (-1 if oldest)
+    int dnext;  // dirty list, dirtied later (-1 if newest)
+    int npar;   // parity blocks of the group the dirty block is in (0 = none)
+    int inflight; // being written back without the lock (off its policy list)
 
 
 }cachesys;
 cachesys *cacheinfo;
+char (*cacheblocks)[LC_DEVICE_BLOCK_SIZE]; // cached block data
+
+// policy list (head = most recently used)
+typedef struct{
+    int head;
+    int tail;
+    int size;
+}cachelist;
+cachelist clists[LC_CACHE_LISTS];
+cachelist dirtylist; // dirty blocks, oldest first (head)
 
 // collect cache data
 typedef struct{
     int hits;
     int misses;
     int numaccess;
-    int bytesused; 
+    int bytesused;
     int numitem; // # of cache items
-    int currentLRU;
-    int currentLRUage;
+    int inserts;
+    int evictions;
+    int dirtywrites;  // writes absorbed by the cache (write-back)
+    int flushes;      // dirty blocks written to the device
 }cachedata;
 cachedata cdata;
 
 int cachesize; // current cache size
 int maxblock;
 
+int *cachehash;  // open addressing table of cache entry indexes (-1 empty)
+int hashmask;    // hash table size - 1 (size is a power of 2)
+int *freeslots;  // stack of unused block data slots
+int nfreeslots;
+int *freeentries;  // stack of unused cache entries
+int nfreeentries;
+
+// replacement policy
+const char *LC_CACHE_POLICY_LABELS[LC_CACHE_MAXPOLICY] = { "lru", "clock", "2q", "arc" };
+LcCachePolicy policy = LC_CACHE_LRU;
+int confblocks = LC_CACHE_MAXBLOCKS;
+int clockhand;   // CLOCK: next entry to look at
+int arcp;        // ARC: target size of T1
+int kin, kout;   // 2Q: A1in and A1out sizes
+
+// write-back
+int writeback = 0;      // write-back mode on/off
+int dirtyhigh;          // flush oldest dirty blocks when more than this many are dirty
+int confdirtyhigh = 0;  // configured high watermark (0 = 3/4 of the cache)
+LcWritebackFn writebackfn = NULL; // writes dirty blocks to the device
+
+pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER; // protects all of the cache state
+pthread_mutex_t flushlock = PTHREAD_MUTEX_INITIALIZER; // one write-back at a time (taken before cachelock)
+pthread_cond_t flushdone = PTHREAD_COND_INITIALIZER;   // a batch written back is in the cache again
+
+// list names used by the policies
+#define LRU_LIST 0  // LRU, CLOCK ring
+#define T1_LIST 0   // ARC T1, 2Q A1in
+#define T2_LIST 1   // ARC T2, 2Q Am
+#define B1_LIST 2   // ARC B1, 2Q A1out (ghosts)
+#define B2_LIST 3   // ARC B2 (ghosts)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : findLRU
-// Description  : Search the LRU cache and return its index
+// Function     : hashslot
+// Description  : home slot of a block in the hash table
 //
-// Outputs      : index of current LRU cache
+// Outputs      : slot index
+
+static int hashslot(LcDeviceId did, uint16_t sec, uint16_t blk){
+    uint32_t key = ((uint32_t)did << 24) ^ ((uint32_t)sec << 12) ^ blk;
+    return (int)((key * 2654435761u) >> 7) & hashmask;
+}
 
-int findLRU(){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupcache
+// Description  : find the hash slot holding a block (linear probing)
+//
+// Outputs      : slot index, -1 if the block is not cached
+
+static int lookupcache(LcDeviceId did, uint16_t sec, uint16_t blk){
+    int slot = hashslot(did, sec, blk);
     int i;
 
-    cdata.currentLRUage = cacheinfo[maxblock-1].howold;
-    for(i=maxblock-1; i>0; i--){
-        // find oldest cache item from the end
-        if(cdata.currentLRUage < cacheinfo[i].howold){
-            cdata.currentLRUage = cacheinfo[i].howold; //update current LRU value as oldest time
-            cdata.currentLRU = i;
+    while((i = cachehash[slot]) != -1){
+        if(cacheinfo[i].did == did && cacheinfo[i].sec == sec && cacheinfo[i].blk == blk){
+            return slot;
         }
+        slot = (slot + 1) & hashmask;
     }
-    return cdata.currentLRU;
+    return -1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : findcache
-// Description  : Search the cache, if not there, return NULL
+// Function     : hashinsert
+// Description  : put cache index i in the hash table (block must not be there yet)
+
+static void hashinsert(int i){
+    int slot = hashslot(cacheinfo[i].did, cacheinfo[i].sec, cacheinfo[i].blk);
+
+    while(cachehash[slot] != -1){
+        slot = (slot + 1) & hashmask;
+    }
+    cachehash[slot] = i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Outputs      : 1 or NULL 
+// Function     : hashremove
+// Description  : empty a hash slot, shifting later entries of the probe run back
+//                so lookups never need tombstones
 
-int findcache(LcDeviceId did, uint16_t sec, uint16_t blk){
-    int i;
-    for(i=0; i<cachesize; i++){
-        if(cacheinfo[i].did == did && cacheinfo[i].sec == sec && cacheinfo[i].blk == blk){
-            return 1;
+static void hashremove(int slot){
+    int next = slot, home, i;
+
+    cachehash[slot] = -1;
+    while(1){
+        next = (next + 1) & hashmask;
+        if((i = cachehash[next]) == -1){
+            return;
+        }
+        // move the entry into the hole unless its home slot lies in (slot, next]
+        home = hashslot(cacheinfo[i].did, cacheinfo[i].sec, cacheinfo[i].blk);
+        if(((next - home) & hashmask) >= ((next - slot) & hashmask)){
+            cachehash[slot] = i;
+            cachehash[next] = -1;
+            slot = next;
         }
     }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listunlink
+// Description  : take cache index i off its list
+
+static void listunlink(int i){
+    cachelist *l = &clists[cacheinfo[i].list];
+
+    if(cacheinfo[i].prev != -1) cacheinfo[cacheinfo[i].prev].next = cacheinfo[i].next;
+    else l->head = cacheinfo[i].next;
+    if(cacheinfo[i].next != -1) cacheinfo[cacheinfo[i].next].prev = cacheinfo[i].prev;
+    else l->tail = cacheinfo[i].prev;
+    l->size--;
+    cacheinfo[i].list = -1;
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listpush
+// Description  : put cache index i at the front (most recently used) of a list
+
+static void listpush(int list, int i){
+    cachelist *l = &clists[list];
+
+    cacheinfo[i].list = list;
+    cacheinfo[i].prev = -1;
+    cacheinfo[i].next = l->head;
+    if(l->head != -1) cacheinfo[l->head].prev = i;
+    else l->tail = i;
+    l->head = i;
+    l->size++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listappend
+// Description  : put cache index i at the back of a list (CLOCK inserts behind the hand)
+
+static void listappend(int list, int i){
+    cachelist *l = &clists[list];
+
+    cacheinfo[i].list = list;
+    cacheinfo[i].next = -1;
+    cacheinfo[i].prev = l->tail;
+    if(l->tail != -1) cacheinfo[l->tail].next = i;
+    else l->head = i;
+    l->tail = i;
+    l->size++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cleanentry
+// Description  : mark dirty cache index i clean (off the dirty list)
+
+static void cleanentry(int i){
+
+    if(cacheinfo[i].dprev != -1) cacheinfo[cacheinfo[i].dprev].dnext = cacheinfo[i].dnext;
+    else dirtylist.head = cacheinfo[i].dnext;
+    if(cacheinfo[i].dnext != -1) cacheinfo[cacheinfo[i].dnext].dprev = cacheinfo[i].dprev;
+    else dirtylist.tail = cacheinfo[i].dprev;
+    dirtylist.size--;
+    cacheinfo[i].dirty = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushentry
+// Description  : write a dirty cache block to the device and mark it clean;
+//                a block the device did not take stays dirty
+//
+// Outputs      : 0 if successful, -1 if failure
+
+static int flushentry(int i){
+    LcCacheBlock b;
+
+    if(!cacheinfo[i].dirty){
+        return 0;
+    }
+    b.did = cacheinfo[i].did;
+    b.sec = cacheinfo[i].sec;
+    b.blk = cacheinfo[i].blk;
+    b.npar = cacheinfo[i].npar;
+    b.data = cacheblocks[cacheinfo[i].slot];
+    if(writebackfn(&b, 1) == -1){
+        logMessage(LOG_ERROR_LEVEL, "LionCloud Cache failed writing back (%d/%d/%d)", cacheinfo[i].did, cacheinfo[i].sec, cacheinfo[i].blk);
+        return -1;
+    }
+    cleanentry(i);
+    cdata.flushes++;
     return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : markdirty
+// Description  : mark cache index i dirty (newest on the dirty list)
+
+static void markdirty(int i){
+
+    if(cacheinfo[i].dirty){
+        return;
+    }
+    cacheinfo[i].dirty = 1;
+    cacheinfo[i].dnext = -1;
+    cacheinfo[i].dprev = dirtylist.tail;
+    if(dirtylist.tail != -1) cacheinfo[dirtylist.tail].dnext = i;
+    else dirtylist.head = i;
+    dirtylist.tail = i;
+    dirtylist.size++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : newentry
+// Description  : take an unused cache entry for a block and put it in the hash table
+//
+// Outputs      : cache index
+
+static int newentry(LcDeviceId did, uint16_t sec, uint16_t blk){
+    int i = freeentries[--nfreeentries];
+
+    cacheinfo[i].did = did;
+    cacheinfo[i].sec = sec;
+    cacheinfo[i].blk = blk;
+    cacheinfo[i].slot = -1;
+    cacheinfo[i].list = -1;
+    cacheinfo[i].ref = 0;
+    cacheinfo[i].dirty = 0;
+    cacheinfo[i].npar = 0;
+    cacheinfo[i].inflight = 0;
+    hashinsert(i);
+    return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : evictentry
+// Description  : give up the block data of cache index i; the entry becomes a
+//                ghost on ghostlist, or is dropped entirely if ghostlist is -1.
+//                A dirty block that cannot be written back is kept, and put
+//                where the policy looks at it last.
+//
+// Outputs      : 0 if successful, -1 if failure (the block is still cached)
+
+static int evictentry(int i, int ghostlist){
+    int list = cacheinfo[i].list;
+
+    // dirty blocks go to the device before the data is dropped
+    if(cacheinfo[i].slot != -1 && flushentry(i) == -1){
+        if(policy == LC_CACHE_CLOCK){
+            cacheinfo[i].ref = 1;
+        }
+        else if(list != -1){
+            listunlink(i);
+            listpush(list, i);
+        }
+        return -1;
+    }
+    if(list != -1){
+        listunlink(i);
+    }
+    if(cacheinfo[i].slot != -1){
+        freeslots[nfreeslots++] = cacheinfo[i].slot;
+        cacheinfo[i].slot = -1;
+        cachesize--;
+        cdata.evictions++;
+        lcLog(LOG_INFO_LEVEL, "Ejecting cache item index %d, length %d", i, LC_DEVICE_BLOCK_SIZE);
+    }
+    if(ghostlist != -1){
+        listpush(ghostlist, i);
+    }
+    else{
+        hashremove(lookupcache(cacheinfo[i].did, cacheinfo[i].sec, cacheinfo[i].blk));
+        freeentries[nfreeentries++] = i;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeslot
+// Description  : give cache index i a free block data slot
+
+static void takeslot(int i){
+    cacheinfo[i].slot = freeslots[--nfreeslots];
+    cachesize++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clockskip
+// Description  : move the CLOCK hand off cache index i before it leaves the ring
+
+static void clockskip(int i){
+    if(i == clockhand){
+        clockhand = (cacheinfo[i].next != -1) ? cacheinfo[i].next : clists[LRU_LIST].head;
+        clockhand = (clockhand == i) ? -1 : clockhand;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clockinsert
+// Description  : put cache index i in the CLOCK ring just behind the hand,
+//                so it is looked at last
+
+static void clockinsert(int i){
+    cachelist *l = &clists[LRU_LIST];
+    int before;
+
+    if(l->size == 0 || clockhand == -1){
+        listappend(LRU_LIST, i);
+        clockhand = i;
+    }
+    else if(cacheinfo[clockhand].prev == -1){
+        listappend(LRU_LIST, i);
+    }
+    else{
+        before = cacheinfo[clockhand].prev;
+        cacheinfo[i].list = LRU_LIST;
+        cacheinfo[i].prev = before;
+        cacheinfo[i].next = clockhand;
+        cacheinfo[before].next = i;
+        cacheinfo[clockhand].prev = i;
+        l->size++;
+    }
+}
+
+//
+// Replacement policies
+//
+// hit   - a cached block (entry i) was accessed
+// admit - make room for and place a block that is not cached; g is the ghost
+//         entry remembered for the block or -1.  Returns the entry now holding
+//         a free data slot for the block, -1 if no block could be evicted
+//         (its write-back failed).
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_hit / lru_admit
+// Description  : least recently used replacement
+
+static void lru_hit(int i){
+    listunlink(i);
+    listpush(LRU_LIST, i);
+}
+
+static int lru_admit(LcDeviceId did, uint16_t sec, uint16_t blk, int g){
+    int i;
+
+    if(cachesize == maxblock && evictentry(clists[LRU_LIST].tail, -1) == -1){
+        return -1;
+    }
+    i = newentry(did, sec, blk);
+    takeslot(i);
+    listpush(LRU_LIST, i);
+    return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clock_hit / clock_admit
+// Description  : CLOCK (second chance) replacement; the list is the clock ring
+//                and a hit only sets the reference bit
+
+static void clock_hit(int i){
+    cacheinfo[i].ref = 1;
+}
+
+static int clock_admit(LcDeviceId did, uint16_t sec, uint16_t blk, int g){
+    int i, victim;
+
+    if(cachesize == maxblock){
+        // sweep, clearing reference bits, until an unreferenced block is found
+        while(cacheinfo[clockhand].ref){
+            cacheinfo[clockhand].ref = 0;
+            clockhand = (cacheinfo[clockhand].next != -1) ? cacheinfo[clockhand].next : clists[LRU_LIST].head;
+        }
+        victim = clockhand;
+        clockhand = (cacheinfo[victim].next != -1) ? cacheinfo[victim].next : clists[LRU_LIST].head;
+        if(evictentry(victim, -1) == -1){
+            return -1;
+        }
+        if(clockhand == victim){
+            clockhand = clists[LRU_LIST].head;
+        }
+    }
+    i = newentry(did, sec, blk);
+    takeslot(i);
+    clockinsert(i);
+    return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_hit / twoq_admit
+// Description  : 2Q replacement (Johnson & Shasha).  New blocks enter the A1in
+//                FIFO; blocks evicted from A1in are remembered in A1out, and
+//                only blocks referenced again while remembered get into the
+//                Am LRU list, so one pass over many blocks does not flush Am.
+
+static void twoq_hit(int i){
+    if(cacheinfo[i].list == T2_LIST){
+        listunlink(i);
+        listpush(T2_LIST, i);
+    }
+    // hits in A1in leave it in place (correlated references)
+}
+
+static int twoq_admit(LcDeviceId did, uint16_t sec, uint16_t blk, int g){
+    int i, ret = 0;
+
+    // take the remembered block off A1out first so trimming A1out cannot drop it
+    if(g != -1){
+        listunlink(g);
+    }
+    if(cachesize == maxblock){
+        if(clists[T1_LIST].size > kin || clists[T2_LIST].size == 0){
+            ret = evictentry(clists[T1_LIST].tail, B1_LIST);
+            if(ret == 0 && clists[B1_LIST].size > kout){
+                evictentry(clists[B1_LIST].tail, -1);
+            }
+        }
+        else{
+            ret = evictentry(clists[T2_LIST].tail, -1);
+        }
+        if(ret == -1){
+            if(g != -1){
+                listpush(B1_LIST, g);
+            }
+            return -1;
+        }
+    }
+
+    if(g != -1){
+        // remembered in A1out: promote to Am
+        takeslot(g);
+        listpush(T2_LIST, g);
+        return g;
+    }
+    i = newentry(did, sec, blk);
+    takeslot(i);
+    listpush(T1_LIST, i);
+    return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_replace
+// Description  : ARC REPLACE: evict from T1 or T2 depending on the target p,
+//                remembering the block in B1 or B2
+//
+// Outputs      : 0 if successful, -1 if failure
+
+static int arc_replace(int inb2){
+    int t1 = clists[T1_LIST].size;
+
+    if(t1 > 0 && ((inb2 && t1 == arcp) || t1 > arcp || clists[T2_LIST].size == 0)){
+        return evictentry(clists[T1_LIST].tail, B1_LIST);
+    }
+    return evictentry(clists[T2_LIST].tail, B2_LIST);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_hit / arc_admit
+// Description  : Adaptive Replacement Cache (Megiddo & Modha).  T1 holds blocks
+//                seen once, T2 blocks seen more than once, B1/B2 remember
+//                blocks evicted from each, and p adapts the T1/T2 split.
+
+static void arc_hit(int i){
+    listunlink(i);
+    listpush(T2_LIST, i);
+}
+
+static int arc_admit(LcDeviceId did, uint16_t sec, uint16_t blk, int g){
+    int i, b1, b2, delta;
+
+    b1 = clists[B1_LIST].size;
+    b2 = clists[B2_LIST].size;
+
+    if(g != -1 && cacheinfo[g].list == B1_LIST){
+        // recently evicted from T1: favor recency
+        delta = (b2 > b1) ? b2 / b1 : 1;
+        arcp = (arcp + delta > maxblock) ? maxblock : arcp + delta;
+        if(cachesize == maxblock && arc_replace(0) == -1) return -1;
+        listunlink(g);
+        takeslot(g);
+        listpush(T2_LIST, g);
+        return g;
+    }
+    if(g != -1){
+        // recently evicted from T2: favor frequency
+        delta = (b1 > b2) ? b1 / b2 : 1;
+        arcp = (arcp - delta < 0) ? 0 : arcp - delta;
+        if(cachesize == maxblock && arc_replace(1) == -1) return -1;
+        listunlink(g);
+        takeslot(g);
+        listpush(T2_LIST, g);
+        return g;
+    }
+
+    // not seen recently (T1 + B1 can overshoot by the blocks a flush put back)
+    if(clists[T1_LIST].size + b1 >= maxblock){
+        if(clists[T1_LIST].size < maxblock){
+            evictentry(clists[B1_LIST].tail, -1);
+            if(cachesize == maxblock && arc_replace(0) == -1) return -1;
+        }
+        else if(evictentry(clists[T1_LIST].tail, -1) == -1){
+            return -1;
+        }
+    }
+    else if(cachesize + b1 + b2 >= maxblock){
+        if(cachesize + b1 + b2 == 2 * maxblock){
+            evictentry(clists[B2_LIST].tail, -1);
+        }
+        if(cachesize == maxblock && arc_replace(0) == -1) return -1;
+    }
+    i = newentry(did, sec, blk);
+    takeslot(i);
+    listpush(T1_LIST, i);
+    return i;
+}
+
+// policy table
+typedef struct{
+    void (*hit)(int i);
+    int (*admit)(LcDeviceId did, uint16_t sec, uint16_t blk, int g);
+}cachepolicy;
+cachepolicy policies[LC_CACHE_MAXPOLICY] = {
+    { lru_hit, lru_admit },
+    { clock_hit, clock_admit },
+    { twoq_hit, twoq_admit },
+    { arc_hit, arc_admit },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findcache
+// Description  : Search the cache, if not there, return NULL
+//
+// Outputs      : 1 or NULL
+
+int findcache(LcDeviceId did, uint16_t sec, uint16_t blk){
+    int slot, found;
+
+    pthread_mutex_lock(&cachelock);
+    slot = lookupcache(did, sec, blk);
+    found = (slot != -1 && cacheinfo[cachehash[slot]].slot != -1);
+    pthread_mutex_unlock(&cachelock);
+    return found;
+}
+
 
 //
 // Functions
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcloud_getcache
-// Description  : Search the cache for a block 
+// Function     : getblock
+// Description  : Search the cache for a block (lock held)
 //
 // Inputs       : did - device number of block to find
 //                sec - sector number of block to find
 //                blk - block number of block to find
 // Outputs      : cache block if found (pointer), NULL if not or failure
 
-char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
-    int i;
-    for(i=0; i<cachesize; i++){
-        cacheinfo[i].howold += 1; // every caches get old
-    }
-    
-    for(i=0; i<cachesize; i++){
-        // if cache exists return block, otherwise get out returning NULL
-        if(cacheinfo[i].did == did && cacheinfo[i].sec == sec && cacheinfo[i].blk == blk){
-            cacheinfo[i].howold = 0; // used, so reset it fresh
-            cdata.hits++; cdata.numaccess++;
-            logMessage(LOG_INFO_LEVEL, "Getting found cache item on index %d, length %d", i, LC_DEVICE_BLOCK_SIZE);
-            logMessage(LOG_INFO_LEVEL, "[INFO] LionCloud Cache ** HIT ** : (%d/%d/%d) index = %d", did, sec, blk, i);
-            logMessage(LOG_INFO_LEVEL, "LC success getting blk [%d/%d/%d] from cache.", did, sec, blk);
-            return cacheinfo[i].cacheblock; // return the found block
+static char * getblock( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int slot, i;
+
+    // if cache exists return block, otherwise get out returning NULL
+    if((slot = lookupcache(did, sec, blk)) != -1 && cacheinfo[cachehash[slot]].slot != -1){
+        i = cachehash[slot];
+        if(cacheinfo[i].list != -1){
+            policies[policy].hit(i); // (not while it is written back)
         }
+        cdata.hits++; cdata.numaccess++;
+        lcLog(LOG_INFO_LEVEL, "Getting found cache item on index %d, length %d", i, LC_DEVICE_BLOCK_SIZE);
+        lcLog(LOG_INFO_LEVEL, "[INFO] LionCloud Cache ** HIT ** : (%d/%d/%d) index = %d", did, sec, blk, i);
+        lcLog(LOG_INFO_LEVEL, "LC success getting blk [%d/%d/%d] from cache.", did, sec, blk);
+        return cacheblocks[cacheinfo[i].slot]; // return the found block
     }
-    
+
     // fail to find cache
     cdata.misses++; cdata.numaccess++;
-    logMessage(LOG_INFO_LEVEL, "Getting cache item (not found!)");
-    logMessage(LOG_INFO_LEVEL, "LionCloud Cache ** MISS ** : (%d/%d/%d)", did, sec, blk);
+    lcLog(LOG_INFO_LEVEL, "Getting cache item (not found!)");
+    lcLog(LOG_INFO_LEVEL, "LionCloud Cache ** MISS ** : (%d/%d/%d)", did, sec, blk);
     /* Return not found */
     return( NULL );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_getcache
+// Description  : Search the cache for a block.  The pointer is only good
+//                until the next cache call, so threaded callers must use
+//                lcloud_readcache instead.
+//
+// Inputs       : did - device number of block to find
+//                sec - sector number of block to find
+//                blk - block number of block to find
+// Outputs      : cache block if found (pointer), NULL if not or failure
+
+char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    char *block;
+
+    pthread_mutex_lock(&cachelock);
+    block = getblock(did, sec, blk);
+    pthread_mutex_unlock(&cachelock);
+    return( block );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_readcache
+// Description  : Search the cache for a block and copy it out
+//
+// Inputs       : did - device number of block to find
+//                sec - sector number of block to find
+//                blk - block number of block to find
+//                block - place for the block contents
+// Outputs      : 1 if found (and copied), 0 if not
+
+int lcloud_readcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
+    char *cached;
+
+    pthread_mutex_lock(&cachelock);
+    if((cached = getblock(did, sec, blk)) != NULL){
+        memcpy(block, cached, LC_DEVICE_BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&cachelock);
+    return( cached != NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : putblock
+// Description  : Put a value in the cache (lock held)
+//
+// Inputs       : did - device number of block to insert
+//                sec - sector number of block to insert
+//                blk - block number of block to insert
+// Outputs      : 0 if succesfully inserted, 1 if there is no room (every
+//                block is being written back), -1 if failure
+
+static int putblock( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
+    int slot, i, g = -1;
+
+    // cache disabled
+    if(maxblock == 0){
+        return 0;
+    }
+
+    /*************** if cache exists, update the cache ***************/
+    if((slot = lookupcache(did, sec, blk)) != -1){
+        i = cachehash[slot];
+        if(cacheinfo[i].slot != -1){
+            if(cacheinfo[i].list != -1){
+                policies[policy].hit(i);
+            }
+            lcLog(LOG_INFO_LEVEL, "Getting found cache item on index %d, length %d", i, LC_DEVICE_BLOCK_SIZE);
+            memcpy(cacheblocks[cacheinfo[i].slot], block, LC_DEVICE_BLOCK_SIZE); // update cache with new writing data
+            return 0;
+        }
+        g = i; // remembered (ghost) block
+    }
+
+    /************* if cache does not exist, let the policy place it **************/
+    if(cachesize == maxblock && clists[T1_LIST].size + clists[T2_LIST].size == 0){
+        return 1;
+    }
+    if((i = policies[policy].admit(did, sec, blk, g)) == -1){
+        logMessage(LOG_ERROR_LEVEL, "LionCloud Cache failed inserting (%d/%d/%d), no block could be ejected", did, sec, blk);
+        return -1;
+    }
+    memcpy(cacheblocks[cacheinfo[i].slot], block, LC_DEVICE_BLOCK_SIZE); //put data into the cache
+    cdata.inserts++;
+    cdata.numitem = cachesize;
+    cdata.bytesused = cachesize * LC_DEVICE_BLOCK_SIZE;
+
+    lcLog(LOG_INFO_LEVEL, "Cache state [%d items, %d bytes used]", cdata.numitem, cdata.bytesused);
+    lcLog(LOG_INFO_LEVEL, "LionCloud Cache success inserting cache item (%d/%d/%d) index= %d", did,sec,blk,i);
+
+    /* Return successfully */
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushdirty
+// Description  : write the oldest dirty blocks back until at most target are
+//                left, a batch at a time.  The batch is taken off the policy
+//                lists (so it cannot be evicted) and copied out under the
+//                cache lock, and written without it; blocks the device did
+//                not take are dirty again.  Called with the flush lock held.
+//
+// Inputs       : target - dirty blocks to leave
+// Outputs      : 0 if successful, -1 if failure
+
+static int flushdirty(int target){
+    LcCacheBlock batch[LC_CACHE_FLUSHBATCH];
+    char data[LC_CACHE_FLUSHBATCH][LC_DEVICE_BLOCK_SIZE];
+    int ent[LC_CACHE_FLUSHBATCH], list[LC_CACHE_FLUSHBATCH];
+    int i, j, n, max, todo, ret = 0;
+
+    pthread_mutex_lock(&cachelock);
+    todo = (maxblock > 0) ? dirtylist.size - target : 0;
+    // leave at least half the cache on the lists so blocks can still be placed
+    max = (maxblock / 2 < LC_CACHE_FLUSHBATCH) ? maxblock / 2 : LC_CACHE_FLUSHBATCH;
+    max = (max < 1) ? 1 : max;
+    while(todo > 0 && dirtylist.head != -1){
+        for(n=0; n < max && n < todo && dirtylist.head != -1; n++){
+            i = dirtylist.head;
+            ent[n] = i;
+            list[n] = cacheinfo[i].list;
+            batch[n].did = cacheinfo[i].did;
+            batch[n].sec = cacheinfo[i].sec;
+            batch[n].blk = cacheinfo[i].blk;
+            batch[n].npar = cacheinfo[i].npar;
+            batch[n].data = data[n];
+            memcpy(data[n], cacheblocks[cacheinfo[i].slot], LC_DEVICE_BLOCK_SIZE);
+            cleanentry(i);
+            if(policy == LC_CACHE_CLOCK){
+                clockskip(i);
+            }
+            listunlink(i);
+            cacheinfo[i].inflight = 1;
+        }
+        pthread_mutex_unlock(&cachelock);
+
+        writebackfn(batch, n);
+
+        pthread_mutex_lock(&cachelock);
+        for(j=0; j<n; j++){
+            i = ent[j];
+            cacheinfo[i].inflight = 0;
+            if(policy == LC_CACHE_CLOCK){
+                clockinsert(i);
+            }
+            else{
+                listpush(list[j], i);
+            }
+            if(batch[j].failed){
+                // rewritten while in flight: the newer data is already dirty
+                if(!cacheinfo[i].dirty){
+                    markdirty(i);
+                }
+                ret = -1;
+            }
+            else{
+                cdata.flushes++;
+            }
+        }
+        pthread_cond_broadcast(&flushdone);
+        todo -= n;
+    }
+    pthread_mutex_unlock(&cachelock);
+    return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : lcloud_putcache
-// Description  : Put a value in the cache 
+// Description  : Put a value in the cache
 //
 // Inputs       : did - device number of block to insert
 //                sec - sector number of block to insert
@@ -137,75 +853,247 @@ char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
 // Outputs      : 0 if succesfully inserted, -1 if failure
 
 int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
-    int i;
-    int LRU;
-    for(i=0; i<cachesize; i++){
-        cacheinfo[i].howold += 1; // every caches get old
+    int ret;
+
+    pthread_mutex_lock(&cachelock);
+    ret = putblock(did, sec, blk, block);
+    pthread_mutex_unlock(&cachelock);
+    return( (ret == -1) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dirtycache
+// Description  : Put a block written by the filesystem in the cache.  In
+//                write-back mode the block is only marked dirty and goes to the
+//                device later (eviction, flush, or the dirty high watermark,
+//                whose flush runs after the cache lock is dropped and is
+//                skipped if another thread is already flushing); otherwise
+//                this is the same as lcloud_putcache.
+//
+// Inputs       : did - device number of block to insert
+//                sec - sector number of block to insert
+//                blk - block number of block to insert
+//                block - the new block contents
+//                npar - parity blocks of the block's group (0 = none)
+// Outputs      : 1 if the write was absorbed by the cache (caller must not
+//                write the block), 0 if the caller must write it, -1 if failure
+
+int lcloud_dirtycache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block, int npar ) {
+    int slot, i, ret = 1;
+
+    pthread_mutex_lock(&cachelock);
+    if(!writeback || maxblock == 0 || writebackfn == NULL){
+        putblock(did, sec, blk, block);
+        pthread_mutex_unlock(&cachelock);
+        return 0;
+    }
+    if((ret = putblock(did, sec, blk, block)) != 0){
+        // no room (the whole cache is being written back): write it through
+        pthread_mutex_unlock(&cachelock);
+        return (ret == 1) ? 0 : -1;
+    }
+    if((slot = lookupcache(did, sec, blk)) == -1){
+        pthread_mutex_unlock(&cachelock);
+        return -1;
     }
+    i = cachehash[slot];
+    cacheinfo[i].npar = npar;
+    markdirty(i);
+    cdata.dirtywrites++;
+    ret = 1;
 
-    for(i=0; i<maxblock; i++){
+    // too many dirty blocks: write the oldest back down to half the watermark
+    // (the ones that fail stay dirty)
+    if(dirtylist.size > dirtyhigh && pthread_mutex_trylock(&flushlock) == 0){
+        lcLog(LOG_INFO_LEVEL, "LionCloud Cache flushing, %d dirty blocks", dirtylist.size);
+        pthread_mutex_unlock(&cachelock);
+        if(flushdirty(dirtyhigh / 2) == -1){
+            ret = -1;
+        }
+        pthread_mutex_unlock(&flushlock);
+        return ret;
+    }
+    pthread_mutex_unlock(&cachelock);
+    return ret;
+}
 
-        /*************** if cache exists, update the cache ***************/
-        if(cacheinfo[i].did == did && cacheinfo[i].sec == sec && cacheinfo[i].blk == blk){
-            cdata.hits++; cdata.numaccess++;
-            cacheinfo[i].cacheline = i;
-            cacheinfo[i].howold = 0; // reset to fresh cache
-            logMessage(LOG_INFO_LEVEL, "Getting found cache item on index %d, length %d", i, LC_DEVICE_BLOCK_SIZE);
-            logMessage(LOG_INFO_LEVEL, "Removing found cache item on index %d, length %d", i, LC_DEVICE_BLOCK_SIZE );
-            memcpy(cacheinfo[i].cacheblock, block, LC_DEVICE_BLOCK_SIZE); // update cache with new writing data
-            return 0;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_flushblock
+// Description  : Write a cached block to the device if it is dirty
+//
+// Inputs       : did/sec/blk - block to flush
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_flushblock( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int slot, ret = 0;
+
+    // a batch write-back holding the block finishes first
+    pthread_mutex_lock(&flushlock);
+    pthread_mutex_lock(&cachelock);
+    if(maxblock > 0 && (slot = lookupcache(did, sec, blk)) != -1 && cacheinfo[cachehash[slot]].slot != -1){
+        ret = flushentry(cachehash[slot]);
+    }
+    pthread_mutex_unlock(&cachelock);
+    pthread_mutex_unlock(&flushlock);
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dropblock
+// Description  : Forget a cached block without writing it back (the block
+//                was freed, its contents do not matter any more)
+//
+// Inputs       : did - device ID of the block
+//                sec - sector of the block
+//                blk - block number
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_dropblock( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int slot, i;
+
+    pthread_mutex_lock(&cachelock);
+    // a block being written back is waited for, so the late write cannot
+    // land on the block after it is given to another file
+    while(maxblock > 0 && (slot = lookupcache(did, sec, blk)) != -1 && cacheinfo[cachehash[slot]].inflight){
+        pthread_cond_wait(&flushdone, &cachelock);
+    }
+    if(maxblock > 0 && slot != -1){
+        i = cachehash[slot];
+        if(cacheinfo[i].dirty){
+            cleanentry(i);
         }
+        clockskip(i);
+        evictentry(i, -1);
     }
+    pthread_mutex_unlock(&cachelock);
+    return 0;
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_flushcache
+// Description  : Write every dirty cached block to the device
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_flushcache( void ) {
+    int ret;
 
-    /************** check if the cache is full -> LRU replacement **************/
-    if(cachesize == LC_CACHE_MAXBLOCKS){
-        cdata.misses++; cdata.numaccess++;
-        LRU = findLRU();
-        cacheinfo[i].cacheline = LRU;
+    pthread_mutex_lock(&flushlock);
+    ret = flushdirty(0);
+    pthread_mutex_unlock(&flushlock);
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_configwriteback
+// Description  : Turn write-back mode on or off
+//
+// Inputs       : enable - 1 for write-back, 0 for write-through
+//                highwater - dirty blocks allowed before flushing (0 = 3/4 of the cache)
+// Outputs      : 0 if successful, -1 if failure
 
-        // set inserting cache info
-        cacheinfo[LRU].did = did;
-        cacheinfo[LRU].sec = sec;
-        cacheinfo[LRU].blk = blk;
-        memcpy(cacheinfo[LRU].cacheblock, block, LC_DEVICE_BLOCK_SIZE); // update LRU cache with new data
-        cacheinfo[LRU].howold = 0; // reset to fresh cache
+int lcloud_configwriteback( int enable, int highwater ) {
 
-        logMessage(LOG_INFO_LEVEL, "Getting cache item (not found!)");
-        logMessage(LOG_INFO_LEVEL, "Ejecting cache item index %d, length %d", LRU, LC_DEVICE_BLOCK_SIZE);
-        logMessage(LOG_INFO_LEVEL, "Cache state [%d items, %d bytes used]", cdata.numitem, LC_DEVICE_BLOCK_SIZE);
-        logMessage(LOG_INFO_LEVEL, "Added cache item index %d, length %d", LRU, LC_DEVICE_BLOCK_SIZE);
-        logMessage(LOG_INFO_LEVEL, "LionCloud Cache success inserting cache item (%d/%d/%d) index= %d", did,sec,blk,LRU);
+    if(highwater < 0){
+        logMessage(LOG_ERROR_LEVEL, "Bad dirty high watermark [%d]", highwater);
+        return -1;
     }
+    writeback = enable;
+    confdirtyhigh = highwater;
+    return 0;
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_setwritebackfn
+// Description  : Set the function the cache uses to write dirty blocks to the device
+//
+// Inputs       : fn - write-back function
+// Outputs      : 0 if successful, -1 if failure
 
-    /************* if cache does not exist, insert cache at the end **************/
-    else{
-        
-        cdata.misses++; cdata.numaccess++;
-        cacheinfo[i].cacheline = cachesize;
-        cdata.numitem += 1; // increment the number of cache item
-        
-
-        // set inserting cache info
-        cacheinfo[cachesize].did = did;
-        cacheinfo[cachesize].sec = sec;
-        cacheinfo[cachesize].blk = blk;
-        memcpy(cacheinfo[cachesize].cacheblock, block, LC_DEVICE_BLOCK_SIZE); //put data into the cache
-        cdata.bytesused += sizeof(cacheinfo[cachesize].cacheblock);
-        cacheinfo[cachesize].howold = 0; // fresh cache
-        cachesize += 1; // increment the cache size
-    
-        logMessage(LOG_INFO_LEVEL, "Getting cache item (not found!)");
-        logMessage(LOG_INFO_LEVEL, "Cache state [%d items, %d bytes used]", cdata.numitem, cdata.bytesused);
-        logMessage(LOG_INFO_LEVEL, "Added cache item index %d, length %d", i, LC_DEVICE_BLOCK_SIZE);
-        logMessage(LOG_INFO_LEVEL, "LionCloud Cache success inserting cache item (%d/%d/%d) index= %d", did,sec,blk,i);
-    }
-    
-    
-    
-    /* Return successfully */
-    return( 0 );
+int lcloud_setwritebackfn( LcWritebackFn fn ) {
+    writebackfn = fn;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_configcache
+// Description  : Set the size and replacement policy of the cache that is
+//                created at power on (lcloud_cacheblocks/lcloud_initcache)
+//
+// Inputs       : maxblocks - the max number number of blocks (0 disables the cache)
+//                pol - replacement policy
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_configcache( int maxblocks, LcCachePolicy pol ) {
+
+    if(maxblocks < 0 || pol < 0 || pol >= LC_CACHE_MAXPOLICY){
+        logMessage(LOG_ERROR_LEVEL, "Bad cache configuration [%d blocks, policy %d]", maxblocks, pol);
+        return -1;
+    }
+    confblocks = maxblocks;
+    policy = pol;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_cacheblocks
+// Description  : Configured cache size
+//
+// Outputs      : number of blocks
+
+int lcloud_cacheblocks( void ) {
+    return confblocks;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_cachepolicy
+// Description  : Look up a replacement policy by name (lru, clock, 2q, arc)
+//
+// Inputs       : name - policy name
+// Outputs      : policy, -1 if unknown
+
+int lcloud_cachepolicy( const char *name ) {
+    int i;
+
+    for(i=0; i<LC_CACHE_MAXPOLICY; i++){
+        if(strcasecmp(name, LC_CACHE_POLICY_LABELS[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_cachestats
+// Description  : Get the cache counters
+//
+// Inputs       : st - filled with the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_cachestats( LcCacheStats *st ) {
+
+    pthread_mutex_lock(&cachelock);
+    st->hits = cdata.hits;
+    st->misses = cdata.misses;
+    st->inserts = cdata.inserts;
+    st->evictions = cdata.evictions;
+    st->dirtywrites = cdata.dirtywrites;
+    st->flushes = cdata.flushes;
+    st->items = cdata.numitem;
+    st->maxblocks = maxblock;
+    pthread_mutex_unlock(&cachelock);
+    return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -213,35 +1101,68 @@ int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
 // Function     : lcloud_initcache
 // Description  : Initialze the cache by setting up metadata a cache elements.
 //
-// Inputs       : maxblocks - the max number number of blocks 
+// Inputs       : maxblocks - the max number number of blocks
 // Outputs      : 0 if successful, -1 if failure
 
 int lcloud_initcache( int maxblocks ) {
 
-    int i=0;
+    int i=0, nentries;
+
+    logMessage(LOG_INFO_LEVEL, "init_cmpsc311_cache: initialization complete [%d/%d] (%s)", maxblocks, maxblocks*LC_DEVICE_BLOCK_SIZE, LC_CACHE_POLICY_LABELS[policy]);
+
+    // cache info initialization: block entries plus up to as many ghosts
+    nentries = maxblocks * 2 + 1;
+    cacheinfo = (cachesys *)malloc(sizeof(cachesys) * nentries);
+    cacheblocks = malloc(LC_DEVICE_BLOCK_SIZE * (maxblocks + 1));
+    freeentries = (int *)malloc(sizeof(int) * nentries);
+    freeslots = (int *)malloc(sizeof(int) * (maxblocks + 1));
 
-    logMessage(LOG_INFO_LEVEL, "init_cmpsc311_cache: initialization complete [%d/%d]", LC_CACHE_MAXBLOCKS, LC_CACHE_MAXBLOCKS*LC_DEVICE_BLOCK_SIZE);
-    logMessage(LOG_INFO_LEVEL, "Cache state [%d items, %d bytes used]", cdata.numitem, cdata.bytesused);
-    
-    // cache info initialization
-    cacheinfo = (cachesys *)malloc(sizeof(cachesys) * maxblocks); // 64 cache lines
-    while(i<maxblocks){
-        cacheinfo[i].did = -1;
-        cacheinfo[i].sec = -1;
-        cacheinfo[i].blk = -1;
-        cacheinfo[i].howold = 0;
-        memset(cacheinfo[i].cacheblock, 0, LC_DEVICE_BLOCK_SIZE);
-        i++;
+    // hash table at most half full
+    hashmask = 1;
+    while(hashmask < nentries * 2){
+        hashmask <<= 1;
+    }
+    cachehash = (int *)malloc(sizeof(int) * hashmask);
+    if(cacheinfo == NULL || cacheblocks == NULL || freeentries == NULL || freeslots == NULL || cachehash == NULL){
+        logMessage(LOG_ERROR_LEVEL, "Failed to allocate cache of %d blocks", maxblocks);
+        return -1;
+    }
+    for(i=0; i<hashmask; i++){
+        cachehash[i] = -1;
+    }
+    hashmask -= 1;
+    for(i=0; i<nentries; i++){
+        freeentries[i] = nentries - 1 - i;
     }
+    nfreeentries = nentries;
+    for(i=0; i<maxblocks; i++){
+        freeslots[i] = maxblocks - 1 - i;
+    }
+    nfreeslots = maxblocks;
+    for(i=0; i<LC_CACHE_LISTS; i++){
+        clists[i].head = -1;
+        clists[i].tail = -1;
+        clists[i].size = 0;
+    }
+    dirtylist.head = -1;
+    dirtylist.tail = -1;
+    dirtylist.size = 0;
+    dirtyhigh = (confdirtyhigh > 0) ? confdirtyhigh : maxblocks * 3 / 4;
+    clockhand = -1;
+    arcp = 0;
+    kin = maxblocks / 4;
+    kout = maxblocks / 2;
 
     // cache data initialization
     cdata.hits =0;
     cdata.misses =0;
     cdata.numaccess =0;
-    cdata.currentLRU = 0;
-    cdata.currentLRUage = 0;
     cdata.bytesused = 0;
     cdata.numitem =0;
+    cdata.inserts = 0;
+    cdata.evictions = 0;
+    cdata.dirtywrites = 0;
+    cdata.flushes = 0;
 
     // global var inaitialization
     cachesize = 0;
@@ -261,24 +1182,28 @@ int lcloud_initcache( int maxblocks ) {
 // Outputs      : 0 if successful, -1 if failure
 
 int lcloud_closecache( void ) {
-    int i=0;
-    logMessage(LOG_INFO_LEVEL, "Closed cmpsc311 cache, deleting %d items", LC_CACHE_MAXBLOCKS);
+    logMessage(LOG_INFO_LEVEL, "Closed cmpsc311 cache, deleting %d items", cachesize);
+    logMessage(LOG_INFO_LEVEL, "Cache policy     [%s, %d blocks]", LC_CACHE_POLICY_LABELS[policy], maxblock);
     logMessage(LOG_INFO_LEVEL, "Cache hits       [%d]", cdata.hits);
     logMessage(LOG_INFO_LEVEL, "Cache misses     [%d]", cdata.misses);
-    logMessage(LOG_INFO_LEVEL, "Cache efficiency [%0.2f%%]", (float)cdata.hits/(float)cdata.numaccess);
-
-    // clean up
-    while(i<maxblock){
-        cacheinfo[i].did = -1;
-        cacheinfo[i].sec = -1;
-        cacheinfo[i].blk = -1;
-        cacheinfo[i].howold = 0;
-        memset(cacheinfo[i].cacheblock, 0, LC_DEVICE_BLOCK_SIZE);
-        i++;
+    logMessage(LOG_INFO_LEVEL, "Cache inserts    [%d], evictions [%d]", cdata.inserts, cdata.evictions);
+    if(writeback){
+        logMessage(LOG_INFO_LEVEL, "Cache write-back [%d writes absorbed, %d blocks flushed]", cdata.dirtywrites, cdata.flushes);
     }
+    if(maxblock > 0 && dirtylist.size > 0){
+        logMessage(LOG_ERROR_LEVEL, "Closing cache with %d dirty blocks not flushed", dirtylist.size);
+    }
+    logMessage(LOG_INFO_LEVEL, "Cache efficiency [%0.2f%%]", (cdata.numaccess == 0) ? 0.0 : 100.0*(float)cdata.hits/(float)cdata.numaccess);
 
     //free
     free(cacheinfo);
+    free(cacheblocks);
+    free(freeentries);
+    free(freeslots);
+    free(cachehash);
+    cacheinfo = NULL;
+    cachehash = NULL;
+    cachesize = 0;
 
 
 
@@ -16,7 +16,45 @@
 #include <lcloud_controller.h>
 
 // Defines 
-#define LC_CACHE_MAXBLOCKS 64
+#define LC_CACHE_MAXBLOCKS 64 // default cache size (blocks)
+#define LC_CACHE_FLUSHBATCH 48 // most dirty blocks handed to one write-back call
+
+// Cache replacement policies
+typedef enum {
+    LC_CACHE_LRU       = 0,  // Least recently used
+    LC_CACHE_CLOCK     = 1,  // CLOCK (second chance)
+    LC_CACHE_2Q        = 2,  // 2Q (A1in/A1out/Am)
+    LC_CACHE_ARC       = 3,  // Adaptive replacement cache
+    LC_CACHE_MAXPOLICY = 4   // Maximum policy number
+} LcCachePolicy;
+
+extern const char *LC_CACHE_POLICY_LABELS[LC_CACHE_MAXPOLICY];
+
+// Cache counters (lcloud_cachestats)
+typedef struct {
+    int hits;           // lookups that found the block
+    int misses;         // lookups that did not
+    int inserts;        // blocks put in the cache
+    int evictions;      // blocks ejected to make room
+    int dirtywrites;    // writes absorbed by the cache (write-back)
+    int flushes;        // dirty blocks written to the device
+    int items;          // blocks in the cache now
+    int maxblocks;      // cache size (blocks)
+} LcCacheStats;
+
+// A dirty block handed to the write-back function
+typedef struct {
+    LcDeviceId did;     // device id
+    uint16_t sec;       // sector
+    uint16_t blk;       // block
+    int npar;           // parity blocks of the group it was dirtied in (0 = none)
+    char *data;         // its 256 bytes
+    int failed;         // not written (set by the write-back function)
+} LcCacheBlock;
+
+// Writes a batch of dirty blocks back to the devices (write-back mode),
+// called without the cache lock; 0 if all were written, -1 if some failed
+typedef int (*LcWritebackFn)( LcCacheBlock *blks, int n );
 
 //
 // Functional Prototypes
@@ -25,9 +63,43 @@ int findcache(LcDeviceId did, uint16_t sec, uint16_t blk);
 char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk );
     // Search the cache for a block 
 
+int lcloud_readcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
+    // Search the cache for a block and copy it out (thread safe)
+
 int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
     // Put a value in the cache 
 
+int lcloud_dirtycache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block, int npar );
+    // Put a written block in the cache (held dirty in write-back mode), npar
+    // parity blocks in its group (handed to the write-back function)
+
+int lcloud_flushblock( LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Write a cached block to the device if it is dirty
+
+int lcloud_dropblock( LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Forget a cached block without writing it back
+
+int lcloud_flushcache( void );
+    // Write every dirty cached block to the device
+
+int lcloud_configwriteback( int enable, int highwater );
+    // Turn write-back mode on or off, set the dirty high watermark
+
+int lcloud_setwritebackfn( LcWritebackFn fn );
+    // Set the function used to write dirty blocks to the device
+
+int lcloud_configcache( int maxblocks, LcCachePolicy pol );
+    // Set the size and replacement policy of the cache created at power on
+
+int lcloud_cacheblocks( void );
+    // Configured cache size (blocks)
+
+int lcloud_cachepolicy( const char *name );
+    // Look up a replacement policy by name (lru, clock, 2q, arc)
+
+int lcloud_cachestats( LcCacheStats *st );
+    // Get the cache counters
+
 int lcloud_initcache( int maxblocks );
     // Initialze the cache by setting up metadata a cache elements.
 
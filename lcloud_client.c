@@ -2,7 +2,11 @@
 //
 //  File          : lcloud_client.c
 //  Description   : This is the client side of the Lion Clound network
-//                  communication protocol.
+//                  communication protocol.  Requests go over a pool of
+//                  connections to the server (one by default, or one per
+//                  device), each of which keeps a window of pipelined block
+//                  transfers in flight.  That TCP client is the default bus
+//                  backend; another (lcloud_membus.c) can be plugged in.
 //
 //  Author        : Sung Woo Oh
 //  Last Modified : Sat 28 Mar 2020 09:43:05 AM EDT
@@ -12,24 +16,73 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 #include <cmpsc311_util.h>  // for hton64ll() and ntoh64ll() functions
 
 // Project Include Files
 #include <lcloud_network.h>
+#include <lcloud_metrics.h>
 #include <cmpsc311_log.h>
 
 
-static LCloudRegisterFrame b0, b1, c0, c1, c2, d0, d1; // global variable for registers
+// one posted request waiting for its response; the protocol has no tag
+// field, so a request is matched by its position in its connection's
+// stream (responses come back in order) and the response must echo the
+// request's registers
+typedef struct{
+    LCloudRegisterFrame reg;    // request (host format)
+    LcBusTag *tag;              // where the response goes (caller's)
+    void *buf;                  // where the data read goes
+    int rdlen;                  // bytes of data following the response
+    int len;                    // bytes of data moved by the request
+}inflight;
+
+// one connection to the server
+typedef struct{
+    int sockfd;                 // socket, -1 if not connected
+    pthread_mutex_t lock;       // protects everything below but the socket reads
+    pthread_cond_t done;        // signalled when a receive finishes
+    int reading;                // a thread is receiving a response (without the lock)
+    int broken;                 // the connection failed
+    inflight pipeline[LCLOUD_MAX_INFLIGHT];
+    int posted;                 // sequence number of the next request posted
+    int completed;              // sequence number of the next response expected
+    int inflightbytes;          // data bytes of the requests in flight
+    // utilization
+    long requests;              // requests sent
+    long bytes;                 // data bytes moved
+    double busy;                // seconds with at least one request in flight
+    double busysince;           // when the connection last became busy
+    double opened;              // when the connection was made
+}lcconn;
+
+lcconn conns[LCLOUD_MAX_CONNECTIONS];
+int numconns = 1;               // connections in the pool
+int perdevice = 0;              // one connection per device id instead of did % numconns
+int didconn[256];               // per device mode: connection of each device id (-1 none yet)
+int nextconn = 0;               // per device mode: next connection to hand out
+int window = LCLOUD_DEFAULT_WINDOW; // most requests in flight per connection
+pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER; // protects the pool setup
+int poolready = 0;              // the connection locks are set up
 
 struct sockaddr_in caddr;
-int sockfd; 
-int socket_handle = -1;
+
+LCloudRegisterFrame tcp_bus_request( LCloudRegisterFrame reg, void *buf );
+int tcp_bus_post( LCloudRegisterFrame reg, void *buf, LcBusTag *tag );
+LCloudRegisterFrame tcp_bus_wait( LcBusTag *tag );
+int tcp_bus_logstats( void );
+
+LcBusBackend LcTcpBus = { "tcp", tcp_bus_request, tcp_bus_post, tcp_bus_wait, tcp_bus_logstats };
+LcBusBackend *bus = &LcTcpBus;  // backend the requests go through
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -38,200 +91,594 @@ int socket_handle = -1;
 // Description  : unpack the registers created with previous function(resp)
 //
 
-uint64_t extract_network_registers(LCloudRegisterFrame resp){
-    b0 = (resp >> 60) & 0xf;                    // 0 - sending / 1 - responding
-    b1 = (resp >> 56) & 0xf;                    // 0 - sending to device / 1 - success from device
-    c0 = (resp >> 48) & 0xff;   /*****  OPCODE : 0 - POWERON / 1 - DEVPROBE / 2 - DEVINIT / 3 - BLOCK_XFER  *****/
-    c1 = (resp >> 40) & 0xff;                   // DID
-    c2 = (resp >> 32) & 0xff;   /*****  LC_XFER_READ - 0 / LC_XFER_WRITE - 1  *****/
-    d0 = (resp >> 16) & 0xffff;                 // sec
-    d1 = (resp & 0xffff);                       // blk
-    
-    return c0; // return operation code
+uint64_t extract_network_registers(LCloudRegisterFrame resp, int *b1, int *c2){
+    *b1 = (resp >> 56) & 0xf;                   // 0 - sending to device / 1 - success from device (vectored: blocks-1)
+    *c2 = (resp >> 32) & 0xff;  /*****  LC_XFER_READ - 0 / LC_XFER_WRITE - 1  *****/
+
+    return (resp >> 48) & 0xff; /*****  OPCODE : 0 - POWERON / 1 - DEVPROBE / 2 - DEVINIT / 3 - BLOCK_XFER  *****/
 }
 
+////////////////////////////////////////////////////////////////////////////////
 //
-// Functions
+// Function     : timenow
+// Description  : monotonic time in seconds
+
+double timenow(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : client_lcloud_bus_request
-// Description  : This the client regstateeration that sends a request to the 
-//                lion client server.   It will:
-//
-//                1) if INIT make a connection to the server
-//                2) send any request to the server, returning results
-//                3) if CLOSE, will close the connection
+// Function     : readfull
+// Description  : read exactly len bytes from the socket (a vectored transfer
+//                can arrive in several pieces)
 //
-// Inputs       : reg - the request reqisters for the command
-//                buf - the block to be read/written from (READ/WRITE)
-// Outputs      : the response structure encoded as needed
+// Inputs       : fd - socket, buf - place to put the data, len - bytes to read
+// Outputs      : len if successful, -1 if failure
 
-LCloudRegisterFrame client_lcloud_bus_request( LCloudRegisterFrame reg, void *buf ) {
-    const char *ip = LCLOUD_DEFAULT_IP;
-    // Set up the address information
-    caddr.sin_family = AF_INET;
-    caddr.sin_port = htons(LCLOUD_DEFAULT_PORT); //htons converts integers to be in network byte order (always big Endian) // literally means host to network
-    socklen_t addrlen = sizeof(caddr);
+int readfull(int fd, void *buf, int len){
+    int got = 0, n;
 
-    
-    
-    // If there isn't an open connection already created, three things need 
-    if(socket_handle == -1){
-        // (a) Setup the address
-        if(inet_aton(ip, &caddr.sin_addr) == 0){
-            logMessage(LOG_ERROR_LEVEL, "Error on address setup\n");
+    while(got < len){
+        if((n = read(fd, (char *)buf+got, len-got)) <= 0){
             return -1;
         }
-        logMessage(LOG_INFO_LEVEL, "IPv4: %s/%d\n", inet_ntoa(caddr.sin_addr), ntohs(caddr.sin_port));
-        
+        got += n;
+    }
+    return len;
+}
 
-        // (b) Create the socket  - socket() 
-        sockfd = socket(PF_INET, SOCK_STREAM, 0);
-        if(sockfd == -1){
-            logMessage(LOG_ERROR_LEVEL, "Error on socket creation [%s]\n", strerror(errno));
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writefull
+// Description  : write exactly len bytes to the socket
+//
+// Inputs       : fd - socket, buf - data to send, len - bytes to write
+// Outputs      : len if successful, -1 if failure
+
+int writefull(int fd, void *buf, int len){
+    int put = 0, n;
+
+    while(put < len){
+        if((n = write(fd, (char *)buf+put, len-put)) <= 0){
             return -1;
         }
+        put += n;
+    }
+    return len;
+}
 
-        // (c) Create the connection  - connect()
-        if(connect(sockfd, (const struct sockaddr *)&caddr, addrlen) == -1){
-            logMessage(LOG_ERROR_LEVEL, "Error on connection\n");
-            return -1;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setuppool
+// Description  : set up the connection locks (once)
+
+void setuppool(void){
+    int i;
+
+    pthread_mutex_lock(&poollock);
+    if(poolready == 0){
+        for(i=0; i<LCLOUD_MAX_CONNECTIONS; i++){
+            conns[i].sockfd = -1;
+            pthread_mutex_init(&conns[i].lock, NULL);
+            pthread_cond_init(&conns[i].done, NULL);
         }
-        logMessage(LOG_INFO_LEVEL, "Successfully made a connection...");
-        socket_handle = 1;
+        for(i=0; i<256; i++){
+            didconn[i] = -1;
+        }
+        poolready = 1;
     }
+    pthread_mutex_unlock(&poollock);
+}
 
-    LCloudRegisterFrame opcode = extract_network_registers(reg); 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pickconn
+// Description  : the connection that carries the requests of a device
+//
+// Inputs       : did - device id
+// Outputs      : connection
 
-    // read( fd, buf, len ) - to receive data FROM a remote process over the network
-    // write( fd, buf, len ) - to send data TO a remote process over the network
-    // fd - file descriptor / buf - array of bytes to write/read / len - number of bytes to write/read
-    // both returns length of bytes read/written
-    
+lcconn * pickconn(int did){
+    int n;
 
-    // There are four cases to consider when extracting this opcode.
-        
-        // CASE 1: read operation (look at the c0 and c2 fields)
-        // SEND: (reg) <- Network format : send the register reg to the network
-        // after converting the register to 'network format'.
-        //
-        // RECEIVE: (reg) -> Host format
-        //          256-byte block (Data read from that frame)
+    if(perdevice == 0){
+        return &conns[did % numconns];
+    }
+    pthread_mutex_lock(&poollock);
+    if(didconn[did] == -1){
+        didconn[did] = nextconn;
+        nextconn = (nextconn + 1) % LCLOUD_MAX_CONNECTIONS;
+    }
+    n = didconn[did];
+    pthread_mutex_unlock(&poollock);
+    return &conns[n];
+}
 
-    LCloudRegisterFrame networkbyte = htonll64(reg); // convert reg to 'network format' (host to network)
-    //LCloudRegisterFrame hostbyte = ntohll64(networkbyte);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connectserver
+// Description  : make a connection to the lion cloud server (lock held)
+//
+// Inputs       : c - connection
+// Outputs      : 0 if successful, -1 if failure
 
-    if(opcode == LC_BLOCK_XFER && c2 == LC_XFER_READ){
-        logMessage(LOG_INFO_LEVEL, "READ connection start...");
+int connectserver(lcconn *c){
+    const char *ip = LCLOUD_DEFAULT_IP;
+    int one = 1;
+    // Set up the address information
+    caddr.sin_family = AF_INET;
+    caddr.sin_port = htons(LCLOUD_DEFAULT_PORT); //htons converts integers to be in network byte order (always big Endian) // literally means host to network
+    socklen_t addrlen = sizeof(caddr);
 
-        if(write(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to send the register reg to the network (READ FAIL)");
-            return -1;
-        }
-        logMessage(LOG_INFO_LEVEL, "Sent the register(%d)", ntohll64(networkbyte), caddr.sin_port);
+    // three things need to be done
+    // (a) Setup the address
+    if(inet_aton(ip, &caddr.sin_addr) == 0){
+        logMessage(LOG_ERROR_LEVEL, "Error on address setup\n");
+        return -1;
+    }
+    logMessage(LOG_INFO_LEVEL, "IPv4: %s/%d\n", inet_ntoa(caddr.sin_addr), ntohs(caddr.sin_port));
 
-        if(read(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to receive the register reg (READ FAIL)");
-            return -1;
-        }
 
-        if(read(sockfd, buf, LC_DEVICE_BLOCK_SIZE) != LC_DEVICE_BLOCK_SIZE){
-            logMessage(LOG_ERROR_LEVEL, "Failed to read from the block (READ FAIL)");
-            return -1;
-        }
+    // (b) Create the socket  - socket()
+    c->sockfd = socket(PF_INET, SOCK_STREAM, 0);
+    if(c->sockfd == -1){
+        logMessage(LOG_ERROR_LEVEL, "Error on socket creation [%s]\n", strerror(errno));
+        return -1;
+    }
+
+    // (c) Create the connection  - connect()
+    if(connect(c->sockfd, (const struct sockaddr *)&caddr, addrlen) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Error on connection\n");
+        close(c->sockfd);
+        c->sockfd = -1;
+        return -1;
+    }
+    // frames are small, send them right away instead of waiting to coalesce (Nagle)
+    setsockopt(c->sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    logMessage(LOG_INFO_LEVEL, "Successfully made connection %d...", (int)(c - conns));
+
+    c->reading = 0;
+    c->broken = 0;
+    c->posted = 0;
+    c->completed = 0;
+    c->inflightbytes = 0;
+    c->requests = 0;
+    c->bytes = 0;
+    c->busy = 0;
+    c->opened = timenow();
+    return 0;
+}
 
-        // When successfully completed read operation, return encoded response
-        return ntohll64(networkbyte);
-        
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : completeoldest
+// Description  : receive the response of the oldest request in flight on the
+//                connection (and the data it read), and check it answers that
+//                request.  Called with the lock held; only one thread reads a
+//                connection at a time, and it drops the lock while it blocks
+//                on the socket so other threads can keep posting.
+//
+// Inputs       : c - connection
+// Outputs      : 0 if successful, -1 if failure
+
+int completeoldest(lcconn *c){
+    inflight *p = &c->pipeline[c->completed % LCLOUD_MAX_INFLIGHT];
+    LCloudRegisterFrame networkbyte;
+    int one = 1, ret = 0;
+
+    // someone else is receiving, wait for them to finish
+    if(c->reading){
+        pthread_cond_wait(&c->done, &c->lock);
+        return (c->broken) ? -1 : 0;
     }
+    c->reading = 1;
+    pthread_mutex_unlock(&c->lock);
 
-        // CASE 2: write operation (look at the c0 and c2 fields)
-        // SEND: (reg) <- Network format : send the register reg to the network 
-        // after converting the register to 'network format'.
-        //       buf 256-byte block (Data to write to that frame)
-        //
-        // RECEIVE: (reg) -> Host format
+    if(readfull(c->sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to receive the register reg (tag %d)", c->completed);
+        ret = -1;
+    }
+    else if(p->rdlen > 0 && readfull(c->sockfd, p->buf, p->rdlen) != p->rdlen){
+        logMessage(LOG_ERROR_LEVEL, "Failed to read from the blocks (tag %d)", c->completed);
+        ret = -1;
+    }
+    else{
+        p->tag->resp = ntohll64(networkbyte);
 
-    else if(opcode == LC_BLOCK_XFER && c2 == LC_XFER_WRITE){
-        logMessage(LOG_INFO_LEVEL, "WRITE connection start...");
+        // ack right away: lcloud_server sends a response's frame and data in two
+        // writes, and with more requests behind it the data would otherwise wait
+        // for our delayed ack (Nagle on the server side)
+        setsockopt(c->sockfd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
 
-        if(write(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to send the register reg to the network (WRITE FAIL)");
-            return -1;
+        // C0-D1 (the low 56 bits) are echoed back, B0/B1 carry the status
+        if(((p->tag->resp ^ p->reg) & 0x00ffffffffffffffULL) != 0){
+            logMessage(LOG_ERROR_LEVEL, "Response does not match request (tag %d)", c->completed);
+            ret = -1;
         }
-        logMessage(LOG_INFO_LEVEL, "Sent the register(%d)", ntohll64(networkbyte));
+    }
 
-        if(write(sockfd, buf, LC_DEVICE_BLOCK_SIZE) != LC_DEVICE_BLOCK_SIZE){
-            logMessage(LOG_ERROR_LEVEL, "Failed to write to the block (WRITE FAIL)");
-            return -1;
+    pthread_mutex_lock(&c->lock);
+    c->reading = 0;
+    if(ret == -1){
+        c->broken = 1;
+    }
+    else{
+        p->tag->done = 1;
+        c->inflightbytes -= p->len;
+        c->completed++;
+        if(c->completed == c->posted){
+            c->busy += timenow() - c->busysince;
         }
+    }
+    pthread_cond_broadcast(&c->done);
+    return ret;
+}
 
-        if(read(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to receive the register reg (WRITE FAIL)");
-            return -1;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_window
+// Description  : set the most block transfers kept in flight per connection
+//                (1 = synchronous)
+//
+// Inputs       : n - window size, 1 to LCLOUD_MAX_INFLIGHT
+// Outputs      : 0 if successful, -1 if failure
+
+int client_lcloud_bus_window( int n ) {
+
+    if(n < 1 || n > LCLOUD_MAX_INFLIGHT){
+        logMessage(LOG_ERROR_LEVEL, "Bad pipeline window %d (1-%d)", n, LCLOUD_MAX_INFLIGHT);
+        return -1;
+    }
+    window = n;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_connections
+// Description  : set the size of the connection pool; block transfers of
+//                device did go over connection did % n, or with n = 0 each
+//                device gets its own connection.  lcloud_server takes a
+//                single connection, more need lcloud_localserver.
+//
+// Inputs       : n - connections, 0 (per device) to LCLOUD_MAX_CONNECTIONS
+// Outputs      : 0 if successful, -1 if failure
+
+int client_lcloud_bus_connections( int n ) {
+
+    if(n < 0 || n > LCLOUD_MAX_CONNECTIONS){
+        logMessage(LOG_ERROR_LEVEL, "Bad connection pool size %d (0-%d)", n, LCLOUD_MAX_CONNECTIONS);
+        return -1;
+    }
+    perdevice = (n == 0);
+    numconns = (n == 0) ? LCLOUD_MAX_CONNECTIONS : n;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : postconn
+// Description  : send a block transfer on a connection without waiting for
+//                its response.  When the window is full the oldest request
+//                is completed first.
+//
+// Inputs       : c - connection, reg - the request registers, buf - the data
+//                to write or the place for the data read, tag - completion
+// Outputs      : 0 if successful, -1 if failure
+
+int postconn( lcconn *c, LCloudRegisterFrame reg, void *buf, LcBusTag *tag ) {
+    LCloudRegisterFrame networkbyte;
+    inflight *p;
+    int opcode, b1, c2, len, ret = -1;
+
+    opcode = extract_network_registers(reg, &b1, &c2);
+    len = ((opcode == LC_BLOCK_XFERV) ? b1 + 1 : 1) * LC_DEVICE_BLOCK_SIZE;
+
+    pthread_mutex_lock(&c->lock);
+    if(c->sockfd == -1 && connectserver(c) == -1){
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+
+    // make room: bounded requests, and bounded data so neither side's
+    // socket buffers fill up while the other is still sending
+    while(c->broken == 0 && c->completed < c->posted &&
+        (c->posted - c->completed >= window || c->inflightbytes + len > LCLOUD_MAX_INFLIGHT_BYTES)){
+        completeoldest(c);
+    }
+    if(c->broken){
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+
+    networkbyte = htonll64(reg);
+    if(writefull(c->sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte) ||
+        (c2 == LC_XFER_WRITE && writefull(c->sockfd, buf, len) != len)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to send the request (tag %d)", c->posted);
+        c->broken = 1;
+    }
+    else{
+        p = &c->pipeline[c->posted % LCLOUD_MAX_INFLIGHT];
+        p->reg = reg;
+        p->tag = tag;
+        p->buf = buf;
+        p->rdlen = (c2 == LC_XFER_READ) ? len : 0;
+        p->len = len;
+        if(c->completed == c->posted){
+            c->busysince = timenow();
         }
+        c->inflightbytes += len;
+        c->requests++;
+        c->bytes += len;
+        c->posted++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_bus_post
+// Description  : send a block transfer (LC_BLOCK_XFER or LC_BLOCK_XFERV) on
+//                the connection of its device without waiting for the
+//                response.  Thread safe.
+//
+// Inputs       : reg - the request registers, buf - the data to write or
+//                the place for the data read, tag - the request's completion
+//                (buf and tag must stay valid until waited)
+// Outputs      : 0 if successful, -1 if failure
+
+int tcp_bus_post( LCloudRegisterFrame reg, void *buf, LcBusTag *tag ) {
+    lcconn *c;
+
+    setuppool();
+    c = pickconn((reg >> 40) & 0xff);
+    tag->conn = (int)(c - conns);
+    tag->done = 0;
+    return postconn(c, reg, buf, tag);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_bus_wait
+// Description  : wait for the response of a posted request (completing the
+//                older ones on its connection on the way)
+//
+// Inputs       : tag - completion passed to tcp_bus_post
+// Outputs      : the response (host format), -1 if failure
 
-        return ntohll64(networkbyte);
+LCloudRegisterFrame tcp_bus_wait( LcBusTag *tag ) {
+    lcconn *c = &conns[tag->conn];
+    LCloudRegisterFrame resp = -1;
 
+    pthread_mutex_lock(&c->lock);
+    while(c->broken == 0 && tag->done == 0){
+        completeoldest(c);
+    }
+    if(tag->done){
+        resp = tag->resp;
     }
+    pthread_mutex_unlock(&c->lock);
+    return resp;
+}
 
-        // CASE 3: power off operation
-        // SEND: (reg) <- Network format : send the register reg to the network 
-        // after converting the register to 'network format'.
-        //
-        // RECEIVE: (reg) -> Host format
-        //
-        // Close the socket when finished : reset socket_handle to initial value of -1.
-        // close(socket_handle)
-    
-    else if(opcode == LC_POWER_OFF){
-        logMessage(LOG_INFO_LEVEL, "POWEROFF connection start...");
-
-        if(write(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to send the register reg to the network (POWEROFF FAIL)");
-            return -1;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_bus_logstats
+// Description  : log the utilization of each connection that was used
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int tcp_bus_logstats( void ) {
+    double elapsed;
+    lcconn *c;
+    int i;
+
+    setuppool();
+    for(i=0; i<LCLOUD_MAX_CONNECTIONS; i++){
+        c = &conns[i];
+        if(c->sockfd == -1){
+            continue;
         }
-        logMessage(LOG_INFO_LEVEL, "Sent the register(%d)", ntohll64(networkbyte));
+        pthread_mutex_lock(&c->lock);
+        elapsed = timenow() - c->opened;
+        logMessage(LOG_INFO_LEVEL, "Connection %d [%ld requests, %ld KB, busy %0.2f%% of %0.3fs]", i, c->requests,
+            c->bytes / 1024, (elapsed > 0) ? c->busy * 100 / elapsed : 0.0, elapsed);
+        pthread_mutex_unlock(&c->lock);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tcp_bus_request
+// Description  : This the client regstateeration that sends a request to the
+//                lion client server.   It will:
+//
+//                1) if INIT make a connection to the server
+//                2) send any request to the server, returning results
+//                3) if CLOSE, will close the connections
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+LCloudRegisterFrame tcp_bus_request( LCloudRegisterFrame reg, void *buf ) {
+    LCloudRegisterFrame networkbyte, resp = -1;
+    lcconn *c = &conns[0];
+    LcBusTag tag;
+    int opcode, b1, c2, i;
 
-        if(read(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to receive the register reg (POWEROFF FAIL)");
+    setuppool();
+    opcode = extract_network_registers(reg, &b1, &c2);
+
+    // There are two cases to consider when extracting this opcode.
+
+        // CASE 1: block transfer (read/write, single or vectored)
+        // Post it on its device's connection and wait for the response; the
+        // data read (after the response) lands in buf, the data written goes
+        // after the request.
+
+    if(opcode == LC_BLOCK_XFER || opcode == LC_BLOCK_XFERV){
+        if(tcp_bus_post(reg, buf, &tag) == -1){
             return -1;
         }
-        close(sockfd);
-        socket_handle = -1; //to avoid use after close
-
-        return ntohll64(networkbyte);
+        return tcp_bus_wait(&tag);
     }
 
-        // CASE 4: Other operations (probes, ...)
-        // SEND: (reg) <- Network format : send the register reg to the network 
-        // after converting the register to 'network format'.
+        // CASE 2: power on, probes, device init and power off
+        // SEND: (reg) <- Network format over the first connection, once the
+        // block transfers in flight on it are done
         //
         // RECEIVE: (reg) -> Host format
+        //
+        // On power off, close every connection when finished
 
-    else{
-        logMessage(LOG_INFO_LEVEL, "POWERON/DEVINIT/OTHER connection start...");
+    pthread_mutex_lock(&c->lock);
+    if(c->sockfd == -1 && connectserver(c) == -1){
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    while(c->broken == 0 && (c->completed < c->posted || c->reading)){
+        completeoldest(c);
+    }
 
-        if(write(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to send the register reg to the network (PROBE or OTHER FAIL)");
-            return -1;
+    networkbyte = htonll64(reg); // convert reg to 'network format' (host to network)
+    if(c->broken || writefull(c->sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to send the register reg to the network (opcode %d)", opcode);
+    }
+    else if(readfull(c->sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to receive the register reg (opcode %d)", opcode);
+    }
+    else{
+        resp = ntohll64(networkbyte);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    if(opcode == LC_POWER_OFF){
+        for(i=0; i<LCLOUD_MAX_CONNECTIONS; i++){
+            pthread_mutex_lock(&conns[i].lock);
+            if(conns[i].sockfd != -1){
+                close(conns[i].sockfd);
+                conns[i].sockfd = -1;  //to avoid use after close
+            }
+            pthread_mutex_unlock(&conns[i].lock);
         }
-        logMessage(LOG_INFO_LEVEL, "Sent the register(%d)", ntohll64(networkbyte));
-        
-
-        if(read(sockfd, &networkbyte, sizeof(networkbyte)) != sizeof(networkbyte)){
-            logMessage(LOG_ERROR_LEVEL, "Failed to receive the register reg (PROBE or OTHER FAIL)");
-            return -1;
+        pthread_mutex_lock(&poollock);
+        for(i=0; i<256; i++){
+            didconn[i] = -1;
         }
-
-        return ntohll64(networkbyte);
+        nextconn = 0;
+        pthread_mutex_unlock(&poollock);
     }
+    return resp;
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_backend
+// Description  : send the requests through a backend from now on (set it
+//                at startup, before the first request)
+//
+// Inputs       : be - the backend, NULL for the TCP client
+// Outputs      : 0 if successful, -1 if failure
 
+int client_lcloud_bus_backend( LcBusBackend *be ) {
+    bus = (be == NULL) ? &LcTcpBus : be;
+    logMessage(LOG_INFO_LEVEL, "Bus backend [%s]", bus->name);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_post
+// Description  : start a block transfer (LC_BLOCK_XFER or LC_BLOCK_XFERV)
+//                without waiting for the response.  Thread safe.
+//
+// Inputs       : reg - the request registers, buf - the data to write or
+//                the place for the data read, tag - the request's completion
+//                (buf and tag must stay valid until waited)
+// Outputs      : 0 if successful, -1 if failure
+
+int client_lcloud_bus_post( LCloudRegisterFrame reg, void *buf, LcBusTag *tag ) {
+    int opcode, b1, c2;
+
+    opcode = extract_network_registers(reg, &b1, &c2);
+    if(opcode != LC_BLOCK_XFER && opcode != LC_BLOCK_XFERV){
+        logMessage(LOG_ERROR_LEVEL, "Only block transfers can be posted (opcode %d)", opcode);
+        return -1;
+    }
+    tag->metric = lcmetrics_busmetric(opcode, c2);
+    tag->posted = lcmetrics_now();
+    return bus->post(reg, buf, tag);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_wait
+// Description  : wait for the response of a posted block transfer
+//
+// Inputs       : tag - completion passed to client_lcloud_bus_post
+// Outputs      : the response (host format), -1 if failure
 
+LCloudRegisterFrame client_lcloud_bus_wait( LcBusTag *tag ) {
+    LCloudRegisterFrame resp;
 
+    if((resp = bus->wait(tag)) != -1){
+        lcmetrics_record(tag->metric, lcmetrics_now() - tag->posted);
+    }
+    return resp;
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_logstats
+// Description  : log the utilization of the backend
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
+int client_lcloud_bus_logstats( void ) {
+    return bus->logstats();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_request
+// Description  : send a request to the devices and return the response.
+//                Block transfers are posted and waited; power on, probes,
+//                device init and power off go to the backend directly.
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+LCloudRegisterFrame client_lcloud_bus_request( LCloudRegisterFrame reg, void *buf ) {
+    LCloudRegisterFrame resp;
+    LcBusTag tag;
+    uint64_t start;
+    int opcode, b1, c2;
+
+    opcode = extract_network_registers(reg, &b1, &c2);
+    if(opcode == LC_BLOCK_XFER || opcode == LC_BLOCK_XFERV){
+        if(client_lcloud_bus_post(reg, buf, &tag) == -1){
+            return -1;
+        }
+        return client_lcloud_bus_wait(&tag);
+    }
+
+    start = lcmetrics_now();
+    if((resp = bus->request(reg, buf)) != -1){
+        lcmetrics_record(lcmetrics_busmetric(opcode, c2), lcmetrics_now() - start);
+    }
+    return resp;
+}
@@ -0,0 +1,600 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_crashtest.c
+//  Description    : This is the crash test of the LionCloud filesystem
+//                   metadata journal.  Each round a writer process appends
+//                   to files on the in-process devices (kept in a directory
+//                   of device files), flushing and closing them at random
+//                   and reporting every commit to the test, and is killed
+//                   by a timer at a random moment (which may be in the
+//                   middle of a bus transfer, a commit, a checkpoint or its
+//                   own recovery).  A checker process then powers on
+//                   (replaying the journal), reopens every file the writers
+//                   touched, and checks that each one holds at least what
+//                   was committed and that all of its bytes are the ones
+//                   written.  The files are sized so that all of them fit
+//                   on the devices of the manifest.  With -K a device is
+//                   dead in every writer and checker from their power on,
+//                   so the filesystem has to keep its metadata and the
+//                   redundant file data on the others.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sun 18 Oct 2026 09:40:12 AM EDT
+//
+
+// Include Files
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_cache.h>
+#include <lcloud_filesys.h>
+#include <lcloud_membus.h>
+#include <lcloud_meta.h>
+#include <lcloud_metrics.h>
+#include <lcloud_network.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LCLOUD_CRASH_ARGUMENTS "hvr:f:x:J:k:w:D:R:K:"
+#define LC_CRASH_MAXFILES 240       // files of all rounds
+#define LC_CRASH_OPEN 3             // files a writer has open at once
+#define LC_CRASH_MAXWRITE 2000      // largest append
+#define LC_CRASH_MAXFILE 12000      // largest file (smaller if the manifest needs it)
+#define USAGE                                                               \
+    "USAGE: lcloud_crashtest [-h] [-v] [-r <rounds>] [-f <files>] [-x <seed>] [-J <blocks>]\n" \
+    "                        [-k <usecs>] [-w <dirty>] [-D <dir>] [-R <k>,<m> [-K <dev>]]\n" \
+    "                        <manifest>\n" \
+    "\n"                                                                    \
+    "where:\n"                                                              \
+    "    -h - help mode (display this message)\n"                           \
+    "    -v - verbose output (of the writer and checker processes)\n"       \
+    "    -r - rounds, each killing a writer and checking (default 20)\n"    \
+    "    -f - files written per round (default 8), sized so all of them\n" \
+    "         fit on the manifest's devices\n"                             \
+    "    -x - random seed (default 1)\n"                                    \
+    "    -J - journal blocks of the filesystem (default 64, small values\n" \
+    "         make the writers checkpoint often)\n"                         \
+    "    -k - largest time before the writer is killed, in microseconds\n"  \
+    "         (default 2000)\n"                                            \
+    "    -w - write-back cache in the writers, flushing above <dirty>\n"    \
+    "         dirty blocks (0 = 3/4 of the cache)\n"                        \
+    "    -D - directory of the device files (default /tmp/lcloud_crash,\n" \
+    "         its device files are removed first)\n"                       \
+    "    -R - keep <m> parity blocks for every <k> data blocks of the files\n" \
+    "    -K - device <dev> (index) is dead from the first power on (needs\n" \
+    "         parity blocks, -R)\n" \
+    "\n"                                                                    \
+    "    <manifest> - hardware manifest of the devices\n"                   \
+    "\n"
+
+// a commit reported by a writer (length -1 when it opens the file)
+typedef struct {
+    int id;                 // file number
+    int length;             // bytes committed
+} crashack;
+
+//
+// Global Data
+int numrounds = 20;             // rounds
+int numfiles = 8;               // files per round
+int journal = LC_META_LOGBLKS;  // journal blocks
+int killmax = 2000;             // largest time before the kill (usecs)
+int wbcache = 0;              // write-back cache in the writers
+int wbdirty = 0;              // its dirty high watermark
+int groupdata = 1;              // data blocks of a redundancy group
+int groupparity = 0;            // parity blocks of it (0 = none)
+int faildev = -1;               // device dead in every process (-1 none)
+int verbose = 0;                // log in the writer and checker
+int maxfile = LC_CRASH_MAXFILE; // largest file, fitted to the manifest
+char *manifest = NULL;          // hardware manifest
+char *store = "/tmp/lcloud_crash"; // device files
+uint64_t rngstate = 1;          // random generator state
+int touched[LC_CRASH_MAXFILES]; // the writers opened the file
+int committed[LC_CRASH_MAXFILES]; // bytes of it committed
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nextRandom
+// Description  : next value of the (xorshift64*) random generator
+//
+// Outputs      : random 64 bit value
+
+uint64_t nextRandom(void)
+{
+    rngstate ^= rngstate >> 12;
+    rngstate ^= rngstate << 25;
+    rngstate ^= rngstate >> 27;
+    return (rngstate * 2685821657736338717ULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : randomBelow
+// Description  : random number from 0 to n-1
+//
+// Inputs       : n - the bound
+// Outputs      : the number
+
+int randomBelow(int n)
+{
+    return ((int)(nextRandom() % (uint64_t)n));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : expected
+// Description  : the byte a writer puts at a position of a file
+//
+// Inputs       : id - file number, off - position
+// Outputs      : the byte
+
+char expected(int id, int off)
+{
+    return ((char)(((uint32_t)off * 2654435761u + (uint32_t)id * 40503u) >> 13));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : startFilesystem
+// Description  : set up the devices and logging of a writer or checker
+//
+// Inputs       : mode - metadata mode of its power on
+// Outputs      : 0 if successful, -1 if failure
+
+int startFilesystem(int mode)
+{
+    LcBusBackend* backend;
+
+    if (verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+    } else {
+        disableLogLevels(LOG_INFO_LEVEL);
+    }
+    if ((backend = membus_lcloud_backend(manifest, store)) == NULL) {
+        return (-1);
+    }
+    client_lcloud_bus_backend(backend);
+    if ((faildev != -1) && (membus_lcloud_faildevice(faildev, 1) == -1)) {
+        return (-1);
+    }
+    if ((lcsetmetadata(mode) == -1) || (lcsetjournal(journal) == -1) ||
+        (lcsetredundancy(groupdata, groupparity) == -1) ||
+        (wbcache && lcloud_configwriteback(1, wbdirty) == -1)) {
+        return (-1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : report
+// Description  : tell the test about an open or a commit
+//
+// Inputs       : out - pipe to the test, id - file, length - bytes committed
+// Outputs      : none
+
+void report(int out, int id, int length)
+{
+    crashack ack;
+
+    ack.id = id;
+    ack.length = length;
+    if (write(out, &ack, sizeof(ack)) != sizeof(ack)) {
+        _exit(1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runWriter
+// Description  : the writer of a round: appends to its files a few at a
+//                time, flushing and closing them at random, until its timer
+//                kills it (or, done early, exits without shutting down)
+//
+// Inputs       : round - round number, out - pipe to the test,
+//                delay - microseconds before the kill
+// Outputs      : none (does not return)
+
+void runWriter(int round, int out, int delay)
+{
+    struct itimerval timer;
+    char name[32], buf[LC_CRASH_MAXWRITE];
+    int id[LC_CRASH_OPEN], length[LC_CRASH_OPEN], target[LC_CRASH_OPEN];
+    LcFHandle fh[LC_CRASH_OPEN];
+    int next = round * numfiles, last = (round + 1) * numfiles;
+    int s, n, i, open = 0;
+
+    // SIGALRM is left to end the process, wherever it is
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = delay / 1000000;
+    timer.it_value.tv_usec = delay % 1000000 + 1;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    if (startFilesystem((round == 0) ? LC_META_FORMAT : LC_META_LOAD) == -1) {
+        _exit(1);
+    }
+    for (s = 0; s < LC_CRASH_OPEN; s++) {
+        id[s] = -1;
+    }
+
+    while (next < last || open > 0) {
+        s = randomBelow(LC_CRASH_OPEN);
+        if (id[s] == -1) {
+            if (next == last) {
+                continue;
+            }
+            // open the next file of the round
+            id[s] = next++;
+            length[s] = 0;
+            target[s] = 1 + randomBelow(maxfile);
+            report(out, id[s], -1);
+            snprintf(name, sizeof(name), "crash-%d", id[s]);
+            if ((fh[s] = lcopen(name)) == -1) {
+                _exit(1);
+            }
+            open++;
+            continue;
+        }
+
+        // append to it, sometimes flushing, closing it once it is long enough
+        n = 1 + randomBelow(LC_CRASH_MAXWRITE);
+        if (length[s] + n > target[s]) {
+            n = target[s] - length[s];
+        }
+        for (i = 0; i < n; i++) {
+            buf[i] = expected(id[s], length[s] + i);
+        }
+        if (lcwrite(fh[s], buf, n) != n) {
+            _exit(1);
+        }
+        length[s] += n;
+        if (length[s] == target[s]) {
+            if (lcclose(fh[s]) == -1) {
+                _exit(1);
+            }
+            report(out, id[s], length[s]);
+            id[s] = -1;
+            open--;
+        } else if (randomBelow(8) == 0) {
+            if (lcflush(fh[s]) == -1) {
+                _exit(1);
+            }
+            report(out, id[s], length[s]);
+        }
+    }
+    _exit(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readAll
+// Description  : read a file from the start to its end (found by reading
+//                ever smaller pieces until nothing more is there)
+//
+// Inputs       : fh - the file, buf - LC_CRASH_MAXFILE bytes
+// Outputs      : bytes read
+
+int readAll(LcFHandle fh, char* buf)
+{
+    int len = 0, step = LC_DEVICE_BLOCK_SIZE;
+
+    // reads past the end are refused (and logged as errors)
+    disableLogLevels(LOG_ERROR_LEVEL);
+    while (step > 0) {
+        if ((len + step <= LC_CRASH_MAXFILE) && (lcread(fh, buf + len, step) == step)) {
+            len += step;
+        } else {
+            step /= 2;
+        }
+    }
+    enableLogLevels(LOG_ERROR_LEVEL);
+    return (len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runChecker
+// Description  : the checker of a round: powers on (replaying the journal),
+//                checks every file the writers opened so far, and shuts
+//                down cleanly
+//
+// Inputs       : nids - files of the rounds so far
+// Outputs      : none (exits with 0 if every file is right, 2 if not)
+
+void runChecker(int nids)
+{
+    char name[32], *buf;
+    uint64_t start;
+    int i, j, len, bad = 0;
+    LcFHandle fh;
+
+    if (startFilesystem(LC_META_LOAD) == -1) {
+        _exit(1);
+    }
+    buf = malloc(LC_CRASH_MAXFILE);
+    start = lcmetrics_now();
+    for (i = 0; i < nids; i++) {
+        if (touched[i] == 0) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "crash-%d", i);
+        if ((fh = lcopen(name)) == -1) {
+            fprintf(stderr, "  [%s] failed to open\n", name);
+            _exit(2);
+        }
+        if (start != 0) {
+            printf("  recovered in %.3f ms\n", (lcmetrics_now() - start) / 1e6);
+            start = 0;
+        }
+
+        // the file holds what was committed, maybe more, all as written
+        len = readAll(fh, buf);
+        if (len < committed[i]) {
+            fprintf(stderr, "  [%s] has %d bytes, %d were committed\n", name, len, committed[i]);
+            bad++;
+        }
+        for (j = 0; j < len; j++) {
+            if (buf[j] != expected(i, j)) {
+                fprintf(stderr, "  [%s] wrong byte at %d of %d (%d committed)\n", name, j, len, committed[i]);
+                bad++;
+                break;
+            }
+        }
+        lcclose(fh);
+    }
+    if (lcdevcount() > 0) {
+        lcshutdown();
+    }
+    free(buf);
+    fflush(stdout);
+    _exit((bad == 0) ? 0 : 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clearStore
+// Description  : remove the device files of earlier tests, so the first
+//                writer formats devices no other filesystem points into
+//
+// Inputs       : none
+// Outputs      : none
+
+void clearStore(void)
+{
+    char path[512];
+    struct dirent* ent;
+    DIR* dir;
+
+    if ((dir = opendir(store)) == NULL) {
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "lcdev-", 6) == 0) {
+            snprintf(path, sizeof(path), "%s/%s", store, ent->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fitFiles
+// Description  : size the files to the manifest.  The journal and about a
+//                block of metadata per file fill the first working devices,
+//                and a redundancy group takes a block on each of k+m
+//                different devices, so the groups that fit are counted on
+//                what the metadata leaves; the files of all rounds at their
+//                largest take at most half of them (the rest is left to
+//                checkpoint copies and partly filled groups)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if the manifest is too small (or has
+//                too few working devices for a redundancy group)
+
+int fitFiles(void)
+{
+    int devblks[LC_MEMBUS_MAXDEVS];
+    int dev, ndevs, n, blocks = 0, working = 0, meta, groups, width, nids, perfile;
+
+    if (membus_lcloud_backend(manifest, store) == NULL) {
+        return (-1);
+    }
+    for (ndevs = 0; (n = membus_lcloud_devblocks(ndevs)) != -1; ndevs++) {
+        devblks[ndevs] = (ndevs != faildev) ? n : 0;
+        blocks += devblks[ndevs];
+        working += (ndevs != faildev);
+    }
+    width = groupdata + groupparity;
+    if (faildev >= ndevs) {
+        fprintf(stderr, "Manifest %s has no device %d to fail, aborting.\n", manifest, faildev);
+        return (-1);
+    }
+    if (working < width) {
+        fprintf(stderr, "Manifest %s has %d working devices, -R %d,%d needs %d, aborting.\n",
+            manifest, working, groupdata, groupparity, width);
+        return (-1);
+    }
+
+    // the metadata, then the most groups with their blocks on different
+    // devices in what it leaves
+    nids = numrounds * numfiles;
+    meta = journal + nids;
+    for (dev = 0; dev < ndevs; dev++) {
+        n = (devblks[dev] < meta) ? devblks[dev] : meta;
+        devblks[dev] -= n;
+        meta -= n;
+    }
+    for (groups = 0;; groups++) {
+        for (dev = 0, n = 0; dev < ndevs; dev++) {
+            n += (devblks[dev] < groups + 1) ? devblks[dev] : groups + 1;
+        }
+        if (n < (groups + 1) * width) {
+            break;
+        }
+    }
+
+    // data blocks of a file, without the parity of its groups
+    perfile = groups / 2 / nids * groupdata;
+    if (perfile < 1) {
+        fprintf(stderr, "Manifest %s (%d working blocks) is too small for %d files (use fewer rounds or files), aborting.\n",
+            manifest, blocks, nids);
+        return (-1);
+    }
+    if (perfile * LC_DEVICE_BLOCK_SIZE < maxfile) {
+        maxfile = perfile * LC_DEVICE_BLOCK_SIZE;
+    }
+    printf("Files of up to %d bytes (%d working blocks)\n", maxfile, blocks);
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud crash test
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if every round passed, -1 if not
+
+int main(int argc, char* argv[])
+{
+    int ch, r, i, fds[2], status, delay, acks, failed = 0;
+    crashack ack;
+    pid_t pid;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_CRASH_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'r': // Rounds
+            numrounds = atoi(optarg);
+            break;
+
+        case 'f': // Files per round
+            numfiles = atoi(optarg);
+            break;
+
+        case 'x': // Random seed
+            rngstate = strtoull(optarg, NULL, 10);
+            if (rngstate == 0) {
+                rngstate = 1;
+            }
+            break;
+
+        case 'J': // Journal blocks
+            journal = atoi(optarg);
+            break;
+
+        case 'k': // Largest kill delay
+            killmax = atoi(optarg);
+            break;
+
+        case 'w': // Write-back cache, dirty high watermark
+            wbcache = 1;
+            wbdirty = atoi(optarg);
+            break;
+
+        case 'D': // Device file directory
+            store = optarg;
+            break;
+
+        case 'R': // Redundancy
+            groupdata = atoi(optarg);
+            groupparity = (strchr(optarg, ',') != NULL) ? atoi(strchr(optarg, ',') + 1) : 0;
+            break;
+
+        case 'K': // Dead device
+            faildev = atoi(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+    if ((optind != argc - 1) || (numrounds < 1) || (numfiles < 1) || (killmax < 1) ||
+        (numrounds * numfiles > LC_CRASH_MAXFILES) || ((faildev != -1) && (groupparity < 1))) {
+        fprintf(stderr, "Bad arguments (at most %d files in all rounds, -K needs parity blocks), use -h to see usage, aborting.\n", LC_CRASH_MAXFILES);
+        return (-1);
+    }
+    manifest = argv[optind];
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    LcSimulatorLLevel = registerLogLevel("LCLOUD_SIMULATOR", 0);
+    clearStore();
+    if (fitFiles() == -1) {
+        return (-1);
+    }
+
+    for (r = 0; r < numrounds; r++) {
+        // a writer, killed at a random moment
+        if (pipe(fds) == -1) {
+            return (-1);
+        }
+        delay = randomBelow(killmax);
+        if ((pid = fork()) == 0) {
+            close(fds[0]);
+            runWriter(r, fds[1], delay);
+        }
+        close(fds[1]);
+        waitpid(pid, &status, 0);
+
+        // what it committed before dying
+        acks = 0;
+        while (read(fds[0], &ack, sizeof(ack)) == sizeof(ack)) {
+            if (ack.id >= 0 && ack.id < LC_CRASH_MAXFILES) {
+                touched[ack.id] = 1;
+                if (ack.length > committed[ack.id]) {
+                    committed[ack.id] = ack.length;
+                    acks++;
+                }
+            }
+        }
+        close(fds[0]);
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Round %d: the writer failed (exit %d)\n", r, WEXITSTATUS(status));
+            failed++;
+            break;
+        }
+
+        // a checker over every file so far
+        printf("Round %d: writer %s (timer %d us), %d commits seen\n", r,
+            WIFSIGNALED(status) ? "killed" : "done first", delay, acks);
+        fflush(stdout);
+        if ((pid = fork()) == 0) {
+            runChecker((r + 1) * numfiles);
+        }
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("Round %d: FAILED\n", r);
+            failed++;
+            break;
+        }
+    }
+
+    for (i = 0, acks = 0; i < LC_CRASH_MAXFILES; i++) {
+        acks += touched[i];
+    }
+    printf("%s: %d rounds, %d files checked\n", (failed) ? "FAILED" : "PASSED", r, acks);
+    return ((failed) ? -1 : 0);
+}
@@ -0,0 +1,341 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_ec.c
+//  Description    : This is the erasure code of the Lion Cloud filesystem, a
+//                   systematic Reed-Solomon code over GF(256) (polynomial
+//                   0x11d).  Parity block p of a group is the sum over the
+//                   data blocks j of coef(p,j) * data j, the coefficients
+//                   taken from a Cauchy matrix scaled so that its first row
+//                   and first column are all ones: every square submatrix
+//                   of a Cauchy matrix is invertible (so any k blocks of the
+//                   group give back the data), parity 0 is the XOR of the
+//                   data, and with one data block every parity block is a
+//                   copy of it.  The inner loop, dst += c * src, looks the
+//                   products of the low and high nibbles of 16 bytes at a
+//                   time up with the SSSE3 byte shuffle when the processor
+//                   has it, and goes through a full product table otherwise.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sun 18 Oct 2026 09:41:07 AM EDT
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <cmpsc311_log.h>
+#include <lcloud_ec.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LC_EC_X86 1
+#endif
+
+// Defines
+#define LC_EC_POLY 0x11d // x^8 + x^4 + x^3 + x^2 + 1
+
+//
+// Global Data
+uint8_t gflog[256];         // discrete log (base 2) of the nonzero elements
+uint8_t gfexp[510];         // 2^i, twice over so sums of two logs need no modulo
+uint8_t gfmul[256][256];    // full product table
+uint8_t gflo[256][16];      // c * x for the low nibbles x (shuffle tables)
+uint8_t gfhi[256][16];      // c * (x << 4) for the high nibbles x
+int ecsimd = 0;             // the SIMD multiply is in use
+pthread_once_t ecready = PTHREAD_ONCE_INIT;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buildtables
+// Description  : build the log, product and nibble tables of GF(256), and
+//                pick the multiply the processor can run
+//
+// Inputs       : none
+// Outputs      : none
+
+void buildtables(void){
+    int i, j, x = 1;
+
+    for(i=0; i<255; i++){
+        gfexp[i] = gfexp[i+255] = x;
+        gflog[x] = i;
+        x <<= 1;
+        if(x & 0x100){
+            x ^= LC_EC_POLY;
+        }
+    }
+    for(i=0; i<256; i++){
+        for(j=0; j<256; j++){
+            gfmul[i][j] = (i == 0 || j == 0) ? 0 : gfexp[gflog[i] + gflog[j]];
+        }
+        for(j=0; j<16; j++){
+            gflo[i][j] = gfmul[i][j];
+            gfhi[i][j] = gfmul[i][j << 4];
+        }
+    }
+#ifdef LC_EC_X86
+    ecsimd = __builtin_cpu_supports("ssse3") ? 1 : 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gfinv
+// Description  : inverse of a nonzero element
+
+uint8_t gfinv(uint8_t a){
+    return gfexp[255 - gflog[a]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : eccoef
+// Description  : coefficient of data block j in parity block p:
+//                cauchy(p,j) * cauchy(0,0) / (cauchy(0,j) * cauchy(p,0)),
+//                where cauchy(p,j) = 1 / (p + (0x80 | j)); it does not
+//                depend on k or m, so the parity of a group only changes
+//                with its data
+//
+// Inputs       : p - parity block, j - data block
+// Outputs      : the coefficient
+
+uint8_t eccoef(int p, int j){
+    uint8_t cpj = gfinv(p ^ (0x80 | j)), c00 = gfinv(0x80), c0j = gfinv(0x80 | j), cp0 = gfinv(p ^ 0x80);
+
+    return gfmul[gfmul[cpj][c00]][gfinv(gfmul[c0j][cp0])];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : muladdscalar
+// Description  : dst += c * src a byte at a time, from the product table
+
+void muladdscalar(uint8_t *dst, const uint8_t *src, uint8_t c, int len){
+    const uint8_t *row = gfmul[c];
+    int i;
+
+    for(i=0; i<len; i++){
+        dst[i] ^= row[src[i]];
+    }
+}
+
+#ifdef LC_EC_X86
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : muladdssse3
+// Description  : dst += c * src 16 bytes at a time: the products of the low
+//                and high nibbles come out of the 16 entry tables of c with
+//                one byte shuffle each
+
+__attribute__((target("ssse3")))
+void muladdssse3(uint8_t *dst, const uint8_t *src, uint8_t c, int len){
+    __m128i lo = _mm_loadu_si128((const __m128i *)gflo[c]);
+    __m128i hi = _mm_loadu_si128((const __m128i *)gfhi[c]);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i x, prod;
+    int i;
+
+    for(i=0; i+16<=len; i+=16){
+        x = _mm_loadu_si128((const __m128i *)(src + i));
+        prod = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(x, mask)),
+                             _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), prod));
+    }
+    muladdscalar(dst + i, src + i, c, len - i);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ecmuladd
+// Description  : dst += c * src over GF(256)
+//
+// Inputs       : dst - block added to, src - block multiplied
+//                c - coefficient, len - bytes
+// Outputs      : none
+
+void lcloud_ecmuladd( char *dst, const char *src, uint8_t c, int len ) {
+    int i;
+
+    pthread_once(&ecready, buildtables);
+    if(c == 0){
+        return;
+    }
+#ifdef LC_EC_X86
+    if(ecsimd == 1){
+        muladdssse3((uint8_t *)dst, (const uint8_t *)src, c, len);
+        return;
+    }
+#endif
+    if(c == 1){
+        for(i=0; i<len; i++){
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    muladdscalar((uint8_t *)dst, (const uint8_t *)src, c, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : badgroup
+// Description  : check the shape of a group
+//
+// Inputs       : k - data blocks, m - parity blocks
+// Outputs      : 1 (logged) if it is not valid, else 0
+
+int badgroup(int k, int m){
+    if(k < 1 || m < 0 || k + m > LC_EC_MAXBLOCKS){
+        logMessage(LOG_ERROR_LEVEL, "Erasure code: bad group of %d data and %d parity blocks", k, m);
+        return 1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ecencode
+// Description  : Compute the parity blocks of a group
+//
+// Inputs       : k - data blocks, m - parity blocks, data - the k data
+//                blocks, parity - the m parity blocks (filled in), len - bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_ecencode( int k, int m, char **data, char **parity, int len ) {
+    int p, j;
+
+    if(badgroup(k, m)){
+        return -1;
+    }
+    pthread_once(&ecready, buildtables);
+    for(p=0; p<m; p++){
+        if(k == 1){
+            memcpy(parity[p], data[0], len); // mirror
+            continue;
+        }
+        memset(parity[p], 0x0, len);
+        for(j=0; j<k; j++){
+            lcloud_ecmuladd(parity[p], data[j], eccoef(p, j), len);
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ecdecode
+// Description  : Rebuild the missing blocks of a group: the first k blocks
+//                there give a k x k system (rows of the identity for data
+//                blocks, coefficient rows for parity blocks) whose inverse
+//                turns them back into the data, then the missing parity is
+//                encoded again
+//
+// Inputs       : k - data blocks, m - parity blocks, blks - the k+m blocks
+//                (data then parity), have - which are there, len - bytes
+// Outputs      : number of blocks rebuilt, -1 if failure
+
+int lcloud_ecdecode( int k, int m, char **blks, const int *have, int len ) {
+    uint8_t a[LC_EC_MAXBLOCKS][LC_EC_MAXBLOCKS], inv[LC_EC_MAXBLOCKS][LC_EC_MAXBLOCKS], t;
+    int rows[LC_EC_MAXBLOCKS];
+    int i, j, r, c, n = 0, rebuilt = 0;
+
+    if(badgroup(k, m)){
+        return -1;
+    }
+    pthread_once(&ecready, buildtables);
+    for(i=0; i<k+m && n<k; i++){
+        if(have[i]){
+            rows[n++] = i;
+        }
+    }
+    if(n < k){
+        logMessage(LOG_ERROR_LEVEL, "Erasure code: %d of the %d blocks needed are left", n, k);
+        return -1;
+    }
+
+    // data blocks: invert the rows of the blocks there (the data blocks
+    // come first, so with all of them there this is the identity)
+    for(i=0; i<k && rows[k-1] >= k; i++){
+        for(j=0; j<k; j++){
+            a[i][j] = (rows[i] < k) ? (rows[i] == j) : eccoef(rows[i] - k, j);
+            inv[i][j] = (i == j);
+        }
+    }
+    for(c=0; c<k && rows[k-1] >= k; c++){
+        for(r=c; r<k && a[r][c] == 0; r++);
+        if(r == k){
+            logMessage(LOG_ERROR_LEVEL, "Erasure code: singular decoding matrix");
+            return -1;
+        }
+        for(j=0; j<k; j++){
+            t = a[c][j]; a[c][j] = a[r][j]; a[r][j] = t;
+            t = inv[c][j]; inv[c][j] = inv[r][j]; inv[r][j] = t;
+        }
+        t = gfinv(a[c][c]);
+        for(j=0; j<k; j++){
+            a[c][j] = gfmul[t][a[c][j]];
+            inv[c][j] = gfmul[t][inv[c][j]];
+        }
+        for(r=0; r<k; r++){
+            if(r != c && (t = a[r][c]) != 0){
+                for(j=0; j<k; j++){
+                    a[r][j] ^= gfmul[t][a[c][j]];
+                    inv[r][j] ^= gfmul[t][inv[c][j]];
+                }
+            }
+        }
+    }
+    for(j=0; j<k; j++){
+        if(have[j]){
+            continue;
+        }
+        memset(blks[j], 0x0, len);
+        for(i=0; i<k; i++){
+            lcloud_ecmuladd(blks[j], blks[rows[i]], inv[j][i], len);
+        }
+        rebuilt++;
+    }
+
+    // parity blocks, from the data
+    for(i=k; i<k+m; i++){
+        if(!have[i]){
+            memset(blks[i], 0x0, len);
+            for(j=0; j<k; j++){
+                lcloud_ecmuladd(blks[i], blks[j], eccoef(i - k, j), len);
+            }
+            rebuilt++;
+        }
+    }
+    return rebuilt;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ecsimd
+// Description  : Turn the SIMD multiply on (if the processor has it) or off
+//
+// Inputs       : enable - 1 to use it, 0 for the product table
+// Outputs      : 1 if it is used from now on, else 0
+
+int lcloud_ecsimd( int enable ) {
+    pthread_once(&ecready, buildtables);
+    ecsimd = 0;
+#ifdef LC_EC_X86
+    ecsimd = (enable && __builtin_cpu_supports("ssse3")) ? 1 : 0;
+#endif
+    return ecsimd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_ecimpl
+// Description  : Name of the multiply in use
+//
+// Inputs       : none
+// Outputs      : "ssse3" or "scalar"
+
+const char * lcloud_ecimpl( void ) {
+    pthread_once(&ecready, buildtables);
+    return (ecsimd == 1) ? "ssse3" : "scalar";
+}
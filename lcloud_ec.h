@@ -0,0 +1,44 @@
+#ifndef LCLOUD_EC_INCLUDED
+#define LCLOUD_EC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_ec.h
+//  Description    : This is the interface of the erasure code of the Lion
+//                   Cloud filesystem: a systematic Reed-Solomon code over
+//                   GF(256) that makes m parity blocks from k data blocks
+//                   and rebuilds any m lost blocks from the other k.  With
+//                   k = 1 the parity blocks are copies (mirroring).
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sun 18 Oct 2026 09:41:07 AM EDT
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define LC_EC_MAXBLOCKS 16 // most data + parity blocks in a group
+
+//
+// Functional Prototypes
+
+int lcloud_ecencode( int k, int m, char **data, char **parity, int len );
+    // Compute the m parity blocks of k data blocks of len bytes
+
+int lcloud_ecdecode( int k, int m, char **blks, const int *have, int len );
+    // Rebuild the blocks of a group (k data then m parity) that are missing
+    // (have[i] == 0) from the others; returns the number rebuilt, -1 if
+    // fewer than k are there
+
+void lcloud_ecmuladd( char *dst, const char *src, uint8_t c, int len );
+    // dst += c * src over GF(256) (the code's inner loop)
+
+int lcloud_ecsimd( int enable );
+    // Use the SIMD multiply when the processor has it (default) or not;
+    // returns 1 if it is used from now on
+
+const char * lcloud_ecimpl( void );
+    // Name of the multiply in use ("ssse3" or "scalar")
+
+#endif
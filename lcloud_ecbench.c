@@ -0,0 +1,236 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_ecbench.c
+//  Description    : This is a check and microbenchmark for the LionCloud
+//                   erasure code.  For a few group shapes (k data + m parity
+//                   blocks) it encodes random data and rebuilds it from
+//                   every pattern of up to m lost blocks, once with the
+//                   product table multiply and once with the SIMD multiply,
+//                   and fails unless both give back the data and the same
+//                   parity.  It then reports encode and decode MB/s (of data)
+//                   for both.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sun 18 Oct 2026 02:20:51 PM EDT
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_ec.h>
+
+// Defines
+#define LCLOUD_ECBENCH_ARGUMENTS "hr:l:"
+#define LCLOUD_ECBENCH_MAXLEN 65536
+#define USAGE                                                               \
+    "USAGE: lcloud_ecbench [-h] [-r <rounds>] [-l <length>]\n"             \
+    "\n"                                                                    \
+    "where:\n"                                                              \
+    "    -h - help mode (display this message)\n"                           \
+    "    -r - groups encoded (and decoded) per timing (default 20000)\n"    \
+    "    -l - bytes per block (default 256, the device block size)\n"       \
+    "\n"
+
+//
+// Global Data
+int shapes[][2] = { {1, 1}, {1, 2}, {2, 1}, {2, 2}, {3, 2}, {4, 2}, {6, 3}, {8, 4}, {10, 6} };
+int checklens[] = { 1, 15, 16, 256, 1029 }; // both sides of the 16 byte SIMD step
+char *orig[LC_EC_MAXBLOCKS];   // the group as encoded
+char *blks[LC_EC_MAXBLOCKS];   // the group being rebuilt
+char *other[LC_EC_MAXBLOCKS];  // parity from the other multiply
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elapsed
+// Description  : seconds between two timestamps
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkShape
+// Description  : encode a random group with both multiplies, and rebuild it
+//                from every pattern of up to m lost blocks with both
+//
+// Inputs       : k - data blocks, m - parity blocks, len - bytes per block
+// Outputs      : number of patterns checked, -1 if any came out wrong
+
+long checkShape(int k, int m, int len) {
+    int have[LC_EC_MAXBLOCKS];
+    int i, n, lost, simd, pattern;
+    long count = 0;
+
+    for (i = 0; i < k; i++) {
+        for (n = 0; n < len; n++) {
+            orig[i][n] = rand();
+        }
+    }
+    lcloud_ecsimd(0);
+    lcloud_ecencode(k, m, orig, orig + k, len);
+    lcloud_ecsimd(1);
+    lcloud_ecencode(k, m, orig, other, len);
+    for (i = 0; i < m; i++) {
+        if (memcmp(orig[k+i], other[i], len) != 0) {
+            fprintf(stderr, "%d+%d, %d bytes: parity %d differs between the multiplies\n", k, m, len, i);
+            return (-1);
+        }
+    }
+
+    for (pattern = 1; pattern < (1 << (k + m)); pattern++) {
+        for (i = 0, lost = 0; i < k + m; i++) {
+            lost += (pattern >> i) & 1;
+        }
+        if (lost > m) {
+            continue;
+        }
+        for (simd = 0; simd < 2; simd++) {
+            lcloud_ecsimd(simd);
+            for (i = 0; i < k + m; i++) {
+                have[i] = !((pattern >> i) & 1);
+                memcpy(blks[i], orig[i], len);
+                if (!have[i]) {
+                    memset(blks[i], 0xa5, len);
+                }
+            }
+            if (lcloud_ecdecode(k, m, blks, have, len) != lost) {
+                fprintf(stderr, "%d+%d, %d bytes: pattern 0x%x not rebuilt (%s)\n", k, m, len, pattern, lcloud_ecimpl());
+                return (-1);
+            }
+            for (i = 0; i < k + m; i++) {
+                if (memcmp(blks[i], orig[i], len) != 0) {
+                    fprintf(stderr, "%d+%d, %d bytes: pattern 0x%x rebuilt block %d wrong (%s)\n", k, m, len, pattern, i, lcloud_ecimpl());
+                    return (-1);
+                }
+            }
+        }
+        count++;
+    }
+    return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : timeShape
+// Description  : encode, and decode with the first m data blocks lost (the
+//                most work), rounds times each
+//
+// Inputs       : k - data blocks, m - parity blocks, len - bytes per block
+//                rounds - groups, enc/dec - filled with the MB/s of data
+// Outputs      : none
+
+void timeShape(int k, int m, int len, int rounds, double *enc, double *dec) {
+    int have[LC_EC_MAXBLOCKS];
+    struct timespec start, end;
+    double mb = (double)k * len * rounds / (1024 * 1024);
+    int i, r;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        lcloud_ecencode(k, m, orig, orig + k, len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *enc = mb / elapsed(&start, &end);
+
+    for (i = 0; i < k + m; i++) {
+        memcpy(blks[i], orig[i], len);
+        have[i] = (i >= m || i >= k);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r++) {
+        lcloud_ecdecode(k, m, blks, have, len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *dec = mb / elapsed(&start, &end);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the erasure code check and benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, -1 if failure
+
+int main(int argc, char* argv[])
+{
+    int ch, s, l, i, k, m, hassimd, rounds = 20000, len = 256;
+    int nshapes = sizeof(shapes) / sizeof(shapes[0]), nlens = sizeof(checklens) / sizeof(checklens[0]);
+    double senc, sdec, venc, vdec;
+    long n;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_ECBENCH_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'r': // Groups per timing
+            rounds = atoi(optarg);
+            break;
+
+        case 'l': // Bytes per block
+            len = atoi(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+    if (rounds < 1 || len < 1 || len > LCLOUD_ECBENCH_MAXLEN) {
+        fprintf(stderr, "Bad rounds or block length, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    for (i = 0; i < LC_EC_MAXBLOCKS; i++) {
+        orig[i] = malloc(LCLOUD_ECBENCH_MAXLEN);
+        blks[i] = malloc(LCLOUD_ECBENCH_MAXLEN);
+        other[i] = malloc(LCLOUD_ECBENCH_MAXLEN);
+    }
+    srand(311);
+
+    // without SIMD both passes run the product table, which still checks it
+    hassimd = lcloud_ecsimd(1);
+    printf("SIMD multiply: %s\n", hassimd ? "ssse3" : "not available, checking the product table only");
+    for (s = 0; s < nshapes; s++) {
+        k = shapes[s][0];
+        m = shapes[s][1];
+        for (l = 0, n = 0; l < nlens; l++) {
+            if ((n = checkShape(k, m, checklens[l])) == -1) {
+                printf("%2d+%-2d: FAILED\n", k, m);
+                return (-1);
+            }
+        }
+        printf("%2d+%-2d: %5ld erasure patterns rebuilt at %d lengths, scalar and SIMD agree\n", k, m, n, nlens);
+    }
+
+    printf("\n%d byte blocks, %d groups per timing, MB/s of data\n", len, rounds);
+    printf("shape   encode scalar  encode %-6s  decode scalar  decode %-6s\n", hassimd ? "ssse3" : "-", hassimd ? "ssse3" : "-");
+    for (s = 0; s < nshapes; s++) {
+        k = shapes[s][0];
+        m = shapes[s][1];
+        lcloud_ecsimd(0);
+        timeShape(k, m, len, rounds, &senc, &sdec);
+        lcloud_ecsimd(1);
+        timeShape(k, m, len, rounds, &venc, &vdec);
+        printf("%2d+%-2d  %13.0f  %13.0f  %13.0f  %13.0f\n", k, m, senc, venc, sdec, vdec);
+    }
+
+    for (i = 0; i < LC_EC_MAXBLOCKS; i++) {
+        free(orig[i]);
+        free(blks[i]);
+        free(other[i]);
+    }
+    freeLogRegistrations();
+    return (0);
+}
@@ -2,7 +2,17 @@
 //
 //  File           : lcloud_filesys.c
 //  Description    : This is the implementation of the Lion Cloud device 
-//                   filesystem interfaces.
+//                   filesystem interfaces.  The interfaces can be called
+//                   from several threads: the file table is guarded by
+//                   one lock, every file by its own lock (so different
+//                   files are read and written in parallel), the allocator
+//                   and cache lock their own state, and the statistics are
+//                   updated atomically.
+//
+//                   A file can keep its data redundant: mirrored, or with
+//                   Reed-Solomon parity, so reads go on when a device
+//                   fails (it goes LC_DEVICE_ERRORED on its first failed
+//                   transfer and its blocks are rebuilt from the others).
 //
 //   Author        : *** Sung Woo Oh ***
 //   Last Modified : *** 2/26/2020 ***
@@ -11,6 +21,7 @@
 // Include files
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <cmpsc311_log.h>
 
 // Project include files
@@ -19,17 +30,59 @@
 #include <lcloud_cache.h>
 #include <lcloud_support.h>
 #include <lcloud_network.h>
+#include <lcloud_alloc.h>
+#include <lcloud_log.h>
+#include <lcloud_metrics.h>
+#include <lcloud_meta.h>
+#include <lcloud_ec.h>
 
 //bool typedef
 typedef int bool;
 #define true 1
 #define false 0
-int full = -1;
 
+// Functional Prototypes (used before they are defined)
+int readfile( LcFHandle fh, char *buf, size_t len );
+int writefile( LcFHandle fh, char *buf, size_t len );
+void releaseblks( LcFHandle fh );
+void setlayout( LcFHandle fh, int width );
+void setredundancy( LcFHandle fh, int k, int m );
+void logextents( LcFHandle fh, int first, int n );
+
+
+// unpacked register values of a frame
+typedef struct{
+    uint64_t b0, b1, c0, c1, c2, d0, d1;
+}lcregs;
+
+// statistics are bumped by several threads
+#define STATADD(counter, n) __sync_fetch_and_add(&(counter), (n))
+#define STATGET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// flags set by threads holding different locks (a file's or the file table's)
+#define FLAGSET(flag, v) __atomic_store_n(&(flag), (v), __ATOMIC_RELAXED)
 
-static LCloudRegisterFrame frm, rfrm, b0, b1, c0, c1, c2, d0, d1;
 int numdevice; //number of devices // there are 5 devices in assign3
-#define filenum 256
+#define LC_FILE_CHUNK 1024         // file table entries allocated at a time
+#define LC_FILE_MAXCHUNKS 1024     // most chunks of the file table (about a million files)
+#define FINFO(fh) (ftable[(fh) / LC_FILE_CHUNK][(fh) % LC_FILE_CHUNK]) // file table entry
+#define LC_TYPE_NONE 0             // unused file table entry
+#define LC_TYPE_FILE 1             // regular file
+#define LC_TYPE_DIR 2              // directory
+#define LC_ROOT 0                  // file handle of the root directory
+#define LC_DIR_ENTRY 64            // bytes of a directory entry slot (fh, name length, name)
+#define LC_DIR_PAGE 64             // directory entry slots read at a time
+#define LC_READAHEAD_MINBLOCKS 2   // read-ahead window when a sequential stream is first seen
+#define LC_READAHEAD_MAXBLOCKS 16  // default largest read-ahead window
+#define LC_XFER_MAXREQ 48          // most blocks gathered into one batch of bus transfers
+#define LC_EXTENT_MINBLOCKS 8      // blocks reserved for a file at a time, to start with
+#define LC_EXTENT_MAXBLOCKS 256    // most blocks reserved ahead of a growing file
+#define LC_LOG_CREATE 1            // journal record: new file or directory (fh, parent, type, width, unit, first device, data and parity blocks of a group)
+#define LC_LOG_EXTENT 2            // journal record: block map extent (fh, index, did, flags, sec, blk, length)
+#define LC_LOG_LENGTH 3            // journal record: file length (fh, length)
+#define LC_LOG_UNLINK 4            // journal record: file or directory removed (fh)
+#define LC_LOG_MOVE 5              // journal record: file or directory moved (fh, parent)
+#define LC_LOG_MAXJOURNAL 4096     // most journal blocks of a filesystem
 //#define devicenum 16
 int devicenum = 0;
 
@@ -37,157 +90,872 @@ int devicenum = 0;
 //LcDeviceId did;
 bool isDeviceOn;
 
+// location of one logical file block on the devices
+typedef struct{
+    int dev;            // device index (devinfo)
+    LcDeviceId did;     // device id
+    uint16_t sec;       // sector
+    uint16_t blk;       // block
+    bool written;       // false until the block is first written (device copy is garbage)
+    bool prefetched;    // read ahead into the cache and not read by the file yet
+}blockloc;
+
+// contiguous blocks reserved ahead for a stripe member of a file
+typedef struct{
+    int dev;            // device index
+    int idx;            // first block (blkindex order)
+    int n;              // blocks left
+}resvrun;
+
 typedef struct{
-    char *fname;
+    char *fname;        // name in its directory ("" until the directory is loaded)
     LcFHandle fhandle;
+    int type;           // LC_TYPE_NONE, LC_TYPE_FILE or LC_TYPE_DIR
+    LcFHandle parent;   // directory holding it
+    int dirslot;        // its entry slot in that directory
+    bool unlinked;      // removed, its blocks are freed at the next checkpoint
     bool isopen;
     uint32_t pos;
     int flength;
-    //device info <-> file 
-    int wfnow;           // file's most recently wrote device number (storage index)
-    int rfnow;
-    LcDeviceId fdid;    // file's most recently wrote did
-    int fsec;           // file's most recently wrote sector
-    int fblk;           // file's most recently wrote block
-
+    //file block map: logical block (pos/256) -> device location
+    blockloc *blkmap;
+    int nblks;          // number of blocks mapped (allocated) for the file
+    int mapsize;        // number of entries blkmap can hold before growing
+    //sequential read detector
+    int rapos;          // file position the last read ended at (-1 none)
+    int rawin;          // read-ahead window in blocks, 0 when access is not sequential
+    int raend;          // first logical block past the ones already read ahead
+    //on-device metadata
+    LcMetaChain map;    // blocks holding the block map stream
+    LcMetaLoc maphead;  // first of them
+    int mapexts;        // extents of the block map on the devices
+    bool maploaded;     // blkmap holds the map (false until opened after a load)
+    bool metadirty;     // the block map changed since it was last written
+    //layout: logical block i belongs to stripe member (i / unit) % width,
+    //which is on device (stripedev + member) % devicenum while that has room
+    int width;          // stripe width in devices (1 = not striped)
+    int unit;           // stripe unit in blocks
+    int stripedev;      // device index of member 0
+    resvrun *resv;      // blocks reserved ahead for each member (width runs, NULL until it allocates)
+    //redundancy: the block map holds groups of ndata data blocks followed
+    //by npar parity blocks (copies when ndata is 1), a group per stripe
+    int ndata;          // data blocks of a group
+    int npar;           // parity blocks of a group (0 = no redundancy)
+    //directory: entry slots kept in its data, names in the dentry cache once loaded
+    bool dirloaded;     // its entries are in the name hash table (dentry cache)
+    int nentries;       // entries in use
+    int *freeslots;     // free entry slots below its length
+    int nfreeslots;     // slots on it
+    int freeslotsize;   // slots it can hold before growing
+    char *dirdata;      // its entry slots when the metadata is kept in memory only
+    pthread_mutex_t lock; // serializes the operations on the file
 
 }filesys;
-filesys finfo[filenum]; //file structure
+filesys *ftable[LC_FILE_MAXCHUNKS]; // file table, in chunks that never move (FINFO)
+int nfiles = 0;         // file handles handed out (entries below this are allocated)
+int *freefh = NULL;     // free list of the handles below nfiles without a file
+int nfree = 0;          // handles on it
+int freesize = 0;       // handles it can hold before growing
+int *namehash = NULL;   // dentry cache: open addressing table of file handles by
+                        // directory and name (-1 empty)
+int namemask = -1;      // hash table size - 1 (size is a power of 2)
+int nnames = 0;         // names in the hash table
+
+// one block of a batch of bus transfers
+typedef struct{
+    blockloc *loc;      // block on the devices
+    char *data;         // the block's 256 bytes
+    bool failed;        // its transfer failed (set by xferblocks)
+}xferblk;
 
 typedef struct{
     LcDeviceId did;
-    int sec;
-    int blk;
-    int rsec;
-    int rblk;
-    char **storage;        // 0 - empty   1- allocated  2- full
-    char **fileblktracker; // each block contains file handle
-    uint16_t **filepostracker;  // each block contains filepos (beginning of the blk)
     int maxsec; 
     int maxblk;
-    int devwritten;        // total bytes written in a device
-    int devread;
-    int numwritten;
-    
+    uint64_t devwritten;   // total bytes written in a device
+    uint64_t devread;      // total bytes read from a device
+    uint64_t numwritten;   // file writes that touched the device (per block)
+    uint64_t numread;      // file reads that touched the device (per block)
+    uint64_t blkswritten;  // blocks written on the bus
+    uint64_t blksread;     // blocks read on the bus
+    uint64_t busreqs;      // bus requests that moved blocks
+    int state;             // LC_DEVICE_ONLINE, LC_DEVICE_ERRORED once a transfer to it failed
+    int inflight;          // bus requests posted to it and not answered yet
+    uint64_t latency;      // moving average of its response time (ns)
 }device;
 device *devinfo;
 
 /*********global variables**********/
 int allocatedblock = 0; // number of blocks allocated
 int totalblock = 0;     // total number of blocks calculated during allocation
-int now = 0;            // current writing device id
-int readnow = 0;         // current reading device id
-int prevfilesnow = 0;   //previous file's device id
-bool findnextfreedev;   // if file went back to block to fill the block, find next free device or not
+int now = 0;            // round robin counter of the device new files start on (taken atomically)
+int stripewidth = 1;    // stripe width of new files in devices, 0 = all (lcsetstripe)
+int stripeunit = LC_STRIPE_UNIT; // stripe unit of new files in blocks
+int redundk = 1;        // data blocks per redundancy group of new files (lcsetredundancy)
+int redundm = 0;        // parity blocks per group of new files, 0 = none
+int rebuilt = 0;        // blocks read back from the rest of their group (degraded reads)
+int copyreads = 0;      // mirrored blocks read from a copy other than the first
+int paritywrites = 0;   // parity blocks (and copies) written
+int parityreads = 0;    // data blocks read to compute parity
+int lostwrites = 0;     // block writes left out, their device had failed
+int blkreads = 0;       // block reads sent on the bus
+int blkwrites = 0;      // block writes sent on the bus
+int cachereads = 0;     // block reads served from the cache instead of the bus
+int busxfers = 0;       // bus requests that moved blocks
+int xfermax = 1;        // most blocks moved by one bus request (1 = no vectored transfers)
+int rmwfull = 0;        // read-modify-write reads skipped, whole block overwritten
+int rmwfresh = 0;       // read-modify-write reads skipped, block never written (zero-filled)
+int rmwcached = 0;      // read-modify-write reads skipped, block taken from the cache
+int openfiles = 0;      // number of files open
+int ramax = LC_READAHEAD_MAXBLOCKS; // largest read-ahead window, 0 disables read-ahead
+int prefetched = 0;     // blocks read ahead into the cache
+int prefetchhits = 0;   // read-ahead blocks later read from the cache
+int prefetchwaste = 0;  // read-ahead blocks evicted before they were read
+pthread_mutex_t fslock = PTHREAD_MUTEX_INITIALIZER; // file table, open count and power state
+int metamode = LC_META_LOAD; // on-device metadata (lcsetmetadata)
+bool metaon = false;    // the metadata is kept on the devices this power cycle
+bool fsdirty = false;   // files changed since the metadata was last written
+LcSuperblock super;     // superblock of the filesystem
+LcMetaChain inodechain; // blocks of the inode table index stream
+LcMetaChain inodechunks[LC_FILE_MAXCHUNKS]; // blocks of the inode stream of each file table chunk
+uint32_t inodelens[LC_FILE_MAXCHUNKS]; // bytes of each chunk's inode stream (0 = none)
+bool inodedirty[LC_FILE_MAXCHUNKS]; // a file of the chunk changed since its stream was written
+LcMetaChain bitmapchain; // blocks of the allocation bitmap stream
+LcMetaChain journalchain; // blocks of the journal block list stream
+LcMetaChain journalblks; // the journal blocks
+int journalsize = LC_META_LOGBLKS; // journal blocks of new filesystems (lcsetjournal)
+bool journalon = false; // changes between checkpoints go to the journal
+int metablkreads = 0;   // metadata blocks read
+int metablkwrites = 0;  // metadata blocks written
+int checkpoints = 0;    // checkpoints written
+int replayed = 0;       // journal records replayed at power on
+int lookups = 0;        // path components looked up
+int dirloads = 0;       // directories read into the dentry cache
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : getfreeblk
-// Description  : iterate the storage(2d array) and find the free sector(i)&block(j) to read/write
+// Function     : clearentry
+// Description  : set a file table entry to an unused file, freeing what it
+//                holds (its lock is left alone)
+//
+// Inputs       : f - the entry
+// Outputs      : none
 
-void getfreeblk(int n, LcFHandle fh){ //argument = now 
-    int i,j;
+void clearentry(filesys *f){
 
-    for(i=0; i<devinfo[n].maxsec; i++){
-        for(j=0; j<devinfo[n].maxblk; j++){
-            if(devinfo[n].storage[i][j] == 0){
-                devinfo[n].sec = i;
-                devinfo[n].blk = j;
-                now = n;
-                return ;
-            }
+    if(f->type != LC_TYPE_NONE && f->fname[0] != '\0'){
+        free(f->fname);
+    }
+    if(f->type != LC_TYPE_NONE){
+        free(f->blkmap);
+        free(f->freeslots);
+        free(f->dirdata);
+        free(f->resv);
+        lcmeta_free(&f->map);
+    }
+    f->isopen = false;
+    f->fname = "\0";
+    f->type = LC_TYPE_NONE;
+    f->parent = -1;
+    f->dirslot = -1;
+    f->unlinked = false;
+    f->pos = -1;
+    f->fhandle = -1;
+    f->flength = -1;
+    //block map
+    f->blkmap = NULL;
+    f->nblks = 0;
+    f->mapsize = 0;
+    f->rapos = -1;
+    f->rawin = 0;
+    f->raend = 0;
+    memset(&f->map, 0, sizeof(LcMetaChain));
+    memset(&f->maphead, 0, sizeof(LcMetaLoc));
+    f->mapexts = 0;
+    f->maploaded = true;
+    f->metadirty = false;
+    f->width = 1;
+    f->unit = 1;
+    f->stripedev = 0;
+    f->resv = NULL;
+    f->ndata = 1;
+    f->npar = 0;
+    f->dirloaded = true;
+    f->nentries = 0;
+    f->freeslots = NULL;
+    f->nfreeslots = 0;
+    f->freeslotsize = 0;
+    f->dirdata = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initentry
+// Description  : set up a new file table entry as an unused file
+//
+// Inputs       : f - the entry
+// Outputs      : none
+
+void initentry(filesys *f){
+
+    f->type = LC_TYPE_NONE;
+    clearentry(f);
+    pthread_mutex_init(&f->lock, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : growtable
+// Description  : make the file table reach handle fh, allocating the chunks
+//                up to it; handles below nfiles stay valid for the other
+//                threads since chunks never move (file table lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : 0 if successful, -1 if failure
+
+int growtable(LcFHandle fh){
+    int c, i;
+
+    if(fh < 0 || fh >= LC_FILE_CHUNK * LC_FILE_MAXCHUNKS){
+        logMessage(LOG_ERROR_LEVEL, "File handle %d is past the file table", fh);
+        return -1;
+    }
+    // chunks are allocated in order, so the missing ones are the last ones
+    for(c = fh / LC_FILE_CHUNK; c >= 0 && ftable[c] == NULL; c--){
+        ftable[c] = (filesys *)malloc(sizeof(filesys) * LC_FILE_CHUNK);
+        if(ftable[c] == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed to grow the file table");
+            return -1;
+        }
+        for(i=0; i<LC_FILE_CHUNK; i++){
+            initentry(&ftable[c][i]);
         }
     }
+    if(fh >= nfiles){
+        // the entries are set up before the handle checks can see them
+        __atomic_store_n(&nfiles, fh + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : findsamefileblock
-// Description  : iterate the storage(2d array) and find the blocks that has same fh
+// Function     : puthandle
+// Description  : put a file handle without a file on the free list
+//                (file table lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : 0 if successful, -1 if failure
 
-void findsamefileblock(int n, LcFHandle fh){ //argument = readnow 
-    int i,j;
-    n = 0;
-    // filepos/256 == fblknum 
-    // fblknum = everytime offset + writebytes >= 256, counter++ -> fblknum[sec][blk]
+int puthandle(LcFHandle fh){
+    int *newlist, newsize;
 
+    if(nfree == freesize){
+        newsize = (freesize == 0) ? 64 : freesize * 2;
+        newlist = (int *)realloc(freefh, sizeof(int) * newsize);
+        if(newlist == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed to grow the free file handle list");
+            return -1;
+        }
+        freefh = newlist;
+        freesize = newsize;
+    }
+    freefh[nfree++] = fh;
+    return 0;
+}
 
-    do{
-        for(i=0; i<devinfo[n].maxsec; i++){
-            for(j=0; j<devinfo[n].maxblk; j++){
-                if(devinfo[n].fileblktracker[i][j] == fh && devinfo[n].filepostracker[i][j]/256 == finfo[fh].pos/256){
-                    devinfo[n].rsec = i;
-                    devinfo[n].rblk = j;
-                    readnow = n;
-                    return ;
-                }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gethandle
+// Description  : take a file handle for a new file: the last one freed, or
+//                the next one past the file table, growing it
+//                (file table lock held)
+//
+// Inputs       : none
+// Outputs      : file handle if successful, -1 if the file table is full
 
-            }
+LcFHandle gethandle(void){
+    LcFHandle fh;
+
+    if(nfree > 0){
+        return freefh[--nfree];
+    }
+    fh = nfiles;
+    if(growtable(fh) == -1){
+        return -1;
+    }
+    return fh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buildfree
+// Description  : put the handles of the file table without a file on the
+//                free list, lowest handle taken first (after a load)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int buildfree(void){
+    LcFHandle fh;
+
+    nfree = 0;
+    for(fh = nfiles - 1; fh >= 0; fh--){
+        if(FINFO(fh).type == LC_TYPE_NONE && puthandle(fh) == -1){
+            return -1;
         }
-        n++;
-    }while(n<devicenum);
+    }
+    return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : findsamefileblock (for write)
-// Description  : find same file block for overwriting
+// Function     : dropfile
+// Description  : free the blocks of a removed file or directory and put its
+//                handle back on the free list (file table lock held, its
+//                block map loaded)
+//
+// Inputs       : fh - file handle
+// Outputs      : none
 
-void wfindsamefileblock(int n, LcFHandle fh){ //argument = now 
-    int i,j;
-    n = 0;
+void dropfile(LcFHandle fh){
+    filesys *f = &FINFO(fh);
+    int j;
 
-    do{
-        for(i=0; i<devinfo[n].maxsec; i++){
-            for(j=0; j<devinfo[n].maxblk; j++){
-                if(devinfo[n].fileblktracker[i][j] == fh && devinfo[n].filepostracker[i][j]/256 == finfo[fh].pos/256 && devinfo[n].storage[i][j] > 0){
-                    devinfo[n].sec = i;
-                    devinfo[n].blk = j;
-                    now = n;
-                    return ;
-                }
+    releaseblks(fh);
+    for(j=0; j<f->nblks; j++){
+        lcloud_dropblock(f->blkmap[j].did, f->blkmap[j].sec, f->blkmap[j].blk);
+        lcloud_freeblk(f->blkmap[j].dev, f->blkmap[j].sec, f->blkmap[j].blk);
+    }
+    lcmeta_release(&f->map);
+    clearentry(f);
+    puthandle(fh);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : makeroot
+// Description  : make the empty root directory of a new filesystem
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int makeroot(void){
+
+    if(growtable(LC_ROOT) == -1){
+        return -1;
+    }
+    FINFO(LC_ROOT).type = LC_TYPE_DIR;
+    setlayout(LC_ROOT, 1);
+    if(redundm > 0 && redundk + redundm <= devicenum){
+        setredundancy(LC_ROOT, redundk, redundm);
+    }
+    FINFO(LC_ROOT).parent = LC_ROOT;
+    FINFO(LC_ROOT).fhandle = LC_ROOT;
+    FINFO(LC_ROOT).flength = 0;
+    FINFO(LC_ROOT).metadirty = true;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : nameslot
+// Description  : home slot of a directory entry in the name hash table
+//                (FNV-1a of the directory and the name)
+//
+// Inputs       : dir - directory, name - name in it
+// Outputs      : slot index
+
+int nameslot(LcFHandle dir, const char *name){
+    uint32_t h = (2166136261u ^ (uint32_t)dir) * 16777619u;
+
+    while(*name != '\0'){
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    }
+    return (int)(h & namemask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findname
+// Description  : find the file handle of a name in a directory (linear
+//                probing); the directory must be loaded (file table lock held)
+//
+// Inputs       : dir - directory, name - name in it
+// Outputs      : file handle, -1 if there is no such file
+
+LcFHandle findname(LcFHandle dir, const char *name){
+    int slot, fh;
+
+    STATADD(lookups, 1);
+    if(namehash == NULL){
+        return -1;
+    }
+    slot = nameslot(dir, name);
+    while((fh = namehash[slot]) != -1){
+        if(FINFO(fh).parent == dir && strcmp(FINFO(fh).fname, name) == 0){
+            return fh;
+        }
+        slot = (slot + 1) & namemask;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashname
+// Description  : put a file handle in its name's slot (table has room)
+//
+// Inputs       : fh - file handle
+// Outputs      : none
+
+void hashname(LcFHandle fh){
+    int slot = nameslot(FINFO(fh).parent, FINFO(fh).fname);
+
+    while(namehash[slot] != -1){
+        slot = (slot + 1) & namemask;
+    }
+    namehash[slot] = fh;
+    nnames++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : removename
+// Description  : take a file out of the name hash table, shifting later
+//                entries of the probe run back so lookups never need
+//                tombstones (file table lock held)
+//
+// Inputs       : fh - file handle (in the table)
+// Outputs      : none
 
+void removename(LcFHandle fh){
+    int slot, next, home, i;
+
+    slot = nameslot(FINFO(fh).parent, FINFO(fh).fname);
+    while(namehash[slot] != fh){
+        slot = (slot + 1) & namemask;
+    }
+    namehash[slot] = -1;
+    nnames--;
+    next = slot;
+    while(1){
+        next = (next + 1) & namemask;
+        if((i = namehash[next]) == -1){
+            return;
+        }
+        // move the entry into the hole unless its home slot lies in (slot, next]
+        home = nameslot(FINFO(i).parent, FINFO(i).fname);
+        if(((next - home) & namemask) >= ((next - slot) & namemask)){
+            namehash[slot] = i;
+            namehash[next] = -1;
+            slot = next;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addname
+// Description  : put a file in the name hash table, doubling the table
+//                when it gets half full (file table lock held)
+//
+// Inputs       : fh - file handle (its name set, not in the table yet)
+// Outputs      : 0 if successful, -1 if failure
+
+int addname(LcFHandle fh){
+    int *oldhash = namehash, oldsize = namemask + 1, newsize, i;
+
+    if((nnames + 1) * 2 > oldsize){
+        newsize = (oldsize == 0) ? 1024 : oldsize * 2;
+        namehash = (int *)malloc(sizeof(int) * newsize);
+        if(namehash == NULL){
+            namehash = oldhash;
+            logMessage(LOG_ERROR_LEVEL, "Failed to grow the file name table");
+            return -1;
+        }
+        memset(namehash, 0xff, sizeof(int) * newsize);
+        namemask = newsize - 1;
+        nnames = 0;
+        for(i=0; i<oldsize; i++){
+            if(oldhash[i] != -1){
+                hashname(oldhash[i]);
             }
         }
-        n++;
-    }while(n<devicenum);
+        free(oldhash);
+    }
+    hashname(fh);
+    return 0;
 }
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : nextdevice
 // Description  : move onto next device
 
 void nextdevice(int *n){
+    if(*n>=devicenum-1){
+        *n=0;
+    }
+    else{
+        (*n)++;
+    }
+}
 
-    
-    while(*n <devicenum){
-        if(*n != full){
-            if(*n>=devicenum-1){
-                *n=0;
-            }
-            else{
-                (*n)++;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : growmap
+// Description  : make room in the file's block map for one more entry
+//                (doubling it when it runs out)
+//
+// Inputs       : fh - file handle
+// Outputs      : 0 if successful, -1 if failure
+
+int growmap(LcFHandle fh){
+    blockloc *newmap;
+    int newsize;
+
+    if(FINFO(fh).nblks == FINFO(fh).mapsize){
+        newsize = (FINFO(fh).mapsize == 0) ? 16 : FINFO(fh).mapsize * 2;
+        newmap = (blockloc *)realloc(FINFO(fh).blkmap, sizeof(blockloc) * newsize);
+        if(newmap == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed to grow block map of file %s", FINFO(fh).fname);
+            return -1;
+        }
+        FINFO(fh).blkmap = newmap;
+        FINFO(fh).mapsize = newsize;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : blkindex
+// Description  : position of a block on its device, in sector major order
+//                (blocks with consecutive indexes are physically contiguous)
+
+int blkindex(blockloc *loc){
+    return loc->sec * devinfo[loc->dev].maxblk + loc->blk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : contiguous
+// Description  : whether block b follows block a on the same device with
+//                the same written flag (they can share an extent)
+
+bool contiguous(blockloc *a, blockloc *b){
+    return a->dev == b->dev && a->written == b->written && blkindex(b) == blkindex(a) + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setlayout
+// Description  : lay a new file out in stripe units of the configured size
+//                over width devices (0 = all of them, at most the devices
+//                there are), its first stripe member on the next device in
+//                turn so the files spread over the devices
+//
+// Inputs       : fh - file handle, width - stripe width
+// Outputs      : none
+
+void setlayout(LcFHandle fh, int width){
+
+    if(width == 0 || width > devicenum){
+        width = devicenum;
+    }
+    FINFO(fh).width = width;
+    FINFO(fh).unit = stripeunit;
+    FINFO(fh).stripedev = (unsigned)STATADD(now, 1) % devicenum;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setredundancy
+// Description  : make a new file keep m parity blocks (copies when k is 1)
+//                for every k data blocks; a group is laid out as one
+//                stripe, a block per device, so it loses at most one block
+//                to a failed device (k+m must not exceed the devices)
+//
+// Inputs       : fh - file handle, k - data blocks, m - parity blocks
+// Outputs      : none
+
+void setredundancy(LcFHandle fh, int k, int m){
+    FINFO(fh).ndata = (m > 0) ? k : 1;
+    FINFO(fh).npar = m;
+    if(m > 0){
+        FINFO(fh).width = k + m;
+        FINFO(fh).unit = 1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dataslot
+// Description  : entry of the block map holding a logical block of the file
+//
+// Inputs       : fh - file handle, i - logical block
+// Outputs      : block map index
+
+int dataslot(LcFHandle fh, int i){
+    return (i / FINFO(fh).ndata) * (FINFO(fh).ndata + FINFO(fh).npar) + i % FINFO(fh).ndata;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : datablocks
+// Description  : logical blocks of the file its block map covers
+//
+// Inputs       : fh - file handle
+// Outputs      : number of blocks
+
+int datablocks(LcFHandle fh){
+    int g = FINFO(fh).ndata + FINFO(fh).npar, rest = FINFO(fh).nblks % g;
+
+    return (FINFO(fh).nblks / g) * FINFO(fh).ndata + ((rest < FINFO(fh).ndata) ? rest : FINFO(fh).ndata);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : usable
+// Description  : whether the next block of the file's map can go on the
+//                device: it has not failed, and no other block of the
+//                redundancy group being mapped is on it
+//
+// Inputs       : fh - file handle, dev - device index
+// Outputs      : true if it can
+
+bool usable(LcFHandle fh, int dev){
+    filesys *f = &FINFO(fh);
+    int i;
+
+    if(devinfo[dev].state == LC_DEVICE_ERRORED){
+        return false;
+    }
+    for(i=f->nblks - f->nblks % (f->ndata + f->npar); i<f->nblks; i++){
+        if(f->blkmap[i].dev == dev){
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stripemember
+// Description  : stripe member holding a logical block of the file
+//
+// Inputs       : fh - file handle, i - logical block
+// Outputs      : member (0 to width-1)
+
+int stripemember(LcFHandle fh, int i){
+    return (i / FINFO(fh).unit) % FINFO(fh).width;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stripedevice
+// Description  : device a stripe member of the file is laid out on (its
+//                blocks go elsewhere only when that device is full)
+//
+// Inputs       : fh - file handle, m - stripe member
+// Outputs      : device index
+
+int stripedevice(LcFHandle fh, int m){
+    return (FINFO(fh).stripedev + m) % devicenum;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : runsize
+// Description  : blocks to reserve for a stripe member of the file on the
+//                device: the blocks the write needs there, or as many as the
+//                member already has (LC_EXTENT_MINBLOCKS to
+//                LC_EXTENT_MAXBLOCKS) if that is more, so a file that keeps
+//                growing gets longer extents; nothing is reserved ahead once
+//                the device is getting full
+//
+// Inputs       : fh - file handle, dev - device index, need - blocks needed
+// Outputs      : blocks to reserve
+
+int runsize(LcFHandle fh, int dev, int need){
+    int want = FINFO(fh).nblks / FINFO(fh).width;
+
+    if(want < LC_EXTENT_MINBLOCKS){
+        want = LC_EXTENT_MINBLOCKS;
+    }
+    if(want > LC_EXTENT_MAXBLOCKS){
+        want = LC_EXTENT_MAXBLOCKS;
+    }
+    if(want <= need || lcloud_countfree(dev) < 8 * want){
+        want = need;
+    }
+    return want;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reclaimblks
+// Description  : take back the blocks reserved ahead for the other files,
+//                when the devices are full; files another thread is using
+//                are skipped (their lock is only tried, so this cannot
+//                deadlock with it) (file lock held)
+//
+// Inputs       : fh - file handle of the file allocating
+// Outputs      : number of blocks taken back
+
+int reclaimblks(LcFHandle fh){
+    int i, m, n = 0;
+
+    for(i=0; i<STATGET(nfiles); i++){
+        if(i == fh || pthread_mutex_trylock(&FINFO(i).lock) != 0){
+            continue;
+        }
+        for(m=0; m<FINFO(i).width && FINFO(i).resv != NULL; m++){
+            n += FINFO(i).resv[m].n;
+        }
+        releaseblks(i);
+        pthread_mutex_unlock(&FINFO(i).lock);
+    }
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserveblks
+// Description  : reserve a run of contiguous blocks for the next blocks of
+//                a stripe member of the file: right after the member's last
+//                block if those are free (its extent keeps growing), else a
+//                new run on the member's device, else on the next devices
+//                in turn, skipping failed devices and the devices of the
+//                rest of the redundancy group (file lock held)
+//
+// Inputs       : fh - file handle, m - stripe member
+//                need - blocks of the member still to be mapped
+// Outputs      : 0 if successful, -1 if failure (all devices are full)
+
+int reserveblks(LcFHandle fh, int m, int need){
+    filesys *f = &FINFO(fh);
+    resvrun *r = &f->resv[m];
+    blockloc *last;
+    uint16_t sec, blk;
+    int i, dev, got, tried, pass;
+
+    // the member's last block: the one before, or the end of its last stripe unit
+    i = f->nblks;
+    i = (i % f->unit != 0) ? i - 1 : i - (f->width - 1) * f->unit - 1;
+    dev = stripedevice(fh, m);
+    if(i >= 0 && f->blkmap[i].dev == dev && usable(fh, dev) == true){
+        last = &f->blkmap[i];
+        if((got = lcloud_extendrun(dev, last->sec, last->blk, runsize(fh, dev, need))) > 0){
+            r->dev = dev;
+            r->idx = blkindex(last) + 1;
+            r->n = got;
+            return 0;
+        }
+    }
+
+    // once more after taking back what the other files reserved ahead
+    for(pass=0; pass<2; pass++){
+        for(tried=0; tried<devicenum; tried++){
+            if(usable(fh, dev) == true && (got = lcloud_allocrun(dev, runsize(fh, dev, need), &sec, &blk)) > 0){
+                r->dev = dev;
+                r->idx = sec * devinfo[dev].maxblk + blk;
+                r->n = got;
+                return 0;
             }
+            nextdevice(&dev);
         }
-        
-        if(*n>=devicenum-1) *n=0;
-        else (*n)++;
+        if(reclaimblks(fh) == 0){
+            break;
+        }
+    }
+    logMessage(LOG_ERROR_LEVEL, "Failed to allocate block: all devices are full");
+    return -1;
+}
 
-        if(*n != full) break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseblks
+// Description  : return the blocks reserved for the file and not mapped to
+//                the allocator (file lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : none
+
+void releaseblks(LcFHandle fh){
+    filesys *f = &FINFO(fh);
+    resvrun *r;
+    int i, m, maxblk;
+
+    for(m=0; m<f->width && f->resv != NULL; m++){
+        r = &f->resv[m];
+        maxblk = devinfo[r->dev].maxblk;
+        for(i=r->idx; i<r->idx+r->n; i++){
+            lcloud_freeblk(r->dev, i / maxblk, i % maxblk);
+        }
+        r->n = 0;
     }
-    
 }
 
-// void nextdevice(int *n){
-//     if(*n>=devicenum-1){
-//         *n=0;
-//     }
-//     else{
-//         (*n)++;
-//     }
-// }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocblocks
+// Description  : map blocks for the file until it has n of them; each
+//                block goes to its stripe member, taken from the run
+//                reserved for the member in order (reserving runs sized for
+//                the member's share of them as it goes), so each member's
+//                blocks form extents of contiguous blocks on its device
+//                (file lock held)
+//
+// Inputs       : fh - file handle, n - logical blocks the file must have
+//                (whole redundancy groups are mapped, parity included)
+// Outputs      : 0 if successful, -1 if failure (all devices are full)
+
+int allocblocks(LcFHandle fh, int n){
+    filesys *f = &FINFO(fh);
+    blockloc *loc;
+    resvrun *r;
+    int m, i, total;
+
+    n = (n + f->ndata - 1) / f->ndata * (f->ndata + f->npar);
+    if(f->resv == NULL && f->nblks < n){
+        if((f->resv = (resvrun *)calloc(f->width, sizeof(resvrun))) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed to allocate the reservations of file %s", f->fname);
+            return -1;
+        }
+    }
+    while(f->nblks < n){
+        m = stripemember(fh, f->nblks);
+        r = &f->resv[m];
+        if(r->n > 0 && usable(fh, r->dev) == false){
+            // its device failed, or took a block of the group already
+            for(i=r->idx; i<r->idx+r->n; i++){
+                lcloud_freeblk(r->dev, i / devinfo[r->dev].maxblk, i % devinfo[r->dev].maxblk);
+            }
+            r->n = 0;
+        }
+        if((r->n == 0 && reserveblks(fh, m, (n - f->nblks + f->width - 1) / f->width) == -1) || growmap(fh) == -1){
+            return -1;
+        }
+        loc = &f->blkmap[f->nblks++];
+        loc->dev = r->dev;
+        loc->did = devinfo[loc->dev].did;
+        loc->sec = r->idx / devinfo[loc->dev].maxblk;
+        loc->blk = r->idx % devinfo[loc->dev].maxblk;
+        loc->written = false;
+        loc->prefetched = false;
+        r->idx++;
+        r->n--;
+
+        total = STATADD(allocatedblock, 1) + 1;
+        lcLog(LOG_INFO_LEVEL, "Allocated block %d out of %d (%0.2f%%)", total, totalblock, (float)total/(float)totalblock);
+        lcLog(LcDriverLLevel, "Allocated block for data [%d/%d/%d]", loc->did, loc->sec, loc->blk);
+    }
+    return 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -218,14 +986,14 @@ LCloudRegisterFrame create_lcloud_registers(uint64_t cb0, uint64_t cb1, uint64_t
 // Description  : unpack the registers created with previous function(resp)
 //
 
-uint64_t extract_lcloud_registers(LCloudRegisterFrame resp){
-    b0 = (resp >> 60) & 0xf;
-    b1 = (resp >> 56) & 0xf;
-    c0 = (resp >> 48) & 0xff;
-    c1 = (resp >> 40) & 0xff;
-    c2 = (resp >> 32) & 0xff;
-    d0 = (resp >> 16) & 0xffff;
-    d1 = (resp & 0xffff);
+uint64_t extract_lcloud_registers(LCloudRegisterFrame resp, lcregs *r){
+    r->b0 = (resp >> 60) & 0xf;
+    r->b1 = (resp >> 56) & 0xf;
+    r->c0 = (resp >> 48) & 0xff;
+    r->c1 = (resp >> 40) & 0xff;
+    r->c2 = (resp >> 32) & 0xff;
+    r->d0 = (resp >> 16) & 0xffff;
+    r->d1 = (resp & 0xffff);
     
     return 0;
 }
@@ -254,9 +1022,9 @@ uint8_t countdevice(uint16_t id0){
 // Function     : probeID
 // Description  : check the device ID
 //
-// Inputs       : id_c1
+// Inputs       : id_c1, rest - filled with the probe bits left after this device
 
-uint8_t probeID(uint16_t id0){
+uint8_t probeID(uint16_t id0, uint16_t *rest){
     unsigned int temp = id0;
     unsigned int leastbit = id0 & ~(id0-1);
 
@@ -268,31 +1036,76 @@ uint8_t probeID(uint16_t id0){
         id0 >>= 1;
         count++;
     }
-    d0 = temp - leastbit;
+    *rest = temp - leastbit;
 
     return count-1;  //shifted amount -1 will be device id
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : do_read
-//
-// Input        : did, sec, blk, *buf
+// Function     : devindex
+// Description  : device index (devinfo) of a device id
+//
+// Inputs       : did - device id
+// Outputs      : index, -1 if unknown
+
+int devindex(LcDeviceId did){
+    int i;
+
+    for(i=0; i<devicenum; i++){
+        if(devinfo[i].did == did){
+            return i;
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devxfered
+// Description  : count a bus request that moved blocks of a device
+//
+// Inputs       : dev - device index (-1 unknown), nblks - blocks moved
+//                rw - LC_XFER_READ/LC_XFER_WRITE
+
+void devxfered(int dev, int nblks, int rw){
+    if(dev < 0){
+        return;
+    }
+    if(rw == LC_XFER_READ){
+        STATADD(devinfo[dev].blksread, nblks);
+    }
+    else{
+        STATADD(devinfo[dev].blkswritten, nblks);
+    }
+    STATADD(devinfo[dev].busreqs, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : do_read
+//
+// Input        : did, sec, blk, *buf
 //
 // Description  : create the registers, call the io-bus, take the 64-bit value and back,
 //                extract the registers, and check value 0.
 //
 
 int do_read(int did, int sec, int blk, char *buf){
+    LCloudRegisterFrame frm, rfrm;
+    lcregs r;
 
     frm = create_lcloud_registers(0, 0 ,LC_BLOCK_XFER ,did, LC_XFER_READ, sec, blk); 
 
     if( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, buf)) == -1) || 
-    (extract_lcloud_registers(rfrm)) || (b0 != 1) || (b1 != 1) || (c0 != LC_BLOCK_XFER)){
+    (extract_lcloud_registers(rfrm, &r)) || (r.b0 != 1) || (r.b1 != 1) || (r.c0 != LC_BLOCK_XFER)){
         logMessage(LOG_ERROR_LEVEL, "LC failure reading blkc [%d/%d/%d].", did, sec, blk);
         return(-1);
     }
-    logMessage(LcDriverLLevel, "LC success reading blkc [%d/%d/%d].", did, sec, blk);
+    STATADD(blkreads, 1);
+    STATADD(busxfers, 1);
+    devxfered(devindex(did), 1, LC_XFER_READ);
+    lcLog(LcDriverLLevel, "LC success reading blkc [%d/%d/%d].", did, sec, blk);
     return 0;
 }
 
@@ -307,528 +1120,3170 @@ int do_read(int did, int sec, int blk, char *buf){
 //
 
 int do_write(int did, int sec, int blk, char *buf){
+    LCloudRegisterFrame frm, rfrm;
+    lcregs r;
 
     frm = create_lcloud_registers(0, 0 ,LC_BLOCK_XFER ,did, LC_XFER_WRITE, sec, blk);  
 
     if( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, buf)) == -1) ||   
-    (extract_lcloud_registers(rfrm)) || (b0 != 1) || (b1 != 1) || (c0 != LC_BLOCK_XFER)){ 
+    (extract_lcloud_registers(rfrm, &r)) || (r.b0 != 1) || (r.b1 != 1) || (r.c0 != LC_BLOCK_XFER)){ 
         logMessage(LOG_ERROR_LEVEL, "LC failure writing blkc [%d/%d/%d].", did, sec, blk);
         return(-1);
     }
-    logMessage(LcDriverLLevel, "LC success writing blkc [%d/%d/%d].", did, sec, blk);
+    STATADD(blkwrites, 1);
+    STATADD(busxfers, 1);
+    devxfered(devindex(did), 1, LC_XFER_WRITE);
+    lcLog(LcDriverLLevel, "LC success writing blkc [%d/%d/%d].", did, sec, blk);
     return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcpoweron
+// Function     : xfercmp
+// Description  : qsort order of a batch: by device, then position on the device
+
+int xfercmp(const void *a, const void *b){
+    blockloc *la = (*(xferblk **)a)->loc, *lb = (*(xferblk **)b)->loc;
+
+    if(la->dev != lb->dev){
+        return la->dev - lb->dev;
+    }
+    return blkindex(la) - blkindex(lb);
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Description  : power on the device 
-//                  
-//                b0/b1 - which direction / return status
-//                c0    - Operation code (poweron/off/probe/transfer)
-//                c1    - device id
-//                c2    - read(0)/write(1)
-//                d0/d1 - sector/block
+// Function     : devfailed
+// Description  : put a device whose transfer failed in the errored state;
+//                no more blocks are sent to it this power cycle, the blocks
+//                of redundant files on it are rebuilt from the others, and
+//                the metadata is placed on the other devices
 //
+// Inputs       : dev - device index
+// Outputs      : none
+
+void devfailed(int dev){
+    lcmeta_setfailed(dev);
+    if(__sync_bool_compare_and_swap(&devinfo[dev].state, LC_DEVICE_ONLINE, LC_DEVICE_ERRORED)){
+        logMessage(LOG_ERROR_LEVEL, "Device %d (id %d) failed, its blocks of redundant files are rebuilt from now on",
+            dev, devinfo[dev].did);
+    }
+}
 
-int32_t lcpoweron(void){
-    int i,j;
-    int fd;
-    int reserved0;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : faileddevs
+// Description  : number of devices in the errored state
+//
+// Inputs       : none
+// Outputs      : devices
 
-    // cache init
-    lcloud_initcache(LC_CACHE_MAXBLOCKS);
+int faileddevs(void){
+    int i, n = 0;
 
-    logMessage(LcControllerLLevel, "Initialzing Lion Cloud system ...");
+    for(i=0; i<devicenum; i++){
+        n += (STATGET(devinfo[i].state) == LC_DEVICE_ERRORED);
+    }
+    return n;
+}
 
-    // Do Operation - PowerOn
-    frm = create_lcloud_registers(0, 0 ,LC_POWER_ON ,0, 0, 0, 0); 
-    rfrm = client_lcloud_bus_request(frm, NULL);
-    extract_lcloud_registers(rfrm);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : xferblocks
+// Description  : read or write a batch of blocks.  Each run of physically
+//                contiguous blocks on a device (up to xfermax blocks) is one
+//                vectored bus request, and every request of the batch is
+//                posted before waiting for the responses so they are all in
+//                flight together.  A block whose transfer failed (or whose
+//                device already did) is marked failed, and its device is
+//                put in the errored state.
+//
+// Inputs       : xfer - the blocks (at most LC_XFER_MAXREQ), n - number of blocks
+//                rw - LC_XFER_READ/LC_XFER_WRITE
+// Outputs      : 0 if successful, -1 if failure (some blocks failed)
+
+int xferblocks(xferblk *xfer, int n, int rw){
+    xferblk *sorted[LC_XFER_MAXREQ];
+    char runbuf[LC_XFER_MAXREQ * LC_DEVICE_BLOCK_SIZE]; // data of a run starting at sorted[i] is at block i
+    LcBusTag tags[LC_XFER_MAXREQ];
+    int first[LC_XFER_MAXREQ], runlen[LC_XFER_MAXREQ];
+    LCloudRegisterFrame frm, rfrm;
+    uint64_t lat, avg;
+    lcregs r;
+    blockloc *loc;
+    char *data;
+    int i, j, run, nruns = 0, ret = 0;
+
+    for(i=0; i<n; i++){
+        sorted[i] = &xfer[i];
+        xfer[i].failed = false;
+    }
+    if(xfermax > 1){
+        qsort(sorted, n, sizeof(xferblk *), xfercmp);
+    }
 
-    isDeviceOn = true;
-    bool first = true; //check if is calling probeID first time
+    // post the runs
+    for(i=0; i<n; i+=run){
+        // extend the run while the next block follows it on the same device
+        loc = sorted[i]->loc;
+        for(run=1; i+run<n && run<xfermax && sorted[i+run]->loc->dev == loc->dev &&
+            blkindex(sorted[i+run]->loc) == blkindex(loc)+run; run++);
 
-    int n=0; //devinit loop counter
+        if(devinfo[loc->dev].state == LC_DEVICE_ERRORED){
+            for(j=0; j<run; j++){
+                sorted[i+j]->failed = true;
+            }
+            ret = -1;
+            continue;
+        }
+        if(run == 1){
+            data = sorted[i]->data;
+            frm = create_lcloud_registers(0, 0 ,LC_BLOCK_XFER ,loc->did, rw, loc->sec, loc->blk);
+        }
+        else{
+            data = runbuf + i*LC_DEVICE_BLOCK_SIZE;
+            for(j=0; j<run && rw == LC_XFER_WRITE; j++){
+                memcpy(data + j*LC_DEVICE_BLOCK_SIZE, sorted[i+j]->data, LC_DEVICE_BLOCK_SIZE);
+            }
+            frm = create_lcloud_registers(0, run-1 ,LC_BLOCK_XFERV ,loc->did, rw, loc->sec, loc->blk);
+        }
+        if(client_lcloud_bus_post(frm, data, &tags[nruns]) == -1){
+            logMessage(LOG_ERROR_LEVEL, "LC failure sending %d blocks at [%d/%d/%d].", run, loc->did, loc->sec, loc->blk);
+            for(j=0; j<run; j++){
+                sorted[i+j]->failed = true;
+            }
+            devfailed(loc->dev);
+            ret = -1;
+            continue;
+        }
+        STATADD(devinfo[loc->dev].inflight, 1);
+        first[nruns] = i;
+        runlen[nruns] = run;
+        nruns++;
+    }
 
-    // Do Operation - Devprobe
-    frm = create_lcloud_registers(0, 0 ,LC_DEVPROBE ,0, 0, 0, 0); 
-    rfrm = client_lcloud_bus_request(frm, NULL);
-    extract_lcloud_registers(rfrm); //after extract I get probed d0 (22048)
-    devicenum = countdevice(d0);
-    
-    devinfo = (device *)malloc(sizeof(device) * devicenum);
-    for(i=0; i<devicenum; i++){
-        devinfo[i].did = 0;
-        devinfo[i].sec = 0;
-        devinfo[i].blk = 0;
-        devinfo[i].rsec = 0;
-        devinfo[i].rblk = 0;
-        devinfo[i].maxsec = 0;
-        devinfo[i].maxblk = 0;
-        devinfo[i].numwritten = 0;
-        devinfo[i].devwritten = 0;
-        devinfo[i].devread = 0;
+    // wait for all of them (even after a failure, the reads land in runbuf)
+    for(j=0; j<nruns; j++){
+        i = first[j];
+        loc = sorted[i]->loc;
+        rfrm = client_lcloud_bus_wait(&tags[j]);
+        STATADD(devinfo[loc->dev].inflight, -1);
+        if((rfrm == -1) || (extract_lcloud_registers(rfrm, &r)) || (r.b0 != 1) || (r.b1 != 1)){
+            logMessage(LOG_ERROR_LEVEL, "LC failure %s %d blocks at [%d/%d/%d].", (rw == LC_XFER_READ) ? "reading" : "writing", runlen[j], loc->did, loc->sec, loc->blk);
+            for(run=0; run<runlen[j]; run++){
+                sorted[i+run]->failed = true;
+            }
+            devfailed(loc->dev);
+            ret = -1;
+            continue;
+        }
+        // response time of the device (moving average, for choosing copies;
+        // an update lost to another thread's only slows the average down)
+        lat = lcmetrics_now() - tags[j].posted;
+        avg = STATGET(devinfo[loc->dev].latency);
+        __atomic_store_n(&devinfo[loc->dev].latency, avg + ((int64_t)lat - (int64_t)avg) / 8, __ATOMIC_RELAXED);
+        if(rw == LC_XFER_READ){
+            for(run=0; run<runlen[j] && runlen[j] > 1; run++){
+                memcpy(sorted[i+run]->data, runbuf + (i+run)*LC_DEVICE_BLOCK_SIZE, LC_DEVICE_BLOCK_SIZE);
+            }
+            STATADD(blkreads, runlen[j]);
+        }
+        else{
+            STATADD(blkwrites, runlen[j]);
+        }
+        STATADD(busxfers, 1);
+        devxfered(loc->dev, runlen[j], rw);
+        lcLog(LcDriverLLevel, "LC success %s %d blocks at [%d/%d/%d].", (rw == LC_XFER_READ) ? "reading" : "writing", runlen[j], loc->did, loc->sec, loc->blk);
     }
+    return ret;
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebuildblock
+// Description  : get a block of a redundant file back from the rest of its
+//                group after a failed read: the blocks of the group in the
+//                cache are taken as they are, the others are read (just
+//                enough of them, on the devices still working, the block
+//                itself too when the copy that failed was another one) until
+//                k of them are there, then the erasure code decodes the
+//                block.  Blocks never written are read too: the parity holds
+//                what their devices hold, and a crash can lose the journal
+//                record of a write whose parity is out (file lock held)
+//
+// Inputs       : fh - file handle, slot - block map index of the block
+//                out - place for its 256 bytes
+// Outputs      : 0 if successful, -1 if failure (too many blocks lost)
+
+int rebuildblock(LcFHandle fh, int slot, char *out){
+    filesys *f = &FINFO(fh);
+    char blks[LC_EC_MAXBLOCKS][LC_DEVICE_BLOCK_SIZE], *ptrs[LC_EC_MAXBLOCKS];
+    int have[LC_EC_MAXBLOCKS], tried[LC_EC_MAXBLOCKS];
+    xferblk rd[LC_EC_MAXBLOCKS];
+    int g = f->ndata + f->npar, base = slot - slot % g;
+    int j, n, nhave = 0;
+    blockloc *loc;
+
+    for(j=0; j<g; j++){
+        loc = &f->blkmap[base+j];
+        ptrs[j] = blks[j];
+        have[j] = 0;
+        tried[j] = 0;
+        if(base+j == slot){
+            continue;
+        }
+        if(lcloud_readcache(loc->did, loc->sec, loc->blk, blks[j])){
+            have[j] = 1;
+        }
+        nhave += have[j];
+    }
 
-    //---------------------- Device init ----------------------------//
-    do{ //find out each multiple devices' number
-    
-        if(first == true){
-            devinfo[n].did = probeID(d0);
-            first = false;
+    // read the blocks still missing, trying others when some fail
+    while(nhave < f->ndata){
+        for(j=0, n=0; j<g && nhave+n < f->ndata; j++){
+            if(have[j] == 0 && tried[j] == 0 && devinfo[f->blkmap[base+j].dev].state != LC_DEVICE_ERRORED){
+                rd[n].loc = &f->blkmap[base+j];
+                rd[n].data = blks[j];
+                tried[j] = 1;
+                n++;
+            }
         }
-        else{
-            devinfo[n].did = probeID(reserved0); 
+        if(n == 0){
+            logMessage(LOG_ERROR_LEVEL, "Failed to rebuild block %d of file %s: more than %d blocks of its group are lost",
+                slot, f->fname, f->npar);
+            return -1;
         }
-        //logMessage(LcControllerLLevel, "Found device [%d] in cloud probe.", devinfo->did);
+        xferblocks(rd, n, LC_XFER_READ);
+        for(j=0; j<n; j++){
+            if(rd[j].failed == false){
+                have[rd[j].loc - &f->blkmap[base]] = 1;
+                nhave++;
+            }
+        }
+    }
+    if(have[slot-base] == 0 && lcloud_ecdecode(f->ndata, f->npar, ptrs, have, LC_DEVICE_BLOCK_SIZE) == -1){
+        return -1;
+    }
+    memcpy(out, blks[slot-base], LC_DEVICE_BLOCK_SIZE);
+    STATADD(rebuilt, (have[slot-base] == 0));
+    lcLog(LcDriverLLevel, "Rebuilt block %d of file %s from its group", slot, f->fname);
+    return 0;
+}
 
-        frm = create_lcloud_registers(0, 0 ,LC_DEVINIT ,devinfo[n].did, 0, 0, 0); 
-        rfrm = client_lcloud_bus_request(frm, NULL);
-        reserved0 = d0; // reserve d0 after probeID function
-        extract_lcloud_registers(rfrm);
-        devinfo[n].maxsec = d0;
-        devinfo[n].maxblk = d1;
-        logMessage(LcControllerLLevel, "Found device [did=%d, secs=%d, blks=%d] in cloud probe.", devinfo[n].did, d0, d1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pickcopy
+// Description  : choose the copy of a mirrored block to read: one on a
+//                working device, the least loaded (requests in flight there,
+//                plus the ones this batch sends it already), then the one
+//                answering fastest
+//
+// Inputs       : fh - file handle, slot - block map index of the block
+//                picks - blocks of the batch sent to each device so far
+// Outputs      : block map index of the copy
+
+int pickcopy(LcFHandle fh, int slot, int *picks){
+    filesys *f = &FINFO(fh);
+    int j, dev, load, best = slot, bestload = -1;
+
+    for(j=slot; j<=slot+f->npar; j++){
+        dev = f->blkmap[j].dev;
+        if(devinfo[dev].state == LC_DEVICE_ERRORED){
+            continue;
+        }
+        load = STATGET(devinfo[dev].inflight) + picks[dev];
+        if(bestload == -1 || load < bestload ||
+           (load == bestload && STATGET(devinfo[dev].latency) < STATGET(devinfo[f->blkmap[best].dev].latency))){
+            best = j;
+            bestload = load;
+        }
+    }
+    picks[f->blkmap[best].dev]++;
+    if(best != slot){
+        STATADD(copyreads, 1);
+    }
+    return best;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readblocks
+// Description  : read a batch of data blocks of a file: the blocks of a
+//                mirrored file are read from the copy picked for each, and
+//                the blocks whose read failed are rebuilt from the rest of
+//                their group (file lock held)
+//
+// Inputs       : fh - file handle, xfer - the blocks (data block map
+//                entries, at most LC_XFER_MAXREQ), n - number of blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int readblocks(LcFHandle fh, xferblk *xfer, int n){
+    filesys *f = &FINFO(fh);
+    xferblk rd[LC_XFER_MAXREQ];
+    int picks[LC_META_MAXDEVS];
+    int i;
+
+    if(f->npar == 0){
+        return xferblocks(xfer, n, LC_XFER_READ);
+    }
+    memset(picks, 0x0, sizeof(picks));
+    for(i=0; i<n; i++){
+        rd[i] = xfer[i];
+        if(f->ndata == 1){
+            rd[i].loc = &f->blkmap[pickcopy(fh, xfer[i].loc - f->blkmap, picks)];
+        }
+    }
+    xferblocks(rd, n, LC_XFER_READ);
+    for(i=0; i<n; i++){
+        if(rd[i].failed == true && rebuildblock(fh, xfer[i].loc - f->blkmap, xfer[i].data) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lostgroups
+// Description  : check the groups a batch of data blocks of the file was
+//                written in, once the transfers are done (a failed write
+//                fails its device): a group with more blocks on failed
+//                devices than it has parity blocks has lost data, and a
+//                block of a file without redundancy is its own group
+//
+// Inputs       : fh - file handle, slots - block map indexes of the data
+//                blocks written (ascending), n - number of blocks
+// Outputs      : 0 if every group can still be read, -1 if not
 
+int lostgroups(LcFHandle fh, int *slots, int n){
+    filesys *f = &FINFO(fh);
+    int g = f->ndata + f->npar, base = -1, i, j, lost;
 
-        //------------2d array dynamic allocation----------//
-        devinfo[n].storage = (char **) malloc(sizeof(char*) * devinfo[n].maxsec); //ex. did = 5,  blk = 64
-        devinfo[n].fileblktracker = (char **) malloc(sizeof(char*) * devinfo[n].maxsec); //ex. did = 5,  blk = 64
-        devinfo[n].filepostracker = (uint16_t **) malloc(sizeof(uint16_t*) * devinfo[n].maxsec); //ex. did = 5,  blk = 64
-        for(i=0; i<devinfo[n].maxsec; i++){
-            devinfo[n].storage[i] = (char *) malloc(sizeof(char) * devinfo[n].maxblk);  //ex. did = 5. sec = 10
-            devinfo[n].fileblktracker[i] = (char *) malloc(sizeof(char) * devinfo[n].maxblk);  //ex. did = 5. sec = 10
-            devinfo[n].filepostracker[i] = (uint16_t *) malloc(sizeof(uint16_t) * devinfo[n].maxblk);  //ex. did = 5. sec = 10
+    for(i=0; i<n; i++){
+        if(slots[i] - slots[i] % g == base){
+            continue;
+        }
+        base = slots[i] - slots[i] % g;
+        for(j=0, lost=0; j<g; j++){
+            lost += (STATGET(devinfo[f->blkmap[base+j].dev].state) == LC_DEVICE_ERRORED);
         }
-        // zero out storage (device tracker)
-        for(i=0; i<devinfo[n].maxsec; i++){
-            for(j=0; j< devinfo[n].maxblk; j++){
-                devinfo[n].storage[i][j] = 0;
-                devinfo[n].fileblktracker[i][j] = 0;
-                devinfo[n].filepostracker[i][j] = 0;
+        if(lost > f->npar){
+            logMessage(LOG_ERROR_LEVEL, "Failed to write file %s: %d blocks of group %d are on failed devices (%d parity blocks)",
+                f->fname, lost, base / g, f->npar);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeparity
+// Description  : compute and write the parity blocks (or copies) of the
+//                groups a batch of data blocks of the file is written in,
+//                before the data blocks are: the other data blocks of a
+//                group come from the batch, the cache or the devices (never
+//                written ones too, see rebuildblock); the parity blocks
+//                written for the first time are journaled once they are
+//                out; the caller checks the groups (lostgroups) once the
+//                data blocks are out too (file lock held)
+//
+// Inputs       : fh - file handle, slots - block map indexes of the data
+//                blocks written (ascending), data - their new contents
+//                n - number of blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int writeparity(LcFHandle fh, int *slots, char data[][LC_DEVICE_BLOCK_SIZE], int n){
+    filesys *f = &FINFO(fh);
+    char grpdata[LC_EC_MAXBLOCKS][LC_DEVICE_BLOCK_SIZE], *dptr[LC_EC_MAXBLOCKS];
+    char pardata[LC_XFER_MAXREQ][LC_DEVICE_BLOCK_SIZE], *pptr[LC_EC_MAXBLOCKS];
+    xferblk rd[LC_EC_MAXBLOCKS], out[LC_XFER_MAXREQ];
+    int fresh[LC_XFER_MAXREQ];
+    int g = f->ndata + f->npar, base, i, j, x, nrd, npar = 0, nout = 0, nfresh = 0, absorbed;
+    blockloc *loc;
+
+    for(i=0; i<n; i=x){
+        base = slots[i] - slots[i] % g;
+
+        // the group's data blocks
+        for(j=0, x=i, nrd=0; j<f->ndata; j++){
+            loc = &f->blkmap[base+j];
+            if(x < n && slots[x] == base+j){
+                dptr[j] = data[x++];
+                continue;
+            }
+            dptr[j] = grpdata[j];
+            if(lcloud_readcache(loc->did, loc->sec, loc->blk, grpdata[j])){
+                continue;
             }
+            rd[nrd].loc = loc;
+            rd[nrd].data = grpdata[j];
+            nrd++;
+        }
+        if(readblocks(fh, rd, nrd) == -1){
+            return -1;
         }
-        /////////////////////////////////////////////////////
+        STATADD(parityreads, nrd);
 
-        totalblock += devinfo[n].maxsec * devinfo[n].maxblk;
-    
-        
-        //increment index(next device)
-        n++;
-    }while(n<devicenum);
+        // its parity, written with the other groups' in batches
+        if(npar + f->npar > LC_XFER_MAXREQ){
+            xferblocks(out, nout, LC_XFER_WRITE);
+            for(j=0; j<nfresh; j++){
+                logextents(fh, fresh[j], 1);
+            }
+            npar = nout = nfresh = 0;
+        }
+        for(j=0; j<f->npar; j++){
+            pptr[j] = pardata[npar++];
+        }
+        if(lcloud_ecencode(f->ndata, f->npar, dptr, pptr, LC_DEVICE_BLOCK_SIZE) == -1){
+            return -1;
+        }
+        for(j=0; j<f->npar; j++){
+            loc = &f->blkmap[base+f->ndata+j];
+            if((absorbed = lcloud_dirtycache(loc->did, loc->sec, loc->blk, pptr[j], f->npar)) == -1){
+                return -1;
+            }
+            if(absorbed == 0){
+                out[nout].loc = loc;
+                out[nout].data = pptr[j];
+                nout++;
+            }
+            if(loc->written == false){
+                fresh[nfresh++] = base+f->ndata+j;
+            }
+            loc->written = true;
+        }
+        STATADD(paritywrites, f->npar);
+    }
+    xferblocks(out, nout, LC_XFER_WRITE);
+    for(j=0; j<nfresh; j++){
+        logextents(fh, fresh[j], 1);
+    }
+    return 0;
+}
 
-    ////////////////// file initialize //////////////////////
-    for(fd=0; fd<filenum; fd++){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writebackblks
+//
+// Input        : *blks, n
+//
+// Description  : write a batch of dirty blocks flushed out of the write-back
+//                cache, LC_XFER_MAXREQ at a time through xferblocks (so the
+//                runs are vectored and all in flight together).  A block its
+//                device cannot take is only left out when its group (npar
+//                parity blocks) can still rebuild it when read: the blocks
+//                of a group are on different devices, so no more of them are
+//                lost than devices failed.
+//
 
-        finfo[fd].isopen = false;
-        finfo[fd].fname = "\0";   // ' '?
-        finfo[fd].pos = -1;
-        finfo[fd].fhandle = -1;
-        finfo[fd].flength = -1;
-        //device <-> file
-        finfo[fd].fdid = -1;
-        finfo[fd].fsec = -1;
-        finfo[fd].fblk = -1;
-        finfo[fd].wfnow = -1;
-        finfo[fd].rfnow = -1;
+int writebackblks(LcCacheBlock *blks, int n){
+    blockloc loc[LC_XFER_MAXREQ];
+    xferblk out[LC_XFER_MAXREQ];
+    int idx[LC_XFER_MAXREQ];
+    LcCacheBlock *b;
+    int i, j, m, ret = 0;
+
+    for(i=0; i<n; i+=LC_XFER_MAXREQ){
+        for(j=i, m=0; j<n && j<i+LC_XFER_MAXREQ; j++){
+            blks[j].failed = 1;
+            if((loc[m].dev = devindex(blks[j].did)) < 0){
+                continue;
+            }
+            loc[m].did = blks[j].did;
+            loc[m].sec = blks[j].sec;
+            loc[m].blk = blks[j].blk;
+            out[m].loc = &loc[m];
+            out[m].data = blks[j].data;
+            idx[m++] = j;
+        }
+        xferblocks(out, m, LC_XFER_WRITE);
+        for(j=0; j<m; j++){
+            b = &blks[idx[j]];
+            if(out[j].failed == false){
+                b->failed = 0;
+            }
+            else if(b->npar > 0 && faileddevs() <= b->npar){
+                STATADD(lostwrites, 1);
+                b->failed = 0;
+            }
+        }
+        for(j=i; j<n && j<i+LC_XFER_MAXREQ; j++){
+            if(blks[j].failed){
+                logMessage(LOG_ERROR_LEVEL, "Failed to write back block [%d/%d/%d], it cannot be rebuilt", blks[j].did, blks[j].sec, blks[j].blk);
+                ret = -1;
+            }
+        }
     }
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readmetablk
+//
+// Input        : did, sec, blk, *buf
+//
+// Description  : read a metadata block (superblock or chain)
+//
+
+int readmetablk(LcDeviceId did, uint16_t sec, uint16_t blk, char *buf){
+    STATADD(metablkreads, 1);
+    return do_read(did, sec, blk, buf);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writemetablk
+//
+// Input        : did, sec, blk, *buf
+//
+// Description  : write a metadata block (superblock or chain); a failed
+//                write fails its device
+//
 
-    //lcloud_initcache();
+int writemetablk(LcDeviceId did, uint16_t sec, uint16_t blk, char *buf){
+    int dev;
 
+    STATADD(metablkwrites, 1);
+    if(do_write(did, sec, blk, buf) == -1){
+        if((dev = devindex(did)) != -1){
+            devfailed(dev);
+        }
+        return -1;
+    }
     return 0;
 }
 
-// File system interface implementation
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logcreate
+// Description  : journal a new file or directory; its name goes in the
+//                blocks of its directory (file table lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : none
+
+void logcreate(LcFHandle fh){
+    char rec[16], *p = rec;
+
+    if(journalon == true){
+        lcmeta_put(&p, LC_LOG_CREATE, 1);
+        lcmeta_put(&p, fh, 4);
+        lcmeta_put(&p, FINFO(fh).parent, 4);
+        lcmeta_put(&p, FINFO(fh).type, 1);
+        lcmeta_put(&p, FINFO(fh).width, 1);
+        lcmeta_put(&p, FINFO(fh).unit, 2);
+        lcmeta_put(&p, devinfo[FINFO(fh).stripedev].did, 1);
+        lcmeta_put(&p, FINFO(fh).ndata, 1);
+        lcmeta_put(&p, FINFO(fh).npar, 1);
+        lcmeta_logappend(rec, sizeof(rec));
+    }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcopen
-// Description  : Open the file for for reading and writing
+// Function     : logunlink
+// Description  : journal a removed file or directory (file table lock held)
 //
-// Inputs       : path - the path/filename of the file to be read
-// Outputs      : file handle if successful test, -1 if failure
+// Inputs       : fh - file handle
+// Outputs      : none
 
-LcFHandle lcopen( const char *path ) {
+void logunlink(LcFHandle fh){
+    char rec[5], *p = rec;
 
-    int fd=0;
+    if(journalon == true){
+        lcmeta_put(&p, LC_LOG_UNLINK, 1);
+        lcmeta_put(&p, fh, 4);
+        lcmeta_logappend(rec, sizeof(rec));
+    }
+}
 
-    //check if power is off, and poweron
-    if(isDeviceOn == false){
-        lcpoweron();
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logmove
+// Description  : journal the new directory of a file or directory
+//                (file table lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : none
+
+void logmove(LcFHandle fh){
+    char rec[9], *p = rec;
+
+    if(journalon == true){
+        lcmeta_put(&p, LC_LOG_MOVE, 1);
+        lcmeta_put(&p, fh, 4);
+        lcmeta_put(&p, FINFO(fh).parent, 4);
+        lcmeta_logappend(rec, sizeof(rec));
     }
+}
 
-    while(fd < filenum){
-        //check if opening the file again
-        if(strcmp(path, finfo[fd].fname) == 0){
-            if(finfo[fd].isopen == true){
-                logMessage(LOG_ERROR_LEVEL, "File is already opened.\n\n");
-                return -1;
-            }
-        }
-        //if we are opening another file, increment the file handle
-        else{ 
-            fd++;
-            if(finfo[fd].isopen == false ) break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logextents
+// Description  : journal block map entries of a file, one record per extent
+//                they make up (file lock held)
+//
+// Inputs       : fh - file handle, first - first logical block, n - blocks
+// Outputs      : none
+
+void logextents(LcFHandle fh, int first, int n){
+    char rec[17], *p;
+    blockloc *map = FINFO(fh).blkmap;
+    int i, len;
+
+    if(journalon == false){
+        return;
+    }
+    for(i=first; i<first+n; i+=len){
+        for(len=1; i+len<first+n && len<0xffff && contiguous(&map[i+len-1], &map[i+len]); len++);
+        p = rec;
+        lcmeta_put(&p, LC_LOG_EXTENT, 1);
+        lcmeta_put(&p, fh, 4);
+        lcmeta_put(&p, i, 4);
+        lcmeta_put(&p, map[i].did, 1);
+        lcmeta_put(&p, (map[i].written == true) ? 0x1 : 0x0, 1);
+        lcmeta_put(&p, map[i].sec, 2);
+        lcmeta_put(&p, map[i].blk, 2);
+        lcmeta_put(&p, len, 2);
+        lcmeta_logappend(rec, sizeof(rec));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mapextents
+// Description  : encode the block map of a file as extents, runs of blocks
+//                that follow each other on a device with the same written
+//                flag (did, flags, sec, blk of the first, length)
+//
+// Inputs       : fh - file handle, buf - LC_META_EXTENT bytes per extent
+//                (NULL to count them only)
+// Outputs      : number of extents
+
+int mapextents(LcFHandle fh, char *buf){
+    blockloc *map = FINFO(fh).blkmap;
+    int i, len, n = 0;
+
+    for(i=0; i<FINFO(fh).nblks; i+=len, n++){
+        for(len=1; i+len<FINFO(fh).nblks && len<0xffff && contiguous(&map[i+len-1], &map[i+len]); len++);
+        if(buf != NULL){
+            lcmeta_put(&buf, map[i].did, 1);
+            lcmeta_put(&buf, (map[i].written == true) ? 0x1 : 0x0, 1);
+            lcmeta_put(&buf, map[i].sec, 2);
+            lcmeta_put(&buf, map[i].blk, 2);
+            lcmeta_put(&buf, len, 2);
         }
     }
+    return n;
+}
 
-    finfo[fd].isopen = true;
-    finfo[fd].fname = strdup(path);        //save file name
-    finfo[fd].fhandle = fd;                //pick unique file handle
-    finfo[fd].pos = 0;                     //set file pointer to first byte
-    finfo[fd].flength = 0;
-    //device <-> file
-    finfo[fd].fdid = 0;
-    finfo[fd].fsec = 0;
-    finfo[fd].fblk = 0;
-    finfo[fd].wfnow = 0;
-    finfo[fd].rfnow = 0;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setblock
+// Description  : set a block map entry of a file loaded from the devices,
+//                appending it if it is the next one (file lock held)
+//
+// Inputs       : fh - file handle, i - logical block (at most nblks)
+//                dev - device index, idx - block on it (blkindex order)
+//                written - the block holds data
+// Outputs      : 0 if successful, -1 if failure
 
-    logMessage(LcControllerLLevel, "Opened new file [%s], fh=%d.", finfo[fd].fname, finfo[fd].fhandle);
+int setblock(LcFHandle fh, int i, int dev, int idx, bool written){
+    filesys *f = &FINFO(fh);
+    blockloc *loc;
 
-    return(finfo[fd].fhandle);
-} 
+    if(i == f->nblks){
+        if(growmap(fh) == -1){
+            return -1;
+        }
+        f->nblks++;
+    }
+    loc = &f->blkmap[i];
+    loc->dev = dev;
+    loc->did = devinfo[dev].did;
+    loc->sec = idx / devinfo[dev].maxblk;
+    loc->blk = idx % devinfo[dev].maxblk;
+    loc->written = written;
+    loc->prefetched = false;
+    return 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcread
-// Description  : Read data from the file 
+// Function     : loglength
+// Description  : journal the length of a file (file lock held)
 //
-// Inputs       : fh - file handle for the file to read from
-//                buf - place to put the data
-//                len - the length of the read
-// Outputs      : number of bytes read, -1 if failure
+// Inputs       : fh - file handle
+// Outputs      : none
 
-int lcread( LcFHandle fh, char *buf, size_t len ) {
+void loglength(LcFHandle fh){
+    char rec[9], *p = rec;
 
-    uint32_t readbytes, filepos;
-    //uint64_t blknum, secnum;
+    if(journalon == true){
+        lcmeta_put(&p, LC_LOG_LENGTH, 1);
+        lcmeta_put(&p, fh, 4);
+        lcmeta_put(&p, FINFO(fh).flength, 4);
+        lcmeta_logappend(rec, sizeof(rec));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countallocated
+// Description  : recount the allocated blocks from the allocator
+//
+// Inputs       : none
+// Outputs      : none
+
+void countallocated(void){
+    int i;
+
+    allocatedblock = 0;
+    for(i=0; i<devicenum; i++){
+        allocatedblock += devinfo[i].maxsec * devinfo[i].maxblk - lcloud_countfree(i);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getlayout
+// Description  : take the layout of a file (width, unit, device id of its
+//                first stripe member, data and parity blocks of its
+//                redundancy groups) from a metadata record
+//
+// Inputs       : fh - file handle, p - position in the record (moved past it)
+// Outputs      : 0 if successful, -1 if the layout is not valid
+
+int getlayout(LcFHandle fh, char **p){
+    filesys *f = &FINFO(fh);
+
+    f->width = lcmeta_get(p, 1);
+    f->unit = lcmeta_get(p, 2);
+    f->stripedev = devindex(lcmeta_get(p, 1));
+    f->ndata = lcmeta_get(p, 1);
+    f->npar = lcmeta_get(p, 1);
+    if(f->width < 1 || f->width > devicenum || f->unit < 1 || f->stripedev < 0 ||
+       f->ndata < 1 || f->ndata + f->npar > devicenum || (f->npar > 0 && (f->width != f->ndata + f->npar || f->unit != 1))){
+        f->width = 1;
+        f->unit = 1;
+        f->stripedev = 0;
+        f->ndata = 1;
+        f->npar = 0;
+        return -1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadinodes
+// Description  : load the inode stream of a file table chunk: count, then
+//                fh, parent, type, layout, length, map extents and map head
+//                of each file (names are in the directories)
+//
+// Inputs       : c - chunk, head - first block of its stream
+// Outputs      : 0 if successful, -1 if failure
+
+int loadinodes(int c, LcMetaLoc head){
+    char *buf, *p, *end;
+    int i, n, fh, dev;
+    LcDeviceId did;
+    filesys *f;
+
+    if(head.dev < 0 || lcmeta_load(&inodechunks[c], head, inodelens[c], &buf) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: failed to load the inodes of chunk %d", c);
+        return -1;
+    }
+    p = buf;
+    end = buf + inodelens[c];
+    n = lcmeta_get(&p, 4);
+    for(i=0; i<n; i++){
+        if(p + 28 > end){
+            break;
+        }
+        fh = lcmeta_get(&p, 4);
+        if(fh / LC_FILE_CHUNK != c || growtable(fh) == -1){
+            break;
+        }
+        f = &FINFO(fh);
+        f->fhandle = fh;
+        f->parent = lcmeta_get(&p, 4);
+        f->type = lcmeta_get(&p, 1);
+        if(getlayout(fh, &p) == -1){
+            f->type = LC_TYPE_NONE;
+            break;
+        }
+        f->flength = lcmeta_get(&p, 4);
+        f->mapexts = lcmeta_get(&p, 4);
+        did = lcmeta_get(&p, 1);
+        f->maphead.did = did;
+        f->maphead.sec = lcmeta_get(&p, 2);
+        f->maphead.blk = lcmeta_get(&p, 2);
+        f->maphead.dev = dev = devindex(did);
+        if((f->type != LC_TYPE_FILE && f->type != LC_TYPE_DIR) || (f->mapexts > 0 && dev < 0)){
+            f->type = LC_TYPE_NONE;
+            break;
+        }
+        f->maploaded = false;
+        f->dirloaded = false;
+    }
+    free(buf);
+    if(i < n){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: inode table is damaged (chunk %d, inode %d of %d)", c, i, n);
+        return -1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadfs
+// Description  : load the allocation bitmap and the inode table of the
+//                filesystem the superblock describes; block maps are left
+//                on the devices until their file is opened
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int loadfs(void){
+    LcMetaLoc heads[LC_FILE_MAXCHUNKS];
+    char *buf, *p;
+    uint32_t len = 0;
+    int i, n;
+
+    // allocation bitmap, every device one after the other
+    for(i=0; i<devicenum; i++){
+        len += lcloud_bitmapsize(i);
+    }
+    if(super.bitmaplen != len || lcmeta_load(&bitmapchain, super.bitmap, len, &buf) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: failed to load the allocation bitmap");
+        return -1;
+    }
+    for(i=0, p=buf; i<devicenum; p+=lcloud_bitmapsize(i), i++){
+        lcloud_setbitmap(i, p);
+    }
+    countallocated();
+    free(buf);
+
+    // inode table: the number of chunks, then the head and bytes of each
+    // chunk's inode stream
+    if(super.inodelen == 0){
+        return 0;
+    }
+    if(lcmeta_load(&inodechain, super.inodes, super.inodelen, &buf) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: failed to load the inode table");
+        return -1;
+    }
+    p = buf;
+    n = lcmeta_get(&p, 4);
+    if(n > LC_FILE_MAXCHUNKS || 4 + n * 9 > super.inodelen){
+        free(buf);
+        logMessage(LOG_ERROR_LEVEL, "Metadata: inode table is damaged (%d chunks)", n);
+        return -1;
+    }
+    for(i=0; i<n; i++){
+        heads[i].did = lcmeta_get(&p, 1);
+        heads[i].sec = lcmeta_get(&p, 2);
+        heads[i].blk = lcmeta_get(&p, 2);
+        heads[i].dev = devindex(heads[i].did);
+        inodelens[i] = lcmeta_get(&p, 4);
+    }
+    free(buf);
+    for(i=0; i<n; i++){
+        if(inodelens[i] > 0 && loadinodes(i, heads[i]) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadjournal
+// Description  : read the list of journal blocks and set up the journal
+//                after the checkpoint the superblock describes
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int loadjournal(void){
+    char *buf, *p;
+    LcMetaLoc *blks;
+    LcDeviceId did;
+    int i, n;
+
+    journalon = false;
+    if(super.journallen == 0){
+        return 0;
+    }
+    if(lcmeta_load(&journalchain, super.journal, super.journallen, &buf) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: failed to load the journal block list");
+        return -1;
+    }
+    n = super.journallen / LC_META_LOGENTRY;
+    blks = (LcMetaLoc *)malloc(sizeof(LcMetaLoc) * n);
+    for(i=0, p=buf; i<n; i++){
+        did = lcmeta_get(&p, 1);
+        blks[i].did = did;
+        blks[i].dev = devindex(did);
+        blks[i].sec = lcmeta_get(&p, 2);
+        blks[i].blk = lcmeta_get(&p, 2);
+        if(blks[i].dev < 0){
+            break;
+        }
+    }
+    free(buf);
+    if(i < n || lcmeta_logstart(blks, n, super.fsid, super.generation) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: journal block list is damaged");
+        free(blks);
+        return -1;
+    }
+    journalblks.blks = blks;
+    journalblks.nblks = journalblks.cap = n;
+    journalon = true;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : makejournal
+// Description  : allocate a journal and write the list of its blocks (they
+//                stay the journal until a device under them fails); the
+//                journal it replaces, if any, is left to the caller
+//
+// Inputs       : nblks - journal blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int makejournal(int nblks){
+    LcMetaChain blks, list;
+    char *buf, *p;
+    int i, ret = 0;
+
+    if(nblks == 0){
+        journalon = false;
+        return 0;
+    }
+    memset(&blks, 0, sizeof(LcMetaChain));
+    memset(&list, 0, sizeof(LcMetaChain));
+    if(lcmeta_grow(&blks, nblks * LC_META_PAYLOAD) == -1){
+        lcmeta_release(&blks);
+        return -1;
+    }
+    buf = malloc(blks.nblks * LC_META_LOGENTRY);
+    for(i=0, p=buf; i<blks.nblks; i++){
+        lcmeta_put(&p, blks.blks[i].did, 1);
+        lcmeta_put(&p, blks.blks[i].sec, 2);
+        lcmeta_put(&p, blks.blks[i].blk, 2);
+    }
+    if(lcmeta_store(&list, buf, blks.nblks * LC_META_LOGENTRY) == -1 ||
+       lcmeta_logstart(blks.blks, blks.nblks, super.fsid, super.generation) == -1){
+        lcmeta_release(&list);
+        lcmeta_release(&blks);
+        ret = -1;
+    }
+    else{
+        journalchain = list;
+        journalblks = blks;
+        super.journal = journalchain.blks[0];
+        super.journallen = blks.nblks * LC_META_LOGENTRY;
+        journalon = true;
+    }
+    free(buf);
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadmap
+// Description  : read the block map of a file loaded from the devices, the
+//                first time it is opened (file lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : 0 if successful, -1 if failure
+
+int loadmap(LcFHandle fh){
+    filesys *f = &FINFO(fh);
+    char *buf, *p;
+    uint16_t sec, blk;
+    int i, j, len, dev, flags;
+
+    if(f->maploaded == true){
+        return 0;
+    }
+    f->nblks = 0;
+    if(f->mapexts > 0){
+        if(lcmeta_load(&f->map, f->maphead, f->mapexts * LC_META_EXTENT, &buf) == -1){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: failed to load the block map of [%s]", f->fname);
+            return -1;
+        }
+        // each extent expands to its blocks in the map
+        for(j=0, p=buf; j<f->mapexts; j++){
+            dev = devindex(lcmeta_get(&p, 1));
+            flags = lcmeta_get(&p, 1);
+            sec = lcmeta_get(&p, 2);
+            blk = lcmeta_get(&p, 2);
+            len = lcmeta_get(&p, 2);
+            if(dev < 0){
+                break;
+            }
+            for(i=0; i<len; i++){
+                if(setblock(fh, f->nblks, dev, sec * devinfo[dev].maxblk + blk + i, (flags & 0x1) ? true : false) == -1){
+                    break;
+                }
+            }
+            if(i < len){
+                break;
+            }
+        }
+        free(buf);
+        if(j < f->mapexts){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: block map of [%s] is damaged", f->fname);
+            return -1;
+        }
+    }
+    f->maploaded = true;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replayrec
+// Description  : apply a journal record to the filesystem loaded from the
+//                last checkpoint
+//
+// Inputs       : rec - the record, len - its bytes
+// Outputs      : 0 if successful, -1 if the record is not valid
+
+int replayrec(char *rec, int len){
+    char *p = rec;
+    int type, fh, i, n, k, idx, dev;
+    LcDeviceId did;
+    uint16_t sec, blk;
+    filesys *f;
+
+    if(len < 5){
+        return -1;
+    }
+    type = lcmeta_get(&p, 1);
+    fh = lcmeta_get(&p, 4);
+    if(fh < 0 || (fh >= nfiles && (type != LC_LOG_CREATE || growtable(fh) == -1))){
+        return -1;
+    }
+    f = &FINFO(fh);
+
+    switch(type){
+    case LC_LOG_CREATE:
+        if(len != 16 || f->type != LC_TYPE_NONE){
+            return -1;
+        }
+        f->parent = lcmeta_get(&p, 4);
+        f->type = lcmeta_get(&p, 1);
+        if((f->type != LC_TYPE_FILE && f->type != LC_TYPE_DIR) || getlayout(fh, &p) == -1){
+            f->type = LC_TYPE_NONE;
+            return -1;
+        }
+        f->fhandle = fh;
+        f->flength = 0;
+        f->mapexts = 0;
+        f->maploaded = true;
+        f->dirloaded = false;
+        f->metadirty = true;
+        return 0;
+
+    case LC_LOG_UNLINK:
+        if(len != 5 || f->type == LC_TYPE_NONE || f->unlinked == true){
+            return -1;
+        }
+        f->unlinked = true;
+        return 0;
+
+    case LC_LOG_MOVE:
+        if(len != 9 || f->type == LC_TYPE_NONE || f->unlinked == true){
+            return -1;
+        }
+        f->parent = lcmeta_get(&p, 4);
+        f->metadirty = true;
+        return 0;
+
+    case LC_LOG_EXTENT:
+        if(len != 17 || f->type == LC_TYPE_NONE || loadmap(fh) == -1){
+            return -1;
+        }
+        i = lcmeta_get(&p, 4);
+        did = lcmeta_get(&p, 1);
+        type = lcmeta_get(&p, 1);
+        sec = lcmeta_get(&p, 2);
+        blk = lcmeta_get(&p, 2);
+        n = lcmeta_get(&p, 2);
+        if(i > f->nblks || (dev = devindex(did)) < 0){
+            return -1;
+        }
+        for(k=0; k<n; k++){
+            idx = sec * devinfo[dev].maxblk + blk + k;
+            if(i + k == f->nblks && lcloud_reserveblk(dev, idx / devinfo[dev].maxblk, idx % devinfo[dev].maxblk) == -1){
+                // a block allocated after the checkpoint
+                logMessage(LOG_WARNING_LEVEL, "Metadata: journal block [%d/%d/%d] is already allocated",
+                    did, idx / devinfo[dev].maxblk, idx % devinfo[dev].maxblk);
+            }
+            if(setblock(fh, i + k, dev, idx, (type & 0x1) ? true : false) == -1){
+                return -1;
+            }
+        }
+        f->metadirty = true;
+        return 0;
+
+    case LC_LOG_LENGTH:
+        if(len != 9 || f->type == LC_TYPE_NONE){
+            return -1;
+        }
+        f->flength = lcmeta_get(&p, 4);
+        f->metadirty = true;
+        return 0;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : syncmeta
+// Description  : write a checkpoint: the block maps of the changed files,
+//                the inode table and the allocation bitmap go to new chains,
+//                then the superblock is switched to them and the journal
+//                starts over; a crash before the superblock leaves the last
+//                checkpoint and its journal as they were.  Maps, inode
+//                streams and journal blocks left on a failed device are
+//                moved to the working ones (file table lock held, the file
+//                locks are taken here)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int syncmeta(void){
+    LcMetaChain *old, newchain;
+    char *buf, *p;
+    uint32_t len;
+    int i, c, n, nchunks, nold = 0, ret = 0;
+    filesys *f;
+
+    if(metaon == false || STATGET(fsdirty) == false){
+        return 0;
+    }
+    for(i=0; i<nfiles; i++){
+        pthread_mutex_lock(&FINFO(i).lock);
+    }
+
+    // the blocks reserved ahead for the files go back first: the chains
+    // may need them on nearly full devices, and the saved bitmap must not
+    // have them (a file reserves its next run again after its last block)
+    for(i=0; i<nfiles; i++){
+        releaseblks(i);
+    }
+    nchunks = (nfiles + LC_FILE_CHUNK - 1) / LC_FILE_CHUNK;
+    old = (LcMetaChain *)malloc(sizeof(LcMetaChain) * (nfiles + nchunks + 4));
+
+    // the data the maps point to goes first
+    if(lcloud_flushcache() == -1){
+        ret = -1;
+    }
+
+    // block maps of the changed files (the maps of removed files are
+    // loaded to free their blocks below)
+    for(i=0; i<nfiles && ret == 0; i++){
+        f = &FINFO(i);
+        if(f->type != LC_TYPE_NONE && f->maploaded == true && lcmeta_onfailed(&f->map)){
+            f->metadirty = true;
+        }
+        if(f->type == LC_TYPE_NONE || (f->metadirty == false && f->unlinked == false)){
+            continue;
+        }
+        inodedirty[i / LC_FILE_CHUNK] = true;
+        if(f->unlinked == true){
+            ret = loadmap(i);
+            continue;
+        }
+        if(f->maploaded == false){
+            continue;
+        }
+        n = mapextents(i, NULL);
+        buf = malloc(n * LC_META_EXTENT + 1);
+        mapextents(i, buf);
+        memset(&newchain, 0, sizeof(LcMetaChain));
+        if(lcmeta_store(&newchain, buf, n * LC_META_EXTENT) == -1){
+            ret = -1;
+        }
+        else{
+            old[nold++] = f->map;
+            f->map = newchain;
+            f->mapexts = n;
+            if(f->map.nblks > 0){
+                f->maphead = f->map.blks[0];
+            }
+            f->metadirty = false;
+        }
+        free(buf);
+    }
+
+    // inode table: the streams of the chunks with changed files are
+    // rewritten, then the index of the chunk streams
+    for(c=0; c<nchunks && ret == 0; c++){
+        if(inodedirty[c] == false && lcmeta_onfailed(&inodechunks[c]) == 0){
+            continue;
+        }
+        for(i=c*LC_FILE_CHUNK, n=0; i<(c+1)*LC_FILE_CHUNK && i<nfiles; i++){
+            if(FINFO(i).type != LC_TYPE_NONE && FINFO(i).unlinked == false){
+                n++;
+            }
+        }
+        len = 4 + n * 28;
+        buf = malloc(len);
+        p = buf;
+        lcmeta_put(&p, n, 4);
+        for(i=c*LC_FILE_CHUNK; i<(c+1)*LC_FILE_CHUNK && i<nfiles; i++){
+            f = &FINFO(i);
+            if(f->type == LC_TYPE_NONE || f->unlinked == true){
+                continue;
+            }
+            lcmeta_put(&p, i, 4);
+            lcmeta_put(&p, f->parent, 4);
+            lcmeta_put(&p, f->type, 1);
+            lcmeta_put(&p, f->width, 1);
+            lcmeta_put(&p, f->unit, 2);
+            lcmeta_put(&p, devinfo[f->stripedev].did, 1);
+            lcmeta_put(&p, f->ndata, 1);
+            lcmeta_put(&p, f->npar, 1);
+            lcmeta_put(&p, f->flength, 4);
+            lcmeta_put(&p, f->mapexts, 4);
+            lcmeta_put(&p, f->maphead.did, 1);
+            lcmeta_put(&p, f->maphead.sec, 2);
+            lcmeta_put(&p, f->maphead.blk, 2);
+        }
+        memset(&newchain, 0, sizeof(LcMetaChain));
+        if(n > 0 && lcmeta_store(&newchain, buf, len) == -1){
+            ret = -1;
+        }
+        else{
+            old[nold++] = inodechunks[c];
+            inodechunks[c] = newchain;
+            inodelens[c] = (n > 0) ? len : 0;
+            inodedirty[c] = false;
+        }
+        free(buf);
+    }
+    len = 4 + nchunks * 9;
+    buf = malloc(len);
+    p = buf;
+    lcmeta_put(&p, nchunks, 4);
+    for(c=0; c<nchunks; c++){
+        lcmeta_put(&p, (inodelens[c] > 0) ? inodechunks[c].blks[0].did : 0, 1);
+        lcmeta_put(&p, (inodelens[c] > 0) ? inodechunks[c].blks[0].sec : 0, 2);
+        lcmeta_put(&p, (inodelens[c] > 0) ? inodechunks[c].blks[0].blk : 0, 2);
+        lcmeta_put(&p, inodelens[c], 4);
+    }
+    memset(&newchain, 0, sizeof(LcMetaChain));
+    if(ret == 0 && lcmeta_store(&newchain, buf, len) == 0){
+        old[nold++] = inodechain;
+        inodechain = newchain;
+        super.inodes = inodechain.blks[0];
+        super.inodelen = len;
+    }
+    else{
+        ret = -1;
+    }
+    free(buf);
+
+    // the journal moves off a failed device (its records are in this
+    // checkpoint, the new blocks take the ones after it)
+    if(ret == 0 && journalon == true && (lcmeta_onfailed(&journalblks) || lcmeta_onfailed(&journalchain))){
+        old[nold] = journalblks;
+        old[nold+1] = journalchain;
+        if(makejournal(journalblks.nblks) == -1){
+            ret = -1;
+        }
+        else{
+            nold += 2;
+            logMessage(LcControllerLLevel, "Metadata: journal moved off a failed device");
+        }
+    }
+
+    // allocation bitmap: its new chain is taken and the replaced chains are
+    // freed first, so the saved bitmap is the one after the switch (nothing
+    // else allocates while the file locks are held)
+    for(i=0, len=0; i<devicenum; i++){
+        len += lcloud_bitmapsize(i);
+    }
+    memset(&newchain, 0, sizeof(LcMetaChain));
+    if(ret == 0 && lcmeta_grow(&newchain, len) == 0){
+        old[nold++] = bitmapchain;
+        bitmapchain = newchain;
+        for(i=0; i<nfiles; i++){
+            if(FINFO(i).type != LC_TYPE_NONE && FINFO(i).unlinked == true){
+                old[nold++] = FINFO(i).map;
+                memset(&FINFO(i).map, 0, sizeof(LcMetaChain));
+                dropfile(i);
+            }
+        }
+        for(i=0; i<nold; i++){
+            lcmeta_release(&old[i]);
+        }
+        nold = 0;
+
+        // a chain block whose write fails moves the chain to new blocks,
+        // so the bitmap is taken and written again after a device fails
+        buf = malloc(len);
+        do{
+            n = faileddevs();
+            for(i=0, p=buf; i<devicenum; p+=lcloud_bitmapsize(i), i++){
+                lcloud_getbitmap(i, p);
+            }
+            if(lcmeta_store(&bitmapchain, buf, len) == -1){
+                ret = -1;
+            }
+        }while(ret == 0 && faileddevs() != n);
+        free(buf);
+        super.bitmap = bitmapchain.blks[0];
+        super.bitmaplen = len;
+    }
+    else{
+        ret = -1;
+    }
+
+    // the superblock goes last, once everything it points to is written
+    if(ret == -1 || lcmeta_writesuper(&super) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: failed to write a checkpoint");
+        ret = -1;
+    }
+    else{
+        lcmeta_logreset(super.generation);
+        checkpoints++;
+        FLAGSET(fsdirty, false);
+    }
+    countallocated();
+
+    free(old);
+    for(i=0; i<nfiles; i++){
+        pthread_mutex_unlock(&FINFO(i).lock);
+    }
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : commitmeta
+// Description  : commit the journal records of every thread (after their
+//                data), or write a checkpoint when the journal is full
+//                (no file lock held)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int commitmeta(void){
+    int ret;
+
+    if(metaon == false || journalon == false){
+        return 0;
+    }
+    if((ret = lcmeta_logcommit(lcloud_flushcache)) == 1){
+        pthread_mutex_lock(&fslock);
+        ret = syncmeta();
+        pthread_mutex_unlock(&fslock);
+    }
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mountfs
+// Description  : set up the on-device metadata at power on: load the
+//                filesystem on the devices (superblock, bitmap and inode
+//                table only) and replay its journal, or format them if
+//                there is none, it is for other devices, or formatting was
+//                asked for
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int mountfs(void){
+    LcDeviceId dids[LC_META_MAXDEVS];
+    uint16_t secs[LC_META_MAXDEVS], blks[LC_META_MAXDEVS];
+    uint64_t start;
+    int i;
+    bool same;
+
+    metaon = false;
+    journalon = false;
+    FLAGSET(fsdirty, false);
+    checkpoints = 0;
+    replayed = 0;
+    memset(&inodechain, 0, sizeof(LcMetaChain));
+    memset(inodechunks, 0, sizeof(inodechunks));
+    memset(inodelens, 0, sizeof(inodelens));
+    memset(inodedirty, 0, sizeof(inodedirty));
+    memset(&bitmapchain, 0, sizeof(LcMetaChain));
+    memset(&journalchain, 0, sizeof(LcMetaChain));
+    memset(&journalblks, 0, sizeof(LcMetaChain));
+    lookups = 0;
+    dirloads = 0;
+    if(metamode == LC_META_NONE){
+        return makeroot();
+    }
+    for(i=0; i<devicenum && i<LC_META_MAXDEVS; i++){
+        dids[i] = devinfo[i].did;
+        secs[i] = devinfo[i].maxsec;
+        blks[i] = devinfo[i].maxblk;
+    }
+    if(lcmeta_init(devicenum, dids, readmetablk, writemetablk) == -1){
+        return -1;
+    }
+
+    if(metamode == LC_META_LOAD && lcmeta_readsuper(&super) == 0){
+        same = (super.ndevs == devicenum);
+        for(i=0; i<devicenum && same; i++){
+            same = (super.did[i] == dids[i] && super.maxsec[i] == secs[i] && super.maxblk[i] == blks[i]);
+        }
+        if(same){
+            if(loadfs() == -1 || nfiles == 0 || FINFO(LC_ROOT).type != LC_TYPE_DIR || loadjournal() == -1){
+                logMessage(LOG_ERROR_LEVEL, "Metadata: filesystem not loaded, its metadata is left as is");
+                return -1;
+            }
+
+            // changes made after the checkpoint, then a checkpoint of them
+            metaon = true;
+            if(journalon == true){
+                start = lcmetrics_now();
+                if((replayed = lcmeta_logreplay(replayrec)) == -1){
+                    logMessage(LOG_ERROR_LEVEL, "Metadata: journal replay failed, its metadata is left as is");
+                    metaon = false;
+                    return -1;
+                }
+                if(replayed > 0){
+                    FLAGSET(fsdirty, true);
+                    if(syncmeta() == -1){
+                        metaon = false;
+                        return -1;
+                    }
+                    logMessage(LcControllerLLevel, "Recovered %d journal records in %.3f ms", replayed, (lcmetrics_now() - start) / 1e6);
+                }
+            }
+            if(buildfree() == -1){
+                metaon = false;
+                return -1;
+            }
+            logMessage(LcControllerLLevel, "Loaded filesystem [generation %u, %d files, %d metadata blocks read]", super.generation, nnames, metablkreads);
+            return 0;
+        }
+        logMessage(LOG_WARNING_LEVEL, "Metadata: filesystem was made on other devices, formatting");
+    }
+
+    // new filesystem, written out at once so its journal has a checkpoint to follow
+    if(lcmeta_format(&super, secs, blks) == -1 || makejournal(journalsize) == -1 || makeroot() == -1){
+        return -1;
+    }
+    metaon = true;
+    FLAGSET(fsdirty, true);
+    if(syncmeta() == -1){
+        metaon = false;
+        return -1;
+    }
+    logMessage(LcControllerLLevel, "Formatted filesystem on %d devices", devicenum);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readahead
+// Description  : after a read of the file, check whether the file is being
+//                read sequentially (the read started where the last one
+//                ended) and if so read the next blocks of its block map into
+//                the cache ahead of the reader.  The window starts small,
+//                doubles every time a read-ahead block is used, and collapses
+//                to 0 on a non-sequential read.
+//
+// Inputs       : fh - file handle, start - file position the read started at
+// Outputs      : 0 if successful, -1 if failure
+
+int readahead(LcFHandle fh, uint32_t start){
+    filesys *f = &FINFO(fh);
+    char radata[LC_XFER_MAXREQ][LC_DEVICE_BLOCK_SIZE];
+    xferblk ra[LC_XFER_MAXREQ];
+    blockloc *loc;
+    int maxwin, first, last, i, n = 0;
+
+    // read-ahead can use at most a quarter of the cache, shared by the open files
+    maxwin = lcloud_cacheblocks() / (4 * STATGET(openfiles));
+    if(ramax < maxwin){
+        maxwin = ramax;
+    }
+    if(maxwin > LC_XFER_MAXREQ){
+        maxwin = LC_XFER_MAXREQ;
+    }
+
+    if(f->rapos == -1 || start != (uint32_t)f->rapos || maxwin == 0){
+        // random access, stop reading ahead
+        f->rapos = f->pos;
+        f->rawin = 0;
+        f->raend = 0;
+        return 0;
+    }
+    f->rapos = f->pos;
+    if(f->rawin == 0){
+        f->rawin = LC_READAHEAD_MINBLOCKS;
+    }
+    if(f->rawin > maxwin){
+        f->rawin = maxwin;
+    }
+
+    // read ahead the written blocks of the window that are not cached yet,
+    // starting at the block the next read begins in, as one batch
+    first = f->pos / LC_DEVICE_BLOCK_SIZE;
+    if(f->raend > first){
+        first = f->raend;
+    }
+    last = f->pos / LC_DEVICE_BLOCK_SIZE + f->rawin - 1;
+    if(last >= datablocks(fh)){
+        last = datablocks(fh)-1;
+    }
+    for(i=first; i<=last; i++){
+        loc = &f->blkmap[dataslot(fh, i)];
+        if(loc->written == false || findcache(loc->did, loc->sec, loc->blk)){
+            continue;
+        }
+        ra[n].loc = loc;
+        ra[n].data = radata[n];
+        n++;
+    }
+    if(readblocks(fh, ra, n) == -1){
+        return -1;
+    }
+    for(i=0; i<n; i++){
+        loc = ra[i].loc;
+        lcloud_putcache(loc->did, loc->sec, loc->blk, ra[i].data);
+        if(loc->prefetched == true){
+            STATADD(prefetchwaste, 1);  // earlier read-ahead of it was evicted unused
+        }
+        loc->prefetched = true;
+        STATADD(prefetched, 1);
+    }
+    if(last+1 > f->raend){
+        f->raend = last+1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcpoweron
+//
+// Description  : power on the device 
+//                  
+//                b0/b1 - which direction / return status
+//                c0    - Operation code (poweron/off/probe/transfer)
+//                c1    - device id
+//                c2    - read(0)/write(1)
+//                d0/d1 - sector/block
+//
+
+int32_t lcpoweron(void){
+    LCloudRegisterFrame frm, rfrm;
+    lcregs r;
+    int i;
+    uint16_t probe;
+
+    // cache init
+    lcloud_initcache(lcloud_cacheblocks());
+    lcloud_setwritebackfn(writebackblks);
+
+    logMessage(LcControllerLLevel, "Initialzing Lion Cloud system ...");
+
+    // Do Operation - PowerOn
+    frm = create_lcloud_registers(0, 0 ,LC_POWER_ON ,0, 0, 0, 0); 
+    rfrm = client_lcloud_bus_request(frm, NULL);
+    extract_lcloud_registers(rfrm, &r);
+
+    isDeviceOn = true;
+
+    int n=0; //devinit loop counter
+
+    // Do Operation - Devprobe
+    frm = create_lcloud_registers(0, 0 ,LC_DEVPROBE ,0, 0, 0, 0); 
+    rfrm = client_lcloud_bus_request(frm, NULL);
+    extract_lcloud_registers(rfrm, &r); //after extract I get probed d0 (22048)
+    probe = r.d0;
+    devicenum = countdevice(probe);
+    totalblock = 0;
+    
+    devinfo = (device *)malloc(sizeof(device) * devicenum);
+    lcloud_initalloc(devicenum);
+    for(i=0; i<devicenum; i++){
+        devinfo[i].did = 0;
+        devinfo[i].maxsec = 0;
+        devinfo[i].maxblk = 0;
+        devinfo[i].numwritten = 0;
+        devinfo[i].numread = 0;
+        devinfo[i].devwritten = 0;
+        devinfo[i].devread = 0;
+        devinfo[i].blkswritten = 0;
+        devinfo[i].blksread = 0;
+        devinfo[i].busreqs = 0;
+        devinfo[i].state = LC_DEVICE_ONLINE;
+        devinfo[i].inflight = 0;
+        devinfo[i].latency = 0;
+    }
+
+
+    //---------------------- Device init ----------------------------//
+    do{ //find out each multiple devices' number
+    
+        devinfo[n].did = probeID(probe, &probe); // probe keeps the devices not looked at yet
+        //logMessage(LcControllerLLevel, "Found device [%d] in cloud probe.", devinfo->did);
+
+        frm = create_lcloud_registers(0, 0 ,LC_DEVINIT ,devinfo[n].did, 0, 0, 0); 
+        rfrm = client_lcloud_bus_request(frm, NULL);
+        extract_lcloud_registers(rfrm, &r);
+        devinfo[n].maxsec = r.d0;
+        devinfo[n].maxblk = r.d1;
+        logMessage(LcControllerLLevel, "Found device [did=%d, secs=%d, blks=%d] in cloud probe.", devinfo[n].did, (int)r.d0, (int)r.d1);
+
+
+        // all blocks of the device start out free
+        lcloud_adddevice(n, devinfo[n].maxsec, devinfo[n].maxblk);
+
+        totalblock += devinfo[n].maxsec * devinfo[n].maxblk;
+    
+        
+        //increment index(next device)
+        n++;
+    }while(n<devicenum);
+
+    ////////////////// file initialize //////////////////////
+    // the file table starts empty and grows as files are added
+    nfiles = 0;
+    nfree = 0;
+    nnames = 0;
+    now = 0;
+    openfiles = 0;
+    allocatedblock = 0;
+    blkreads = 0;
+    blkwrites = 0;
+    cachereads = 0;
+    busxfers = 0;
+    rmwfull = 0;
+    rmwfresh = 0;
+    rmwcached = 0;
+    prefetched = 0;
+    prefetchhits = 0;
+    prefetchwaste = 0;
+    metablkreads = 0;
+    metablkwrites = 0;
+    rebuilt = 0;
+    copyreads = 0;
+    paritywrites = 0;
+    parityreads = 0;
+    lostwrites = 0;
+
+    // files already on the devices (or a new filesystem)
+    if(mountfs() == -1){
+        return -1;
+    }
+
+    return 0;
+}
+
+// Directories
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fsready
+// Description  : power the devices on if they are off and check that the
+//                filesystem on them is mounted (file table lock held)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fsready(void){
+
+    //check if power is off, and poweron
+    if(isDeviceOn == false){
+        lcpoweron();
+    }
+    if(metaon == false && metamode != LC_META_NONE){
+        // the files on the devices could not be loaded, do not write over them
+        logMessage(LOG_ERROR_LEVEL, "Filesystem is not mounted.");
+        return -1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dirio
+// Description  : read or write entry slots of a directory; its data goes
+//                through the block map, cache and journal like a file's,
+//                or stays in memory when the metadata does (the directory
+//                lock is taken here; writes hold the file table lock too)
+//
+// Inputs       : dir - directory, slot - first slot, buf - the slots
+//                n - number of slots, rw - LC_XFER_READ/LC_XFER_WRITE
+// Outputs      : 0 if successful, -1 if failure
+
+int dirio(LcFHandle dir, int slot, char *buf, int n, int rw){
+    filesys *d = &FINFO(dir);
+    uint32_t end = (slot + n) * LC_DIR_ENTRY, cap;
+    char *newdata;
+    int ret = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->type != LC_TYPE_DIR){
+        // removed (lcreaddir reads without the file table lock)
+    }
+    else if(metaon == false){
+        if(rw == LC_XFER_WRITE && end > d->flength){
+            // the buffer holds a power of two pages, doubled when it fills
+            for(cap = LC_DIR_PAGE * LC_DIR_ENTRY; cap < d->flength; cap *= 2);
+            if(end <= cap && d->dirdata != NULL){
+                d->flength = end;
+            }
+            else{
+                for(; cap < end; cap *= 2);
+                if((newdata = (char *)realloc(d->dirdata, cap)) != NULL){
+                    d->dirdata = newdata;
+                    d->flength = end;
+                }
+            }
+        }
+        if(end <= d->flength){
+            if(rw == LC_XFER_READ){
+                memcpy(buf, d->dirdata + slot * LC_DIR_ENTRY, n * LC_DIR_ENTRY);
+            }
+            else{
+                memcpy(d->dirdata + slot * LC_DIR_ENTRY, buf, n * LC_DIR_ENTRY);
+            }
+            ret = n * LC_DIR_ENTRY;
+        }
+    }
+    else if(loadmap(dir) == 0){
+        // directories are never open to the callers, only for this
+        d->isopen = true;
+        d->pos = slot * LC_DIR_ENTRY;
+        if(rw == LC_XFER_READ){
+            ret = readfile(dir, buf, n * LC_DIR_ENTRY);
+        }
+        else{
+            ret = writefile(dir, buf, n * LC_DIR_ENTRY);
+        }
+        d->isopen = false;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return (ret == n * LC_DIR_ENTRY) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pushslot
+// Description  : put a free entry slot of a directory on its free list
+//
+// Inputs       : dir - directory, slot - entry slot
+// Outputs      : 0 if successful, -1 if failure
+
+int pushslot(LcFHandle dir, int slot){
+    filesys *d = &FINFO(dir);
+    int *newlist, newsize;
+
+    if(d->nfreeslots == d->freeslotsize){
+        newsize = (d->freeslotsize == 0) ? 16 : d->freeslotsize * 2;
+        newlist = (int *)realloc(d->freeslots, sizeof(int) * newsize);
+        if(newlist == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed to grow the free slot list of a directory");
+            return -1;
+        }
+        d->freeslots = newlist;
+        d->freeslotsize = newsize;
+    }
+    d->freeslots[d->nfreeslots++] = slot;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : direntry
+// Description  : take the file handle and name out of a directory entry
+//                slot, checking the file it names
+//
+// Inputs       : dir - directory, p - the slot, name - filled with the name
+// Outputs      : file handle, -1 for a free slot or a stale entry
+
+LcFHandle direntry(LcFHandle dir, char *p, char *name){
+    LcFHandle fh;
+    int len;
+
+    fh = lcmeta_get(&p, 4);
+    len = lcmeta_get(&p, 1);
+    if(fh == LC_ROOT){
+        return -1;  // free slot
+    }
+    if(fh < 0 || fh >= nfiles || len == 0 || len > LC_DIR_NAMEMAX || FINFO(fh).type == LC_TYPE_NONE ||
+       FINFO(fh).unlinked == true || FINFO(fh).parent != dir){
+        // left behind by a crash between the directory block and the journal
+        logMessage(LOG_WARNING_LEVEL, "Directory %d has a stale entry for file handle %d", dir, fh);
+        return -1;
+    }
+    memcpy(name, p, len);
+    name[len] = '\0';
+    return fh;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loaddir
+// Description  : read the entries of a directory into the dentry cache the
+//                first time it is looked in; later lookups stay off the bus
+//                (file table lock held)
+//
+// Inputs       : dir - directory
+// Outputs      : 0 if successful, -1 if failure
+
+int loaddir(LcFHandle dir){
+    filesys *d = &FINFO(dir);
+    char page[LC_DIR_PAGE * LC_DIR_ENTRY], name[LC_DIR_NAMEMAX + 1];
+    int slot, nslots, n, i;
+    LcFHandle fh;
+
+    if(d->dirloaded == true){
+        return 0;
+    }
+    STATADD(dirloads, 1);
+    d->nentries = 0;
+    d->nfreeslots = 0;
+    nslots = d->flength / LC_DIR_ENTRY;
+    for(slot = 0; slot < nslots; slot += n){
+        n = (nslots - slot < LC_DIR_PAGE) ? nslots - slot : LC_DIR_PAGE;
+        if(dirio(dir, slot, page, n, LC_XFER_READ) == -1){
+            logMessage(LOG_ERROR_LEVEL, "Failed to read directory %d", dir);
+            return -1;
+        }
+        for(i=0; i<n; i++){
+            fh = direntry(dir, page + i * LC_DIR_ENTRY, name);
+            if(fh != -1 && FINFO(fh).dirslot != -1){
+                logMessage(LOG_WARNING_LEVEL, "Directory %d names file handle %d twice", dir, fh);
+                fh = -1;
+            }
+            if(fh == -1){
+                if(pushslot(dir, slot + i) == -1){
+                    return -1;
+                }
+                continue;
+            }
+            FINFO(fh).fname = strdup(name);
+            FINFO(fh).dirslot = slot + i;
+            if(addname(fh) == -1){
+                return -1;
+            }
+            d->nentries++;
+        }
+    }
+    d->dirloaded = true;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : diradd
+// Description  : write the entry of a file into its directory, in a free
+//                slot or after the last one (file table lock held)
+//
+// Inputs       : fh - file handle (its name and parent set)
+// Outputs      : 0 if successful, -1 if failure
+
+int diradd(LcFHandle fh){
+    LcFHandle dir = FINFO(fh).parent;
+    filesys *d = &FINFO(dir);
+    char entry[LC_DIR_ENTRY], *p = entry;
+    int slot, len = strlen(FINFO(fh).fname);
+
+    slot = (d->nfreeslots > 0) ? d->freeslots[--d->nfreeslots] : d->flength / LC_DIR_ENTRY;
+    memset(entry, 0, LC_DIR_ENTRY);
+    lcmeta_put(&p, fh, 4);
+    lcmeta_put(&p, len, 1);
+    memcpy(p, FINFO(fh).fname, len);
+    if(dirio(dir, slot, entry, 1, LC_XFER_WRITE) == -1){
+        if(slot < d->flength / LC_DIR_ENTRY){
+            pushslot(dir, slot);
+        }
+        logMessage(LOG_ERROR_LEVEL, "Failed to add [%s] to directory %d", FINFO(fh).fname, dir);
+        return -1;
+    }
+    FINFO(fh).dirslot = slot;
+    d->nentries++;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dirremove
+// Description  : clear the entry of a file in its directory (file table
+//                lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : 0 if successful, -1 if failure
+
+int dirremove(LcFHandle fh){
+    LcFHandle dir = FINFO(fh).parent;
+    char entry[LC_DIR_ENTRY];
+
+    memset(entry, 0, LC_DIR_ENTRY);
+    if(dirio(dir, FINFO(fh).dirslot, entry, 1, LC_XFER_WRITE) == -1 || pushslot(dir, FINFO(fh).dirslot) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed to remove [%s] from directory %d", FINFO(fh).fname, dir);
+        return -1;
+    }
+    FINFO(fh).dirslot = -1;
+    FINFO(dir).nentries--;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookupname
+// Description  : find a name in a directory, loading the directory into
+//                the dentry cache first ("." and ".." are the directory
+//                and its parent) (file table lock held)
+//
+// Inputs       : dir - directory, name - name in it
+// Outputs      : file handle, -1 if there is no such file
+
+LcFHandle lookupname(LcFHandle dir, const char *name){
+
+    if(strcmp(name, ".") == 0){
+        return dir;
+    }
+    if(strcmp(name, "..") == 0){
+        return FINFO(dir).parent;
+    }
+    if(loaddir(dir) == -1){
+        return -1;
+    }
+    return findname(dir, name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookuppath
+// Description  : walk a path ('/' separated, from the root) to the
+//                directory holding its last name (file table lock held)
+//
+// Inputs       : path - the path, dir - filled with the directory
+//                leaf - filled with the last name ("" for the root)
+// Outputs      : 0 if successful, -1 if failure
+
+int lookuppath(const char *path, LcFHandle *dir, char *leaf){
+    const char *p = path, *end;
+    LcFHandle d = LC_ROOT, fh;
+    int len;
+
+    leaf[0] = '\0';
+    while(1){
+        while(*p == '/'){
+            p++;
+        }
+        if(*p == '\0'){
+            break;
+        }
+        end = strchr(p, '/');
+        len = (end == NULL) ? strlen(p) : end - p;
+        if(len > LC_DIR_NAMEMAX){
+            logMessage(LOG_ERROR_LEVEL, "Path [%s]: a name is longer than %d bytes", path, LC_DIR_NAMEMAX);
+            return -1;
+        }
+        // the name before this one must be a directory
+        if(leaf[0] != '\0'){
+            if((fh = lookupname(d, leaf)) == -1 || FINFO(fh).type != LC_TYPE_DIR){
+                logMessage(LOG_ERROR_LEVEL, "Path [%s]: [%s] is not a directory", path, leaf);
+                return -1;
+            }
+            d = fh;
+        }
+        memcpy(leaf, p, len);
+        leaf[len] = '\0';
+        p += len;
+    }
+    *dir = d;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : newname
+// Description  : check that a name can be given to a new file or directory
+//
+// Inputs       : name - the name
+// Outputs      : true if it can
+
+bool newname(const char *name){
+    return (name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlinkentry
+// Description  : forget a file or directory taken out of its directory;
+//                with the metadata on the devices its blocks and handle
+//                stay taken until the next checkpoint, which no longer
+//                points at them (file table lock held)
+//
+// Inputs       : fh - file handle
+// Outputs      : none
+
+void unlinkentry(LcFHandle fh){
+
+    logunlink(fh);
+    FLAGSET(fsdirty, true);
+    pthread_mutex_lock(&FINFO(fh).lock);
+    if(metaon == true){
+        FINFO(fh).unlinked = true;
+    }
+    else if(loadmap(fh) == 0){
+        dropfile(fh);
+    }
+    pthread_mutex_unlock(&FINFO(fh).lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : makeentry
+// Description  : make a new file or directory in a directory (file table
+//                lock held, the directory loaded)
+//
+// Inputs       : dir - directory, name - its name, type - LC_TYPE_FILE/DIR
+// Outputs      : file handle if successful, -1 if failure
+
+LcFHandle makeentry(LcFHandle dir, const char *name, int type){
+    LcFHandle fd;
+
+    if(redundm > 0 && redundk + redundm > devicenum){
+        logMessage(LOG_ERROR_LEVEL, "Failed to make [%s]: a group of %d data and %d parity blocks needs as many devices (%d found)",
+            name, redundk, redundm, devicenum);
+        return -1;
+    }
+    if((fd = gethandle()) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed to make [%s]: file table is full", name);
+        return -1;
+    }
+    FINFO(fd).fname = strdup(name);        //save file name
+    FINFO(fd).type = type;
+    setlayout(fd, (type == LC_TYPE_FILE) ? stripewidth : 1); // directories are not striped
+    setredundancy(fd, redundk, redundm);   // (but are redundant, laid out a group per stripe)
+    FINFO(fd).parent = dir;
+    FINFO(fd).fhandle = fd;                //pick unique file handle
+    FINFO(fd).pos = 0;                     //set file pointer to first byte
+    FINFO(fd).flength = 0;
+    //block map
+    FINFO(fd).blkmap = NULL;
+    FINFO(fd).nblks = 0;
+    FINFO(fd).mapsize = 0;
+    FINFO(fd).rapos = -1;
+    FINFO(fd).rawin = 0;
+    FINFO(fd).raend = 0;
+    FINFO(fd).mapexts = 0;
+    FINFO(fd).maploaded = true;
+    FINFO(fd).metadirty = true;
+    FINFO(fd).dirloaded = true;            // a new directory is empty
+    FLAGSET(fsdirty, true);
+
+    // the inode is journaled before the directory entry naming it
+    logcreate(fd);
+    if(diradd(fd) == -1){
+        unlinkentry(fd);
+        return -1;
+    }
+    if(addname(fd) == -1){
+        dirremove(fd);
+        unlinkentry(fd);
+        return -1;
+    }
+    return fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmkdir
+// Description  : make a directory (its parent must exist)
+//
+// Inputs       : path - the directory's path
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmkdir( const char *path ) {
+    char leaf[LC_DIR_NAMEMAX + 1];
+    LcFHandle dir, fh = -1;
+
+    pthread_mutex_lock(&fslock);
+    if(fsready() == 0 && lookuppath(path, &dir, leaf) == 0){
+        if(newname(leaf) == false || lookupname(dir, leaf) != -1){
+            logMessage(LOG_ERROR_LEVEL, "Failed to make directory [%s]: it exists", path);
+        }
+        else if(loaddir(dir) == 0){
+            fh = makeentry(dir, leaf, LC_TYPE_DIR);
+        }
+    }
+    pthread_mutex_unlock(&fslock);
+    if(fh == -1){
+        return -1;
+    }
+    lcLog(LcControllerLLevel, "Made directory [%s], fh=%d.", path, fh);
+    return commitmeta();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcreaddir
+// Description  : list a directory a page of entries at a time, straight
+//                from its blocks (the directory is not kept in memory).
+//                The pages are read holding only the directory's lock; the
+//                file table lock is taken again to check the entries of a
+//                page.
+//
+// Inputs       : path - the directory's path
+//                cookie - slot to go on from (0 to start), moved past the
+//                         entries listed
+//                ents - filled with the entries, max - room in it
+// Outputs      : entries listed (0 at the end), -1 if failure
+
+int lcreaddir( const char *path, uint32_t *cookie, LcDirEntry *ents, int max ) {
+    char page[LC_DIR_PAGE * LC_DIR_ENTRY], leaf[LC_DIR_NAMEMAX + 1];
+    LcFHandle dir, fh;
+    int slot, nslots, n, i, ret, count = 0;
+
+    pthread_mutex_lock(&fslock);
+    if(fsready() == -1 || lookuppath(path, &dir, leaf) == -1 ||
+       (leaf[0] != '\0' && (dir = lookupname(dir, leaf)) == -1) || FINFO(dir).type != LC_TYPE_DIR){
+        pthread_mutex_unlock(&fslock);
+        logMessage(LOG_ERROR_LEVEL, "Failed to read directory [%s]: no such directory", path);
+        return -1;
+    }
+    // the slots there now (entries added meanwhile are listed on the next call)
+    pthread_mutex_lock(&FINFO(dir).lock);
+    nslots = FINFO(dir).flength / LC_DIR_ENTRY;
+    pthread_mutex_unlock(&FINFO(dir).lock);
+    pthread_mutex_unlock(&fslock);
+
+    for(slot = *cookie; slot < nslots && count < max; ){
+        n = (nslots - slot < LC_DIR_PAGE) ? nslots - slot : LC_DIR_PAGE;
+        ret = dirio(dir, slot, page, n, LC_XFER_READ);
+        pthread_mutex_lock(&fslock);
+        if(FINFO(dir).type != LC_TYPE_DIR || FINFO(dir).unlinked == true){
+            // removed while it was read (so it was empty)
+            pthread_mutex_unlock(&fslock);
+            break;
+        }
+        if(ret == -1){
+            pthread_mutex_unlock(&fslock);
+            logMessage(LOG_ERROR_LEVEL, "Failed to read directory [%s]", path);
+            return -1;
+        }
+        for(i=0; i<n && count < max; i++, slot++){
+            if((fh = direntry(dir, page + i * LC_DIR_ENTRY, ents[count].name)) == -1){
+                continue;
+            }
+            ents[count].fh = fh;
+            ents[count].isdir = (FINFO(fh).type == LC_TYPE_DIR);
+            ents[count].length = STATGET(FINFO(fh).flength); // (a write may be growing it)
+            count++;
+        }
+        pthread_mutex_unlock(&fslock);
+    }
+    *cookie = slot;
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : removable
+// Description  : check that a file can be removed: not open, and a
+//                directory must be empty (file table lock held)
+//
+// Inputs       : fh - file handle, path - its path (for the messages)
+// Outputs      : true if it can
+
+bool removable(LcFHandle fh, const char *path){
+    bool open;
+
+    if(FINFO(fh).type == LC_TYPE_DIR){
+        if(loaddir(fh) == -1 || FINFO(fh).nentries > 0){
+            logMessage(LOG_ERROR_LEVEL, "Failed to remove [%s]: directory is not empty", path);
+            return false;
+        }
+        return true;
+    }
+    pthread_mutex_lock(&FINFO(fh).lock);
+    open = FINFO(fh).isopen;
+    pthread_mutex_unlock(&FINFO(fh).lock);
+    if(open == true){
+        logMessage(LOG_ERROR_LEVEL, "Failed to remove [%s]: file is open", path);
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcunlink
+// Description  : remove a file that is not open, or an empty directory
+//
+// Inputs       : path - its path
+// Outputs      : 0 if successful, -1 if failure
+
+int lcunlink( const char *path ) {
+    char leaf[LC_DIR_NAMEMAX + 1];
+    LcFHandle dir, fh = -1;
+    int ret = -1;
+
+    pthread_mutex_lock(&fslock);
+    if(fsready() == 0 && lookuppath(path, &dir, leaf) == 0){
+        if(newname(leaf) == false || (fh = lookupname(dir, leaf)) == -1){
+            logMessage(LOG_ERROR_LEVEL, "Failed to remove [%s]: no such file", path);
+        }
+        else if(removable(fh, path) == true && dirremove(fh) == 0){
+            removename(fh);
+            unlinkentry(fh);
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&fslock);
+    if(ret == -1){
+        return -1;
+    }
+    lcLog(LcControllerLLevel, "Removed [%s], fh=%d.", path, fh);
+    return commitmeta();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcrename
+// Description  : move a file or directory to a new path, replacing a file
+//                that is there (its handle stays the same)
+//
+// Inputs       : from - its path, to - the new path
+// Outputs      : 0 if successful, -1 if failure
+
+int lcrename( const char *from, const char *to ) {
+    char sleaf[LC_DIR_NAMEMAX + 1], dleaf[LC_DIR_NAMEMAX + 1], *name;
+    LcFHandle sdir, ddir, fh = -1, old, d;
+    int ret = -1;
+
+    pthread_mutex_lock(&fslock);
+    if(fsready() == -1 || lookuppath(from, &sdir, sleaf) == -1 || lookuppath(to, &ddir, dleaf) == -1){
+        pthread_mutex_unlock(&fslock);
+        return -1;
+    }
+    if(newname(sleaf) == false || (fh = lookupname(sdir, sleaf)) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed to rename [%s]: no such file", from);
+    }
+    else if(newname(dleaf) == false || loaddir(ddir) == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed to rename [%s] to [%s]", from, to);
+    }
+    else{
+        // a directory cannot go inside itself
+        for(d = ddir; d != LC_ROOT && d != fh; d = FINFO(d).parent);
+        old = findname(ddir, dleaf);
+        if(d == fh){
+            logMessage(LOG_ERROR_LEVEL, "Failed to rename [%s] to [%s]: it is inside it", from, to);
+        }
+        else if(old == fh){
+            ret = 0;
+        }
+        else if(old != -1 && (FINFO(old).type == LC_TYPE_DIR || FINFO(fh).type == LC_TYPE_DIR)){
+            logMessage(LOG_ERROR_LEVEL, "Failed to rename [%s] to [%s]: it exists", from, to);
+        }
+        else if(old == -1 || (removable(old, to) == true && dirremove(old) == 0)){
+            if(old != -1){
+                removename(old);
+                unlinkentry(old);
+            }
+            // out of the old directory, into the new one
+            name = strdup(dleaf);
+            if(name == NULL || dirremove(fh) == -1){
+                free(name);
+            }
+            else{
+                removename(fh);
+                pthread_mutex_lock(&FINFO(fh).lock);
+                free(FINFO(fh).fname);
+                FINFO(fh).fname = name;
+                FINFO(fh).parent = ddir;
+                FINFO(fh).metadirty = true;
+                pthread_mutex_unlock(&FINFO(fh).lock);
+                FLAGSET(fsdirty, true);
+                logmove(fh);
+                if(diradd(fh) == 0 && addname(fh) == 0){
+                    ret = 0;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&fslock);
+    if(ret == -1){
+        return -1;
+    }
+    lcLog(LcControllerLLevel, "Renamed [%s] to [%s], fh=%d.", from, to, fh);
+    return commitmeta();
+}
+
+// File system interface implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openfile
+// Description  : Open the file for for reading and writing
+//
+// Inputs       : path - the path/filename of the file to be read
+// Outputs      : file handle if successful test, -1 if failure
+
+LcFHandle openfile( const char *path ) {
+
+    char leaf[LC_DIR_NAMEMAX + 1];
+    LcFHandle dir;
+    int fd=0;
+
+    pthread_mutex_lock(&fslock);
+    if(fsready() == -1 || lookuppath(path, &dir, leaf) == -1 || loaddir(dir) == -1){
+        pthread_mutex_unlock(&fslock);
+        logMessage(LOG_ERROR_LEVEL, "Failed to open [%s]", path);
+        return -1;
+    }
+
+    //check if opening the file again (file keeps its data and block map)
+    fd = (leaf[0] == '\0') ? dir : lookupname(dir, leaf);
+    if(fd != -1 && FINFO(fd).type == LC_TYPE_DIR){
+        pthread_mutex_unlock(&fslock);
+        logMessage(LOG_ERROR_LEVEL, "Failed to open [%s]: it is a directory", path);
+        return -1;
+    }
+    if(fd != -1){
+        pthread_mutex_lock(&FINFO(fd).lock);
+        if(FINFO(fd).isopen == true){
+            pthread_mutex_unlock(&FINFO(fd).lock);
+            pthread_mutex_unlock(&fslock);
+            logMessage(LOG_ERROR_LEVEL, "File is already opened.\n\n");
+            return -1;
+        }
+        if(loadmap(fd) == -1){
+            pthread_mutex_unlock(&FINFO(fd).lock);
+            pthread_mutex_unlock(&fslock);
+            return -1;
+        }
+        FINFO(fd).isopen = true;
+        STATADD(openfiles, 1);
+        FINFO(fd).pos = 0;
+        FINFO(fd).rapos = -1;
+        FINFO(fd).rawin = 0;
+        FINFO(fd).raend = 0;
+        pthread_mutex_unlock(&FINFO(fd).lock);
+        pthread_mutex_unlock(&fslock);
+        lcLog(LcControllerLLevel, "Reopened file [%s], fh=%d.", path, fd);
+        return(fd);
+    }
+
+    //if we are opening another file, make it in its directory
+    if(newname(leaf) == false || (fd = makeentry(dir, leaf, LC_TYPE_FILE)) == -1){
+        pthread_mutex_unlock(&fslock);
+        logMessage(LOG_ERROR_LEVEL, "Failed to open [%s]", path);
+        return -1;
+    }
+    FINFO(fd).isopen = true;
+    STATADD(openfiles, 1);
+    pthread_mutex_unlock(&fslock);
+
+    lcLog(LcControllerLLevel, "Opened new file [%s], fh=%d.", path, fd);
+
+    return(fd);
+} 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcopen
+// Description  : Open the file for for reading and writing
+//
+// Inputs       : path - the path/filename of the file to be read
+// Outputs      : file handle if successful test, -1 if failure
+
+LcFHandle lcopen( const char *path ) {
+    uint64_t start = lcmetrics_now();
+    LcFHandle fd;
+
+    fd = openfile(path);
+    lcmetrics_record(LC_MET_OPEN, lcmetrics_now() - start);
+    return(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readfile
+// Description  : Read data from the file (file lock held)
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+// Outputs      : number of bytes read, -1 if failure
+
+int readfile( LcFHandle fh, char *buf, size_t len ) {
+
+    uint32_t readbytes, filepos;
+    uint16_t offset, remaining, size;
+    char missdata[LC_XFER_MAXREQ][LC_DEVICE_BLOCK_SIZE];
+    char *missbuf[LC_XFER_MAXREQ];         // where each missed block's bytes go
+    uint16_t missoff[LC_XFER_MAXREQ], misssize[LC_XFER_MAXREQ];
+    xferblk miss[LC_XFER_MAXREQ];          // blocks to read from the devices
+    char cacheblk[LC_DEVICE_BLOCK_SIZE];
+    blockloc *loc;
+    int nmiss = 0, i;
+    
+    /*************Error Checking****************/
+
+    //check if file handle is valid (is associated with open file)
+    if(FINFO(fh).isopen == false){
+        logMessage(LOG_ERROR_LEVEL, "Failed to read: file handle is not valid or file is not opened");
+        return -1;
+    }
+    //check length to if it is valid
+    if(len < 0){
+        logMessage(LOG_ERROR_LEVEL, "Failed to read: length is not valid");
+        return -1;
+    }
+    //check if reading exceeds end of the file
+    if(FINFO(fh).pos+len > FINFO(fh).flength){
+        logMessage(LOG_ERROR_LEVEL, "Reading exceeds end of the file");
+        return -1;
+    }
+
+    filepos = FINFO(fh).pos;
+    readbytes = len;
+
+
+    /////////////// begin reading ////////////////////
+
+    while( readbytes > 0){
+
+        loc = &FINFO(fh).blkmap[dataslot(fh, filepos / LC_DEVICE_BLOCK_SIZE)];  // block holding filepos
+
+        offset = filepos % LC_DEVICE_BLOCK_SIZE; //e.g. 50%256 = 50,  500%256 = 244 (1block and 244bytes)
+        remaining = LC_DEVICE_BLOCK_SIZE - offset;  //e.g. 256-(500%256) = 12
+
+
+        //if exceeds the len we will write will be the remaining
+        if(readbytes < remaining){
+            size = readbytes;
+        }
+        else{
+            size = remaining;
+        }
+
+        // a block never written (reserved ahead) holds zeros
+        if(loc->written == false){
+            memset(buf, 0x0, size);
+        }
+        // if found in cache, get it
+        else if(lcloud_readcache(loc->did, loc->sec, loc->blk, cacheblk)){
+            memcpy(buf, cacheblk+offset, size);
+            STATADD(cachereads, 1);
+            if(loc->prefetched == true){
+                // read-ahead paid off, open the window further
+                STATADD(prefetchhits, 1);
+                FINFO(fh).rawin *= 2;
+            }
+        }
+        else{
+            // gather it, the missed blocks are read together below
+            miss[nmiss].loc = loc;
+            miss[nmiss].data = missdata[nmiss];
+            missbuf[nmiss] = buf;
+            missoff[nmiss] = offset;
+            misssize[nmiss] = size;
+            nmiss++;
+            if(loc->prefetched == true){
+                // read ahead but evicted before it was used, the cache is
+                // too busy for this stream so start detecting it again
+                STATADD(prefetchwaste, 1);
+                FINFO(fh).rawin = 0;
+                FINFO(fh).rapos = -1;
+            }
+        }
+        loc->prefetched = false;
+    
+        /////// update position, readbytes, and buf offset //////
+        filepos += size;
+        readbytes -= size;
+        buf += size;
+        STATADD(devinfo[loc->dev].devread, size);
+        STATADD(devinfo[loc->dev].numread, 1);
+
+        FINFO(fh).pos = filepos;
+
+        // read the gathered blocks, copy up to len to the buf, and cache them
+        if(nmiss > 0 && (nmiss == LC_XFER_MAXREQ || readbytes == 0)){
+            if(readblocks(fh, miss, nmiss) == -1){
+                return -1;
+            }
+            for(i=0; i<nmiss; i++){
+                memcpy(missbuf[i], miss[i].data+missoff[i], misssize[i]);
+                lcloud_putcache(miss[i].loc->did, miss[i].loc->sec, miss[i].loc->blk, miss[i].data);
+            }
+            nmiss = 0;
+        }
+    }
+
+    // read the following blocks ahead if the file is read sequentially
+    // (not directories, their pages are read once when they are loaded)
+    if(len > 0 && FINFO(fh).type == LC_TYPE_FILE && readahead(fh, filepos - len) == -1){
+        return -1;
+    }
+
+    lcLog(LcDriverLLevel, "Driver read %d bytes to file %s", len, FINFO(fh).fname, FINFO(fh).flength);
+    return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcread
+// Description  : Read data from the file 
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+// Outputs      : number of bytes read, -1 if failure
+
+int lcread( LcFHandle fh, char *buf, size_t len ) {
+    uint64_t start = lcmetrics_now();
+    int ret;
+
+    if(fh < 0 || fh >= STATGET(nfiles)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to read: file handle is not valid or file is not opened");
+        return -1;
+    }
+    pthread_mutex_lock(&FINFO(fh).lock);
+    ret = readfile(fh, buf, len);
+    pthread_mutex_unlock(&FINFO(fh).lock);
+    lcmetrics_record(LC_MET_READ, lcmetrics_now() - start);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writefile
+// Description  : write data to the file (file lock held)
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+// Outputs      : number of bytes written if successful test, -1 if failure
+
+int writefile( LcFHandle fh, char *buf, size_t len ) {
+
+    uint64_t writebytes, filepos;
     uint16_t offset, remaining, size;
-    char tempbuf[LC_DEVICE_BLOCK_SIZE];
-    prevfilesnow = readnow; // save last block point
+    char newdata[LC_XFER_MAXREQ][LC_DEVICE_BLOCK_SIZE];
+    char *src[LC_XFER_MAXREQ];             // where each block's new bytes come from
+    uint16_t off[LC_XFER_MAXREQ], sz[LC_XFER_MAXREQ];
+    int slot[LC_XFER_MAXREQ];              // block map index (the map can grow meanwhile)
+    bool needread[LC_XFER_MAXREQ];         // old contents must come from the device
+    bool fresh[LC_XFER_MAXREQ];            // first write of the block (journaled once written)
+    xferblk rmw[LC_XFER_MAXREQ], out[LC_XFER_MAXREQ];
+    int absorbed, n = 0, nrmw, nout, i, j, oldnblks;
+    uint64_t oldlength;
+    blockloc *loc;
+    
+
+    /*************Error Checking****************/
+
+    //check if file handle is valid (is associated with open file)
+    if(FINFO(fh).fhandle != fh || FINFO(fh).isopen == false){
+        logMessage(LOG_ERROR_LEVEL, "Failed to write: file handle is not valid or file is not opened");
+        return -1;
+    }
+    //check length to if it is valid
+    if(len < 0){
+        logMessage(LOG_ERROR_LEVEL, "Failed to write: length is not valid");
+        return -1;
+    }
+    
+    /******************Begin Writing********************/
+    writebytes = len;
+    filepos = FINFO(fh).pos;
+    FINFO(fh).metadirty = true;  // length, blocks or written flags change
+    FLAGSET(fsdirty, true);
+    oldnblks = FINFO(fh).nblks;
+    oldlength = FINFO(fh).flength;
+
+    // allocate the blocks up to the end of the write at once (appending or
+    // writing past the end), so they are reserved as extents sized for it
+    if(len > 0 && allocblocks(fh, (filepos + len + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE) == -1){
+        return -1;
+    }
+    // the blocks of a redundant file's new groups are journaled (unwritten)
+    // right away: its parity blocks are written ahead of the data blocks
+    // before them in the map, and a replay maps blocks in order
+    if(FINFO(fh).npar > 0 && FINFO(fh).nblks > oldnblks){
+        logextents(fh, oldnblks, FINFO(fh).nblks - oldnblks);
+        oldnblks = FINFO(fh).nblks;
+    }
+
+    while(writebytes > 0){
+
+        // when seek brings back to position where already written
+        if(filepos < FINFO(fh).flength){
+            lcLog(LOG_INFO_LEVEL, "file overwrites from pos:%d", filepos);
+        }
+
+        loc = &FINFO(fh).blkmap[dataslot(fh, filepos / LC_DEVICE_BLOCK_SIZE)];  // block holding filepos
+
+        offset = filepos % LC_DEVICE_BLOCK_SIZE;  //e.g. 50%256 = 50,  500%256 = 244 (1block and 244bytes)
+        remaining = LC_DEVICE_BLOCK_SIZE - offset;  //e.g. 256-(500%256) = 12
+
+
+        //if exceeds the len we will write will be the remaining
+        if(writebytes < remaining){
+            size = writebytes;
+        }
+        else{
+            size = remaining;
+        }
+
+        // get the old block contents; the device is only read (below, with
+        // the step's other partial blocks) when part of the block is kept and
+        // nothing else has a copy
+        needread[n] = false;
+        if(size == LC_DEVICE_BLOCK_SIZE){
+            STATADD(rmwfull, 1);  // whole block is overwritten, nothing to keep
+        }
+        else if(lcloud_readcache(loc->did, loc->sec, loc->blk, newdata[n])){
+            STATADD(rmwcached, 1); // cached copy may be newer than the device
+        }
+        else if(loc->written == false){
+            memset(newdata[n], 0x0, LC_DEVICE_BLOCK_SIZE); // fresh block, zero-fill locally
+            STATADD(rmwfresh, 1);
+        }
+        else{
+            needread[n] = true; //read to find offset
+        }
+        fresh[n] = (loc->written == false);
+        slot[n] = dataslot(fh, filepos / LC_DEVICE_BLOCK_SIZE);
+        src[n] = buf;
+        off[n] = offset;
+        sz[n] = size;
+        n++;
+        
+
+        ////////update pos, decrease len used (bytesleft to write), update buffer after written///////////////////
+        filepos += size; 
+        writebytes -= size;
+        buf += size;
+        STATADD(devinfo[loc->dev].devwritten, size); // plus amount of overwritten
+        STATADD(devinfo[loc->dev].numwritten, 1);
+    
+
+        // if position exceeds the size of the file then increase file size to current position
+        if(filepos > FINFO(fh).flength){
+            FINFO(fh).flength = filepos;
+        }
+      
+        FINFO(fh).pos = filepos;
+
+        // read the partial blocks, put the data at the offsets, and write the
+        // blocks back (unless the write-back cache holds them dirty) as batches
+        if(n == LC_XFER_MAXREQ || writebytes == 0){
+            for(i=0, nrmw=0; i<n; i++){
+                if(needread[i] == true){
+                    rmw[nrmw].loc = &FINFO(fh).blkmap[slot[i]];
+                    rmw[nrmw].data = newdata[i];
+                    nrmw++;
+                }
+            }
+            if(readblocks(fh, rmw, nrmw) == -1){
+                return -1;
+            }
+            for(i=0; i<n; i++){
+                memcpy(newdata[i]+off[i], src[i], sz[i]);
+            }
+            // the parity goes first: a block of a group it rebuilds
+            // (degraded) must come from the blocks as they were
+            if(FINFO(fh).npar > 0 && writeparity(fh, slot, newdata, n) == -1){
+                return -1;
+            }
+            for(i=0, nout=0; i<n; i++){
+                loc = &FINFO(fh).blkmap[slot[i]];
+                if((absorbed = lcloud_dirtycache(loc->did, loc->sec, loc->blk, newdata[i], FINFO(fh).npar)) == -1){
+                    return -1;
+                }
+                if(absorbed == 0){
+                    out[nout].loc = loc;
+                    out[nout].data = newdata[i];
+                    nout++;
+                }
+                loc->written = true;
+            }
+            // a redundant file's blocks on failed devices are left out, the
+            // parity written for them brings them back while their groups
+            // have enough blocks left, counted after all the transfers
+            xferblocks(out, nout, LC_XFER_WRITE);
+            if(lostgroups(fh, slot, n) == -1){
+                return -1;
+            }
+
+            // journal the blocks written for the first time, now that their
+            // data is out (a run of them at a time)
+            for(i=0; i<n; i+=j){
+                for(j=1; i+j<n && fresh[i+j] == fresh[i] && slot[i+j] == slot[i]+j; j++);
+                if(fresh[i] == true){
+                    logextents(fh, slot[i], j);
+                }
+            }
+            n = 0;
+        }
+    }
+
+    // blocks allocated but left unwritten (writing past the end) and the length
+    for(i=oldnblks; i<FINFO(fh).nblks; i=j+1){
+        for(j=i; j<FINFO(fh).nblks && FINFO(fh).blkmap[j].written == false; j++);
+        if(j > i){
+            logextents(fh, i, j - i);
+        }
+    }
+    if(FINFO(fh).flength != oldlength){
+        loglength(fh);
+    }
+    
+    lcLog(LcDriverLLevel, "Driver wrote %d bytes to file %s (now %d bytes)", len, FINFO(fh).fname, FINFO(fh).flength);
+    return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwrite
+// Description  : write data to the file
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+// Outputs      : number of bytes written if successful test, -1 if failure
+
+int lcwrite( LcFHandle fh, char *buf, size_t len ) {
+    uint64_t start = lcmetrics_now();
+    int ret;
+
+    if(fh < 0 || fh >= STATGET(nfiles)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to write: file handle is not valid or file is not opened");
+        return -1;
+    }
+    pthread_mutex_lock(&FINFO(fh).lock);
+    ret = writefile(fh, buf, len);
+    pthread_mutex_unlock(&FINFO(fh).lock);
+    lcmetrics_record(LC_MET_WRITE, lcmetrics_now() - start);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcreadat
+// Description  : Read data from a position of the file (seek and read as
+//                one step, so other threads cannot move the position between)
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+//                off - position to read from
+// Outputs      : number of bytes read, -1 if failure
+
+int lcreadat( LcFHandle fh, char *buf, size_t len, size_t off ) {
+    uint64_t start = lcmetrics_now();
+    int ret;
+
+    if(fh < 0 || fh >= STATGET(nfiles)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to read: file handle is not valid or file is not opened");
+        return -1;
+    }
+    pthread_mutex_lock(&FINFO(fh).lock);
+    if(FINFO(fh).isopen == true){
+        FINFO(fh).pos = off;
+    }
+    ret = readfile(fh, buf, len);
+    pthread_mutex_unlock(&FINFO(fh).lock);
+    lcmetrics_record(LC_MET_READ, lcmetrics_now() - start);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwriteat
+// Description  : Write data at a position of the file (seek and write as
+//                one step)
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+//                off - position to write at
+// Outputs      : number of bytes written if successful test, -1 if failure
+
+int lcwriteat( LcFHandle fh, char *buf, size_t len, size_t off ) {
+    uint64_t start = lcmetrics_now();
+    int ret;
+
+    if(fh < 0 || fh >= STATGET(nfiles)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to write: file handle is not valid or file is not opened");
+        return -1;
+    }
+    pthread_mutex_lock(&FINFO(fh).lock);
+    if(FINFO(fh).isopen == true){
+        FINFO(fh).pos = off;
+    }
+    ret = writefile(fh, buf, len);
+    pthread_mutex_unlock(&FINFO(fh).lock);
+    lcmetrics_record(LC_MET_WRITE, lcmetrics_now() - start);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : seekfile
+// Description  : Seek to a specific place in the file
+//
+// Inputs       : fh - the file handle of the file to seek in
+//                off - offset within the file to seek to
+// Outputs      : 0 if successful test, -1 if failure
 
-    memset(tempbuf, 0x0, LC_DEVICE_BLOCK_SIZE);
-    
-    /*************Error Checking****************/
+int seekfile( LcFHandle fh, size_t off ) {
+    int pos;
 
-    //check if file handle is valid (is associated with open file)
-    if(fh < 0 || finfo[fh].isopen == false){
-        logMessage(LOG_ERROR_LEVEL, "Failed to read: file handle is not valid or file is not opened");
-        return -1;
-    }
-    //check length to if it is valid
-    if(len < 0){
-        logMessage(LOG_ERROR_LEVEL, "Failed to read: length is not valid");
+    if(fh < 0 || fh >= STATGET(nfiles)){
+        logMessage(LOG_ERROR_LEVEL, "file failed to seek in");
         return -1;
     }
-    //check if reading exceeds end of the file
-    if(finfo[fh].pos+len > finfo[fh].flength){
-        logMessage(LOG_ERROR_LEVEL, "Reading exceeds end of the file");
+    pthread_mutex_lock(&FINFO(fh).lock);
+    if(FINFO(fh).isopen == false || isDeviceOn == false || FINFO(fh).flength < 0 /*||(FINFO(fh).pos + off) > FINFO(fh).flength*/){
+        pthread_mutex_unlock(&FINFO(fh).lock);
+        logMessage(LOG_ERROR_LEVEL, "file failed to seek in");
         return -1;
     }
-
-    int start = finfo[fh].flength - finfo[fh].pos;
-    if(len > start){
-        len = start;
+    if(FINFO(fh).flength < off){
+        logMessage(LOG_ERROR_LEVEL, "Seeking out of file [%d < %d]", FINFO(fh).flength, off);
     }
 
-    filepos = finfo[fh].pos;
-    readbytes = len;
-
+    lcLog(LcDriverLLevel, "Seeking to position %d in file handle %d [%s]", off, fh, FINFO(fh).fname);
+    FINFO(fh).pos = off;
+    pos = FINFO(fh).pos;
+    pthread_mutex_unlock(&FINFO(fh).lock);
 
-    /////////////// begin reading ////////////////////
+    return( pos ); //fix this 
+}
 
-    while( readbytes > 0){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcseek
+// Description  : Seek to a specific place in the file
+//
+// Inputs       : fh - the file handle of the file to seek in
+//                off - offset within the file to seek to
+// Outputs      : new position if successful, -1 if failure
 
-        findsamefileblock(readnow, fh);  
+int lcseek( LcFHandle fh, size_t off ) {
+    uint64_t start = lcmetrics_now();
+    int pos;
 
-        offset = filepos % LC_DEVICE_BLOCK_SIZE; //e.g. 50%256 = 50,  500%256 = 244 (1block and 244bytes)
-        remaining = LC_DEVICE_BLOCK_SIZE - offset;  //e.g. 256-(500%256) = 12
+    pos = seekfile(fh, off);
+    lcmetrics_record(LC_MET_SEEK, lcmetrics_now() - start);
+    return( pos );
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcfallocate
+// Description  : Allocate the blocks of the first len bytes of the file
+//                ahead of the writes, as contiguous extents; the blocks read
+//                as zeros until written and the length is left as it is
+//
+// Inputs       : fh - the file handle, len - bytes to allocate blocks for
+// Outputs      : 0 if successful test, -1 if failure
 
-        //if exceeds the len we will write will be the remaining
-        if(readbytes < remaining){
-            size = readbytes;
-        }
-        else{
-            size = remaining;
+int lcfallocate( LcFHandle fh, size_t len ) {
+    int oldnblks, ret = -1;
+
+    if(fh >= 0 && fh < STATGET(nfiles)){
+        pthread_mutex_lock(&FINFO(fh).lock);
+        if(FINFO(fh).isopen == true){
+            oldnblks = FINFO(fh).nblks;
+            ret = allocblocks(fh, (len + LC_DEVICE_BLOCK_SIZE - 1) / LC_DEVICE_BLOCK_SIZE);
+            if(FINFO(fh).nblks > oldnblks){
+                FINFO(fh).metadirty = true;
+                FLAGSET(fsdirty, true);
+                logextents(fh, oldnblks, FINFO(fh).nblks - oldnblks);
+            }
         }
+        pthread_mutex_unlock(&FINFO(fh).lock);
+    }
+    if(ret == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed to allocate %lu bytes of file handle %d", (unsigned long)len, fh);
+        return( ret );
+    }
 
-        // if found in cache, get it
-        if(findcache(devinfo[readnow].did, devinfo[readnow].rsec, devinfo[readnow].rblk) != 0){
-            memcpy(tempbuf, lcloud_getcache(devinfo[readnow].did, devinfo[readnow].rsec, devinfo[readnow].rblk), 256);
-            memcpy(buf, tempbuf+offset, size);
-        }
+    // the new extents go to the journal
+    return( commitmeta() );
+}
 
-        /************ if read exceeds the block size (256) *************/
-        else if(offset + readbytes >= LC_DEVICE_BLOCK_SIZE){
-            // read, and copy up to len to the buf
-            do_read(devinfo[readnow].did, devinfo[readnow].rsec, devinfo[readnow].rblk, tempbuf);
-            memcpy(buf, tempbuf+offset, size); 
-        }
-        else{
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetreadahead
+// Description  : Set the largest sequential read-ahead window
+//
+// Inputs       : maxblocks - window size in blocks, 0 disables read-ahead
+// Outputs      : 0 if successful test, -1 if failure
 
-            // read, and copy up to len to the buf
-            do_read(devinfo[readnow].did, devinfo[readnow].rsec, devinfo[readnow].rblk, tempbuf);
-            memcpy(buf, tempbuf+offset, size);
-        }
-    
-        /////// update position, readbytes, and buf offset //////
-        filepos += size;
-        readbytes -= size;
-        buf += size;
-        devinfo->devread += size;
-        finfo[fh].rfnow = readnow;      
+int lcsetreadahead( int maxblocks ) {
 
+    if(maxblocks < 0){
+        logMessage(LOG_ERROR_LEVEL, "Bad read-ahead window %d", maxblocks);
+        return -1;
+    }
+    ramax = maxblocks;
+    return( 0 );
+}
 
-        //nextdevice(&readnow);
-    
-        
-        // if position exceeds the size of the file then increase file size to current position
-        if(filepos > finfo[fh].flength){
-            finfo[fh].flength = filepos;
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetxferbatch
+// Description  : Set the most blocks moved by one bus request; above 1 the
+//                driver sends vectored transfers (needs lcloud_localserver)
+//
+// Inputs       : maxblocks - 1 (single block transfers) to LC_XFERV_MAXBLOCKS
+// Outputs      : 0 if successful test, -1 if failure
 
-        finfo[fh].pos = filepos;
+int lcsetxferbatch( int maxblocks ) {
 
+    if(maxblocks < 1 || maxblocks > LC_XFERV_MAXBLOCKS){
+        logMessage(LOG_ERROR_LEVEL, "Bad transfer batch size %d (1-%d)", maxblocks, LC_XFERV_MAXBLOCKS);
+        return -1;
     }
+    xfermax = maxblocks;
+    return( 0 );
+}
 
-    logMessage(LcDriverLLevel, "Driver read %d bytes to file %s", len, finfo[fh].fname, finfo[fh].flength);
-    return( len );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetstripe
+// Description  : Set the layout of the files created from then on: their
+//                blocks go in stripe units of unit blocks to width devices
+//                in turn (RAID-0 style), each device's share kept in extents
+//
+// Inputs       : width - stripe width in devices (1 = no striping, 0 = all)
+//                unit - stripe unit in blocks
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcsetstripe( int width, int unit ) {
+
+    if(width < 0 || width > LC_META_MAXDEVS || unit < 1 || unit > 0xffff){
+        logMessage(LOG_ERROR_LEVEL, "Bad stripe layout [width %d, unit %d blocks]", width, unit);
+        return -1;
+    }
+    stripewidth = width;
+    stripeunit = unit;
+    return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcwrite
-// Description  : write data to the file
+// Function     : lcsetredundancy
+// Description  : Make the files and directories created from then on keep
+//                m parity blocks for every k data blocks (Reed-Solomon), on
+//                k+m different devices, so they survive m failed devices;
+//                with k = 1 the parity blocks are copies (m+1 way mirror)
 //
-// Inputs       : fh - file handle for the file to write to
-//                buf - pointer to data to write
-//                len - the length of the write
-// Outputs      : number of bytes written if successful test, -1 if failure
+// Inputs       : k - data blocks of a group, m - parity blocks (0 = none)
+// Outputs      : 0 if successful test, -1 if failure
 
-int lcwrite( LcFHandle fh, char *buf, size_t len ) {
+int lcsetredundancy( int k, int m ) {
 
-    uint64_t writebytes, filepos;
-    uint16_t offset, remaining, size;
-    char tempbuf[LC_DEVICE_BLOCK_SIZE];
-    prevfilesnow = now; // save last block point
-    
-    
+    if(k < 1 || m < 0 || k + m > LC_EC_MAXBLOCKS || k + m > LC_META_MAXDEVS){
+        logMessage(LOG_ERROR_LEVEL, "Bad redundancy [%d data, %d parity blocks]", k, m);
+        return -1;
+    }
+    redundk = k;
+    redundm = m;
+    return( 0 );
+}
 
-    /*************Error Checking****************/
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcfaildevice
+// Description  : Make a device fail its block transfers (or work again),
+//                on servers that can (LC_DEVICE_FAULT); the filesystem puts
+//                it in the errored state at its first failed transfer and
+//                keeps it there until power off
+//
+// Inputs       : dev - device index, fail - 1 to fail it, 0 to bring it back
+// Outputs      : 0 if successful test, -1 if failure
 
-    //check if file handle is valid (is associated with open file)
-    if(finfo[fh].fhandle != fh || fh < 0 || finfo[fh].isopen == false){
-        logMessage(LOG_ERROR_LEVEL, "Failed to write: file handle is not valid or file is not opened");
+int lcfaildevice( int dev, int fail ) {
+    LCloudRegisterFrame frm, rfrm;
+    lcregs r;
+
+    pthread_mutex_lock(&fslock);
+    if(isDeviceOn == false || dev < 0 || dev >= devicenum){
+        pthread_mutex_unlock(&fslock);
+        logMessage(LOG_ERROR_LEVEL, "No device with index %d", dev);
         return -1;
     }
-    //check length to if it is valid
-    if(len < 0){
-        logMessage(LOG_ERROR_LEVEL, "Failed to write: length is not valid");
+    frm = create_lcloud_registers(0, 0, LC_DEVICE_FAULT, devinfo[dev].did, 0, (fail != 0), 0);
+    rfrm = client_lcloud_bus_request(frm, NULL);
+    pthread_mutex_unlock(&fslock);
+    if((rfrm == -1) || (extract_lcloud_registers(rfrm, &r)) || (r.b0 != 1) || (r.b1 != 1)){
+        logMessage(LOG_ERROR_LEVEL, "The server cannot fail device %d (id %d)", dev, devinfo[dev].did);
         return -1;
     }
-    
-    /******************Begin Writing********************/
-    writebytes = len;;
-    filepos = finfo[fh].pos;
-
-
-    while(writebytes > 0){
-        
-        getfreeblk(now, fh);   // find empty block within the passed device
+    lcLog(LcDriverLLevel, "Device %d (id %d) %s", dev, devinfo[dev].did, (fail != 0) ? "fails from now on" : "works again");
+    return( 0 );
+}
 
-        if(devinfo[now].storage[devinfo[now].sec][devinfo[now].blk] == 0){  //if writing first time on that blk
-            devinfo[now].filepostracker[devinfo[now].sec][devinfo[now].blk] = filepos; //each blk remembers filepos (beginning)
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetmetadata
+// Description  : Set how the filesystem metadata is kept on the devices,
+//                from the next power on
+//
+// Inputs       : mode - LC_META_NONE, LC_META_LOAD or LC_META_FORMAT
+// Outputs      : 0 if successful test, -1 if failure
 
-        // if there's block has some space left, go back to device that file lastly wrote
-        if(devinfo[finfo[fh].wfnow].storage[finfo[fh].fsec][finfo[fh].fblk] == 1){
-            now = finfo[fh].wfnow;
-            findnextfreedev = true;
-        }
+int lcsetmetadata( int mode ) {
 
-        // just in case of F-15 off=925 sz=298  -> when there's block file did not finish writing but skip and tries to find empty blk in same device
-        if(prevfilesnow == finfo[fh].wfnow && devinfo[finfo[fh].wfnow].storage[finfo[fh].fsec][finfo[fh].fblk] == 1){
-            devinfo[now].sec = finfo[fh].fsec;
-            devinfo[now].blk = finfo[fh].fblk;
-        }
+    if(mode != LC_META_NONE && mode != LC_META_LOAD && mode != LC_META_FORMAT){
+        logMessage(LOG_ERROR_LEVEL, "Bad metadata mode %d", mode);
+        return -1;
+    }
+    metamode = mode;
+    return( 0 );
+}
 
-        // when seek brings back to position where already written
-        if(filepos < finfo[fh].flength){
-            wfindsamefileblock(now, fh);
-            logMessage(LOG_INFO_LEVEL, "file overwrites from pos:%d", filepos);
-        }
-      
-        
-        //allocate block if block is empty
-        else if(devinfo[now].storage[devinfo[now].sec][devinfo[now].blk] < 1){
-            devinfo[now].storage[devinfo[now].sec][devinfo[now].blk] = 1;
-            allocatedblock++;
-            logMessage(LOG_INFO_LEVEL, "Allocated block %d out of %d (%0.2f%%)", allocatedblock, totalblock, (float)allocatedblock/(float)totalblock);
-            logMessage(LcDriverLLevel, "Allocated block for data [%d/%d/%d]", devinfo[now].did, devinfo[now].sec, devinfo[now].blk);
-            finfo[fh].fdid = devinfo[now].did;
-            finfo[fh].fsec = devinfo[now].sec;
-            finfo[fh].fblk = devinfo[now].blk;
-        } 
-        
-        offset = filepos % LC_DEVICE_BLOCK_SIZE;  //e.g. 50%256 = 50,  500%256 = 244 (1block and 244bytes)
-        remaining = LC_DEVICE_BLOCK_SIZE - offset;  //e.g. 256-(500%256) = 12
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetjournal
+// Description  : Set the journal size of the filesystems formatted from
+//                then on
+//
+// Inputs       : blocks - journal blocks, 0 for none (the metadata is then
+//                only written by checkpoints)
+// Outputs      : 0 if successful test, -1 if failure
 
+int lcsetjournal( int blocks ) {
 
-        if(devinfo[now].blk > devinfo[now].maxblk){
-            logMessage(LOG_ERROR_LEVEL, "Block number exceeds memory");
-            return -1;
-        }
-        
+    if(blocks < 0 || blocks > LC_LOG_MAXJOURNAL){
+        logMessage(LOG_ERROR_LEVEL, "Bad journal size %d (0-%d)", blocks, LC_LOG_MAXJOURNAL);
+        return -1;
+    }
+    journalsize = blocks;
+    return( 0 );
+}
 
-        //if exceeds the len we will write will be the remaining
-        if(writebytes < remaining){
-            size = writebytes;
-        }
-        else{
-            size = remaining;
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushfile
+// Description  : Write the file's dirty cached blocks to the devices (file
+//                lock held)
+//
+// Inputs       : fh - the file handle of the file to flush
+// Outputs      : 0 if successful test, -1 if failure
 
-        /************** if fills exactly 256  *****************/
-        if(offset + writebytes == LC_DEVICE_BLOCK_SIZE){
-            if(filepos < finfo[fh].flength){
-                do_read(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf); //read to find offset
-                memcpy(tempbuf+offset, buf, writebytes );
-                do_write(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf);
-                lcloud_putcache(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf);
-            }
-            else{
-                do_read(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf); //read to find offset
-                memcpy(tempbuf+offset, buf, writebytes );
-                do_write(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-                lcloud_putcache(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-            }
-            
+int flushfile( LcFHandle fh ) {
+    int i, ret = 0;
 
-            if(devinfo[now].sec != finfo[fh].fsec || devinfo[now].blk != finfo[fh].fblk){
-                devinfo[now].storage[finfo[fh].fsec][finfo[fh].fblk] = 2;
-            }
-            else{
-                devinfo[now].storage[devinfo[now].sec][devinfo[now].blk] = 2; // block is full
-            }
+    for(i=0; i<FINFO(fh).nblks; i++){
+        if(lcloud_flushblock(FINFO(fh).blkmap[i].did, FINFO(fh).blkmap[i].sec, FINFO(fh).blkmap[i].blk) == -1){
+            ret = -1;
         }
-        /////////// one block done ///////////
-
-
-        /************* if exceeds the block size **************/
-        else if(offset + writebytes > LC_DEVICE_BLOCK_SIZE){ 
-            if(filepos < finfo[fh].flength){
-                do_read(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf); //read to find offset
-                memcpy(tempbuf+offset, buf, size );
-                do_write(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf);
-                lcloud_putcache(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf);
-            }
-            else{
-                do_read(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-                memcpy(tempbuf+offset, buf, size );
-                do_write(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-                lcloud_putcache(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-            }
+    }
 
-            if(devinfo[now].sec != finfo[fh].fsec || devinfo[now].blk != finfo[fh].fblk){
-                devinfo[now].storage[finfo[fh].fsec][finfo[fh].fblk] = 2;
-            }
-            else{
-                devinfo[now].storage[devinfo[now].sec][devinfo[now].blk] = 2; // block is full
-            }
-        }
+    lcLog(LcDriverLLevel, "Flushed file handle %d [%s]", fh, FINFO(fh).fname);
+    return( ret );
+}
 
-        else{  //if(offset + len < 256)
-            if(filepos < finfo[fh].flength){
-                do_read(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf); //read to find offset
-                memcpy(tempbuf+offset, buf, size );
-                do_write(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf);
-                lcloud_putcache(devinfo[now].did, devinfo[now].sec, devinfo[now].blk, tempbuf);
-            }
-            else{
-                do_read(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-                memcpy(tempbuf+offset, buf, size ); //flength%256 instead of size?
-                do_write(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-                lcloud_putcache(finfo[fh].fdid, finfo[fh].fsec, finfo[fh].fblk, tempbuf);
-            }
-        }
-        
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcflush
+// Description  : Write the file's dirty cached blocks to the devices
+//
+// Inputs       : fh - the file handle of the file to flush
+// Outputs      : 0 if successful test, -1 if failure
 
+int lcflush( LcFHandle fh ) {
+    int ret = -1;
 
-        if(filepos < finfo[fh].flength){
-            devinfo[now].storage[devinfo[now].sec][devinfo[now].blk] = 3; // when overwritten
+    if(fh >= 0 && fh < STATGET(nfiles)){
+        pthread_mutex_lock(&FINFO(fh).lock);
+        if(FINFO(fh).isopen == true){
+            ret = flushfile(fh);
         }
-        
-
-        // block remembers which file wrote on it
-        devinfo[now].fileblktracker[finfo[fh].fsec][finfo[fh].fblk] = finfo[fh].fhandle;
+        pthread_mutex_unlock(&FINFO(fh).lock);
+    }
+    if(ret == -1){
+        logMessage(LOG_ERROR_LEVEL, "Failed to flush: file handle is not valid or file is not opened");
+        return( ret );
+    }
 
-        ////////update pos, decrease len used (bytesleft to write), update buffer after written///////////////////
-        filepos += size; 
-        writebytes -= size;
-        buf += size;
-        devinfo[now].devwritten += size; // plus amount of overwritten
-        finfo[fh].wfnow = now;
+    // the file's changes (and any other pending ones) go to the journal
+    return( commitmeta() );
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsync
+// Description  : Write every dirty cached block and then a checkpoint of
+//                the filesystem metadata to the devices
+//
+// Inputs       : none
+// Outputs      : 0 if successful test, -1 if failure
 
-        // if device is full, go to next device
-        // if(devinfo[now].storage[devinfo[now].maxsec-1][devinfo[now].maxblk-1] == 2){
-        //     nextdevice(&now);
-        // }
-        if(devinfo[now].storage[devinfo[now].maxsec-1][devinfo[now].maxblk-1] == 2){
-            full = now;
-        }
-        if(findnextfreedev == true){
-            now = prevfilesnow;
-        }
-        else{
-            nextdevice(&now);
-        }
-    
+int lcsync( void ) {
+    int ret = 0;
 
-        // if position exceeds the size of the file then increase file size to current position
-        if(filepos > finfo[fh].flength){
-            finfo[fh].flength = filepos;
+    pthread_mutex_lock(&fslock);
+    if(isDeviceOn == true){
+        if(lcloud_flushcache() == -1 || syncmeta() == -1){
+            ret = -1;
         }
-      
-        finfo[fh].pos = filepos;
-
-        findnextfreedev = false; //reset toggle
     }
-    
-    logMessage(LcDriverLLevel, "Driver wrote %d bytes to file %s (now %d bytes)", len, finfo[fh].fname, finfo[fh].flength);
-    return( len );
+    pthread_mutex_unlock(&fslock);
+    return( ret );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcseek
-// Description  : Seek to a specific place in the file
+// Function     : closefile
+// Description  : Close the file
 //
-// Inputs       : fh - the file handle of the file to seek in
-//                off - offset within the file to seek to
+// Inputs       : fh - the file handle of the file to close
 // Outputs      : 0 if successful test, -1 if failure
 
-int lcseek( LcFHandle fh, size_t off ) {
-    //filesys finfo;
+int closefile( LcFHandle fh ) {
 
-    if(fh < 0 || finfo[fh].isopen == false || isDeviceOn == false || finfo[fh].flength < 0 /*||(finfo[fh].pos + off) > finfo[fh].flength*/){
-        logMessage(LOG_ERROR_LEVEL, "file failed to seek in");
+    //check if there is no file to close
+    if(fh < 0 || fh >= STATGET(nfiles)){
+        logMessage(LOG_ERROR_LEVEL, "There is no opened file to close");
         return -1;
     }
-    if(finfo[fh].flength < off){
-        logMessage(LOG_ERROR_LEVEL, "Seeking out of file [%d < %d]", finfo[fh].flength, off);
+    pthread_mutex_lock(&FINFO(fh).lock);
+    if(FINFO(fh).isopen == false){
+        pthread_mutex_unlock(&FINFO(fh).lock);
+        logMessage(LOG_ERROR_LEVEL, "There is no opened file to close");
+        return -1;
     }
 
-    logMessage(LcDriverLLevel, "Seeking to position %d in file handle %d [%s]", off, fh, finfo[fh].fname);
-    finfo[fh].pos = off;
+    //write back the file's dirty blocks, close file
+    if(flushfile(fh) == -1){
+        pthread_mutex_unlock(&FINFO(fh).lock);
+        return -1;
+    }
+    releaseblks(fh);
+    FINFO(fh).isopen = false;
+    STATADD(openfiles, -1);
+    pthread_mutex_unlock(&FINFO(fh).lock);
 
-    return( finfo[fh].pos ); //fix this 
+    lcLog(LcDriverLLevel, "Closed file handle %d [%s]", fh, FINFO(fh).fname);
+    return( commitmeta() );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -840,17 +4295,57 @@ int lcseek( LcFHandle fh, size_t off ) {
 // Outputs      : 0 if successful test, -1 if failure
 
 int lcclose( LcFHandle fh ) {
+    uint64_t start = lcmetrics_now();
+    int ret;
 
-    //check if there is no file to close
-    if(finfo[fh].isopen == false){
-        logMessage(LOG_ERROR_LEVEL, "There is no opened file to close");
-        return -1;
-    }
+    ret = closefile(fh);
+    lcmetrics_record(LC_MET_CLOSE, lcmetrics_now() - start);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcdevcount
+// Description  : Number of devices
+//
+// Inputs       : none
+// Outputs      : number of devices, 0 before power on
+
+int lcdevcount( void ) {
+    int n;
+
+    pthread_mutex_lock(&fslock);
+    n = (isDeviceOn == true) ? devicenum : 0;
+    pthread_mutex_unlock(&fslock);
+    return( n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcdevstats
+// Description  : Get the counters of a device
+//
+// Inputs       : dev - device index, st - filled with the counters
+// Outputs      : 0 if successful, -1 if failure
 
-    //close file
-    finfo[fh].isopen = false;
+int lcdevstats( int dev, LcDeviceStats *st ) {
 
-    logMessage(LcDriverLLevel, "Closed file handle %d [%s]", fh, finfo[fh].fname);
+    pthread_mutex_lock(&fslock);
+    if(isDeviceOn == false || dev < 0 || dev >= devicenum){
+        pthread_mutex_unlock(&fslock);
+        logMessage(LOG_ERROR_LEVEL, "No device with index %d", dev);
+        return -1;
+    }
+    st->did = devinfo[dev].did;
+    st->bytesread = STATGET(devinfo[dev].devread);
+    st->byteswritten = STATGET(devinfo[dev].devwritten);
+    st->reads = STATGET(devinfo[dev].numread);
+    st->writes = STATGET(devinfo[dev].numwritten);
+    st->blksread = STATGET(devinfo[dev].blksread);
+    st->blkswritten = STATGET(devinfo[dev].blkswritten);
+    st->busreqs = STATGET(devinfo[dev].busreqs);
+    st->state = devinfo[dev].state;
+    pthread_mutex_unlock(&fslock);
     return( 0 );
 }
 
@@ -863,37 +4358,115 @@ int lcclose( LcFHandle fh ) {
 // Outputs      : 0 if successful test, -1 if failure
 
 int lcshutdown( void ) {
-    int i;
+    LCloudRegisterFrame frm;
+    LcLogStats logst;
+    int i, j, mapped = 0, extents = 0, failed = 0;
+    uint64_t moved, minmoved = 0, maxmoved = 0, totmoved = 0;
+
+    // the other threads must be done with the files by now
+    pthread_mutex_lock(&fslock);
+
+    // write back every dirty cached block while the devices are still on,
+    // then a checkpoint of the metadata that points at them
+    lcloud_flushcache();
+    syncmeta();
+    lcmeta_logstats(&logst);
+
+    // read-ahead blocks never read by their file are wasted too, and the
+    // extents the loaded block maps make up
+    for(i = 0; i < nfiles; i++){
+        for(j = 0; j < FINFO(i).nblks && FINFO(i).maploaded == true; j++){
+            if(FINFO(i).blkmap[j].prefetched == true){
+                prefetchwaste++;
+            }
+        }
+        if(FINFO(i).type != LC_TYPE_NONE && FINFO(i).maploaded == true){
+            mapped += FINFO(i).nblks;
+            extents += mapextents(i, NULL);
+        }
+    }
+
+    // device and allocator counters, before their state is freed
+    for(i = 0; i < devicenum; i++){
+        logMessage(LOG_INFO_LEVEL, "Device %d (id %d) [%lu KB read in %lu reads, %lu KB written in %lu writes, %lu/%lu blocks read/written in %lu bus requests]",
+            i, devinfo[i].did, devinfo[i].devread / 1024, devinfo[i].numread, devinfo[i].devwritten / 1024, devinfo[i].numwritten,
+            devinfo[i].blksread, devinfo[i].blkswritten, devinfo[i].busreqs);
+        moved = devinfo[i].blksread + devinfo[i].blkswritten;
+        minmoved = (i == 0 || moved < minmoved) ? moved : minmoved;
+        maxmoved = (moved > maxmoved) ? moved : maxmoved;
+        totmoved += moved;
+        failed += (devinfo[i].state == LC_DEVICE_ERRORED);
+    }
+    // how evenly the striping spread the bus traffic (1.0 = perfectly)
+    logMessage(LOG_INFO_LEVEL, "Balance [stripe width %d, unit %d blocks, %lu-%lu blocks moved per device, max/mean %0.2f]",
+        stripewidth, stripeunit, minmoved, maxmoved, (totmoved == 0) ? 0.0 : (double)maxmoved*devicenum/totmoved);
+    if(redundm > 0 || failed > 0){
+        logMessage(LOG_INFO_LEVEL, "Redundancy [%d data + %d parity blocks, %d devices failed, %d blocks rebuilt, %d copy reads, %d parity writes, %d parity reads, %d writes lost, %s code]",
+            redundk, redundm, failed, rebuilt, copyreads, paritywrites, parityreads, lostwrites, lcloud_ecimpl());
+    }
+    lcloud_logalloc();
+    if(metaon == true){
+        logMessage(LOG_INFO_LEVEL, "Metadata [generation %u, %d blocks read, %d blocks written, %d checkpoints, %d records replayed]",
+            super.generation, metablkreads, metablkwrites, checkpoints, replayed);
+    }
+    if(journalon == true){
+        logMessage(LOG_INFO_LEVEL, "Journal [%d commits, %d records in %d blocks, %d times full]", logst.commits, logst.records, logst.blocks, logst.full);
+    }
+    logMessage(LOG_INFO_LEVEL, "Namespace [%d names cached, %d lookups, %d directories read]", nnames, lookups, dirloads);
+    logMessage(LOG_INFO_LEVEL, "Extents [%d blocks mapped in %d extents, %0.1f blocks per extent]", mapped, extents,
+        (extents == 0) ? 0.0 : (float)mapped/extents);
 
     //////////////////////// free //////////////////////////
-    int n=0;
-    while(n<devicenum){
-        for(i = 0; i < devinfo[n].maxsec; i++){
-            free(devinfo[n].storage[i]);
-            free(devinfo[n].fileblktracker[i]);
-            free(devinfo[n].filepostracker[i]);
-        }      
-        free(devinfo[n].storage);    
-        free(devinfo[n].fileblktracker);
-        free(devinfo[n].filepostracker);
-        n++;
+    lcloud_closealloc();
+    lcmeta_free(&inodechain);
+    for(i = 0; i < LC_FILE_MAXCHUNKS; i++){
+        lcmeta_free(&inodechunks[i]);
+    }
+    lcmeta_free(&bitmapchain);
+    lcmeta_free(&journalchain);
+    lcmeta_free(&journalblks);
+    lcmeta_logclose();
+    for(i = 0; i < LC_FILE_MAXCHUNKS && ftable[i] != NULL; i++){
+        for(j = 0; j < LC_FILE_CHUNK; j++){
+            clearentry(&ftable[i][j]);
+            pthread_mutex_destroy(&ftable[i][j].lock);
+        }
+        free(ftable[i]);
+        ftable[i] = NULL;
     }
+    nfiles = 0;
+    free(freefh);
+    freefh = NULL;
+    nfree = freesize = 0;
+    free(namehash);
+    namehash = NULL;
+    namemask = -1;
+    nnames = 0;
 
     free(devinfo);
     ////////////////////////////////////////////////////////
 
 
+    // connection utilization, before power off closes them
+    client_lcloud_bus_logstats();
+
     //Poweroff
     frm = create_lcloud_registers(0, 0 ,LC_POWER_OFF ,0, 0, 0, 0); 
     client_lcloud_bus_request(frm, NULL);
 
     // close cache
     lcloud_closecache();
+    logMessage(LOG_INFO_LEVEL, "Block transfers  [%d reads, %d writes] in %d bus requests, %d reads served from cache", blkreads, blkwrites, busxfers, cachereads);
+    logMessage(LOG_INFO_LEVEL, "Read-ahead [%d blocks prefetched, %d hits (%0.2f%%), %d wasted (%0.2f%%)]", prefetched, prefetchhits,
+        (prefetched == 0) ? 0.0 : (float)prefetchhits*100/prefetched, prefetchwaste, (prefetched == 0) ? 0.0 : (float)prefetchwaste*100/prefetched);
+    logMessage(LOG_INFO_LEVEL, "RMW reads avoided [%d full block, %d fresh block, %d cached]", rmwfull, rmwfresh, rmwcached);
+    lcmetrics_log();
 
 
     logMessage(LcDriverLLevel, "Powered off the Lion cloud system.");
 
     isDeviceOn = false;
+    pthread_mutex_unlock(&fslock);
 
     return( 0 );
 }
@@ -16,14 +16,51 @@
 #include <stdint.h>
 
 // Defines 
+#define LC_DIR_NAMEMAX 59          // longest name in a directory (one path component)
+#define LC_STRIPE_UNIT 16          // default stripe unit in blocks (lcsetstripe)
 
 // Type definitions
 typedef int32_t LcFHandle;
 
+// An entry of a directory (lcreaddir)
+typedef struct {
+    LcFHandle fh;           // file handle of the file or directory
+    int isdir;              // 1 for a directory
+    uint32_t length;        // bytes of a file
+    char name[LC_DIR_NAMEMAX + 1];
+} LcDirEntry;
+
+// Counters of a device (lcdevstats)
+typedef struct {
+    uint8_t did;            // device id
+    uint64_t bytesread;     // file bytes read from the device
+    uint64_t byteswritten;  // file bytes written to the device
+    uint64_t reads;         // file reads of one of its blocks
+    uint64_t writes;        // file writes of one of its blocks
+    uint64_t blksread;      // blocks read on the bus
+    uint64_t blkswritten;   // blocks written on the bus
+    uint64_t busreqs;       // bus requests that moved its blocks
+    int state;              // LC_DEVICE_ONLINE, LC_DEVICE_ERRORED once it failed
+} LcDeviceStats;
+
 // File system interface definitions
 
 LcFHandle lcopen( const char *path );
-    // Open the file for for reading and writing
+    // Open the file for for reading and writing ('/' separated path, its
+    // directories must exist)
+
+int lcmkdir( const char *path );
+    // Make a directory
+
+int lcreaddir( const char *path, uint32_t *cookie, LcDirEntry *ents, int max );
+    // List up to max entries of a directory from *cookie on (0 to start),
+    // moving *cookie past them; returns the entries listed, 0 at the end
+
+int lcunlink( const char *path );
+    // Remove a file that is not open, or an empty directory
+
+int lcrename( const char *from, const char *to );
+    // Move a file or directory to a new path (replacing a file there)
 
 int lcread( LcFHandle fh, char *buf, size_t len );
     // Read data from the file hande
@@ -31,12 +68,58 @@ int lcread( LcFHandle fh, char *buf, size_t len );
 int lcwrite( LcFHandle fh, char *buf, size_t len );
     // Write data to the file
 
+int lcreadat( LcFHandle fh, char *buf, size_t len, size_t off );
+    // Read data from a position of the file (seek and read in one step)
+
+int lcwriteat( LcFHandle fh, char *buf, size_t len, size_t off );
+    // Write data at a position of the file (seek and write in one step)
+
 int lcseek( LcFHandle fh, size_t off );
     // Seek to a specific place in the file
 
+int lcfallocate( LcFHandle fh, size_t len );
+    // Allocate the blocks of the first len bytes of the file ahead of the
+    // writes, as contiguous extents (its length is left as it is)
+
+int lcsetreadahead( int maxblocks );
+    // Set the largest sequential read-ahead window (blocks, 0 disables)
+
+int lcsetxferbatch( int maxblocks );
+    // Set the most blocks moved by one (vectored) bus request, 1 = off
+
+int lcsetstripe( int width, int unit );
+    // Set the stripe width (devices, 1 = none, 0 = all) and unit (blocks) of
+    // the files created from then on
+
+int lcsetredundancy( int k, int m );
+    // Keep m parity blocks for every k data blocks (k = 1: m+1 copies, m = 0:
+    // none) of the files and directories created from then on
+
+int lcfaildevice( int dev, int fail );
+    // Make the server fail a device's transfers (1) or bring it back (0),
+    // for testing degraded operation
+
+int lcsetmetadata( int mode );
+    // Set how the metadata is kept on the devices (LC_META_*), from the next power on
+
+int lcsetjournal( int blocks );
+    // Set the journal size of filesystems formatted from then on (0 = none)
+
+int lcflush( LcFHandle fh );
+    // Write the file's dirty cached blocks to the devices
+
+int lcsync( void );
+    // Write every dirty cached block and a checkpoint of the metadata to the devices
+
 int lcclose( LcFHandle fh );
     // Close the file
 
+int lcdevcount( void );
+    // Number of devices (0 before power on)
+
+int lcdevstats( int dev, LcDeviceStats *st );
+    // Get the counters of a device (index 0 to lcdevcount()-1)
+
 int lcshutdown( void );
     // Shut down the filesystem
 
@@ -0,0 +1,485 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_localserver.c
+//  Description    : This is a local stand-in for the LionCloud device server.
+//                   It serves the devices of a hardware manifest from memory
+//                   over the same register frame protocol as lcloud_server,
+//                   plus the vectored block transfer (LC_BLOCK_XFERV) that
+//                   moves a run of contiguous blocks in one exchange.  It can
+//                   delay every response to simulate a network round trip;
+//                   requests keep being served while earlier responses wait,
+//                   so pipelined clients overlap the delays.  Every client
+//                   connection gets its own thread, and each device can be
+//                   given a service time per block, held under the device's
+//                   lock, so transfers to different devices run in parallel
+//                   when they come over different connections.  A device
+//                   can be failed (its block transfers fail with
+//                   LC_NO_DEVICE) from the command line, after a number of
+//                   transfers, or by a client with LC_DEVICE_FAULT.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 06:05:12 PM EDT
+//
+
+// Include Files
+#define _GNU_SOURCE // ppoll()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <lcloud_network.h>
+
+// Defines
+#define LCLOUD_LOCALSERVER_ARGUMENTS "hvd:s:F:"
+#define LCLOUD_LOCALSERVER_MAXDEVS 16
+#define LCLOUD_LOCALSERVER_MAXQUEUE 256 // most responses waiting out their delay
+#define USAGE                                                               \
+    "USAGE: lcloud_localserver [-h] [-v] [-d <usecs>] [-s <usecs>] [-F <did>[:<xfers>]]\n" \
+    "                          <hardware-manifest>\n" \
+    "\n"                                                                    \
+    "where:\n"                                                              \
+    "    -h - help mode (display this message)\n"                           \
+    "    -v - verbose output\n"                                             \
+    "    -d - delay every response by <usecs> microseconds (simulated RTT)\n" \
+    "    -s - device service time of <usecs> microseconds per block\n" \
+    "    -F - fail device <did> once <xfers> block transfers were served\n" \
+    "         (default 0, from the start)\n"                                \
+    "\n"                                                                    \
+    "    <hardware-manifest> - file containing the device geometries\n"     \
+    "\n"
+
+// one served device
+typedef struct{
+    int did;            // device id
+    int maxsec;         // sectors
+    int maxblk;         // blocks per sector
+    char *data;         // maxsec*maxblk blocks, sector major
+    int failed;         // its block transfers fail (LC_DEVICE_FAULT)
+    pthread_mutex_t lock; // one transfer at a time per device
+}localdev;
+
+// a response waiting to be sent
+typedef struct{
+    struct timespec due;        // when it may be sent
+    LCloudRegisterFrame frm;    // response frame (network format)
+    int len;                    // bytes of data following the frame
+    char data[LC_XFERV_MAXBLOCKS * LC_DEVICE_BLOCK_SIZE];
+}response;
+
+//
+// Global Data
+localdev devs[LCLOUD_LOCALSERVER_MAXDEVS];
+int numdevs;
+unsigned long LcServerLLevel; // server log level
+long delayusecs = 0;          // simulated round trip added to every response
+long serviceusecs = 0;        // simulated device time per block transferred
+int faultdid = -1;            // device failed by -F (-1 none)
+long faultafter = 0;          // block transfers served before it fails
+long xfers = 0;               // block transfers served
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readManifest
+// Description  : read the "did sectors blocks" lines of a hardware manifest
+//                and allocate the (zeroed) device storage
+//
+// Inputs       : fname - manifest filename
+// Outputs      : 0 if successful, -1 if failure
+
+int readManifest(const char *fname) {
+    FILE *fp;
+    char line[256];
+    int did, secs, blks;
+
+    if ((fp = fopen(fname, "r")) == NULL) {
+        fprintf(stderr, "Failed to open manifest [%s], aborting.\n", fname);
+        return (-1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL && numdevs < LCLOUD_LOCALSERVER_MAXDEVS) {
+        if (line[0] == '#' || sscanf(line, "%d %d %d", &did, &secs, &blks) != 3) {
+            continue;
+        }
+        devs[numdevs].did = did;
+        devs[numdevs].maxsec = secs;
+        devs[numdevs].maxblk = blks;
+        pthread_mutex_init(&devs[numdevs].lock, NULL);
+        devs[numdevs].data = calloc((size_t)secs * blks, LC_DEVICE_BLOCK_SIZE);
+        if (devs[numdevs].data == NULL) {
+            fprintf(stderr, "Failed to allocate device %d storage, aborting.\n", did);
+            fclose(fp);
+            return (-1);
+        }
+        numdevs++;
+    }
+    fclose(fp);
+    return (numdevs > 0) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finddev
+// Description  : find the served device with the device id
+//
+// Inputs       : did - device id
+// Outputs      : device, NULL if not found
+
+localdev * finddev(int did) {
+    int i;
+
+    for (i = 0; i < numdevs; i++) {
+        if (devs[i].did == did) {
+            return (&devs[i]);
+        }
+    }
+    return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : iofull
+// Description  : read or write exactly len bytes on the socket
+//
+// Inputs       : fd - socket, buf - data, len - bytes, rd - 1 read / 0 write
+// Outputs      : len if successful, -1 if failure (or connection closed)
+
+int iofull(int fd, void *buf, int len, int rd) {
+    int done = 0, n;
+
+    while (done < len) {
+        n = rd ? read(fd, (char *)buf+done, len-done) : write(fd, (char *)buf+done, len-done);
+        if (n <= 0) {
+            return (-1);
+        }
+        done += n;
+    }
+    return (len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : packFrame
+// Description  : pack the register values into a frame
+//
+// Outputs      : packed frame
+
+LCloudRegisterFrame packFrame(uint64_t b0, uint64_t b1, uint64_t c0, uint64_t c1, uint64_t c2, uint64_t d0, uint64_t d1) {
+    return ((b0 & 0xf) << 60) | ((b1 & 0xf) << 56) | ((c0 & 0xff) << 48) | ((c1 & 0xff) << 40) |
+           ((c2 & 0xff) << 32) | ((d0 & 0xffff) << 16) | (d1 & 0xffff);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handleRequest
+// Description  : read one request from the client, do it, and fill in the
+//                response
+//
+// Inputs       : fd - client socket, resp - response to fill in
+// Outputs      : 0 if successful, 1 if powered off, -1 if the connection failed
+
+int handleRequest(int fd, response *resp) {
+    LCloudRegisterFrame frm;
+    localdev *dev, *fdev;
+    struct timespec service;
+    int b1, c0, c1, c2, d0, d1, i, nblks, first, status, len, probe;
+
+    if (iofull(fd, &frm, sizeof(frm), 1) == -1) {
+        return (-1);
+    }
+    frm = ntohll64(frm);
+    b1 = (frm >> 56) & 0xf;
+    c0 = (frm >> 48) & 0xff;
+    c1 = (frm >> 40) & 0xff;
+    c2 = (frm >> 32) & 0xff;
+    d0 = (frm >> 16) & 0xffff;
+    d1 = frm & 0xffff;
+    status = LC_SUCCESS;
+    resp->len = 0;
+
+    switch (c0) {
+    case LC_POWER_ON: // Nothing to set up, the devices live in memory
+    case LC_POWER_OFF:
+        frm = packFrame(1, LC_SUCCESS, c0, 0, 0, 0, 0);
+        break;
+
+    case LC_DEVPROBE: // One bit per device id
+        for (i = 0, probe = 0; i < numdevs; i++) {
+            probe |= 1 << devs[i].did;
+        }
+        frm = packFrame(1, LC_SUCCESS, c0, 0, 0, probe, 0);
+        break;
+
+    case LC_DEVINIT: // Geometry of the device
+        if ((dev = finddev(c1)) == NULL) {
+            frm = packFrame(1, LC_NO_DEVICE, c0, 0, c1, 0, 0);
+        } else {
+            frm = packFrame(1, LC_SUCCESS, c0, 0, c1, dev->maxsec, dev->maxblk);
+        }
+        break;
+
+    case LC_BLOCK_XFER:  // One block
+    case LC_BLOCK_XFERV: // A run of b1+1 contiguous blocks
+        nblks = (c0 == LC_BLOCK_XFERV) ? b1 + 1 : 1;
+        len = nblks * LC_DEVICE_BLOCK_SIZE;
+        if (c2 == LC_XFER_WRITE && iofull(fd, resp->data, len, 1) == -1) {
+            return (-1);
+        }
+        // the device given with -F fails once enough transfers were served
+        if (faultdid != -1 && __sync_add_and_fetch(&xfers, 1) > faultafter && (fdev = finddev(faultdid)) != NULL) {
+            logMessage(LOG_INFO_LEVEL, "Device %d failed after %ld block transfers", fdev->did, faultafter);
+            fdev->failed = 1;
+            faultdid = -1;
+        }
+        dev = finddev(c1);
+        first = (dev == NULL) ? 0 : d0 * dev->maxblk + d1;
+        if (dev == NULL || dev->failed) {
+            status = LC_NO_DEVICE;
+        } else if (d0 >= dev->maxsec || d1 >= dev->maxblk || first + nblks > dev->maxsec * dev->maxblk) {
+            logMessage(LOG_ERROR_LEVEL, "Block transfer bad block [%d/%d/%d] x%d, failure", c1, d0, d1, nblks);
+            status = LC_BAD_PARAMS;
+        } else {
+            // the device is busy for the whole transfer
+            pthread_mutex_lock(&dev->lock);
+            if (serviceusecs > 0) {
+                service.tv_sec = serviceusecs * nblks / 1000000;
+                service.tv_nsec = (serviceusecs * nblks % 1000000) * 1000;
+                nanosleep(&service, NULL);
+            }
+            if (c2 == LC_XFER_WRITE) {
+                memcpy(dev->data + (size_t)first * LC_DEVICE_BLOCK_SIZE, resp->data, len);
+            } else {
+                memcpy(resp->data, dev->data + (size_t)first * LC_DEVICE_BLOCK_SIZE, len);
+            }
+            pthread_mutex_unlock(&dev->lock);
+        }
+        logMessage(LcServerLLevel, "%s [%d/%d/%d] x%d status %d", (c2 == LC_XFER_WRITE) ? "Write" : "Read", c1, d0, d1, nblks, status);
+        frm = packFrame(1, status, c0, c1, c2, d0, d1);
+        // the blocks read go back, even on failure (like lcloud_server)
+        if (c2 == LC_XFER_READ) {
+            resp->len = len;
+        }
+        break;
+
+    case LC_DEVICE_FAULT: // Fail or bring back a device
+        if ((dev = finddev(c1)) == NULL) {
+            frm = packFrame(1, LC_NO_DEVICE, c0, c1, 0, 0, 0);
+        } else {
+            dev->failed = (d0 != 0);
+            logMessage(LOG_INFO_LEVEL, "Device %d %s", c1, (dev->failed) ? "failed" : "back online");
+            frm = packFrame(1, LC_SUCCESS, c0, c1, 0, d0, 0);
+        }
+        break;
+
+    default: // Unknown operation
+        logMessage(LOG_ERROR_LEVEL, "Unknown operation code %d, failure", c0);
+        frm = packFrame(1, LC_BAD_PARAMS, c0, c1, c2, d0, d1);
+        break;
+    }
+
+    resp->frm = htonll64(frm);
+    return (c0 == LC_POWER_OFF) ? 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : usecsUntil
+// Description  : microseconds from now until a time (0 if it has passed)
+
+long usecsUntil(struct timespec *t) {
+    struct timespec now;
+    long us;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (t->tv_sec - now.tv_sec) * 1000000L + (t->tv_nsec - now.tv_nsec) / 1000;
+    return (us > 0) ? us : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serveClient
+// Description  : serve a client connection until it powers off or goes away.
+//                Each request is done as soon as it arrives; its response is
+//                queued and sent once the delay has passed.
+//
+// Inputs       : fd - client socket
+// Outputs      : 1 if powered off, -1 if the connection failed
+
+int serveClient(int fd) {
+    struct pollfd pfd;
+    struct timespec timeout;
+    response *respq, *resp;
+    int ret, off = 0, failed = 0, qhead = 0, qcount = 0;
+    long wait;
+
+    // responses in the order they are sent, oldest at qhead
+    if ((respq = malloc(sizeof(response) * LCLOUD_LOCALSERVER_MAXQUEUE)) == NULL) {
+        return (-1);
+    }
+    while (1) {
+        // wait for a request (unless the queue is full or the client is
+        // done) or for the oldest response to come due
+        pfd.fd = fd;
+        pfd.events = (qcount < LCLOUD_LOCALSERVER_MAXQUEUE && !off) ? POLLIN : 0;
+        if (qcount > 0) {
+            wait = usecsUntil(&respq[qhead].due);
+            timeout.tv_sec = wait / 1000000;
+            timeout.tv_nsec = (wait % 1000000) * 1000;
+        }
+        if (ppoll(&pfd, 1, (qcount > 0) ? &timeout : NULL, NULL) == -1) {
+            break;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            resp = &respq[(qhead + qcount) % LCLOUD_LOCALSERVER_MAXQUEUE];
+            if ((ret = handleRequest(fd, resp)) == -1) {
+                break;
+            }
+            off = (ret == 1);
+            clock_gettime(CLOCK_MONOTONIC, &resp->due);
+            resp->due.tv_nsec += (delayusecs % 1000000) * 1000;
+            resp->due.tv_sec += delayusecs / 1000000 + resp->due.tv_nsec / 1000000000;
+            resp->due.tv_nsec %= 1000000000;
+            qcount++;
+        }
+
+        // send the responses that are due, in order
+        while (!failed && qcount > 0 && usecsUntil(&respq[qhead].due) == 0) {
+            resp = &respq[qhead];
+            if ((iofull(fd, &resp->frm, sizeof(resp->frm), 0) == -1) ||
+                (resp->len > 0 && iofull(fd, resp->data, resp->len, 0) == -1)) {
+                failed = 1;
+            }
+            qhead = (qhead + 1) % LCLOUD_LOCALSERVER_MAXQUEUE;
+            qcount--;
+        }
+        if (failed) {
+            break;
+        }
+        if (off && qcount == 0) {
+            free(respq);
+            return (1);
+        }
+    }
+    free(respq);
+    return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clientThread
+// Description  : serve one client connection, then close it
+//
+// Inputs       : arg - client socket
+// Outputs      : NULL
+
+void * clientThread(void *arg) {
+    int fd = (int)(intptr_t)arg, ret;
+
+    logMessage(LcServerLLevel, "Client connected (fd %d)", fd);
+    ret = serveClient(fd);
+    logMessage(LcServerLLevel, (ret == 1) ? "Client powered off (fd %d)" : "Client connection lost (fd %d)", fd);
+    close(fd);
+    return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the local LionCloud server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, -1 if failure
+
+int main(int argc, char* argv[])
+{
+    int ch, verbose = 0, lfd, cfd, one = 1;
+    struct sockaddr_in saddr;
+    pthread_t tid;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_LOCALSERVER_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'd': // Response delay
+            delayusecs = atol(optarg);
+            break;
+
+        case 's': // Device service time
+            serviceusecs = atol(optarg);
+            break;
+
+        case 'F': // Failed device
+            faultdid = atoi(optarg);
+            if (strchr(optarg, ':') != NULL) {
+                faultafter = atol(strchr(optarg, ':') + 1);
+            }
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+    if (argv[optind] == NULL || readManifest(argv[optind]) == -1) {
+        fprintf(stderr, "Missing or empty hardware manifest, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+    initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    LcServerLLevel = registerLogLevel("LCLOUD_SERVER", 0);
+    if (verbose) {
+        enableLogLevels(LOG_INFO_LEVEL | LcServerLLevel);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Listen on the default LionCloud address
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(LCLOUD_DEFAULT_PORT);
+    inet_aton(LCLOUD_DEFAULT_IP, &saddr.sin_addr);
+    if (((lfd = socket(PF_INET, SOCK_STREAM, 0)) == -1) ||
+        (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) ||
+        (bind(lfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) ||
+        (listen(lfd, LCLOUD_MAX_BACKLOG) == -1)) {
+        logMessage(LOG_ERROR_LEVEL, "Failed to listen on %s/%d, aborting.", LCLOUD_DEFAULT_IP, LCLOUD_DEFAULT_PORT);
+        return (-1);
+    }
+    logMessage(LOG_INFO_LEVEL, "Serving %d devices on %s/%d, %ld usec delay, %ld usec/block service", numdevs,
+        LCLOUD_DEFAULT_IP, LCLOUD_DEFAULT_PORT, delayusecs, serviceusecs);
+
+    // Serve every client connection in its own thread, until it powers off
+    // or goes away
+    while ((cfd = accept(lfd, NULL, NULL)) != -1) {
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (pthread_create(&tid, NULL, clientThread, (void *)(intptr_t)cfd) != 0) {
+            logMessage(LOG_ERROR_LEVEL, "Failed to start a client thread, dropping connection.");
+            close(cfd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+
+    close(lfd);
+    freeLogRegistrations();
+    return (0);
+}
@@ -0,0 +1,44 @@
+#ifndef LCLOUD_LOG_INCLUDED
+#define LCLOUD_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_log.h
+//  Description    : This is the hot-path logging macro of the Lion Cloud
+//                   filesystem.  lcLog checks the level before the call, so
+//                   a disabled message costs a test and its arguments are
+//                   never evaluated, and levels above LC_LOG_MAXLEVEL are
+//                   compiled out.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 09:40:55 PM EDT
+//
+
+// Includes
+#include <cmpsc311_log.h>
+
+// Defines
+
+// Highest level compiled into lcLog.  The fixed levels go ERROR (1),
+// WARNING (2), INFO (4), OUTPUT (8), and the levels registered at run time
+// (controller, driver, simulator) come after them, so a release build made
+// with -DLC_LOG_MAXLEVEL=LOG_WARNING_LEVEL drops the INFO and registered
+// level messages of lcLog entirely.
+#ifndef LC_LOG_MAXLEVEL
+#define LC_LOG_MAXLEVEL (~0UL)
+#endif
+
+// Registered levels are variables, not constants, so they are compiled in
+// only when the build keeps every level past OUTPUT
+#define LC_LOG_COMPILED(lvl) (__builtin_constant_p(lvl) ?                  \
+    ((unsigned long)(lvl) <= (unsigned long)(LC_LOG_MAXLEVEL)) :            \
+    ((unsigned long)(LC_LOG_MAXLEVEL) > LOG_OUTPUT_LEVEL))
+
+// Log a message if its level is compiled in and enabled
+#define lcLog(lvl, ...) do {                                                \
+    if (LC_LOG_COMPILED(lvl) && levelEnabled(lvl)) {                        \
+        logMessage((lvl), __VA_ARGS__);                                     \
+    }                                                                       \
+} while (0)
+
+#endif
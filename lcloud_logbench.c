@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_logbench.c
+//  Description    : This is a microbenchmark for the logging on the
+//                   LionCloud hot paths.  It times a cache-hit style log
+//                   line with its level disabled through logMessage and
+//                   through lcLog, and with the level enabled (to /dev/null)
+//                   for reference, and reports nanoseconds per call.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 09:40:55 PM EDT
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <lcloud_log.h>
+
+// Defines
+#define LCLOUD_LOGBENCH_ARGUMENTS "hn:"
+#define USAGE                                                               \
+    "USAGE: lcloud_logbench [-h] [-n <calls>]\n"                            \
+    "\n"                                                                    \
+    "where:\n"                                                              \
+    "    -h - help mode (display this message)\n"                           \
+    "    -n - number of log calls per case (default 10000000)\n"            \
+    "\n"
+
+//
+// Global Data
+unsigned long benchLevel; // registered level, like the driver's
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elapsed
+// Description  : seconds between two timestamps
+
+double elapsed(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : report
+// Description  : print the time per call of a case
+
+void report(const char *label, long calls, struct timespec *start, struct timespec *end) {
+    double secs = elapsed(start, end);
+
+    printf("%-34s: %10ld calls in %8.4f s  (%8.1f ns/call)\n", label, calls, secs, secs * 1e9 / calls);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the logging benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful test, -1 if failure
+
+int main(int argc, char* argv[])
+{
+    int ch;
+    long i, calls = 10000000;
+    struct timespec start, end;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_LOGBENCH_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'n': // Number of calls
+            calls = atol(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+    if (calls < 1) {
+        fprintf(stderr, "Bad number of calls, aborting.\n");
+        return (-1);
+    }
+    initializeLogWithFilename("/dev/null");
+    benchLevel = registerLogLevel("LCLOUD_LOGBENCH", 0);
+    disableLogLevels(LOG_INFO_LEVEL);
+
+    printf("LC_LOG_MAXLEVEL %#lx\n", (unsigned long)(LC_LOG_MAXLEVEL));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < calls; i++) {
+        logMessage(benchLevel, "LionCloud Cache ** HIT ** : (%d/%d/%d) index = %d", (int)(i & 15), (int)(i & 255), (int)(i & 63), (int)i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("logMessage, level disabled", calls, &start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < calls; i++) {
+        lcLog(benchLevel, "LionCloud Cache ** HIT ** : (%d/%d/%d) index = %d", (int)(i & 15), (int)(i & 255), (int)(i & 63), (int)i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("lcLog, level disabled", calls, &start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < calls; i++) {
+        lcLog(LOG_INFO_LEVEL, "LionCloud Cache ** HIT ** : (%d/%d/%d) index = %d", (int)(i & 15), (int)(i & 255), (int)(i & 63), (int)i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("lcLog INFO, level disabled", calls, &start, &end);
+
+    // enabled (written to /dev/null), fewer calls
+    enableLogLevels(benchLevel);
+    calls = (calls / 100 > 0) ? calls / 100 : 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < calls; i++) {
+        lcLog(benchLevel, "LionCloud Cache ** HIT ** : (%d/%d/%d) index = %d", (int)(i & 15), (int)(i & 255), (int)(i & 63), (int)i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("lcLog, level enabled (/dev/null)", calls, &start, &end);
+
+    freeLogRegistrations();
+    return (0);
+}
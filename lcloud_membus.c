@@ -0,0 +1,370 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_membus.c
+//  Description    : This is the in-process bus backend of the Lion Cloud
+//                   filesystem.  It serves LC_POWER_ON, LC_DEVPROBE,
+//                   LC_DEVINIT, LC_BLOCK_XFER(V), LC_DEVICE_FAULT and
+//                   LC_POWER_OFF itself,
+//                   against the devices of a hardware manifest kept in
+//                   memory or in a store directory with one sparse file per
+//                   device, mapped (mmap) when LC_DEVINIT hands out its
+//                   geometry.  Either way a block transfer is a copy between
+//                   the device and the caller's buffer under the device's
+//                   lock, instead of a round trip to lcloud_server.  A posted
+//                   transfer is done right away, and waiting for it just
+//                   returns its response.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 11:04:18 PM EDT
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cmpsc311_log.h>
+#include <lcloud_controller.h>
+#include <lcloud_membus.h>
+
+// one device served in process
+typedef struct{
+    int did;                // device id
+    int maxsec;             // sectors
+    int maxblk;             // blocks per sector
+    char *data;             // maxsec*maxblk blocks, sector major (NULL until mapped)
+    size_t size;            // bytes of data
+    int failed;             // its block transfers fail (LC_DEVICE_FAULT)
+    pthread_mutex_t lock;   // one transfer at a time per device
+}memdev;
+
+//
+// Global Data
+memdev memdevs[LC_MEMBUS_MAXDEVS];
+int nummemdevs = 0;
+char storedir[256];         // store directory, "" if the devices live in memory
+uint64_t memrequests = 0;   // requests served
+uint64_t membytes = 0;      // data bytes moved
+
+LCloudRegisterFrame membus_request( LCloudRegisterFrame reg, void *buf );
+int membus_post( LCloudRegisterFrame reg, void *buf, LcBusTag *tag );
+LCloudRegisterFrame membus_wait( LcBusTag *tag );
+int membus_logstats( void );
+
+LcBusBackend LcMemBus = { "memory", membus_request, membus_post, membus_wait, membus_logstats };
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : packframe
+// Description  : pack the register values into a frame
+//
+// Outputs      : packed frame
+
+LCloudRegisterFrame packframe(uint64_t b0, uint64_t b1, uint64_t c0, uint64_t c1, uint64_t c2, uint64_t d0, uint64_t d1){
+    return ((b0 & 0xf) << 60) | ((b1 & 0xf) << 56) | ((c0 & 0xff) << 48) | ((c1 & 0xff) << 40) |
+           ((c2 & 0xff) << 32) | ((d0 & 0xffff) << 16) | (d1 & 0xffff);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findmemdev
+// Description  : find the device with the device id
+//
+// Inputs       : did - device id
+// Outputs      : device, NULL if not found
+
+memdev * findmemdev(int did){
+    int i;
+
+    for(i=0; i<nummemdevs; i++){
+        if(memdevs[i].did == did){
+            return &memdevs[i];
+        }
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mapdevice
+// Description  : map the store file of a device (lock held), created
+//                sparse and grown to its geometry if needed; the blocks
+//                already there are kept, so the device survives restarts
+//
+// Inputs       : dev - the device
+// Outputs      : 0 if successful, -1 if failure
+
+int mapdevice(memdev *dev){
+    char path[300];
+    struct stat st;
+    void *p;
+    int fd;
+
+    if(dev->data != NULL){
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/lcdev-%d.img", storedir, dev->did);
+    if(((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) || (fstat(fd, &st) == -1) ||
+        ((size_t)st.st_size < dev->size && ftruncate(fd, dev->size) == -1)){
+        logMessage(LOG_ERROR_LEVEL, "Failed to open device store [%s] (%s)", path, strerror(errno));
+        if(fd != -1){
+            close(fd);
+        }
+        return -1;
+    }
+    p = mmap(NULL, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file
+    if(p == MAP_FAILED){
+        logMessage(LOG_ERROR_LEVEL, "Failed to map device store [%s] (%s)", path, strerror(errno));
+        return -1;
+    }
+    dev->data = p;
+    logMessage(LOG_INFO_LEVEL, "Mapped device %d [%s, %d sectors x %d blocks]", dev->did, path, dev->maxsec, dev->maxblk);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_lcloud_backend
+// Description  : read the "did sectors blocks" lines of a hardware manifest
+//                and set up the devices: zeroed memory, or (store != NULL)
+//                a directory holding one file per device, mapped when the
+//                device is initialized
+//
+// Inputs       : manifest - manifest filename, store - store directory or NULL
+// Outputs      : the backend, NULL if failure
+
+LcBusBackend * membus_lcloud_backend( const char *manifest, const char *store ) {
+    FILE *fp;
+    char line[256];
+    int did, secs, blks;
+    size_t size = 0;
+
+    if(nummemdevs > 0){
+        return &LcMemBus;
+    }
+    if(store != NULL){
+        if((strlen(store) >= sizeof(storedir)) || (mkdir(store, 0755) == -1 && errno != EEXIST)){
+            logMessage(LOG_ERROR_LEVEL, "Bad device store directory [%s]", store);
+            return NULL;
+        }
+        strcpy(storedir, store);
+    }
+    if((fp = fopen(manifest, "r")) == NULL){
+        logMessage(LOG_ERROR_LEVEL, "Failed to open manifest [%s]", manifest);
+        return NULL;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL && nummemdevs < LC_MEMBUS_MAXDEVS){
+        if(line[0] == '#' || sscanf(line, "%d %d %d", &did, &secs, &blks) != 3){
+            continue;
+        }
+        memdevs[nummemdevs].did = did;
+        memdevs[nummemdevs].maxsec = secs;
+        memdevs[nummemdevs].maxblk = blks;
+        memdevs[nummemdevs].size = (size_t)secs * blks * LC_DEVICE_BLOCK_SIZE;
+        memdevs[nummemdevs].data = NULL;
+        memdevs[nummemdevs].failed = 0;
+        pthread_mutex_init(&memdevs[nummemdevs].lock, NULL);
+        size += memdevs[nummemdevs].size;
+        if(store == NULL && (memdevs[nummemdevs].data = calloc(memdevs[nummemdevs].size, 1)) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Failed to allocate device %d storage", did);
+            fclose(fp);
+            return NULL;
+        }
+        nummemdevs++;
+    }
+    fclose(fp);
+    if(nummemdevs == 0){
+        logMessage(LOG_ERROR_LEVEL, "No devices in manifest [%s]", manifest);
+        return NULL;
+    }
+    logMessage(LOG_INFO_LEVEL, "In-process bus: %d devices, %lu KB in %s%s", nummemdevs, (unsigned long)(size / 1024),
+        (store == NULL) ? "memory" : "directory ", (store == NULL) ? "" : store);
+    return &LcMemBus;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_lcloud_faildevice
+// Description  : Make a device fail its block transfers, or work again,
+//                without a bus request (so before power on too)
+//
+// Inputs       : dev - device index (in device id order, as the filesystem
+//                numbers them), fail - 1 to fail it, 0 to bring it back
+// Outputs      : 0 if successful, -1 if there is no such device
+
+int membus_lcloud_faildevice( int dev, int fail ) {
+    int i, j, below;
+
+    for(i=0; i<nummemdevs; i++){
+        for(j=0, below=0; j<nummemdevs; j++){
+            below += (memdevs[j].did < memdevs[i].did);
+        }
+        if(below == dev){
+            memdevs[i].failed = (fail != 0);
+            logMessage(LOG_INFO_LEVEL, "In-process device %d %s", memdevs[i].did, (fail != 0) ? "failed" : "back online");
+            return 0;
+        }
+    }
+    logMessage(LOG_ERROR_LEVEL, "No in-process device with index %d", dev);
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_lcloud_devblocks
+// Description  : Blocks of a device of the manifest (sectors x blocks)
+//
+// Inputs       : dev - device index (in device id order)
+// Outputs      : the blocks, -1 if there is no such device
+
+int membus_lcloud_devblocks( int dev ) {
+    int i, j, below;
+
+    for(i=0; i<nummemdevs; i++){
+        for(j=0, below=0; j<nummemdevs; j++){
+            below += (memdevs[j].did < memdevs[i].did);
+        }
+        if(below == dev){
+            return memdevs[i].maxsec * memdevs[i].maxblk;
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_request
+// Description  : do a bus request and build its response
+//
+// Inputs       : reg - the request registers, buf - the data to write or
+//                the place for the data read (block transfers)
+// Outputs      : the response frame
+
+LCloudRegisterFrame membus_request( LCloudRegisterFrame reg, void *buf ) {
+    memdev *dev;
+    int b1, c0, c1, c2, d0, d1, i, nblks, first, status, len, probe;
+
+    b1 = (reg >> 56) & 0xf;
+    c0 = (reg >> 48) & 0xff;
+    c1 = (reg >> 40) & 0xff;
+    c2 = (reg >> 32) & 0xff;
+    d0 = (reg >> 16) & 0xffff;
+    d1 = reg & 0xffff;
+    __sync_fetch_and_add(&memrequests, 1);
+
+    switch(c0){
+    case LC_POWER_ON: // the devices are already set up
+        return packframe(1, LC_SUCCESS, c0, 0, 0, 0, 0);
+
+    case LC_POWER_OFF: // their contents stay, the mapped stores are made durable
+        for(i=0; i<nummemdevs; i++){
+            pthread_mutex_lock(&memdevs[i].lock);
+            if(storedir[0] != '\0' && memdevs[i].data != NULL){
+                msync(memdevs[i].data, memdevs[i].size, MS_SYNC);
+            }
+            pthread_mutex_unlock(&memdevs[i].lock);
+        }
+        return packframe(1, LC_SUCCESS, c0, 0, 0, 0, 0);
+
+    case LC_DEVPROBE: // one bit per device id
+        for(i=0, probe=0; i<nummemdevs; i++){
+            probe |= 1 << memdevs[i].did;
+        }
+        return packframe(1, LC_SUCCESS, c0, 0, 0, probe, 0);
+
+    case LC_DEVINIT: // geometry of the device, its store mapped to match
+        if((dev = findmemdev(c1)) == NULL){
+            return packframe(1, LC_NO_DEVICE, c0, 0, c1, 0, 0);
+        }
+        pthread_mutex_lock(&dev->lock);
+        status = (mapdevice(dev) == 0) ? LC_SUCCESS : LC_NO_DEVICE;
+        pthread_mutex_unlock(&dev->lock);
+        return packframe(1, status, c0, 0, c1, dev->maxsec, dev->maxblk);
+
+    case LC_BLOCK_XFER:  // one block
+    case LC_BLOCK_XFERV: // a run of b1+1 contiguous blocks
+        nblks = (c0 == LC_BLOCK_XFERV) ? b1 + 1 : 1;
+        len = nblks * LC_DEVICE_BLOCK_SIZE;
+        status = LC_SUCCESS;
+        if((dev = findmemdev(c1)) == NULL || dev->failed){
+            status = LC_NO_DEVICE;
+        }
+        else if(d0 >= dev->maxsec || d1 >= dev->maxblk || (first = d0 * dev->maxblk + d1) + nblks > dev->maxsec * dev->maxblk){
+            logMessage(LOG_ERROR_LEVEL, "Block transfer bad block [%d/%d/%d] x%d, failure", c1, d0, d1, nblks);
+            status = LC_BAD_PARAMS;
+        }
+        else{
+            pthread_mutex_lock(&dev->lock);
+            if(mapdevice(dev) == -1){
+                status = LC_NO_DEVICE;
+            }
+            else if(c2 == LC_XFER_WRITE){
+                memcpy(dev->data + (size_t)first * LC_DEVICE_BLOCK_SIZE, buf, len);
+            }
+            else{
+                memcpy(buf, dev->data + (size_t)first * LC_DEVICE_BLOCK_SIZE, len);
+            }
+            pthread_mutex_unlock(&dev->lock);
+            __sync_fetch_and_add(&membytes, len);
+        }
+        return packframe(1, status, c0, c1, c2, d0, d1);
+
+    case LC_DEVICE_FAULT: // fail a device or bring it back
+        if((dev = findmemdev(c1)) == NULL){
+            return packframe(1, LC_NO_DEVICE, c0, c1, 0, 0, 0);
+        }
+        dev->failed = (d0 != 0);
+        logMessage(LOG_INFO_LEVEL, "In-process device %d %s", c1, (dev->failed) ? "failed" : "back online");
+        return packframe(1, LC_SUCCESS, c0, c1, 0, d0, 0);
+    }
+
+    logMessage(LOG_ERROR_LEVEL, "Unknown operation code %d, failure", c0);
+    return packframe(1, LC_BAD_PARAMS, c0, c1, c2, d0, d1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_post
+// Description  : do a block transfer now; its response waits in the tag
+//
+// Inputs       : reg - the request registers, buf - the data, tag - completion
+// Outputs      : 0 if successful, -1 if failure
+
+int membus_post( LCloudRegisterFrame reg, void *buf, LcBusTag *tag ) {
+    tag->conn = 0;
+    tag->resp = membus_request(reg, buf);
+    tag->done = 1;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_wait
+// Description  : response of a posted block transfer (already done)
+//
+// Inputs       : tag - completion passed to membus_post
+// Outputs      : the response
+
+LCloudRegisterFrame membus_wait( LcBusTag *tag ) {
+    return (tag->done) ? tag->resp : (LCloudRegisterFrame)-1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : membus_logstats
+// Description  : log the requests served
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int membus_logstats( void ) {
+    logMessage(LOG_INFO_LEVEL, "In-process bus [%lu requests, %lu KB]", memrequests, membytes / 1024);
+    return 0;
+}
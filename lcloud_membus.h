@@ -0,0 +1,37 @@
+#ifndef LCLOUD_MEMBUS_INCLUDED
+#define LCLOUD_MEMBUS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_membus.h
+//  Description    : This is the interface of the in-process bus backend of
+//                   the Lion Cloud filesystem: the devices of a hardware
+//                   manifest served from memory (or mapped device files) in
+//                   the client itself, without a socket or server.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 11:04:18 PM EDT
+//
+
+// Includes
+#include <lcloud_network.h>
+
+// Defines
+#define LC_MEMBUS_MAXDEVS 16 // most devices in a manifest
+
+//
+// Functional Prototypes
+
+LcBusBackend * membus_lcloud_backend( const char *manifest, const char *store );
+    // Set up the devices of a manifest, in memory or (store != NULL) in a
+    // directory of device files that keeps them between runs; returns the
+    // backend to pass to client_lcloud_bus_backend, NULL if failure
+
+int membus_lcloud_faildevice( int dev, int fail );
+    // Make device dev (index in device id order) fail its block transfers
+    // (fail 1) or work again (fail 0), before power on too
+
+int membus_lcloud_devblocks( int dev );
+    // Blocks of device dev (index in device id order), -1 if no such device
+
+#endif
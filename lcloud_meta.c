@@ -0,0 +1,936 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_meta.c
+//  Description    : This is the on-device metadata of the Lion Cloud
+//                   filesystem.  The superblock sits at block 0/0 or 0/1 of
+//                   the first two devices (the copies are written in turn
+//                   to both, the newest valid one counts) and points to the
+//                   inode table
+//                   and allocation bitmap streams; every stream is a chain
+//                   of blocks (each names the next one) taken from the
+//                   allocator, so the metadata only uses the blocks it
+//                   needs and grows with the filesystem.
+//
+//                   Changes made between checkpoints go to a write-ahead
+//                   journal: records gathered from every thread are written
+//                   together to the next journal blocks at each commit, and
+//                   replayed at power on after a crash.  A checkpoint writes
+//                   the streams to new chains, switches the superblock and
+//                   starts the journal over.
+//
+//                   Nothing new is placed on a device once its transfers
+//                   fail: chains go to the working devices (a chain whose
+//                   block write fails is moved and written again), and the
+//                   journal asks for a checkpoint when it reaches a block on
+//                   a failed device, so the filesystem can move it.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sun 18 Oct 2026 12:02:45 AM EDT
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmpsc311_log.h>
+#include <lcloud_alloc.h>
+#include <lcloud_meta.h>
+
+// Defines
+#define LC_META_CHAINMAGIC 'M'
+#define LC_META_LOGMAGIC 'J'
+#define LC_META_HASNEXT 0x1
+
+//
+// Global Data
+int metadevs = 0;                       // devices
+LcDeviceId metadids[LC_META_MAXDEVS];   // their ids, by index
+LcBlockIoFn metaread = NULL;            // bus block read
+LcBlockIoFn metawrite = NULL;           // bus block write
+int metafailed[LC_META_MAXDEVS];        // devices to place nothing on (their transfers fail)
+
+LcMetaLoc *logblks = NULL;              // journal blocks, in order
+int lognblks = 0;                       // how many
+int lognext = 0;                        // next one to write
+uint32_t logfsid = 0;                   // filesystem id in their headers
+uint32_t logepoch = 0;                  // checkpoint generation they follow
+char *logpend = NULL;                   // records of the next commit (length byte, record)
+int logpendlen = 0;                     // bytes of them
+int logpendcap = 0;                     // bytes logpend can hold
+int logpendrecs = 0;                    // records in them
+int logoverflow = 0;                     // a record too big for the journal came
+LcLogStats logstats;                    // journal counters
+pthread_mutex_t logappendlock = PTHREAD_MUTEX_INITIALIZER; // the pending records
+pthread_mutex_t logcommitlock = PTHREAD_MUTEX_INITIALIZER; // journal block writes
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_put
+// Description  : Append a little endian value of 1, 2 or 4 bytes at *p
+//
+// Inputs       : p - write position (moved past the value), v - the value,
+//                bytes - its size
+// Outputs      : none
+
+void lcmeta_put( char **p, uint32_t v, int bytes ) {
+    int i;
+
+    for(i=0; i<bytes; i++){
+        (*p)[i] = (char)((v >> (8*i)) & 0xff);
+    }
+    *p += bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_get
+// Description  : Take a little endian value of 1, 2 or 4 bytes from *p
+//
+// Inputs       : p - read position (moved past the value), bytes - its size
+// Outputs      : the value
+
+uint32_t lcmeta_get( char **p, int bytes ) {
+    uint32_t v = 0;
+    int i;
+
+    for(i=0; i<bytes; i++){
+        v |= (uint32_t)(uint8_t)(*p)[i] << (8*i);
+    }
+    *p += bytes;
+    return v;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checksum
+// Description  : FNV-1a hash of a buffer
+//
+// Inputs       : buf - the data, len - its bytes
+// Outputs      : the hash
+
+uint32_t checksum(const char *buf, int len){
+    uint32_t h = 2166136261u;
+    int i;
+
+    for(i=0; i<len; i++){
+        h = (h ^ (uint8_t)buf[i]) * 16777619u;
+    }
+    return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : metaloc
+// Description  : fill in a location from a device id (-1 if unknown)
+//
+// Inputs       : loc - the location, did/sec/blk - the block
+// Outputs      : 0 if successful, -1 if the device is unknown
+
+int metaloc(LcMetaLoc *loc, LcDeviceId did, uint16_t sec, uint16_t blk){
+    int i;
+
+    for(i=0; i<metadevs; i++){
+        if(metadids[i] == did){
+            loc->dev = i;
+            loc->did = did;
+            loc->sec = sec;
+            loc->blk = blk;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : isfailed
+// Description  : tell whether a device takes no more metadata (devices are
+//                failed from any thread)
+//
+// Inputs       : dev - device index
+// Outputs      : 1 if it failed, 0 if not
+
+int isfailed(int dev){
+    return __atomic_load_n(&metafailed[dev], __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_setfailed
+// Description  : Place no more metadata on a device whose transfers fail
+//
+// Inputs       : dev - device index
+// Outputs      : none
+
+void lcmeta_setfailed( int dev ) {
+
+    if(dev >= 0 && dev < metadevs){
+        __atomic_store_n(&metafailed[dev], 1, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_onfailed
+// Description  : Tell whether a chain has a block on a failed device
+//
+// Inputs       : c - the chain
+// Outputs      : 1 if it has, 0 if not
+
+int lcmeta_onfailed( const LcMetaChain *c ) {
+    int i;
+
+    for(i=0; i<c->nblks; i++){
+        if(isfailed(c->blks[i].dev)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_init
+// Description  : Set up the metadata layer for the devices and block I/O
+//
+// Inputs       : ndevs - devices, dids - their ids (index order),
+//                rd/wr - block read and write on the bus
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmeta_init( int ndevs, const LcDeviceId *dids, LcBlockIoFn rd, LcBlockIoFn wr ) {
+
+    if(ndevs < 1 || ndevs > LC_META_MAXDEVS){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: bad number of devices %d", ndevs);
+        return -1;
+    }
+    lcmeta_logclose();
+    memcpy(metadids, dids, ndevs * sizeof(LcDeviceId));
+    memset(metafailed, 0, sizeof(metafailed));
+    metadevs = ndevs;
+    metaread = rd;
+    metawrite = wr;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_format
+// Description  : Fill in a new superblock for the devices and reserve its
+//                blocks (the allocator must be fresh); its generation goes
+//                on from the copies of an older filesystem, so they never
+//                count as newer
+//
+// Inputs       : sb - the superblock, maxsec/maxblk - device geometries
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmeta_format( LcSuperblock *sb, const uint16_t *maxsec, const uint16_t *maxblk ) {
+    struct timespec now;
+    uint32_t generation = 0;
+    int i, d;
+
+    if(lcmeta_readsuper(sb) == 0){
+        generation = sb->generation;
+    }
+    memset(sb, 0, sizeof(LcSuperblock));
+    sb->generation = generation;
+    clock_gettime(CLOCK_REALTIME, &now);
+    sb->fsid = (uint32_t)now.tv_sec * 2654435761u ^ (uint32_t)now.tv_nsec ^ ((uint32_t)getpid() << 16);
+    sb->ndevs = metadevs;
+    for(i=0; i<metadevs; i++){
+        sb->did[i] = metadids[i];
+        sb->maxsec[i] = maxsec[i];
+        sb->maxblk[i] = maxblk[i];
+    }
+    if(maxblk[0] < LC_META_SUPERBLKS){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: the first device is too small for the superblock");
+        return -1;
+    }
+    for(d=0; d<LC_META_SUPERDEVS && d<metadevs; d++){
+        for(i=0; i<LC_META_SUPERBLKS && maxblk[d] >= LC_META_SUPERBLKS; i++){
+            if(lcloud_reserveblk(d, 0, i) == -1){
+                logMessage(LOG_ERROR_LEVEL, "Metadata: failed to reserve the superblock on device %d", d);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readslot
+// Description  : read and check one copy of the superblock
+//
+// Inputs       : dev - its device, blk - its block (0/blk), sb - filled in
+// Outputs      : 0 if successful, -1 if the copy is not valid
+
+int readslot(int dev, uint16_t blk, LcSuperblock *sb){
+    char block[LC_DEVICE_BLOCK_SIZE], *p = block;
+    LcDeviceId did[3];
+    uint16_t sec[3], b[3];
+    int i;
+
+    if(metaread(metadids[dev], 0, blk, block) == -1){
+        return -1;
+    }
+    if(lcmeta_get(&p, 4) != LC_META_MAGIC || lcmeta_get(&p, 4) != LC_META_VERSION){
+        return -1;
+    }
+    p = block + LC_DEVICE_BLOCK_SIZE - 4;
+    if(lcmeta_get(&p, 4) != checksum(block, LC_DEVICE_BLOCK_SIZE - 4)){
+        logMessage(LOG_WARNING_LEVEL, "Metadata: superblock copy %d/%d checksum mismatch", dev, blk);
+        return -1;
+    }
+
+    p = block + 8;
+    memset(sb, 0, sizeof(LcSuperblock));
+    sb->generation = lcmeta_get(&p, 4);
+    sb->fsid = lcmeta_get(&p, 4);
+    sb->ndevs = lcmeta_get(&p, 1);
+    if(sb->ndevs > LC_META_MAXDEVS){
+        return -1;
+    }
+    for(i=0; i<sb->ndevs; i++){
+        sb->did[i] = lcmeta_get(&p, 1);
+        sb->maxsec[i] = lcmeta_get(&p, 2);
+        sb->maxblk[i] = lcmeta_get(&p, 2);
+    }
+
+    // inode table, bitmap and journal streams (unpacked before use, argument
+    // order is not defined)
+    for(i=0; i<3; i++){
+        did[i] = lcmeta_get(&p, 1);
+        sec[i] = lcmeta_get(&p, 2);
+        b[i] = lcmeta_get(&p, 2);
+        if(i == 0) sb->inodelen = lcmeta_get(&p, 4);
+        if(i == 1) sb->bitmaplen = lcmeta_get(&p, 4);
+        if(i == 2) sb->journallen = lcmeta_get(&p, 4);
+    }
+    if((sb->inodelen > 0 && metaloc(&sb->inodes, did[0], sec[0], b[0]) == -1) ||
+       (sb->bitmaplen > 0 && metaloc(&sb->bitmap, did[1], sec[1], b[1]) == -1) ||
+       (sb->journallen > 0 && metaloc(&sb->journal, did[2], sec[2], b[2]) == -1)){
+        return -1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_readsuper
+// Description  : Read and check the superblock copies, taking the newest
+//                valid one (a copy may be torn by a crash, or left behind
+//                while its device was failed)
+//
+// Inputs       : sb - filled with the superblock
+// Outputs      : 0 if successful, -1 if there is no valid superblock
+
+int lcmeta_readsuper( LcSuperblock *sb ) {
+    LcSuperblock copy;
+    int i, d, found = 0;
+
+    for(d=0; d<LC_META_SUPERDEVS && d<metadevs; d++){
+        for(i=0; i<LC_META_SUPERBLKS; i++){
+            if(readslot(d, i, &copy) == 0 && (found == 0 || copy.generation > sb->generation)){
+                *sb = copy;
+                found = 1;
+            }
+        }
+    }
+    return (found) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_writesuper
+// Description  : Write the superblock, bumping its generation, over the
+//                older of the two copies on each working superblock device
+//                (a device with fewer blocks than copies holds none)
+//
+// Inputs       : sb - the superblock
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmeta_writesuper( LcSuperblock *sb ) {
+    char block[LC_DEVICE_BLOCK_SIZE], *p = block;
+    int i, d, written = 0;
+
+    memset(block, 0, sizeof(block));
+    sb->generation++;
+    lcmeta_put(&p, LC_META_MAGIC, 4);
+    lcmeta_put(&p, LC_META_VERSION, 4);
+    lcmeta_put(&p, sb->generation, 4);
+    lcmeta_put(&p, sb->fsid, 4);
+    lcmeta_put(&p, sb->ndevs, 1);
+    for(i=0; i<sb->ndevs; i++){
+        lcmeta_put(&p, sb->did[i], 1);
+        lcmeta_put(&p, sb->maxsec[i], 2);
+        lcmeta_put(&p, sb->maxblk[i], 2);
+    }
+    lcmeta_put(&p, sb->inodes.did, 1);
+    lcmeta_put(&p, sb->inodes.sec, 2);
+    lcmeta_put(&p, sb->inodes.blk, 2);
+    lcmeta_put(&p, sb->inodelen, 4);
+    lcmeta_put(&p, sb->bitmap.did, 1);
+    lcmeta_put(&p, sb->bitmap.sec, 2);
+    lcmeta_put(&p, sb->bitmap.blk, 2);
+    lcmeta_put(&p, sb->bitmaplen, 4);
+    lcmeta_put(&p, sb->journal.did, 1);
+    lcmeta_put(&p, sb->journal.sec, 2);
+    lcmeta_put(&p, sb->journal.blk, 2);
+    lcmeta_put(&p, sb->journallen, 4);
+    p = block + LC_DEVICE_BLOCK_SIZE - 4;
+    lcmeta_put(&p, checksum(block, LC_DEVICE_BLOCK_SIZE - 4), 4);
+
+    for(d=0; d<LC_META_SUPERDEVS && d<metadevs && d<sb->ndevs; d++){
+        if(sb->maxblk[d] < LC_META_SUPERBLKS){
+            continue;
+        }
+        if(isfailed(d) == 0 && metawrite(metadids[d], 0, sb->generation % LC_META_SUPERBLKS, block) == -1){
+            lcmeta_setfailed(d);
+        }
+        written += (isfailed(d) == 0);
+    }
+    if(written == 0){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: failed to write the superblock");
+        return -1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addblock
+// Description  : append a block to the list of a chain
+//
+// Inputs       : c - the chain, loc - the block
+// Outputs      : 0 if successful, -1 if failure
+
+int addblock(LcMetaChain *c, LcMetaLoc *loc){
+    LcMetaLoc *newblks;
+    int newcap;
+
+    if(c->nblks == c->cap){
+        newcap = (c->cap == 0) ? 4 : c->cap * 2;
+        if((newblks = realloc(c->blks, sizeof(LcMetaLoc) * newcap)) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: failed to grow a chain");
+            return -1;
+        }
+        c->blks = newblks;
+        c->cap = newcap;
+    }
+    c->blks[c->nblks++] = *loc;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_load
+// Description  : Read a stream, following its chain from the first block
+//
+// Inputs       : c - filled with the chain, head - first block,
+//                len - bytes of the stream, data - set to the bytes (malloc'd)
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmeta_load( LcMetaChain *c, LcMetaLoc head, uint32_t len, char **data ) {
+    char block[LC_DEVICE_BLOCK_SIZE], *p;
+    LcMetaLoc loc = head;
+    uint32_t got = 0, n;
+    uint16_t sec, blk;
+    LcDeviceId did;
+    int flags;
+
+    memset(c, 0, sizeof(LcMetaChain));
+    if((*data = malloc(len + 1)) == NULL){
+        return -1;
+    }
+    while(got < len){
+        if(addblock(c, &loc) == -1 || metaread(loc.did, loc.sec, loc.blk, block) == -1 || block[6] != LC_META_CHAINMAGIC){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: bad chain block [%d/%d/%d]", loc.did, loc.sec, loc.blk);
+            free(*data);
+            lcmeta_free(c);
+            return -1;
+        }
+        n = (len - got < LC_META_PAYLOAD) ? len - got : LC_META_PAYLOAD;
+        memcpy(*data + got, block + LC_META_HEADER, n);
+        got += n;
+
+        // the next block (arguments are not evaluated in order, so unpack first)
+        p = block;
+        flags = lcmeta_get(&p, 1);
+        did = lcmeta_get(&p, 1);
+        sec = lcmeta_get(&p, 2);
+        blk = lcmeta_get(&p, 2);
+        if(got < len && ((flags & LC_META_HASNEXT) == 0 || metaloc(&loc, did, sec, blk) == -1)){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: chain ends early [%d/%d/%d]", loc.did, loc.sec, loc.blk);
+            free(*data);
+            lcmeta_free(c);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : newblock
+// Description  : allocate a chain block on the first working device with
+//                room
+//
+// Inputs       : loc - filled with the block
+// Outputs      : 0 if successful, -1 if failure (devices full)
+
+int newblock(LcMetaLoc *loc){
+    int dev;
+
+    for(dev=0; dev<metadevs; dev++){
+        if(isfailed(dev) == 0 && lcloud_allocblk(dev, &loc->sec, &loc->blk) == 0){
+            loc->dev = dev;
+            loc->did = metadids[dev];
+            return 0;
+        }
+    }
+    logMessage(LOG_ERROR_LEVEL, "Metadata: no free block for a chain");
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : movefailed
+// Description  : move the blocks of a chain on failed devices to working
+//                ones (before the chain is written)
+//
+// Inputs       : c - the chain
+// Outputs      : 0 if successful, -1 if failure (devices full)
+
+int movefailed(LcMetaChain *c){
+    LcMetaLoc loc;
+    int i;
+
+    for(i=0; i<c->nblks; i++){
+        if(isfailed(c->blks[i].dev)){
+            if(newblock(&loc) == -1){
+                return -1;
+            }
+            lcloud_freeblk(c->blks[i].dev, c->blks[i].sec, c->blks[i].blk);
+            c->blks[i] = loc;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_grow
+// Description  : Make the chain big enough for a stream of len bytes,
+//                allocating its new blocks from the first working device
+//                with room
+//
+// Inputs       : c - the chain, len - bytes of the stream
+// Outputs      : 0 if successful, -1 if failure (devices full)
+
+int lcmeta_grow( LcMetaChain *c, uint32_t len ) {
+    int need = (len + LC_META_PAYLOAD - 1) / LC_META_PAYLOAD;
+    LcMetaLoc loc;
+
+    while(c->nblks < need){
+        if(newblock(&loc) == -1 || addblock(c, &loc) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_store
+// Description  : Write a stream to its chain, growing the chain if needed;
+//                blocks past the end of the stream stay in the chain for
+//                later growth.  Blocks on failed devices are moved first,
+//                and the chain is moved and written again when a block
+//                write fails (its device is failed then)
+//
+// Inputs       : c - the chain, data - the stream, len - its bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmeta_store( LcMetaChain *c, const char *data, uint32_t len ) {
+    char block[LC_DEVICE_BLOCK_SIZE], *p;
+    int need = (len + LC_META_PAYLOAD - 1) / LC_META_PAYLOAD, i;
+    uint32_t n;
+
+    if(lcmeta_grow(c, len) == -1 || movefailed(c) == -1){
+        return -1;
+    }
+    for(i=0; i<need; i++){
+        memset(block, 0, sizeof(block));
+        p = block;
+        if(i+1 < need){
+            lcmeta_put(&p, LC_META_HASNEXT, 1);
+            lcmeta_put(&p, c->blks[i+1].did, 1);
+            lcmeta_put(&p, c->blks[i+1].sec, 2);
+            lcmeta_put(&p, c->blks[i+1].blk, 2);
+        }
+        block[6] = LC_META_CHAINMAGIC;
+        n = (len - i*LC_META_PAYLOAD < LC_META_PAYLOAD) ? len - i*LC_META_PAYLOAD : LC_META_PAYLOAD;
+        memcpy(block + LC_META_HEADER, data + i*LC_META_PAYLOAD, n);
+        if(metawrite(c->blks[i].did, c->blks[i].sec, c->blks[i].blk, block) == -1){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: failed to write chain block [%d/%d/%d], moving the chain", c->blks[i].did, c->blks[i].sec, c->blks[i].blk);
+            lcmeta_setfailed(c->blks[i].dev);
+            if(movefailed(c) == -1){
+                return -1;
+            }
+            i = -1; // every block names the next one, write them all again
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_free
+// Description  : Forget a chain (its blocks stay allocated)
+//
+// Inputs       : c - the chain
+// Outputs      : none
+
+void lcmeta_free( LcMetaChain *c ) {
+    free(c->blks);
+    memset(c, 0, sizeof(LcMetaChain));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_release
+// Description  : Return the blocks of a chain to the allocator and forget
+//                it (the chain is no longer pointed to)
+//
+// Inputs       : c - the chain
+// Outputs      : none
+
+void lcmeta_release( LcMetaChain *c ) {
+    int i;
+
+    for(i=0; i<c->nblks; i++){
+        lcloud_freeblk(c->blks[i].dev, c->blks[i].sec, c->blks[i].blk);
+    }
+    lcmeta_free(c);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logstart
+// Description  : Set up the journal on its blocks, or move it to new ones
+//                at a checkpoint (the pending records stay for it); records
+//                go after the checkpoint of generation epoch
+//
+// Inputs       : blks - journal blocks, nblks - how many, fsid - filesystem
+//                id, epoch - generation of the checkpoint
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmeta_logstart( const LcMetaLoc *blks, int nblks, uint32_t fsid, uint32_t epoch ) {
+    LcMetaLoc *newblks = NULL;
+
+    if(nblks > 0){
+        if((newblks = malloc(sizeof(LcMetaLoc) * nblks)) == NULL){
+            return -1;
+        }
+        memcpy(newblks, blks, sizeof(LcMetaLoc) * nblks);
+    }
+    pthread_mutex_lock(&logcommitlock);
+    pthread_mutex_lock(&logappendlock);
+    if(logblks == NULL){
+        memset(&logstats, 0, sizeof(LcLogStats)); // first journal of the power cycle
+    }
+    free(logblks);
+    logblks = newblks;
+    lognblks = nblks;
+    lognext = 0;
+    logfsid = fsid;
+    logepoch = epoch;
+    pthread_mutex_unlock(&logappendlock);
+    pthread_mutex_unlock(&logcommitlock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logcheck
+// Description  : check that a journal block was written after the current
+//                checkpoint at its place in the journal
+//
+// Inputs       : block - the block, seq - its place (from 1)
+// Outputs      : bytes of records in it, -1 if it is not valid
+
+int logcheck(char *block, uint32_t seq){
+    char *p = block + 2;
+    int used;
+
+    if(block[0] != LC_META_LOGMAGIC || lcmeta_get(&p, 4) != logfsid || lcmeta_get(&p, 4) != logepoch ||
+       lcmeta_get(&p, 4) != seq){
+        return -1;
+    }
+    used = lcmeta_get(&p, 2);
+    p = block + LC_DEVICE_BLOCK_SIZE - 4;
+    if(used > LC_META_LOGPAYLOAD || lcmeta_get(&p, 4) != checksum(block, LC_DEVICE_BLOCK_SIZE - 4)){
+        return -1;
+    }
+    return used;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logreplay
+// Description  : Hand the committed records to apply, block by block until
+//                the first one not written since the checkpoint; the
+//                journal continues after them
+//
+// Inputs       : apply - takes a record and its bytes, -1 if it fails
+// Outputs      : number of records, -1 if apply failed
+
+int lcmeta_logreplay( int (*apply)( char *rec, int len ) ) {
+    char block[LC_DEVICE_BLOCK_SIZE];
+    int i, used, pos, len, n = 0;
+
+    for(i=0; i<lognblks; i++){
+        if(metaread(logblks[i].did, logblks[i].sec, logblks[i].blk, block) == -1 ||
+           (used = logcheck(block, i + 1)) == -1){
+            break;
+        }
+        for(pos=0; pos<used; pos+=len+1){
+            len = (uint8_t)block[LC_META_LOGHEADER + pos];
+            if(apply(block + LC_META_LOGHEADER + pos + 1, len) == -1){
+                logMessage(LOG_ERROR_LEVEL, "Metadata: bad journal record (block %d, offset %d)", i, pos);
+                return -1;
+            }
+            n++;
+        }
+    }
+    lognext = i;
+    return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logappend
+// Description  : Add a record to the next commit
+//
+// Inputs       : rec - the record, len - its bytes
+// Outputs      : 0 if successful, -1 if failure (the next commit then asks
+//                for a checkpoint)
+
+int lcmeta_logappend( const char *rec, int len ) {
+    char *newpend;
+    int newcap;
+
+    if(lognblks == 0){
+        return 0;
+    }
+    pthread_mutex_lock(&logappendlock);
+    if(len > LC_META_LOGMAXREC){
+        logoverflow = 1;
+        pthread_mutex_unlock(&logappendlock);
+        return -1;
+    }
+    if(logpendlen + len + 1 > logpendcap){
+        newcap = (logpendcap == 0) ? LC_DEVICE_BLOCK_SIZE : logpendcap * 2;
+        while(newcap < logpendlen + len + 1){
+            newcap *= 2;
+        }
+        if((newpend = realloc(logpend, newcap)) == NULL){
+            logoverflow = 1;
+            pthread_mutex_unlock(&logappendlock);
+            return -1;
+        }
+        logpend = newpend;
+        logpendcap = newcap;
+    }
+    logpend[logpendlen] = (char)len;
+    memcpy(logpend + logpendlen + 1, rec, len);
+    logpendlen += len + 1;
+    logpendrecs++;
+    pthread_mutex_unlock(&logappendlock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logpack
+// Description  : take the records that fit in one journal block
+//
+// Inputs       : recs - pending records, len - their bytes, pos - first one
+// Outputs      : bytes taken
+
+int logpack(const char *recs, int len, int pos){
+    int used = 0;
+
+    while(pos + used < len && used + (uint8_t)recs[pos + used] + 1 <= LC_META_LOGPAYLOAD){
+        used += (uint8_t)recs[pos + used] + 1;
+    }
+    return used;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logrequeue
+// Description  : put records a commit could not write back in front of the
+//                pending ones, for the checkpoint
+//
+// Inputs       : recs - the records (length byte, record), len - their bytes
+// Outputs      : none
+
+void logrequeue(const char *recs, int len){
+    char *newpend;
+    int pos;
+
+    pthread_mutex_lock(&logappendlock);
+    if((newpend = malloc(len + logpendlen + 1)) == NULL){
+        logoverflow = 1;
+        pthread_mutex_unlock(&logappendlock);
+        return;
+    }
+    memcpy(newpend, recs, len);
+    if(logpendlen > 0){
+        memcpy(newpend + len, logpend, logpendlen);
+    }
+    free(logpend);
+    logpend = newpend;
+    logpendlen += len;
+    logpendcap = logpendlen + 1;
+    for(pos=0; pos<len; pos+=(uint8_t)recs[pos]+1){
+        logpendrecs++;
+    }
+    pthread_mutex_unlock(&logappendlock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logcommit
+// Description  : Write the records added so far by every thread to the next
+//                journal blocks (group commit: a thread finding its records
+//                taken by another's commit has nothing left to write); flush
+//                runs first so the data the records point to is durable
+//
+// Inputs       : flush - writes back the dirty data (NULL if none)
+// Outputs      : 0 if successful, 1 if the journal is full or its next
+//                blocks are on a failed device (the records stay pending
+//                for the checkpoint), -1 if failure
+
+int lcmeta_logcommit( int (*flush)( void ) ) {
+    char block[LC_DEVICE_BLOCK_SIZE], *p, *recs;
+    int len, nrecs, need, pos, used, i, ret = 0;
+
+    if(lognblks == 0){
+        return 0;
+    }
+    pthread_mutex_lock(&logcommitlock);
+    pthread_mutex_lock(&logappendlock);
+    for(need=0, pos=0; pos<logpendlen; need++){
+        pos += logpack(logpend, logpendlen, pos);
+    }
+    for(i=lognext; i<lognext+need && i<lognblks && isfailed(logblks[i].dev) == 0; i++);
+    if(logoverflow == 1 || lognext + need > lognblks || i < lognext + need){
+        logstats.full++;
+        pthread_mutex_unlock(&logappendlock);
+        pthread_mutex_unlock(&logcommitlock);
+        return 1;
+    }
+    recs = logpend;
+    len = logpendlen;
+    nrecs = logpendrecs;
+    logpend = NULL;
+    logpendlen = logpendcap = logpendrecs = 0;
+    pthread_mutex_unlock(&logappendlock);
+
+    if(len > 0 && flush != NULL && flush() == -1){
+        logMessage(LOG_ERROR_LEVEL, "Metadata: data write back failed, %d journal records dropped", nrecs);
+        ret = -1;
+    }
+    for(pos=0; pos<len && ret == 0; pos+=used){
+        used = logpack(recs, len, pos);
+        memset(block, 0, sizeof(block));
+        block[0] = LC_META_LOGMAGIC;
+        p = block + 2;
+        lcmeta_put(&p, logfsid, 4);
+        lcmeta_put(&p, logepoch, 4);
+        lcmeta_put(&p, lognext + 1, 4);
+        lcmeta_put(&p, used, 2);
+        memcpy(block + LC_META_LOGHEADER, recs + pos, used);
+        p = block + LC_DEVICE_BLOCK_SIZE - 4;
+        lcmeta_put(&p, checksum(block, LC_DEVICE_BLOCK_SIZE - 4), 4);
+        if(metawrite(logblks[lognext].did, logblks[lognext].sec, logblks[lognext].blk, block) == -1){
+            logMessage(LOG_ERROR_LEVEL, "Metadata: failed to write journal block %d, checkpoint asked for", lognext);
+            lcmeta_setfailed(logblks[lognext].dev);
+            logrequeue(recs + pos, len - pos);
+            logstats.full++;
+            ret = 1;
+            break;
+        }
+        lognext++;
+        logstats.blocks++;
+    }
+    if(len > 0 && ret == 0){
+        logstats.commits++;
+        logstats.records += nrecs;
+    }
+    free(recs);
+    pthread_mutex_unlock(&logcommitlock);
+    return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logreset
+// Description  : Start the journal over after a checkpoint, dropping the
+//                pending records (the checkpoint has their changes)
+//
+// Inputs       : epoch - generation of the checkpoint
+// Outputs      : 0 if successful
+
+int lcmeta_logreset( uint32_t epoch ) {
+
+    pthread_mutex_lock(&logcommitlock);
+    pthread_mutex_lock(&logappendlock);
+    free(logpend);
+    logpend = NULL;
+    logpendlen = logpendcap = logpendrecs = 0;
+    logoverflow = 0;
+    lognext = 0;
+    logepoch = epoch;
+    pthread_mutex_unlock(&logappendlock);
+    pthread_mutex_unlock(&logcommitlock);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logstats
+// Description  : Get the journal counters
+//
+// Inputs       : st - filled with the counters
+// Outputs      : 0 if successful
+
+int lcmeta_logstats( LcLogStats *st ) {
+
+    *st = logstats;
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmeta_logclose
+// Description  : Free the journal state
+//
+// Inputs       : none
+// Outputs      : none
+
+void lcmeta_logclose( void ) {
+
+    free(logblks);
+    free(logpend);
+    logblks = NULL;
+    logpend = NULL;
+    lognblks = lognext = 0;
+    logpendlen = logpendcap = logpendrecs = 0;
+    logoverflow = 0;
+}
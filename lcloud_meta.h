@@ -0,0 +1,150 @@
+#ifndef LCLOUD_META_INCLUDED
+#define LCLOUD_META_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_meta.h
+//  Description    : This is the interface of the on-device metadata of the
+//                   Lion Cloud filesystem: a superblock at a fixed place,
+//                   metadata streams (inode table, allocation bitmap, block
+//                   maps of extents) kept in chains of blocks taken from the
+//                   allocator, and a write-ahead journal of the changes made
+//                   since the last checkpoint.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sun 18 Oct 2026 12:02:45 AM EDT
+//
+
+// Includes
+#include <stdint.h>
+#include <lcloud_controller.h>
+
+// Defines
+#define LC_META_MAGIC 0x5346434c   // "LCFS"
+#define LC_META_VERSION 8
+#define LC_META_MAXDEVS 16
+#define LC_META_SUPERBLKS 2        // superblock copies (blocks 0/0 and 0/1), written in turn
+#define LC_META_SUPERDEVS 2        // devices holding them (the first ones, mirrored)
+#define LC_META_HEADER 8           // chain block header: next block and flags
+#define LC_META_PAYLOAD (LC_DEVICE_BLOCK_SIZE - LC_META_HEADER)
+#define LC_META_EXTENT 8           // bytes of a block map extent (did, flags, sec, blk, length)
+#define LC_META_LOGENTRY 5         // bytes of a journal block location (did, sec, blk)
+#define LC_META_LOGBLKS 64         // default journal blocks of a new filesystem
+#define LC_META_LOGHEADER 16       // journal block header: magic, fs id, epoch, sequence, bytes
+#define LC_META_LOGPAYLOAD (LC_DEVICE_BLOCK_SIZE - LC_META_LOGHEADER - 4)
+#define LC_META_LOGMAXREC (LC_META_LOGPAYLOAD - 1) // largest journal record
+
+// Metadata modes (lcsetmetadata)
+#define LC_META_NONE 0             // keep the metadata in memory only
+#define LC_META_LOAD 1             // load it at power on, format devices without it
+#define LC_META_FORMAT 2           // format the devices at every power on
+
+// location of a metadata block
+typedef struct {
+    int dev;                // device index
+    LcDeviceId did;         // device id
+    uint16_t sec;           // sector
+    uint16_t blk;           // block
+} LcMetaLoc;
+
+// a metadata stream: its bytes kept in a chain of blocks
+typedef struct {
+    LcMetaLoc *blks;        // the blocks, in order
+    int nblks;              // blocks in the chain
+    int cap;                // entries blks can hold
+} LcMetaChain;
+
+// the superblock (block 0/0 or 0/1 of device 0 or 1, the newest valid one)
+typedef struct {
+    uint32_t generation;    // bumped by every checkpoint
+    uint32_t fsid;          // made up at format, tells its journal blocks from stale ones
+    int ndevs;              // devices the filesystem was made on
+    LcDeviceId did[LC_META_MAXDEVS];
+    uint16_t maxsec[LC_META_MAXDEVS];
+    uint16_t maxblk[LC_META_MAXDEVS];
+    LcMetaLoc inodes;       // first block of the inode table stream
+    uint32_t inodelen;      // its bytes (0 = none)
+    LcMetaLoc bitmap;       // first block of the allocation bitmap stream
+    uint32_t bitmaplen;     // its bytes
+    LcMetaLoc journal;      // first block of the stream listing the journal blocks
+    uint32_t journallen;    // its bytes (0 = no journal)
+} LcSuperblock;
+
+// Journal counters (lcmeta_logstats)
+typedef struct {
+    int commits;            // commits that wrote journal blocks
+    int blocks;             // journal blocks written
+    int records;            // records committed
+    int full;               // commits that found the journal full
+} LcLogStats;
+
+// Block read/write on the bus
+typedef int (*LcBlockIoFn)( LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
+
+//
+// Functional Prototypes
+
+int lcmeta_init( int ndevs, const LcDeviceId *dids, LcBlockIoFn rd, LcBlockIoFn wr );
+    // Set up the metadata layer for the devices (index order) and block I/O
+
+int lcmeta_format( LcSuperblock *sb, const uint16_t *maxsec, const uint16_t *maxblk );
+    // Fill in a new superblock and reserve its blocks
+
+int lcmeta_readsuper( LcSuperblock *sb );
+    // Read and check the superblock, -1 if there is no valid one
+
+int lcmeta_writesuper( LcSuperblock *sb );
+    // Write the superblock over the older copy (bumping its generation)
+
+int lcmeta_load( LcMetaChain *c, LcMetaLoc head, uint32_t len, char **data );
+    // Read a stream of len bytes starting at head (data malloc'd)
+
+int lcmeta_grow( LcMetaChain *c, uint32_t len );
+    // Make the chain big enough for len bytes, allocating blocks
+
+int lcmeta_store( LcMetaChain *c, const char *data, uint32_t len );
+    // Write a stream to its chain (growing it if needed)
+
+void lcmeta_free( LcMetaChain *c );
+    // Forget a chain (the blocks stay allocated on the devices)
+
+void lcmeta_release( LcMetaChain *c );
+    // Return the blocks of a chain to the allocator and forget it
+
+void lcmeta_setfailed( int dev );
+    // Place no more metadata on a device whose transfers fail
+
+int lcmeta_onfailed( const LcMetaChain *c );
+    // 1 if a block of the chain is on a failed device, 0 if not
+
+int lcmeta_logstart( const LcMetaLoc *blks, int nblks, uint32_t fsid, uint32_t epoch );
+    // Set up the journal on its blocks for the checkpoint of generation epoch
+
+int lcmeta_logreplay( int (*apply)( char *rec, int len ) );
+    // Hand the records committed since the checkpoint to apply, in order;
+    // returns the number of records, -1 if apply failed
+
+int lcmeta_logappend( const char *rec, int len );
+    // Add a record to the next commit
+
+int lcmeta_logcommit( int (*flush)( void ) );
+    // Write the records added so far (every thread's), after flush has made
+    // the data they point to durable; 1 if the journal is full (checkpoint)
+
+int lcmeta_logreset( uint32_t epoch );
+    // Start the journal over after the checkpoint of generation epoch,
+    // dropping the records it covers
+
+int lcmeta_logstats( LcLogStats *st );
+    // Get the journal counters
+
+void lcmeta_logclose( void );
+    // Free the journal state
+
+void lcmeta_put( char **p, uint32_t v, int bytes );
+    // Append a little endian value of 1, 2 or 4 bytes at *p
+
+uint32_t lcmeta_get( char **p, int bytes );
+    // Take a little endian value of 1, 2 or 4 bytes from *p
+
+#endif
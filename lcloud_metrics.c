@@ -0,0 +1,256 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_metrics.c
+//  Description    : This is the latency metrics of the Lion Cloud
+//                   filesystem.  Each metric is a log-linear histogram
+//                   (HDR style): values below 2^SUBBITS get a bucket each,
+//                   and every larger power of 2 is split in 2^SUBBITS equal
+//                   buckets, so any latency from 1ns to hours is kept within
+//                   about 3% in a fixed table.  Samples are added with
+//                   atomic increments, so recording never takes a lock.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 09:02:13 PM EDT
+//
+
+// Includes
+#include <string.h>
+#include <time.h>
+
+#include <cmpsc311_log.h>
+#include <lcloud_controller.h>
+#include <lcloud_network.h>
+#include <lcloud_metrics.h>
+
+// Defines
+#define LC_METRICS_SUB (1 << LC_METRICS_SUBBITS)
+
+// one latency histogram
+typedef struct{
+    uint64_t count;     // samples
+    uint64_t sum;       // total of the samples
+    uint64_t min;       // smallest sample (UINT64_MAX when empty)
+    uint64_t max;       // largest sample
+    uint64_t buckets[LC_METRICS_BUCKETS];
+}lchist;
+lchist hists[LC_MET_MAX] = {[0 ... LC_MET_MAX-1] = {.min = UINT64_MAX}};
+
+const char *LC_METRIC_LABELS[LC_MET_MAX] = {
+    "lcopen", "lcread", "lcwrite", "lcseek", "lcclose",
+    "bus power on", "bus probe", "bus devinit", "bus read", "bus write",
+    "bus readv", "bus writev", "bus power off"
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bucketof
+// Description  : histogram bucket of a value
+//
+// Inputs       : v - the value
+// Outputs      : bucket index
+
+int bucketof(uint64_t v){
+    int msb;
+
+    if(v < LC_METRICS_SUB){
+        return (int)v;
+    }
+    msb = 63 - __builtin_clzll(v);
+    return ((msb - LC_METRICS_SUBBITS + 1) << LC_METRICS_SUBBITS) +
+        (int)((v >> (msb - LC_METRICS_SUBBITS)) & (LC_METRICS_SUB - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bucketmax
+// Description  : largest value that falls in a bucket
+//
+// Inputs       : b - bucket index
+// Outputs      : the value
+
+uint64_t bucketmax(int b){
+    int shift;
+
+    if(b < LC_METRICS_SUB){
+        return b;
+    }
+    shift = (b >> LC_METRICS_SUBBITS) - 1;
+    return (((uint64_t)(LC_METRICS_SUB + (b & (LC_METRICS_SUB - 1))) << shift) + ((uint64_t)1 << shift) - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_now
+// Description  : Monotonic time in nanoseconds
+//
+// Inputs       : none
+// Outputs      : the time
+
+uint64_t lcmetrics_now( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_record
+// Description  : Add a latency sample to a histogram
+//
+// Inputs       : m - the metric, nsecs - the latency
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmetrics_record( LcMetric m, uint64_t nsecs ) {
+    lchist *h;
+    uint64_t old, seen;
+
+    if(m < 0 || m >= LC_MET_MAX){
+        return -1;
+    }
+    h = &hists[m];
+    __sync_fetch_and_add(&h->buckets[bucketof(nsecs)], 1);
+    __sync_fetch_and_add(&h->sum, nsecs);
+    __sync_fetch_and_add(&h->count, 1);
+    for(old = __atomic_load_n(&h->min, __ATOMIC_RELAXED); nsecs < old; old = seen){
+        if((seen = __sync_val_compare_and_swap(&h->min, old, nsecs)) == old){
+            break;
+        }
+    }
+    for(old = __atomic_load_n(&h->max, __ATOMIC_RELAXED); nsecs > old; old = seen){
+        if((seen = __sync_val_compare_and_swap(&h->max, old, nsecs)) == old){
+            break;
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_busmetric
+// Description  : Metric of a bus request
+//
+// Inputs       : opcode - the request's C0 register, rw - its C2 register
+// Outputs      : the metric, -1 if the opcode is unknown
+
+int lcmetrics_busmetric( int opcode, int rw ) {
+    switch(opcode){
+    case LC_POWER_ON:
+        return LC_MET_BUS_POWERON;
+    case LC_DEVPROBE:
+        return LC_MET_BUS_PROBE;
+    case LC_DEVINIT:
+        return LC_MET_BUS_DEVINIT;
+    case LC_BLOCK_XFER:
+        return (rw == LC_XFER_READ) ? LC_MET_BUS_READ : LC_MET_BUS_WRITE;
+    case LC_BLOCK_XFERV:
+        return (rw == LC_XFER_READ) ? LC_MET_BUS_READV : LC_MET_BUS_WRITEV;
+    case LC_POWER_OFF:
+        return LC_MET_BUS_POWEROFF;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_percentile
+// Description  : Latency at a percentile of a histogram (the top of the
+//                bucket holding that sample, never above the largest one)
+//
+// Inputs       : m - the metric, pct - percentile, 0 to 100
+// Outputs      : the latency in nanoseconds, 0 if there are no samples
+
+uint64_t lcmetrics_percentile( LcMetric m, double pct ) {
+    lchist *h;
+    uint64_t count, rank, seen = 0, max;
+    int b;
+
+    if(m < 0 || m >= LC_MET_MAX || (count = __atomic_load_n(&hists[m].count, __ATOMIC_RELAXED)) == 0){
+        return 0;
+    }
+    h = &hists[m];
+    rank = (uint64_t)(pct / 100.0 * count + 0.999999);
+    if(rank < 1){
+        rank = 1;
+    }
+    max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for(b=0; b<LC_METRICS_BUCKETS; b++){
+        seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        if(seen >= rank){
+            return (bucketmax(b) < max) ? bucketmax(b) : max;
+        }
+    }
+    return max;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_get
+// Description  : Summarize a histogram (it may keep growing meanwhile, so
+//                the figures are a close snapshot)
+//
+// Inputs       : m - the metric, st - filled with the summary
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmetrics_get( LcMetric m, LcLatencyStats *st ) {
+    lchist *h;
+
+    if(m < 0 || m >= LC_MET_MAX){
+        logMessage(LOG_ERROR_LEVEL, "Unknown metric %d", m);
+        return -1;
+    }
+    h = &hists[m];
+    memset(st, 0, sizeof(LcLatencyStats));
+    if((st->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED)) == 0){
+        return 0;
+    }
+    st->min = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    st->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    st->mean = __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / st->count;
+    st->p50 = lcmetrics_percentile(m, 50.0);
+    st->p99 = lcmetrics_percentile(m, 99.0);
+    st->p999 = lcmetrics_percentile(m, 99.9);
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_reset
+// Description  : Clear every histogram (samples recorded at the same time
+//                may be lost)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmetrics_reset( void ) {
+    int i;
+
+    for(i=0; i<LC_MET_MAX; i++){
+        memset(&hists[i], 0, sizeof(lchist));
+        hists[i].min = UINT64_MAX;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmetrics_log
+// Description  : Log the summary of every histogram that has samples
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcmetrics_log( void ) {
+    LcLatencyStats st;
+    int i;
+
+    logMessage(LOG_INFO_LEVEL, "Latency (usecs)  %-13s %9s %9s %9s %9s %9s %9s", "", "count", "mean", "p50", "p99", "p99.9", "max");
+    for(i=0; i<LC_MET_MAX; i++){
+        if(lcmetrics_get(i, &st) == -1 || st.count == 0){
+            continue;
+        }
+        logMessage(LOG_INFO_LEVEL, "Latency (usecs)  %-13s %9lu %9.1f %9.1f %9.1f %9.1f %9.1f", LC_METRIC_LABELS[i], st.count,
+            st.mean / 1000.0, st.p50 / 1000.0, st.p99 / 1000.0, st.p999 / 1000.0, st.max / 1000.0);
+    }
+    return 0;
+}
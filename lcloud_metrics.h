@@ -0,0 +1,77 @@
+#ifndef LCLOUD_METRICS_INCLUDED
+#define LCLOUD_METRICS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_metrics.h
+//  Description    : This is the latency metrics API for the Lion Cloud
+//                   filesystem: one histogram per filesystem call and per
+//                   bus operation, recorded in nanoseconds.
+//
+//   Author        : Sung Woo Oh
+//   Last Modified : Sat 17 Oct 2026 09:02:13 PM EDT
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define LC_METRICS_SUBBITS 5   // sub-buckets per power of 2 = 2^SUBBITS (~3% precision)
+#define LC_METRICS_BUCKETS ((64 - LC_METRICS_SUBBITS + 1) << LC_METRICS_SUBBITS)
+
+// The latencies recorded
+typedef enum {
+    LC_MET_OPEN         = 0,  // lcopen
+    LC_MET_READ         = 1,  // lcread/lcreadat
+    LC_MET_WRITE        = 2,  // lcwrite/lcwriteat
+    LC_MET_SEEK         = 3,  // lcseek
+    LC_MET_CLOSE        = 4,  // lcclose
+    LC_MET_BUS_POWERON  = 5,  // LC_POWER_ON bus request
+    LC_MET_BUS_PROBE    = 6,  // LC_DEVPROBE
+    LC_MET_BUS_DEVINIT  = 7,  // LC_DEVINIT
+    LC_MET_BUS_READ     = 8,  // LC_BLOCK_XFER read
+    LC_MET_BUS_WRITE    = 9,  // LC_BLOCK_XFER write
+    LC_MET_BUS_READV    = 10, // LC_BLOCK_XFERV read
+    LC_MET_BUS_WRITEV   = 11, // LC_BLOCK_XFERV write
+    LC_MET_BUS_POWEROFF = 12, // LC_POWER_OFF
+    LC_MET_MAX          = 13  // Maximum metric number
+} LcMetric;
+
+extern const char *LC_METRIC_LABELS[LC_MET_MAX];
+
+// Summary of one latency histogram (nanoseconds)
+typedef struct {
+    uint64_t count;     // samples recorded
+    uint64_t min;       // smallest sample
+    uint64_t max;       // largest sample
+    uint64_t mean;      // average sample
+    uint64_t p50;       // median
+    uint64_t p99;       // 99th percentile
+    uint64_t p999;      // 99.9th percentile
+} LcLatencyStats;
+
+//
+// Functional Prototypes
+
+uint64_t lcmetrics_now( void );
+    // Monotonic time in nanoseconds
+
+int lcmetrics_record( LcMetric m, uint64_t nsecs );
+    // Add a latency sample to a histogram (thread safe, lock free)
+
+int lcmetrics_busmetric( int opcode, int rw );
+    // Metric of a bus request (opcode and C2 direction)
+
+uint64_t lcmetrics_percentile( LcMetric m, double pct );
+    // Latency at a percentile (0-100) of a histogram, 0 if empty
+
+int lcmetrics_get( LcMetric m, LcLatencyStats *st );
+    // Summarize a histogram
+
+int lcmetrics_reset( void );
+    // Clear every histogram
+
+int lcmetrics_log( void );
+    // Log the summary of every histogram that has samples
+
+#endif
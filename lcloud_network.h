@@ -12,6 +12,7 @@
 //
 
 // Include Files
+#include <stdint.h>
 
 // Project Include Files
 #include <lcloud_controller.h>
@@ -22,6 +23,48 @@
 #define LCLOUD_DEFAULT_IP "127.0.0.1"
 #define LCLOUD_DEFAULT_PORT 24567
 
+// Vectored block transfer (protocol extension, served by lcloud_localserver).
+// Same registers as LC_BLOCK_XFER with D0/D1 naming the first block of a run
+// of physically contiguous blocks (sec*maxblk+blk order) and B1 holding the
+// number of blocks - 1 in the request.  The run's blocks follow the request
+// frame (write) or the response frame (read) back to back.
+#define LC_BLOCK_XFERV 8
+#define LC_XFERV_MAXBLOCKS 16 // most blocks one vectored transfer can move
+
+// Device fault injection (protocol extension, served by lcloud_localserver
+// and the in-process bus).  C1 names the device and D0 is 1 to fail it, so
+// every block transfer to it fails with LC_NO_DEVICE (a device gone to
+// LC_DEVICE_ERRORED), or 0 to bring it back with its blocks as they were.
+#define LC_DEVICE_FAULT 9
+
+// Pipelined block transfers (client_lcloud_bus_post/wait)
+#define LCLOUD_MAX_INFLIGHT 64            // largest window of requests in flight
+#define LCLOUD_DEFAULT_WINDOW 16          // default window
+#define LCLOUD_MAX_INFLIGHT_BYTES (64*1024) // most data bytes in flight (per connection)
+
+// Connection pool (client_lcloud_bus_connections)
+#define LCLOUD_MAX_CONNECTIONS 16         // largest pool
+
+// Completion of a posted block transfer, owned by the caller
+typedef struct {
+    LCloudRegisterFrame resp; // response (host format), once done
+    int conn;                 // connection the request went on
+    int done;                 // response received
+    int metric;               // latency histogram of the request (LcMetric)
+    uint64_t posted;          // time it was posted (lcmetrics_now)
+} LcBusTag;
+
+// Bus backend (client_lcloud_bus_backend): how requests reach the devices.
+// The TCP client to lcloud_server is the default; the in-process backend
+// (lcloud_membus.h) serves the devices in the client itself.
+typedef struct {
+    const char *name;
+    LCloudRegisterFrame (*request)(LCloudRegisterFrame reg, void *buf); // any request, synchronous
+    int (*post)(LCloudRegisterFrame reg, void *buf, LcBusTag *tag);     // start a block transfer
+    LCloudRegisterFrame (*wait)(LcBusTag *tag);                          // finish a posted transfer
+    int (*logstats)(void);                                              // log its utilization
+} LcBusBackend;
+
 // Global data
 
 //
@@ -31,5 +74,23 @@ LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf
 	// This is the implementation of the client operation, as implemented 
 	//  by the 311 student code.
 
+int client_lcloud_bus_post(LCloudRegisterFrame reg, void *buf, LcBusTag *tag);
+	// Send a block transfer without waiting for the response
+
+LCloudRegisterFrame client_lcloud_bus_wait(LcBusTag *tag);
+	// Wait for the response of a posted block transfer
+
+int client_lcloud_bus_window(int n);
+	// Set the most block transfers kept in flight (1 = synchronous)
+
+int client_lcloud_bus_connections(int n);
+	// Set the connection pool size (0 = one connection per device)
+
+int client_lcloud_bus_logstats(void);
+	// Log the utilization of each connection
+
+int client_lcloud_bus_backend(LcBusBackend *be);
+	// Send the requests through a backend (NULL = TCP, the default)
+
 
 #endif
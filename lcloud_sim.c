@@ -15,39 +15,148 @@
 #include <cmpsc311_workload.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 // Project Includes
+#include <lcloud_async.h>
 #include <lcloud_controller.h>
 #include <lcloud_filesys.h>
+#include <lcloud_log.h>
+#include <lcloud_cache.h>
+#include <lcloud_membus.h>
+#include <lcloud_meta.h>
+#include <lcloud_network.h>
 #include <lcloud_support.h>
 
 // Defines
-#define LCLOUD_ARGUMENTS "hvl:x:"
+#define LCLOUD_ARGUMENTS "hvl:x:c:p:w:r:b:q:n:a:t:i:D:m:S:R:"
+#define LC_SIM_MAXDEPTH 64 // most asynchronous requests in flight per replay thread
+#define LC_SIM_MAXTHREADS 64 // most replay threads per workload
 #define USAGE                                                       \
-    "USAGE: lcloud_sim [-h] [-v] [-l <logfile>] <workload-file>\n"  \
+    "USAGE: lcloud_sim [-h] [-v] [-l <logfile>] [-c <blocks>] [-p <policy>] [-w <dirty>] [-r <blocks>]\n"  \
+    "                  [-b <blocks>] [-q <requests>] [-n <connections>]\n"  \
+    "                  [-a <depth>] [-t <threads>] [-i <manifest> [-D <dir>]] [-m <mode>]\n"  \
+    "                  [-S <width>[,<unit>]] [-R <k>,<m>]\n"  \
+    "                  <workload-file> ...\n"  \
     "\n"                                                            \
     "where:\n"                                                      \
     "    -h - help mode (display this message)\n"                   \
     "    -v - verbose output\n"                                     \
     "    -l - write log messages to the filename <logfile>\n"       \
+    "    -c - cache size in blocks (default 64, 0 disables)\n"      \
+    "    -p - cache policy: lru, clock, 2q or arc (default lru)\n"  \
+    "    -w - write-back cache, flushing above <dirty> dirty blocks\n" \
+    "         (0 = 3/4 of the cache)\n"                             \
+    "    -r - largest read-ahead window in blocks (default 16, 0 disables)\n" \
+    "    -b - most blocks per vectored bus transfer (default 1 = off,\n" \
+    "         up to 16, needs lcloud_localserver)\n"                 \
+    "    -q - block transfers kept in flight on the bus (default 16,\n" \
+    "         1 = synchronous)\n"                                     \
+    "    -n - connections to the server (default 1, 0 = one per\n"   \
+    "         device, more than 1 needs lcloud_localserver)\n"        \
+    "    -a - replay reads and writes asynchronously, keeping up to\n" \
+    "         <depth> requests in flight (default 0 = synchronous, up to 64)\n" \
+    "    -t - replay each workload with <threads> threads, the operations\n" \
+    "         of each file staying in order on one thread (default 1)\n" \
+    "    -i - serve the devices of <manifest> in process instead of\n" \
+    "         connecting to the server\n"                            \
+    "    -D - keep the in-process devices in the directory <dir>\n"  \
+    "    -m - filesystem metadata on the devices: load (default, the\n" \
+    "         files already there), format (start empty) or none\n"  \
+    "    -S - stripe new files over <width> devices (default 1, 0 = all)\n" \
+    "         in units of <unit> blocks (default 16)\n"             \
+    "    -R - keep <m> parity blocks for every <k> data blocks of new\n" \
+    "         files, on k+m devices (1,<m> = m+1 copies, default none)\n" \
     "\n"                                                            \
-    "    <workload-file> - file contain the workload to simulate\n" \
+    "    <workload-file> - file contain the workload to simulate; with more\n" \
+    "         than one, each runs in its own thread at the same time\n" \
     "\n"
 
+// a workload run by its own thread
+typedef struct {
+    char* wload;        // workload file
+    int wlid;           // workload number (prefixes its file names)
+    int result;         // 0 if the workload passed, -1 if it failed
+    pthread_t tid;
+} simthread;
+
+// an open file of the workload
+typedef struct {
+    char* filename;
+    LcFHandle fhandle;
+    int pos;
+} fsysdata;
+
+// a workload operation (kept for a replay thread)
+typedef struct simop {
+    char* objname;      // object (file) name
+    workload_operations_type op; // operation
+    size_t pos;         // position in the object
+    size_t size;        // size of the read/write
+    char* data;         // data written / expected to be read
+    struct simop* next; // next operation of the replay thread
+} simop;
+
+// replay counters
+typedef struct {
+    long opens, reads, writes, seeks, closes;
+    uint64_t readbytes, writebytes;
+} simstats;
+
+// an asynchronous read or write in flight
+typedef struct {
+    LcRequestId id;     // request id
+    int write;          // 1 write, 0 read
+    char* filename;     // file name (for the log)
+    char* data;         // copy of the data written / expected to be read
+    char* buf;          // place for the data read
+    int pos;            // file position
+    int size;           // bytes
+} simrequest;
+
+// a stream of operations replayed in order, by one thread
+typedef struct {
+    AssocArray fhTable;     // open files (fsysdata) by name
+    simrequest pending[LC_SIM_MAXDEPTH]; // asynchronous requests in flight
+    int oldest;             // oldest request in pending
+    int npending;           // requests in pending
+    simop* ops;             // operations to replay (replay threads)
+    int result;             // 0 if the stream passed, -1 if it failed
+    pthread_t tid;
+    long opens, reads, writes, seeks, closes;
+    uint64_t readbytes, writebytes;
+} simstream;
+
 //
 // Global Data
 int verbose;
+int asyncdepth = 0; // asynchronous requests in flight per stream, 0 = synchronous
+int replaythreads = 1; // replay threads per workload
+simstats totals; // counters of all the streams
+pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER; // protects totals
+pthread_mutex_t wllock = PTHREAD_MUTEX_INITIALIZER; // the workload reader is not reentrant
 
 //
 // Functional Prototypes
 
-int simulateLionCloud(char* wload); // LionCloud simulation
+int simulateLionCloud(char* wload, int wlid); // LionCloud simulation
+void* simulateThread(void* arg); // LionCloud simulation of one of several workloads
+int completeRequest(simrequest* req); // Wait for an asynchronous request and check it
+int drainStream(simstream* s); // Wait for all the asynchronous requests of a stream
+int submitRequest(simstream* s, fsysdata* fdata, simop* op); // Queue an asynchronous request
+int replayOperation(simstream* s, simop* op); // Run one workload operation
+int endStream(simstream* s); // Finish a stream, add up its counters
+void* replayThread(void* arg); // Replay one partition of a workload
+int partitionOf(char* objname); // Replay thread of an object
 
 //
 // Functions
@@ -66,6 +175,19 @@ int main(int argc, char* argv[])
 
     // Local variables
     int ch, verbose = 0, log_initialized = 0;
+    int cacheblocks = LC_CACHE_MAXBLOCKS, cachepolicy = LC_CACHE_LRU;
+    int writeback = 0, dirtyhigh = 0, readahead = -1, xferbatch = 1;
+    int buswindow = LCLOUD_DEFAULT_WINDOW, busconns = 1, metadata = LC_META_LOAD;
+    int stripewidth = 1, stripeunit = LC_STRIPE_UNIT;
+    int redundk = 1, redundm = 0;
+    int nwl, i, failed = 0;
+    char *manifest = NULL, *store = NULL;
+    LcBusBackend* backend;
+    simthread* sims;
+    struct timespec start, end;
+    struct rusage usage;
+    double elapsed, cpu;
+    long ops;
 
     // Process the command line parameters
     while ((ch = getopt(argc, argv, LCLOUD_ARGUMENTS)) != -1) {
@@ -84,6 +206,79 @@ int main(int argc, char* argv[])
             log_initialized = 1;
             break;
 
+        case 'c': // Cache size (blocks)
+            cacheblocks = atoi(optarg);
+            break;
+
+        case 'p': // Cache replacement policy
+            if ((cachepolicy = lcloud_cachepolicy(optarg)) == -1) {
+                fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+                return (-1);
+            }
+            break;
+
+        case 'w': // Write-back cache, dirty high watermark
+            writeback = 1;
+            dirtyhigh = atoi(optarg);
+            break;
+
+        case 'r': // Read-ahead window
+            readahead = atoi(optarg);
+            break;
+
+        case 'b': // Vectored transfer size
+            xferbatch = atoi(optarg);
+            break;
+
+        case 'q': // Pipelined transfers in flight
+            buswindow = atoi(optarg);
+            break;
+
+        case 'n': // Connection pool size
+            busconns = atoi(optarg);
+            break;
+
+        case 'a': // Asynchronous replay depth
+            asyncdepth = atoi(optarg);
+            break;
+
+        case 't': // Replay threads per workload
+            replaythreads = atoi(optarg);
+            break;
+
+        case 'i': // In-process devices
+            manifest = optarg;
+            break;
+
+        case 'D': // In-process device store directory
+            store = optarg;
+            break;
+
+        case 'm': // Metadata mode
+            if (strcmp(optarg, "load") == 0) {
+                metadata = LC_META_LOAD;
+            } else if (strcmp(optarg, "format") == 0) {
+                metadata = LC_META_FORMAT;
+            } else if (strcmp(optarg, "none") == 0) {
+                metadata = LC_META_NONE;
+            } else {
+                fprintf(stderr, "Unknown metadata mode (%s), aborting.\n", optarg);
+                return (-1);
+            }
+            break;
+
+        case 'S': // Stripe layout
+            stripewidth = atoi(optarg);
+            if (strchr(optarg, ',') != NULL) {
+                stripeunit = atoi(strchr(optarg, ',') + 1);
+            }
+            break;
+
+        case 'R': // Redundancy
+            redundk = atoi(optarg);
+            redundm = (strchr(optarg, ',') != NULL) ? atoi(strchr(optarg, ',') + 1) : 0;
+            break;
+
         default: // Default (unknown)
             fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
             return (-1);
@@ -102,14 +297,85 @@ int main(int argc, char* argv[])
         enableLogLevels(LcControllerLLevel | LcDriverLLevel | LcSimulatorLLevel);
     }
 
+    // Configure the cache used by the filesystem
+    if ((lcloud_configcache(cacheblocks, cachepolicy) == -1) ||
+        (lcloud_configwriteback(writeback, dirtyhigh) == -1) ||
+        ((readahead != -1) && (lcsetreadahead(readahead) == -1)) ||
+        (lcsetxferbatch(xferbatch) == -1) ||
+        (lcsetstripe(stripewidth, stripeunit) == -1) ||
+        (lcsetredundancy(redundk, redundm) == -1) ||
+        (lcsetmetadata(metadata) == -1) ||
+        (client_lcloud_bus_window(buswindow) == -1) ||
+        (client_lcloud_bus_connections(busconns) == -1)) {
+        fprintf(stderr, "Bad cache configuration, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+    if (manifest != NULL) {
+        if ((backend = membus_lcloud_backend(manifest, store)) == NULL) {
+            fprintf(stderr, "Failed to set up the in-process devices, aborting.\n");
+            return (-1);
+        }
+        client_lcloud_bus_backend(backend);
+    }
+
     // The filename should be the next option
     if (argv[optind] == NULL) {
         fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
         return (-1);
     }
 
-    // Run the simulation
-    if (simulateLionCloud(argv[optind]) == 0) {
+    // Every workload's requests have to fit in the async request table
+    nwl = argc - optind;
+    if ((replaythreads < 1) || (replaythreads > LC_SIM_MAXTHREADS)) {
+        fprintf(stderr, "Bad number of replay threads %d (1-%d), aborting.\n", replaythreads, LC_SIM_MAXTHREADS);
+        return (-1);
+    }
+    if ((asyncdepth < 0) || (asyncdepth > LC_SIM_MAXDEPTH) || (asyncdepth * nwl * replaythreads > LC_ASYNC_MAXREQ)) {
+        fprintf(stderr, "Bad async depth %d (0-%d, at most %d over all threads), aborting.\n",
+            asyncdepth, LC_SIM_MAXDEPTH, LC_ASYNC_MAXREQ);
+        return (-1);
+    }
+
+    // Run the simulation, several workloads at once in their own threads
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (nwl == 1) {
+        failed = simulateLionCloud(argv[optind], -1);
+    } else {
+        sims = calloc(nwl, sizeof(simthread));
+        for (i = 0; i < nwl; i++) {
+            sims[i].wload = argv[optind + i];
+            sims[i].wlid = i;
+            if (pthread_create(&sims[i].tid, NULL, simulateThread, &sims[i]) != 0) {
+                fprintf(stderr, "Failed to start workload thread, aborting.\n");
+                return (-1);
+            }
+        }
+        for (i = 0; i < nwl; i++) {
+            pthread_join(sims[i].tid, NULL);
+            if (sims[i].result != 0) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 workload [%s] failed", sims[i].wload);
+                failed = -1;
+            }
+        }
+        if (asyncdepth > 0) {
+            lcasync_stop();
+        }
+        lcshutdown();
+        free(sims);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    ops = totals.opens + totals.reads + totals.writes + totals.closes;
+    logMessage(LOG_INFO_LEVEL, "Replay [%d workloads x %d threads]: %ld ops (%ld opens, %ld reads, %ld writes, %ld seeks, %ld closes) in %.3f secs",
+        nwl, replaythreads, ops, totals.opens, totals.reads, totals.writes, totals.seeks, totals.closes, elapsed);
+    logMessage(LOG_INFO_LEVEL, "Replay throughput: %.0f ops/sec, %.0f bytes/sec (%.0f read, %.0f written)",
+        ops / elapsed, (totals.readbytes + totals.writebytes) / elapsed,
+        totals.readbytes / elapsed, totals.writebytes / elapsed);
+    getrusage(RUSAGE_SELF, &usage);
+    cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    logMessage(LOG_INFO_LEVEL, "Replay CPU: %.3f secs (%.3f user), %.2f usecs/op",
+        cpu, usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6, (ops > 0) ? cpu * 1e6 / ops : 0.0);
+    if (failed == 0) {
         logMessage(LOG_INFO_LEVEL, "LionCloud simulation completed successfully!!!\n\n");
     } else {
         logMessage(LOG_INFO_LEVEL, "LionCloud simulation failed.\n\n");
@@ -124,188 +390,416 @@ int main(int argc, char* argv[])
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : simulateLionCloud
-// Description  : The main control loop for the processing of the LionCloud
-//                simulation (which calls the student code).
+// Function     : simulateThread
+// Description  : Thread running one of several workloads at the same time
 //
-// Inputs       : wload - the name of the workload file
-// Outputs      : 0 if successful test, -1 if failure
+// Inputs       : arg - the workload (simthread)
+// Outputs      : NULL
 
-int simulateLionCloud(char* wload)
+void* simulateThread(void* arg)
 {
+    simthread* sim = arg;
 
-    /* Local types */
-    typedef struct {
-        char* filename;
-        LcFHandle fhandle;
-        int pos;
-    } fsysdata;
+    sim->result = simulateLionCloud(sim->wload, sim->wlid);
+    return (NULL);
+}
 
-    /* Local variables */
-    workload_state state;
-    workload_operation operation;
-    LcFHandle fh;
-    AssocArray fhTable;
-    char buf[LC_MAX_OPERATION_SIZE];
-    int opens, reads, writes, seeks, closes;
-    fsysdata* fdata;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : completeRequest
+// Description  : Wait for an asynchronous read or write, check the result
+//                (and the data read), and free the request's buffers
+//
+// Inputs       : req - the request
+// Outputs      : 0 if successful, -1 if failure
 
-    /* Init fh table, open the workload for processing */
-    init_assoc(&fhTable, stringCompareCallback, pointerCompareCallback);
-    if (openCmpsc311Workload(&state, wload)) {
-        logMessage(LOG_ERROR_LEVEL, "CMPSC311 lcloud workload: failed opening workload [%s]", wload);
-        return (-1);
+int completeRequest(simrequest* req)
+{
+    int ret = 0;
+
+    if (lcwait(req->id) != req->size) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 error async %s failed [%s, pos=%d, size=%d], aborting",
+            (req->write) ? "write" : "read", req->filename, req->pos, req->size);
+        ret = -1;
+    } else if (!req->write && strncmp(req->buf, req->data, req->size) != 0) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 read data compare failed, aborting");
+        logMessage(LOG_ERROR_LEVEL, "Read data     : [%.*s]", req->size, req->buf);
+        logMessage(LOG_ERROR_LEVEL, "Expected data : [%.*s]", req->size, req->data);
+        ret = -1;
+    } else {
+        lcLog(LcControllerLLevel, "Correctly %s [%s], %d bytes at position %d",
+            (req->write) ? "wrote" : "read", req->filename, req->size, req->pos);
     }
+    free(req->data);
+    free(req->buf);
+    return (ret);
+}
 
-    /* Loop until we are done with the workload */
-    logMessage(LcSimulatorLLevel, "CMPSC311 lcloud : executing workload [%s]", state.filename);
-    do {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drainStream
+// Description  : Wait for all the asynchronous requests of a stream
+//
+// Inputs       : s - the stream
+// Outputs      : 0 if successful, -1 if failure
 
-        /* Get the next operation to process */
-        if (readCmpsc311Workload(&state, &operation)) {
-            logMessage(LOG_ERROR_LEVEL, "CMPSC311 workload unit test failed at line %d, get op", state.lineno);
+int drainStream(simstream* s)
+{
+    for (; s->npending > 0; s->npending--, s->oldest = (s->oldest + 1) % asyncdepth) {
+        if (completeRequest(&s->pending[s->oldest]) != 0) {
             return (-1);
         }
+    }
+    return (0);
+}
 
-        /* Verbose log the operation */
-        if ((operation.op == WL_READ) || (operation.op == WL_WRITE)) {
-            logMessage(LcSimulatorLLevel, "CMPSCS311 workload op: %s %s off=%d, sz=%d [%.20s]", operation.objname,
-                workload_operations_strings[operation.op], operation.pos, operation.size, operation.data);
-        } else {
-            logMessage(LcSimulatorLLevel, "CMPSCS311 workload op: %s %s", operation.objname,
-                workload_operations_strings[operation.op]);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : submitRequest
+// Description  : Queue an asynchronous read or write of a stream, waiting
+//                for its oldest request first if the stream is full
+//
+// Inputs       : s - the stream
+//                fdata - the file
+//                op - the read or write
+// Outputs      : 0 if successful, -1 if failure
+
+int submitRequest(simstream* s, fsysdata* fdata, simop* op)
+{
+    simrequest* req;
+
+    if (s->npending == asyncdepth) {
+        if (completeRequest(&s->pending[s->oldest]) != 0) {
+            return (-1);
         }
+        s->oldest = (s->oldest + 1) % asyncdepth;
+        s->npending--;
+    }
+    req = &s->pending[(s->oldest + s->npending) % asyncdepth];
+    req->write = (op->op == WL_WRITE);
+    req->filename = fdata->filename;
+    req->data = malloc(op->size);
+    memcpy(req->data, op->data, op->size);
+    req->buf = (req->write) ? NULL : malloc(op->size);
+    req->pos = op->pos;
+    req->size = op->size;
+    if (req->write) {
+        req->id = lcwrite_async(fdata->fhandle, req->data, op->size, op->pos, NULL, NULL);
+    } else {
+        req->id = lcread_async(fdata->fhandle, req->buf, op->size, op->pos, NULL, NULL);
+    }
+    if (req->id == -1) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 error async %s failed [%s, pos=%d, size=%d], aborting",
+            (req->write) ? "write" : "read", op->objname, op->pos, op->size);
+        free(req->data);
+        free(req->buf);
+        return (-1);
+    }
+    s->npending++;
+    return (0);
+}
 
-        /* Switch on the operation type */
-        switch (operation.op) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replayOperation
+// Description  : Run one workload operation on a stream
+//
+// Inputs       : s - the stream
+//                op - the operation (not WL_EOF)
+// Outputs      : 0 if successful test, -1 if failure
 
-        case WL_OPEN: /* Open the file for reading/writing, check error */
+int replayOperation(simstream* s, simop* op)
+{
+    char buf[LC_MAX_OPERATION_SIZE];
+    LcFHandle fh;
+    fsysdata* fdata;
 
-            /* Open the file for reading */
-            if ((fh = lcopen(operation.objname)) == -1) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error opening file [%s], aborting", operation.objname);
-                return (-1);
-            }
+    /* Verbose log the operation */
+    if ((op->op == WL_READ) || (op->op == WL_WRITE)) {
+        lcLog(LcSimulatorLLevel, "CMPSCS311 workload op: %s %s off=%d, sz=%d [%.20s]", op->objname,
+            workload_operations_strings[op->op], op->pos, op->size, op->data);
+    } else {
+        lcLog(LcSimulatorLLevel, "CMPSCS311 workload op: %s %s", op->objname,
+            workload_operations_strings[op->op]);
+    }
 
-            /* Setup the structure */
-            fdata = malloc(sizeof(fsysdata));
-            fdata->filename = strdup(operation.objname);
-            fdata->fhandle = fh;
-            fdata->pos = 0;
+    /* Switch on the operation type */
+    switch (op->op) {
 
-            /* Insert the file into the table */
-            insert_assoc(&fhTable, fdata->filename, fdata);
-            logMessage(LcSimulatorLLevel, "Open file [%s]", fdata->filename);
-            opens++;
-            break;
+    case WL_OPEN: /* Open the file for reading/writing, check error */
 
-        case WL_READ: /* Read a block of data from the file */
+        /* Open the file for reading */
+        if ((fh = lcopen(op->objname)) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error opening file [%s], aborting", op->objname);
+            return (-1);
+        }
 
-            /* Find the file for processing */
-            if ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error reading unknown file [%s], aborting",
-                    operation.objname);
-                return (-1);
-            }
+        /* Setup the structure */
+        fdata = malloc(sizeof(fsysdata));
+        fdata->filename = strdup(op->objname);
+        fdata->fhandle = fh;
+        fdata->pos = 0;
 
-            /* If the position within the file is not a read location, seek */
-            if (fdata->pos != operation.pos) {
-                if (lcseek(fdata->fhandle, operation.pos) != operation.pos) {
-                    logMessage(LOG_ERROR_LEVEL, "CMPSC311 error seek failed [%s, pos=%d], aborting",
-                        operation.objname, operation.pos);
-                    return (-1);
-                }
-                fdata->pos = operation.pos;
-                seeks++;
-            }
+        /* Insert the file into the table */
+        insert_assoc(&s->fhTable, fdata->filename, fdata);
+        lcLog(LcSimulatorLLevel, "Open file [%s]", fdata->filename);
+        s->opens++;
+        break;
 
-            /* Now do the read from the file */
-            if (lcread(fdata->fhandle, buf, operation.size) != operation.size) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error read failed [%s, pos=%d, size=%d], aborting",
-                    operation.objname, operation.pos, operation.size);
-                return (-1);
-            }
+    case WL_READ: /* Read a block of data from the file */
 
-            /* Compare the data read with that in the workload data */
-            if (strncmp(buf, operation.data, operation.size) != 0) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 read data compare failed, aborting");
-                logMessage(LOG_ERROR_LEVEL, "Read data     : [%s]", buf);
-                logMessage(LOG_ERROR_LEVEL, "Expected data : [%s]", operation.data);
+        /* Find the file for processing */
+        if ((fdata = find_assoc(&s->fhTable, op->objname)) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error reading unknown file [%s], aborting",
+                op->objname);
+            return (-1);
+        }
+
+        /* Asynchronous replay: queue the read, check it when it completes */
+        if (asyncdepth > 0) {
+            if (submitRequest(s, fdata, op) != 0) {
                 return (-1);
             }
-
-            /* Now increment the file position, log the data */
-            fdata->pos += operation.size;
-            logMessage(LcControllerLLevel, "Correctly read from [%s], %d bytes at position %d",
-                fdata->filename, operation.size, operation.pos);
-            reads++;
+            fdata->pos = op->pos + op->size;
+            s->reads++;
+            s->readbytes += op->size;
             break;
+        }
 
-        case WL_WRITE: /* Write a block of data to the file */
-
-            /* Find the file for processing */
-            if ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error writing unknown file [%s], aborting",
-                    operation.objname);
+        /* If the position within the file is not a read location, seek */
+        if (fdata->pos != op->pos) {
+            if (lcseek(fdata->fhandle, op->pos) != op->pos) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error seek failed [%s, pos=%d], aborting",
+                    op->objname, op->pos);
                 return (-1);
             }
+            fdata->pos = op->pos;
+            s->seeks++;
+        }
 
-            /* If the position within the file is not a read location, seek */
-            if (fdata->pos != operation.pos) {
-                if (lcseek(fdata->fhandle, operation.pos) != operation.pos) {
-                    logMessage(LOG_ERROR_LEVEL, "CMPSC311 error seek failed [%s, pos=%d], aborting",
-                        operation.objname, operation.pos);
-                    return (-1);
-                }
-                fdata->pos = operation.pos;
-                seeks++;
-            }
+        /* Now do the read from the file */
+        if (lcread(fdata->fhandle, buf, op->size) != op->size) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error read failed [%s, pos=%d, size=%d], aborting",
+                op->objname, op->pos, op->size);
+            return (-1);
+        }
 
-            /* Now do the write to the file */
-            if (lcwrite(fdata->fhandle, operation.data, operation.size) != operation.size) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error write failed [%s, pos=%d, size=%d], aborting",
-                    operation.objname, operation.pos, operation.size);
-                return (-1);
-            }
+        /* Compare the data read with that in the workload data */
+        if (strncmp(buf, op->data, op->size) != 0) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 read data compare failed, aborting");
+            logMessage(LOG_ERROR_LEVEL, "Read data     : [%s]", buf);
+            logMessage(LOG_ERROR_LEVEL, "Expected data : [%s]", op->data);
+            return (-1);
+        }
 
-            /* Now increment the file position, log the data */
-            fdata->pos += operation.size;
-            logMessage(LcControllerLLevel, "Wrote data to file [%s], %d bytes at position %d",
-                fdata->filename, operation.size, operation.pos);
-            writes++;
-            break;
+        /* Now increment the file position, log the data */
+        fdata->pos += op->size;
+        lcLog(LcControllerLLevel, "Correctly read from [%s], %d bytes at position %d",
+            fdata->filename, op->size, op->pos);
+        s->reads++;
+        s->readbytes += op->size;
+        break;
 
-        case WL_CLOSE:
+    case WL_WRITE: /* Write a block of data to the file */
 
-            /* Find the file for processing */
-            if ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error closing unknown file [%s], aborting",
-                    operation.objname);
+        /* Find the file for processing */
+        if ((fdata = find_assoc(&s->fhTable, op->objname)) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error writing unknown file [%s], aborting",
+                op->objname);
+            return (-1);
+        }
+
+        /* Asynchronous replay: queue the write, check it when it completes */
+        if (asyncdepth > 0) {
+            if (submitRequest(s, fdata, op) != 0) {
                 return (-1);
             }
+            fdata->pos = op->pos + op->size;
+            s->writes++;
+            s->writebytes += op->size;
+            break;
+        }
 
-            /* Now close the file */
-            if (lcclose(fdata->fhandle) != 0) {
-                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error write failed [%s, pos=%d, size=%d], aborting",
-                    operation.objname, operation.pos, operation.size);
+        /* If the position within the file is not a read location, seek */
+        if (fdata->pos != op->pos) {
+            if (lcseek(fdata->fhandle, op->pos) != op->pos) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error seek failed [%s, pos=%d], aborting",
+                    op->objname, op->pos);
                 return (-1);
             }
+            fdata->pos = op->pos;
+            s->seeks++;
+        }
 
-            /* Remove file from file handle table, clean up structures, log */
-            logMessage(LcSimulatorLLevel, "Closed file [%s].", fdata->filename);
-            delete_assoc(&fhTable, fdata->filename);
-            free(fdata->filename);
-            free(fdata);
-            closes++;
-            break;
+        /* Now do the write to the file */
+        if (lcwrite(fdata->fhandle, op->data, op->size) != op->size) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error write failed [%s, pos=%d, size=%d], aborting",
+                op->objname, op->pos, op->size);
+            return (-1);
+        }
 
-        case WL_EOF: // End of the workload file
-            lcshutdown();
-            logMessage(LcSimulatorLLevel, "End of the workload file (processed)");
-            break;
+        /* Now increment the file position, log the data */
+        fdata->pos += op->size;
+        lcLog(LcControllerLLevel, "Wrote data to file [%s], %d bytes at position %d",
+            fdata->filename, op->size, op->pos);
+        s->writes++;
+        s->writebytes += op->size;
+        break;
+
+    case WL_CLOSE:
+
+        /* Let the requests in flight finish first */
+        if (drainStream(s) != 0) {
+            return (-1);
+        }
 
-        default: /* Unknown oepration type, bailout */
-            logMessage(LOG_ERROR_LEVEL, "CMPSC311 lion clound bad operation type [%d]", operation.op);
+        /* Find the file for processing */
+        if ((fdata = find_assoc(&s->fhTable, op->objname)) == NULL) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error closing unknown file [%s], aborting",
+                op->objname);
+            return (-1);
+        }
+
+        /* Now close the file */
+        if (lcclose(fdata->fhandle) != 0) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 error write failed [%s, pos=%d, size=%d], aborting",
+                op->objname, op->pos, op->size);
+            return (-1);
+        }
+
+        /* Remove file from file handle table, clean up structures, log */
+        lcLog(LcSimulatorLLevel, "Closed file [%s].", fdata->filename);
+        delete_assoc(&s->fhTable, fdata->filename);
+        free(fdata->filename);
+        free(fdata);
+        s->closes++;
+        break;
+
+    default: /* Unknown oepration type, bailout */
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 lion clound bad operation type [%d]", op->op);
+        return (-1);
+    }
+
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : endStream
+// Description  : Finish a stream: wait for its requests, add its counters
+//                to the replay totals
+//
+// Inputs       : s - the stream
+// Outputs      : 0 if successful, -1 if failure
+
+int endStream(simstream* s)
+{
+    int ret = drainStream(s);
+
+    pthread_mutex_lock(&statslock);
+    totals.opens += s->opens;
+    totals.reads += s->reads;
+    totals.writes += s->writes;
+    totals.seeks += s->seeks;
+    totals.closes += s->closes;
+    totals.readbytes += s->readbytes;
+    totals.writebytes += s->writebytes;
+    pthread_mutex_unlock(&statslock);
+    return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replayThread
+// Description  : Thread replaying one partition of a workload
+//
+// Inputs       : arg - the stream, with the partition's operations
+// Outputs      : NULL
+
+void* replayThread(void* arg)
+{
+    simstream* s = arg;
+    simop* op;
+
+    s->result = 0;
+    for (op = s->ops; op != NULL && s->result == 0; op = op->next) {
+        s->result = replayOperation(s, op);
+    }
+    if (endStream(s) != 0) {
+        s->result = -1;
+    }
+    return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partitionOf
+// Description  : The replay thread of an object (all its operations go to
+//                the same thread, in workload order)
+//
+// Inputs       : objname - the object name
+// Outputs      : partition number
+
+int partitionOf(char* objname)
+{
+    uint32_t h = 5381;
+
+    while (*objname) {
+        h = (h * 33) ^ (uint8_t)*objname++;
+    }
+    return (h % replaythreads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulateLionCloud
+// Description  : The main control loop for the processing of the LionCloud
+//                simulation (which calls the student code).  With more than
+//                one replay thread, the workload is read first and split by
+//                object, and each part is replayed by its own thread.
+//
+// Inputs       : wload - the name of the workload file
+//                wlid - workload number when several run at once (its file
+//                       names get a "<wlid>:" prefix and the filesystem is
+//                       shut down by the caller), -1 when run alone
+// Outputs      : 0 if successful test, -1 if failure
+
+int simulateLionCloud(char* wload, int wlid)
+{
+
+    /* Local variables */
+    workload_state state;
+    workload_operation operation;
+    char name[sizeof(operation.objname)];
+    simstream* streams;
+    simop op, *nop, **tails;
+    int i, ret, failed = 0;
+
+    /* One stream per replay thread, open the workload for processing */
+    streams = calloc(replaythreads, sizeof(simstream));
+    tails = calloc(replaythreads, sizeof(simop*));
+    for (i = 0; i < replaythreads; i++) {
+        init_assoc(&streams[i].fhTable, stringCompareCallback, pointerCompareCallback);
+        tails[i] = NULL;
+    }
+    pthread_mutex_lock(&wllock);
+    ret = openCmpsc311Workload(&state, wload);
+    pthread_mutex_unlock(&wllock);
+    if (ret) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 lcloud workload: failed opening workload [%s]", wload);
+        return (-1);
+    }
+
+    /* Loop until we are done with the workload */
+    logMessage(LcSimulatorLLevel, "CMPSC311 lcloud : executing workload [%s]", state.filename);
+    do {
+
+        /* Get the next operation to process */
+        pthread_mutex_lock(&wllock);
+        ret = readCmpsc311Workload(&state, &operation);
+        pthread_mutex_unlock(&wllock);
+        if (ret) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 workload unit test failed at line %d, get op", state.lineno);
             return (-1);
         }
 
@@ -314,10 +808,87 @@ int simulateLionCloud(char* wload)
             logMessage(LOG_ERROR_LEVEL, "CMPSC311 lion clound bad POST HOC op code [%d]", operation.op);
             return (-1);
         }
+        if (operation.op == WL_EOF) {
+            logMessage(LcSimulatorLLevel, "End of the workload file (processed)");
+            break;
+        }
 
-    } while (operation.op < WL_EOF);
+        /* Keep the files of concurrent workloads apart */
+        if (wlid >= 0) {
+            if (snprintf(name, sizeof(name), "%d:%s", wlid, operation.objname) >= (int)sizeof(name)) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 file name too long [%s], aborting", operation.objname);
+                return (-1);
+            }
+            strcpy(operation.objname, name);
+        }
+
+        /* Replay it now, or keep a copy for the object's replay thread */
+        op.objname = operation.objname;
+        op.op = operation.op;
+        op.pos = operation.pos;
+        op.size = operation.size;
+        op.data = operation.data;
+        op.next = NULL;
+        if (replaythreads == 1) {
+            if (replayOperation(&streams[0], &op) != 0) {
+                return (-1);
+            }
+            continue;
+        }
+        nop = malloc(sizeof(simop));
+        *nop = op;
+        nop->objname = strdup(op.objname);
+        nop->data = NULL;
+        if ((op.op == WL_READ) || (op.op == WL_WRITE)) {
+            nop->data = malloc(op.size);
+            memcpy(nop->data, op.data, op.size);
+        }
+        i = partitionOf(nop->objname);
+        if (tails[i] == NULL) {
+            streams[i].ops = nop;
+        } else {
+            tails[i]->next = nop;
+        }
+        tails[i] = nop;
+
+    } while (1);
+
+    /* Replay the parts, one thread each */
+    if (replaythreads == 1) {
+        failed = endStream(&streams[0]);
+    } else {
+        for (i = 0; i < replaythreads; i++) {
+            if (pthread_create(&streams[i].tid, NULL, replayThread, &streams[i]) != 0) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 failed to start replay thread, aborting");
+                return (-1);
+            }
+        }
+        for (i = 0; i < replaythreads; i++) {
+            pthread_join(streams[i].tid, NULL);
+            failed |= streams[i].result;
+            while ((nop = streams[i].ops) != NULL) {
+                streams[i].ops = nop->next;
+                free(nop->objname);
+                free(nop->data);
+                free(nop);
+            }
+        }
+    }
+    if (failed) {
+        return (-1);
+    }
+    if (wlid == -1) {
+        if (asyncdepth > 0) {
+            lcasync_stop();
+        }
+        lcshutdown();
+    }
 
     /* Log, close workload and delete the local file, return successfully  */
+    pthread_mutex_lock(&wllock);
     closeCmpsc311Workload(&state);
+    pthread_mutex_unlock(&wllock);
+    free(streams);
+    free(tails);
     return (0);
 }